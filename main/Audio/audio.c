@@ -17,6 +17,7 @@
 #include <audio_alc.h>
 #include <driver/gpio.h>
 #include <esp_timer.h>
+#include <sys/stat.h>
 
 #include "audio.h"
 #include "../Storage/storage.h"
@@ -24,6 +25,7 @@
 #include "../Playlist/playlist.h"
 #include "../BLE/ble.h"
 #include "../Indicator/indicator.h"
+#include "../Status/device_status.h"
 
 #define SPEAKER_ENABLE_PIN GPIO_NUM_34
 
@@ -42,9 +44,17 @@ static volatile bool stop_recording_requested = false;
 // Active ALC element for volume control during playback
 static audio_element_handle_t active_alc_el = NULL;
 
+// Running playback pipeline, for pause/resume from other tasks.
+// pipeline_lock keeps it alive while another task uses it.
+static audio_pipeline_handle_t active_pipeline = NULL;
+static SemaphoreHandle_t pipeline_lock = NULL;
+
 // Last recording path
 static char last_recording_path[128] = {0};
 
+// File of the running playback task
+static char playing_path[128] = {0};
+
 // ============ Helper Functions ============
 
 static void enable_speaker(void) {
@@ -57,6 +67,12 @@ static void disable_speaker(void) {
     ESP_LOGI(TAG, "Speaker disabled");
 }
 
+// Change state and publish it
+static void set_state(audio_state_t state) {
+    current_state = state;
+    device_status_set_audio_state((uint8_t)state);
+}
+
 // ============ State Functions ============
 
 audio_state_t audio_get_state(void) {
@@ -75,6 +91,22 @@ bool audio_is_paused(void) {
     return (current_state == AUDIO_STATE_PAUSED);
 }
 
+bool audio_is_file_in_use(const char *file_path) {
+    if (file_path == NULL) {
+        return false;
+    }
+
+    switch (current_state) {
+    case AUDIO_STATE_PLAYING:
+    case AUDIO_STATE_PAUSED:
+        return strcmp(playing_path, file_path) == 0;
+    case AUDIO_STATE_RECORDING:
+        return strcmp(last_recording_path, file_path) == 0;
+    default:
+        return false;
+    }
+}
+
 const char* audio_get_last_recording(void) {
     if (last_recording_path[0] == '\0') {
         return NULL;
@@ -99,7 +131,13 @@ void init_audio_system(void) {
         return;
     }
 
-    current_state = AUDIO_STATE_IDLE;
+    pipeline_lock = xSemaphoreCreateMutex();
+    if (pipeline_lock == NULL) {
+        ESP_LOGE(TAG, "Failed to create pipeline lock");
+        return;
+    }
+
+    set_state(AUDIO_STATE_IDLE);
     ESP_LOGI(TAG, "Audio system initialized");
 }
 
@@ -108,6 +146,7 @@ void init_audio_system(void) {
 typedef struct {
     char file_path[128];
     bool auto_advance;
+    uint32_t start_byte;    // Resume point (ADTS frames resync on their own)
 } playback_params_t;
 
 static void playback_task(void *pvParameters) {
@@ -115,7 +154,9 @@ static void playback_task(void *pvParameters) {
     char file_path[128];
     bool auto_advance = params->auto_advance;
     bool should_advance = false;  // Track if we should auto-advance after cleanup
+    uint32_t start_byte = params->start_byte;
     strncpy(file_path, params->file_path, sizeof(file_path) - 1);
+    file_path[sizeof(file_path) - 1] = '\0';
     free(params);
 
     // Take mutex
@@ -126,8 +167,9 @@ static void playback_task(void *pvParameters) {
         return;
     }
 
-    current_state = AUDIO_STATE_PLAYING;
+    set_state(AUDIO_STATE_PLAYING);
     stop_playback_requested = false;
+    strncpy(playing_path, file_path, sizeof(playing_path) - 1);
 
     ESP_LOGI(TAG, "========================================");
     const char *filename = strrchr(file_path, '/');
@@ -212,6 +254,10 @@ static void playback_task(void *pvParameters) {
 
     // Set file URI
     audio_element_set_uri(fatfs_reader, file_path);
+    if (start_byte > 0) {
+        audio_element_set_byte_pos(fatfs_reader, start_byte);
+        ESP_LOGI(TAG, "Starting at byte %lu", (unsigned long)start_byte);
+    }
 
     // Create event interface
     audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
@@ -224,6 +270,9 @@ static void playback_task(void *pvParameters) {
     // Enable speaker and set volume via ALC element
     enable_speaker();
     active_alc_el = alc_el;  // Store for live volume updates
+    xSemaphoreTake(pipeline_lock, portMAX_DELAY);
+    active_pipeline = pipeline;
+    xSemaphoreGive(pipeline_lock);
     alc_volume_setup_set_channel(alc_el, 1);  // Mono
     alc_volume_setup_set_volume(alc_el, volume_get_raw_value());
     ESP_LOGI(TAG, "Volume: %d dB", volume_get_raw_value());
@@ -278,6 +327,13 @@ static void playback_task(void *pvParameters) {
     // Cleanup pipeline
     ESP_LOGI(TAG, "Stopping pipeline...");
     active_alc_el = NULL;  // Clear before cleanup
+    xSemaphoreTake(pipeline_lock, portMAX_DELAY);
+    active_pipeline = NULL;
+    xSemaphoreGive(pipeline_lock);
+    if (current_state == AUDIO_STATE_PAUSED) {
+        // Elements have to be running to see the stop
+        audio_pipeline_resume(pipeline);
+    }
     audio_pipeline_stop(pipeline);
     audio_pipeline_wait_for_stop(pipeline);
     audio_event_iface_destroy(evt);
@@ -298,7 +354,8 @@ static void playback_task(void *pvParameters) {
     should_advance = track_finished && auto_advance && !stop_playback_requested;
 
 cleanup:
-    current_state = AUDIO_STATE_IDLE;
+    set_state(AUDIO_STATE_IDLE);
+    playing_path[0] = '\0';
     playback_task_handle = NULL;
 
     // Set LED back to idle (unless BLE advertising)
@@ -312,8 +369,8 @@ cleanup:
     if (should_advance) {
         ESP_LOGI(TAG, "Auto-advancing to next track...");
         vTaskDelay(pdMS_TO_TICKS(100));  // Small delay before next track
-        const char *next = playlist_next();
-        if (next != NULL) {
+        char next[PLAYLIST_MAX_PATH_LEN];
+        if (playlist_next(next, sizeof(next)) == ESP_OK) {
             audio_play_file(next);
         } else {
             ESP_LOGI(TAG, "End of playlist");
@@ -324,6 +381,10 @@ cleanup:
 }
 
 esp_err_t audio_play_file(const char *file_path) {
+    return audio_play_file_at(file_path, 0);
+}
+
+esp_err_t audio_play_file_at(const char *file_path, uint32_t start_byte) {
     if (file_path == NULL) {
         ESP_LOGE(TAG, "Invalid file path");
         return ESP_ERR_INVALID_ARG;
@@ -354,6 +415,7 @@ esp_err_t audio_play_file(const char *file_path) {
     strncpy(params->file_path, file_path, sizeof(params->file_path) - 1);
     params->file_path[sizeof(params->file_path) - 1] = '\0';
     params->auto_advance = true;
+    params->start_byte = start_byte;
 
     // Create playback task
     BaseType_t ret = xTaskCreate(playback_task, "playback", 8192, params, 15, &playback_task_handle);
@@ -373,6 +435,70 @@ void audio_stop_playback(void) {
     }
 }
 
+esp_err_t audio_pause(void) {
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    if (pipeline_lock == NULL) {
+        return ret;
+    }
+
+    xSemaphoreTake(pipeline_lock, portMAX_DELAY);
+    if (current_state == AUDIO_STATE_PLAYING && active_pipeline != NULL) {
+        ret = audio_pipeline_pause(active_pipeline);
+        if (ret == ESP_OK) {
+            disable_speaker();
+            set_state(AUDIO_STATE_PAUSED);
+            ESP_LOGI(TAG, "Playback paused");
+        }
+    }
+    xSemaphoreGive(pipeline_lock);
+    return ret;
+}
+
+esp_err_t audio_resume(void) {
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    if (pipeline_lock == NULL) {
+        return ret;
+    }
+
+    xSemaphoreTake(pipeline_lock, portMAX_DELAY);
+    if (current_state == AUDIO_STATE_PAUSED && active_pipeline != NULL) {
+        enable_speaker();
+        ret = audio_pipeline_resume(active_pipeline);
+        if (ret == ESP_OK) {
+            set_state(AUDIO_STATE_PLAYING);
+            ESP_LOGI(TAG, "Playback resumed");
+        } else {
+            disable_speaker();
+        }
+    }
+    xSemaphoreGive(pipeline_lock);
+    return ret;
+}
+
+esp_err_t audio_seek(uint16_t permille) {
+    if (permille > 1000) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (current_state != AUDIO_STATE_PLAYING && current_state != AUDIO_STATE_PAUSED) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // playing_path is cleared when the task stops, so keep a copy
+    char path[sizeof(playing_path)];
+    strncpy(path, playing_path, sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+
+    struct stat st;
+    if (path[0] == '\0' || stat(path, &st) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t start_byte = (uint32_t)(((uint64_t)st.st_size * permille) / 1000);
+    ESP_LOGI(TAG, "Seek to %u.%u%% (byte %lu)", permille / 10, permille % 10,
+             (unsigned long)start_byte);
+    return audio_play_file_at(path, start_byte);
+}
+
 void audio_update_volume(void) {
     if (active_alc_el != NULL && current_state == AUDIO_STATE_PLAYING) {
         alc_volume_setup_set_volume(active_alc_el, volume_get_raw_value());
@@ -391,7 +517,7 @@ static void recording_task(void *pvParameters) {
         return;
     }
 
-    current_state = AUDIO_STATE_RECORDING;
+    set_state(AUDIO_STATE_RECORDING);
     stop_recording_requested = false;
 
     // Generate recording path
@@ -500,7 +626,8 @@ static void recording_task(void *pvParameters) {
     }
 
     // Get final duration
-    uint32_t total_sec = (uint32_t)((esp_timer_get_time() - start_time) / 1000000);
+    uint64_t duration_us = esp_timer_get_time() - start_time;
+    uint32_t total_sec = (uint32_t)(duration_us / 1000000);
 
     // Stop and cleanup pipeline
     ESP_LOGI(TAG, "Stopping recording pipeline...");
@@ -514,13 +641,17 @@ static void recording_task(void *pvParameters) {
     audio_element_deinit(aac_enc);
     audio_element_deinit(fatfs_writer);
 
+    // The file is closed; register it with the storage cache
+    storage_file_written(last_recording_path);
+    storage_cache_set_duration(last_recording_path, (uint32_t)(duration_us / 1000));
+
     ESP_LOGI(TAG, "========================================");
     ESP_LOGI(TAG, "  RECORDING STOPPED: %s", filename);
     ESP_LOGI(TAG, "  Duration: %02lu:%02lu", (unsigned long)(total_sec / 60), (unsigned long)(total_sec % 60));
     ESP_LOGI(TAG, "========================================");
 
 cleanup:
-    current_state = AUDIO_STATE_IDLE;
+    set_state(AUDIO_STATE_IDLE);
     recording_task_handle = NULL;
 
     // Set LED back to idle (unless BLE advertising)
@@ -561,8 +692,8 @@ void play_pause_single_handler(void) {
 
     switch (current_state) {
         case AUDIO_STATE_IDLE: {
-            const char *track = playlist_get_current();
-            if (track != NULL) {
+            char track[PLAYLIST_MAX_PATH_LEN];
+            if (playlist_get_current(track, sizeof(track)) == ESP_OK) {
                 audio_play_file(track);
             } else {
                 ESP_LOGW(TAG, "Playlist is empty");
@@ -571,16 +702,18 @@ void play_pause_single_handler(void) {
         }
 
         case AUDIO_STATE_PLAYING:
-            // For now, stop playback (pause not implemented with new architecture)
-            audio_stop_playback();
-            ESP_LOGI(TAG, "Playback stopped");
+            // Pause in place; stop if the pipeline won't pause
+            if (audio_pause() != ESP_OK) {
+                audio_stop_playback();
+                ESP_LOGI(TAG, "Playback stopped");
+            }
             break;
 
         case AUDIO_STATE_PAUSED:
-            // Resume - restart from current track
-            {
-                const char *track = playlist_get_current();
-                if (track != NULL) {
+            if (audio_resume() != ESP_OK) {
+                // Restart the current track
+                char track[PLAYLIST_MAX_PATH_LEN];
+                if (playlist_get_current(track, sizeof(track)) == ESP_OK) {
                     audio_play_file(track);
                 }
             }
@@ -607,8 +740,8 @@ void play_pause_double_handler(void) {
     }
 
     if (current_state == AUDIO_STATE_IDLE || current_state == AUDIO_STATE_PAUSED) {
-        const char *next = playlist_next();
-        if (next != NULL) {
+        char next[PLAYLIST_MAX_PATH_LEN];
+        if (playlist_next(next, sizeof(next)) == ESP_OK) {
             ESP_LOGI(TAG, "Playing next track: %s", next);
             audio_play_file(next);
         } else {
@@ -628,8 +761,10 @@ void record_single_handler(void) {
             vTaskDelay(pdMS_TO_TICKS(50));
             wait++;
         }
-        // Rescan playlist
-        playlist_rescan();
+        // Add the new recording to the playlist
+        if (storage_file_exists(last_recording_path)) {
+            playlist_add(last_recording_path);
+        }
     } else {
         // Cycle volume
         volume_level_t new_level = volume_cycle();
@@ -650,8 +785,10 @@ void record_double_handler(void) {
             vTaskDelay(pdMS_TO_TICKS(50));
             wait++;
         }
-        playlist_rescan();
-    } else if (current_state == AUDIO_STATE_PLAYING) {
+        if (storage_file_exists(last_recording_path)) {
+            playlist_add(last_recording_path);
+        }
+    } else if (current_state == AUDIO_STATE_PLAYING || current_state == AUDIO_STATE_PAUSED) {
         // Stop playback first
         audio_stop_playback();
         int wait = 0;
@@ -661,7 +798,7 @@ void record_double_handler(void) {
         }
         // Start recording
         audio_start_recording();
-    } else if (current_state == AUDIO_STATE_IDLE || current_state == AUDIO_STATE_PAUSED) {
+    } else if (current_state == AUDIO_STATE_IDLE) {
         audio_start_recording();
     }
 }
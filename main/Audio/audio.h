@@ -2,6 +2,7 @@
 #define AUDIO_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <esp_err.h>
 
 #ifdef __cplusplus
@@ -27,13 +28,24 @@ bool audio_is_paused(void);
 
 // Playback control
 esp_err_t audio_play_file(const char *file_path);
+esp_err_t audio_play_file_at(const char *file_path, uint32_t start_byte);
 void audio_stop_playback(void);
 void audio_update_volume(void);
 
+// Pause/resume the running track in place (ESP_ERR_INVALID_STATE otherwise)
+esp_err_t audio_pause(void);
+esp_err_t audio_resume(void);
+
+// Restart the current track at permille/1000 of the file (playing or paused)
+esp_err_t audio_seek(uint16_t permille);
+
 // Recording control
 esp_err_t audio_start_recording(void);
 void audio_stop_recording(void);
 
+// Check if a file is being played (or paused) or recorded
+bool audio_is_file_in_use(const char *file_path);
+
 // Get last recorded file path
 const char* audio_get_last_recording(void);
 
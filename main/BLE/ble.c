@@ -2,16 +2,29 @@
 #include "ble_uuids.h"
 #include "ble_auth.h"
 #include "ble_gatt.h"
+#include "ble_file_list.h"
+#include "ble_file_ops.h"
+#include "ble_status.h"
+#include "ble_audio_ctrl.h"
 #include "ble_transfer.h"
+#include "ble_link.h"
+#include "ble_coc.h"
+#include "ble_conn.h"
+#include "ble_bond.h"
+#include "ble_adv.h"
+#include "ble_notify.h"
+#include "ble_ota.h"
+#include "ble_rpc.h"
 #include "../Storage/storage.h"
 #include "../Audio/audio.h"
 #include "../Volume/volume.h"
 #include "../Playlist/playlist.h"
-#include "../Power/power.h"
+#include "../Status/device_status.h"
 #include "../Indicator/indicator.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <stdatomic.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -40,9 +53,17 @@ static const char *TAG = "BLE";
 // State variables
 static bool is_initialized = false;
 static bool is_advertising = false;
-static bool is_connected = false;
-static uint16_t current_conn_handle = BLE_HS_CONN_HANDLE_NONE;
 static uint8_t own_addr_type;
+static TaskHandle_t host_task_handle = NULL;
+
+// Advertising start/stop requests from other tasks (button handler) are
+// applied on the host task, where the advertising schedule and GAP live.
+// One event reconciles the stack with adv_wanted, so a quick stop/start
+// pair can't run out of order, and GAP events handled before it can't
+// restart advertising the user just stopped.
+static struct ble_npl_event adv_apply_ev;
+static atomic_bool adv_wanted;       // Requested by ble_start_advertising
+static atomic_bool adv_restart;      // Start the schedule over at fast
 
 // Forward declarations
 static void ble_on_reset(int reason);
@@ -50,10 +71,12 @@ static void ble_on_sync(void);
 static void ble_host_task(void *param);
 static int ble_gap_event_handler(struct ble_gap_event *event, void *arg);
 static void start_advertising(void);
+static void adv_apply_run(struct ble_npl_event *ev);
 
 // ============ NimBLE Host Task ============
 
 static void ble_host_task(void *param) {
+    host_task_handle = xTaskGetCurrentTaskHandle();
     ESP_LOGI(TAG, "BLE host task started");
     // This function will return only when nimble_port_stop() is executed
     nimble_port_run();
@@ -91,6 +114,9 @@ static void ble_on_sync(void) {
              addr_val[5], addr_val[4], addr_val[3],
              addr_val[2], addr_val[1], addr_val[0]);
 
+    // Check the GATT table against the one bonded phones cached
+    ble_bond_on_sync();
+
     // Start advertising if requested
     if (is_advertising) {
         start_advertising();
@@ -102,40 +128,32 @@ static void ble_on_sync(void) {
 static void start_advertising(void) {
     int rc;
     struct ble_gap_adv_params adv_params;
-    struct ble_hs_adv_fields fields;
-
-    // Configure advertising fields
-    memset(&fields, 0, sizeof(fields));
-
-    // Flags: general discoverable, BLE only
-    fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+    const ble_addr_t *direct_addr;
+    int32_t duration_ms;
 
-    // TX power level
-    fields.tx_pwr_lvl_is_present = 1;
-    fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
-
-    // Device name
-    const char *name = ble_svc_gap_device_name();
-    fields.name = (uint8_t *)name;
-    fields.name_len = strlen(name);
-    fields.name_is_complete = 1;
+    if (!atomic_load(&adv_wanted) || ble_gap_adv_active()) {
+        return;
+    }
 
-    rc = ble_gap_adv_set_fields(&fields);
+    // Name, TX power and the status payload
+    rc = ble_adv_set_fields();
     if (rc != 0) {
         ESP_LOGE(TAG, "Failed to set advertising fields: %d", rc);
         return;
     }
 
-    // Configure advertising parameters
-    memset(&adv_params, 0, sizeof(adv_params));
-    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;  // Undirected connectable
-    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;  // General discoverable
-    adv_params.itvl_min = BLE_GAP_ADV_FAST_INTERVAL1_MIN;  // 30ms
-    adv_params.itvl_max = BLE_GAP_ADV_FAST_INTERVAL1_MAX;  // 60ms
+    // Parameters for the current phase of the advertising schedule
+    ble_adv_profile_t profile = ble_adv_next(&adv_params, &direct_addr, &duration_ms);
 
     // Start advertising
-    rc = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER,
+    rc = ble_gap_adv_start(own_addr_type, direct_addr, duration_ms,
                            &adv_params, ble_gap_event_handler, NULL);
+    if (rc != 0 && direct_addr != NULL) {
+        // Directed advertising is optional; fall back to the burst phase
+        ESP_LOGW(TAG, "Directed advertising unavailable: %d", rc);
+        start_advertising();
+        return;
+    }
     if (rc != 0) {
         ESP_LOGE(TAG, "Failed to start advertising: %d", rc);
         is_advertising = false;
@@ -143,7 +161,34 @@ static void start_advertising(void) {
     }
 
     is_advertising = true;
-    ESP_LOGI(TAG, "Advertising started");
+    ESP_LOGI(TAG, "Advertising started (%s)", ble_adv_profile_name(profile));
+}
+
+// Host task: bring advertising and connections in line with adv_wanted
+static void adv_apply_run(struct ble_npl_event *ev) {
+    if (atomic_load(&adv_wanted)) {
+        if (atomic_exchange(&adv_restart, false)) {
+            ble_adv_on_start();
+        }
+        // Otherwise ble_on_sync will start advertising
+        if (ble_hs_synced()) {
+            start_advertising();
+        }
+        return;
+    }
+
+    int rc = ble_gap_adv_stop();
+    if (rc != 0 && rc != BLE_HS_EALREADY) {
+        ESP_LOGE(TAG, "Failed to stop advertising: %d", rc);
+    }
+
+    // Disconnect every connection
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        uint16_t conn_handle = ble_conn_handle(i);
+        if (conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+            ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+        }
+    }
 }
 
 // ============ GAP Event Handler ============
@@ -159,10 +204,21 @@ static int ble_gap_event_handler(struct ble_gap_event *event, void *arg) {
                  event->connect.status);
 
         if (event->connect.status == 0) {
-            // Connection successful
-            current_conn_handle = event->connect.conn_handle;
-            is_connected = true;
-            is_advertising = false;  // Stop advertising - single connection only
+            // Connection successful; claim a slot for its per-connection state
+            if (ble_conn_add(event->connect.conn_handle) < 0) {
+                ble_gap_terminate(event->connect.conn_handle, BLE_ERR_CONN_LIMIT);
+                break;
+            }
+
+            // Reconnected: no more burst for the other slots
+            ble_adv_on_connect();
+
+            // Advertising stopped on connect; keep it going while slots are free
+            if (ble_conn_count() < BLE_MAX_CONNECTIONS) {
+                start_advertising();
+            } else {
+                is_advertising = false;
+            }
 
             rc = ble_gap_conn_find(event->connect.conn_handle, &desc);
             if (rc == 0) {
@@ -182,29 +238,25 @@ static int ble_gap_event_handler(struct ble_gap_event *event, void *arg) {
                 ESP_LOGW(TAG, "Failed to request MTU exchange: %d", rc);
             }
 
-            // Request faster connection parameters for higher throughput
-            // Min interval: 7.5ms (6 * 1.25ms), Max interval: 15ms (12 * 1.25ms)
-            // Latency: 0, Supervision timeout: 4s (400 * 10ms)
-            struct ble_gap_upd_params conn_params = {
-                .itvl_min = 6,    // 7.5ms (fastest allowed)
-                .itvl_max = 12,   // 15ms
-                .latency = 0,     // No slave latency for fastest response
-                .supervision_timeout = 400,  // 4 seconds
-                .min_ce_len = 0,
-                .max_ce_len = 0,
-            };
-            rc = ble_gap_update_params(event->connect.conn_handle, &conn_params);
-            if (rc != 0) {
-                ESP_LOGW(TAG, "Failed to request connection param update: %d", rc);
-            } else {
-                ESP_LOGI(TAG, "Requested fast connection parameters (7.5-15ms interval)");
-            }
+            // Request fast connection parameters (default link profile)
+            ble_link_on_connect(event->connect.conn_handle);
 
             // Update GATT module with connection handle
-            ble_gatt_set_conn_handle(current_conn_handle);
+            ble_gatt_on_connect(event->connect.conn_handle);
+
+            // Encrypt with the stored bond, or pair (bonded mode only)
+            ble_bond_on_connect(event->connect.conn_handle);
 
-            // Update battery level in Battery Service
-            ble_gatt_update_battery_level(get_battery_percent());
+            // No key yet: every connection counts as authenticated, so this
+            // one proves a phone can reach the update path
+            if (!ble_auth_has_stored_key()) {
+                ble_ota_confirm();
+            }
+
+            // Update battery level in Battery Service from the cached status
+            device_status_t dev;
+            device_status_get(&dev);
+            ble_gatt_update_battery_level(dev.battery_percent);
 
             // LED stays in BLE mode
             led_set_mode(LED_MODE_BLE_PAIRING);
@@ -217,19 +269,40 @@ static int ble_gap_event_handler(struct ble_gap_event *event, void *arg) {
     case BLE_GAP_EVENT_DISCONNECT:
         ESP_LOGI(TAG, "Disconnected; reason=%d", event->disconnect.reason);
 
-        current_conn_handle = BLE_HS_CONN_HANDLE_NONE;
-        is_connected = false;
+        {
+            uint16_t conn_handle = event->disconnect.conn.conn_handle;
 
-        // Clear authentication state
-        ble_auth_on_disconnect();
+            // Per-connection state first, while the slot still maps to it
+            ble_link_on_disconnect(conn_handle);
 
-        // Cancel any ongoing transfer
-        ble_transfer_cancel();
+            // Clear authentication state
+            ble_auth_on_disconnect(conn_handle);
 
-        // Update GATT module
-        ble_gatt_set_conn_handle(BLE_HS_CONN_HANDLE_NONE);
+            // Cancel any ongoing transfer and listing
+            ble_transfer_cancel(conn_handle);
+            ble_file_list_cancel(conn_handle);
+            ble_file_ops_reset(conn_handle);
+            ble_notify_on_disconnect(conn_handle);
 
-        // Resume advertising
+            ble_conn_remove(conn_handle);
+            if (ble_conn_count() == 0) {
+                ble_status_reset();
+                ble_notify_log_stats();
+                ble_rpc_log_stats();
+
+                // Access callbacks run on this task; watch its headroom
+                ESP_LOGI(TAG, "Host task stack: %u bytes never used",
+                         (unsigned)uxTaskGetStackHighWaterMark(NULL));
+            }
+
+            // Directed and burst phases next; restart if advertising for free slots
+            ble_adv_on_disconnect(&event->disconnect.conn);
+            if (ble_gap_adv_active()) {
+                ble_gap_adv_stop();
+            }
+        }
+
+        // Resume advertising in the fast reconnect phase
         start_advertising();
 
         // Keep LED in BLE mode since we're advertising again
@@ -238,29 +311,47 @@ static int ble_gap_event_handler(struct ble_gap_event *event, void *arg) {
 
     case BLE_GAP_EVENT_CONN_UPDATE:
         ESP_LOGI(TAG, "Connection updated; status=%d", event->conn_update.status);
-        if (event->conn_update.status == 0) {
-            rc = ble_gap_conn_find(event->conn_update.conn_handle, &desc);
-            if (rc == 0) {
-                ESP_LOGI(TAG, "New conn params: interval=%d (%.2fms), latency=%d, timeout=%d",
-                         desc.conn_itvl, desc.conn_itvl * 1.25,
-                         desc.conn_latency, desc.supervision_timeout);
-            }
-        }
+        ble_link_on_conn_update(event->conn_update.conn_handle,
+                                event->conn_update.status);
+        break;
+
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        ble_link_on_phy_update(event->phy_updated.conn_handle,
+                               event->phy_updated.status,
+                               event->phy_updated.tx_phy,
+                               event->phy_updated.rx_phy);
+        break;
+
+    case BLE_GAP_EVENT_DATA_LEN_CHG:
+        ble_link_on_data_len(event->data_len_chg.conn_handle,
+                             event->data_len_chg.max_tx_octets,
+                             event->data_len_chg.max_rx_octets);
         break;
 
     case BLE_GAP_EVENT_ADV_COMPLETE:
         ESP_LOGI(TAG, "Advertising complete; reason=%d",
                  event->adv_complete.reason);
-        // Restart advertising if not connected
-        if (!is_connected) {
+        // Next phase of the schedule, while slots are free
+        if (ble_conn_count() < BLE_MAX_CONNECTIONS) {
             start_advertising();
         }
         break;
 
+    case BLE_GAP_EVENT_ENC_CHANGE:
+        ESP_LOGI(TAG, "Encryption change; conn=%d status=%d",
+                 event->enc_change.conn_handle, event->enc_change.status);
+        ble_bond_on_enc_change(event->enc_change.conn_handle,
+                               event->enc_change.status);
+        break;
+
+    case BLE_GAP_EVENT_REPEAT_PAIRING:
+        return ble_bond_on_repeat_pairing(event->repeat_pairing.conn_handle);
+
     case BLE_GAP_EVENT_MTU:
         ESP_LOGI(TAG, "MTU update: conn_handle=%d, cid=%d, mtu=%d",
                  event->mtu.conn_handle, event->mtu.channel_id,
                  event->mtu.value);
+        ble_link_on_mtu(event->mtu.conn_handle, event->mtu.value);
         break;
 
     case BLE_GAP_EVENT_SUBSCRIBE:
@@ -270,6 +361,12 @@ static int ble_gap_event_handler(struct ble_gap_event *event, void *arg) {
         break;
 
     case BLE_GAP_EVENT_NOTIFY_TX:
+        // Indications are not sent; count notification outcomes
+        if (!event->notify_tx.indication) {
+            ble_notify_on_tx(event->notify_tx.status);
+        }
+        break;
+
     default:
         break;
     }
@@ -302,12 +399,8 @@ esp_err_t ble_init(void) {
     ble_hs_cfg.gatts_register_cb = ble_gatt_svr_register_cb;
     ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
 
-    // Disable pairing/bonding (using app-level auth)
-    ble_hs_cfg.sm_bonding = 0;
-    ble_hs_cfg.sm_mitm = 0;
-    ble_hs_cfg.sm_sc = 0;
-    ble_hs_cfg.sm_our_key_dist = 0;
-    ble_hs_cfg.sm_their_key_dist = 0;
+    // Security manager: pairing off, or Just Works bonding (Kconfig)
+    ble_bond_init();
 
     // Initialize GATT services
     rc = ble_gatt_svr_init();
@@ -328,6 +421,41 @@ esp_err_t ble_init(void) {
     // Initialize transfer module
     ble_transfer_init();
 
+    // Firmware update over the transfer engine
+    if (ble_ota_init() != ESP_OK) {
+        ESP_LOGW(TAG, "OTA restart timer unavailable");
+    }
+
+    // Notification mbuf pool and retry queue
+    if (ble_notify_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize notifications");
+        return ESP_FAIL;
+    }
+
+    // File list producer task
+    if (ble_file_list_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start file list task");
+        return ESP_FAIL;
+    }
+
+    // Audio command executor (keeps playback changes off the host task)
+    if (ble_audio_ctrl_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start audio control task");
+        return ESP_FAIL;
+    }
+
+    // Change-driven Device Status notifications
+    if (ble_status_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Device Status notifications unavailable");
+    }
+
+    // L2CAP CoC bulk data channel (GATT transfer stays as the fallback)
+    if (ble_coc_init() != ESP_OK) {
+        ESP_LOGW(TAG, "L2CAP CoC unavailable - GATT transfers only");
+    }
+
+    ble_npl_event_init(&adv_apply_ev, adv_apply_run, NULL);
+
     // Start NimBLE host task
     nimble_port_freertos_init(ble_host_task);
 
@@ -346,23 +474,20 @@ esp_err_t ble_start_advertising(void) {
         }
     }
 
-    if (is_connected) {
-        ESP_LOGW(TAG, "Already connected, cannot advertise");
+    if (ble_conn_count() >= BLE_MAX_CONNECTIONS) {
+        ESP_LOGW(TAG, "All %d connections in use, cannot advertise", BLE_MAX_CONNECTIONS);
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (is_advertising) {
+    if (atomic_load(&adv_wanted) && is_advertising) {
         ESP_LOGW(TAG, "Already advertising");
         return ESP_OK;
     }
 
     is_advertising = true;  // Set flag before sync callback
-
-    // If host is already synced, start advertising now
-    if (ble_hs_synced()) {
-        start_advertising();
-    }
-    // Otherwise, ble_on_sync will start advertising
+    atomic_store(&adv_restart, true);
+    atomic_store(&adv_wanted, true);
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &adv_apply_ev);
 
     // Set LED to BLE pairing mode
     led_set_mode(LED_MODE_BLE_PAIRING);
@@ -375,25 +500,18 @@ esp_err_t ble_stop_advertising(void) {
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (!is_advertising) {
+    // Still wanted with every slot taken: stop disconnects them
+    if (!atomic_load(&adv_wanted)) {
         ESP_LOGW(TAG, "Not advertising");
         return ESP_OK;
     }
 
-    int rc = ble_gap_adv_stop();
-    if (rc != 0 && rc != BLE_HS_EALREADY) {
-        ESP_LOGE(TAG, "Failed to stop advertising: %d", rc);
-        return ESP_FAIL;
-    }
-
+    // The host task stops advertising and disconnects everyone
+    atomic_store(&adv_wanted, false);
     is_advertising = false;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &adv_apply_ev);
     ESP_LOGI(TAG, "Advertising stopped");
 
-    // If connected, disconnect
-    if (is_connected && current_conn_handle != BLE_HS_CONN_HANDLE_NONE) {
-        ble_gap_terminate(current_conn_handle, BLE_ERR_REM_USER_CONN_TERM);
-    }
-
     // Restore LED to appropriate mode based on audio state
     audio_state_t audio_state = audio_get_state();
     switch (audio_state) {
@@ -412,13 +530,17 @@ esp_err_t ble_stop_advertising(void) {
 }
 
 bool ble_is_connected(void) {
-    return is_connected;
+    return ble_conn_count() > 0;
 }
 
 bool ble_is_advertising(void) {
     return is_advertising;
 }
 
+bool ble_is_host_task(void) {
+    return host_task_handle != NULL && xTaskGetCurrentTaskHandle() == host_task_handle;
+}
+
 void ble_button_handler(void) {
     ESP_LOGI(TAG, "BLE button handler triggered");
 
@@ -426,7 +548,7 @@ void ble_button_handler(void) {
         ble_init();
     }
 
-    if (is_advertising || is_connected) {
+    if (is_advertising || ble_is_connected()) {
         ESP_LOGI(TAG, "Stopping BLE...");
         ble_stop_advertising();
     } else {
@@ -479,12 +601,44 @@ static esp_err_t list_files_recursive(const char *path, ble_file_list_cb_t callb
     return ESP_OK;
 }
 
+// Storage root listing from the metadata cache; only subdirectories
+// (which the firmware never creates) are walked on flash
+typedef struct {
+    const char *base_path;
+    ble_file_list_cb_t callback;
+    void *user_data;
+} cached_list_ctx_t;
+
+static void cached_list_callback(const storage_entry_t *entry, void *user_data) {
+    cached_list_ctx_t *ctx = (cached_list_ctx_t *)user_data;
+    ble_file_info_t file_info;
+
+    memset(&file_info, 0, sizeof(file_info));
+    snprintf(file_info.name, sizeof(file_info.name), "%s/%s", ctx->base_path, entry->name);
+    file_info.size = entry->meta.size;
+    file_info.is_directory = (entry->meta.type == STORAGE_ENTRY_DIRECTORY);
+
+    if (ctx->callback) {
+        ctx->callback(&file_info, ctx->user_data);
+    }
+
+    if (file_info.is_directory) {
+        list_files_recursive(file_info.name, ctx->callback, ctx->user_data);
+    }
+}
+
 esp_err_t ble_list_files(const char *path, ble_file_list_cb_t callback, void *user_data) {
-    if (!path) {
+    char base_path[32];
+    get_base_path(base_path, sizeof(base_path));
+
+    if (!path || strcmp(path, base_path) == 0) {
         // Default to storage root
-        char base_path[32];
-        get_base_path(base_path, sizeof(base_path));
-        return list_files_recursive(base_path, callback, user_data);
+        cached_list_ctx_t ctx = {
+            .base_path = base_path,
+            .callback = callback,
+            .user_data = user_data,
+        };
+        return storage_cache_foreach(cached_list_callback, &ctx);
     }
     return list_files_recursive(path, callback, user_data);
 }
@@ -523,13 +677,13 @@ esp_err_t ble_delete_file(const char *path) {
         return ESP_ERR_NOT_SUPPORTED;
     }
 
-    if (unlink(path) != 0) {
+    if (storage_delete_file(path) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to delete file: %s", path);
         return ESP_FAIL;
     }
 
     ESP_LOGI(TAG, "File deleted successfully: %s", path);
-    playlist_rescan();
+    playlist_remove(path);
 
     return ESP_OK;
 }
@@ -541,13 +695,13 @@ esp_err_t ble_rename_file(const char *old_path, const char *new_path) {
 
     ESP_LOGI(TAG, "Renaming file: %s -> %s", old_path, new_path);
 
-    if (rename(old_path, new_path) != 0) {
+    if (storage_rename_file(old_path, new_path) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to rename file");
         return ESP_FAIL;
     }
 
     ESP_LOGI(TAG, "File renamed successfully");
-    playlist_rescan();
+    playlist_rename(old_path, new_path);
 
     return ESP_OK;
 }
@@ -572,6 +726,17 @@ esp_err_t ble_get_file_info(const char *path, ble_file_info_t *info) {
 }
 
 // ============ File Transfer Wrappers ============
+// These predate multiple connections and act on the first one
+
+static uint16_t first_conn_handle(void) {
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        uint16_t conn_handle = ble_conn_handle(i);
+        if (conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+            return conn_handle;
+        }
+    }
+    return BLE_HS_CONN_HANDLE_NONE;
+}
 
 esp_err_t ble_start_download(const char *file_path, ble_transfer_progress_cb_t progress_cb) {
     // Extract just filename from path if full path provided
@@ -579,7 +744,7 @@ esp_err_t ble_start_download(const char *file_path, ble_transfer_progress_cb_t p
     if (strncmp(file_path, "/Storage/", 9) == 0) {
         filename = file_path + 9;
     }
-    return ble_transfer_start_download(filename, current_conn_handle);
+    return ble_transfer_start_download(first_conn_handle(), filename, 0, 0);
 }
 
 esp_err_t ble_start_upload(const char *file_path, uint32_t file_size, ble_transfer_progress_cb_t progress_cb) {
@@ -588,16 +753,18 @@ esp_err_t ble_start_upload(const char *file_path, uint32_t file_size, ble_transf
     if (strncmp(file_path, "/Storage/", 9) == 0) {
         filename = file_path + 9;
     }
-    return ble_transfer_start_upload(filename, file_size, current_conn_handle);
+    return ble_transfer_start_upload(first_conn_handle(), filename, file_size, 0, 0);
 }
 
 esp_err_t ble_cancel_transfer(void) {
-    ble_transfer_cancel();
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        ble_transfer_cancel(ble_conn_handle(i));
+    }
     return ESP_OK;
 }
 
 ble_transfer_state_t ble_get_transfer_state(void) {
-    ble_xfer_state_t state = ble_transfer_get_state();
+    ble_xfer_state_t state = ble_transfer_get_state(first_conn_handle());
     // Map internal states to public enum
     switch (state) {
         case BLE_XFER_STATE_IDLE:
@@ -617,7 +784,7 @@ ble_transfer_state_t ble_get_transfer_state(void) {
 }
 
 uint32_t ble_get_transfer_progress(void) {
-    return ble_transfer_get_progress();
+    return ble_transfer_get_progress(first_conn_handle());
 }
 
 // ============ Playlist Control ============
@@ -627,14 +794,16 @@ esp_err_t ble_cmd_play(void) {
     audio_state_t state = audio_get_state();
 
     if (state == AUDIO_STATE_IDLE) {
-        const char *track = playlist_get_current();
-        if (track) {
-            return audio_play_file(track);
+        char track[PLAYLIST_MAX_PATH_LEN];
+        esp_err_t err = playlist_get_current(track, sizeof(track));
+        if (err != ESP_OK) {
+            return err;
         }
-        return ESP_ERR_NOT_FOUND;
+        return audio_play_file(track);
     } else if (state == AUDIO_STATE_PAUSED) {
-        play_pause_single_handler();  // Resume
-        return ESP_OK;
+        return audio_resume();
+    } else if (state == AUDIO_STATE_RECORDING) {
+        return ESP_ERR_INVALID_STATE;
     }
     return ESP_OK;
 }
@@ -642,29 +811,40 @@ esp_err_t ble_cmd_play(void) {
 esp_err_t ble_cmd_pause(void) {
     ESP_LOGI(TAG, "BLE command: pause");
     if (audio_get_state() == AUDIO_STATE_PLAYING) {
-        play_pause_single_handler();
+        return audio_pause();
     }
     return ESP_OK;
 }
 
 esp_err_t ble_cmd_next(void) {
     ESP_LOGI(TAG, "BLE command: next");
+    if (audio_get_state() == AUDIO_STATE_RECORDING) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (playlist_get_count() == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
     play_pause_double_handler();
     return ESP_OK;
 }
 
 esp_err_t ble_cmd_prev(void) {
     ESP_LOGI(TAG, "BLE command: prev");
-    const char *track = playlist_prev();
-    if (track) {
-        audio_state_t state = audio_get_state();
-        if (state == AUDIO_STATE_PLAYING || state == AUDIO_STATE_PAUSED) {
-            audio_stop_playback();
-            vTaskDelay(pdMS_TO_TICKS(100));
-        }
-        return audio_play_file(track);
+    if (audio_get_state() == AUDIO_STATE_RECORDING) {
+        return ESP_ERR_INVALID_STATE;
     }
-    return ESP_ERR_NOT_FOUND;
+    char track[PLAYLIST_MAX_PATH_LEN];
+    esp_err_t err = playlist_prev(track, sizeof(track));
+    if (err != ESP_OK) {
+        return err;
+    }
+    // Stops the current track and waits for it
+    return audio_play_file(track);
+}
+
+esp_err_t ble_cmd_seek(uint16_t permille) {
+    ESP_LOGI(TAG, "BLE command: seek to %u/1000", permille);
+    return audio_seek(permille);
 }
 
 esp_err_t ble_cmd_set_volume(uint8_t level) {
@@ -673,6 +853,7 @@ esp_err_t ble_cmd_set_volume(uint8_t level) {
         level = 4;
     }
     volume_set_level((volume_level_t)level);
+    audio_update_volume();
     return ESP_OK;
 }
 
@@ -687,14 +868,17 @@ esp_err_t ble_get_device_status(ble_device_status_t *status) {
 
     status->audio_state = (uint8_t)audio_get_state();
     status->volume_level = (uint8_t)volume_get_level();
-    status->battery_percent = get_battery_percent();
-    status->battery_mv = get_bat_voltage();
-    status->is_charging = is_battery_charging();
+    // Cached by the power poll; never blocks on the ADC
+    device_status_t dev;
+    device_status_get(&dev);
+    status->battery_percent = dev.battery_percent;
+    status->battery_mv = dev.battery_mv;
+    status->is_charging = dev.is_charging;
     status->playlist_index = (uint8_t)playlist_get_current_index();
     status->playlist_count = (uint8_t)playlist_get_count();
 
-    const char *current = playlist_get_current();
-    if (current) {
+    char current[PLAYLIST_MAX_PATH_LEN];
+    if (playlist_get_current(current, sizeof(current)) == ESP_OK) {
         const char *filename = strrchr(current, '/');
         if (filename) {
             filename++;
@@ -708,5 +892,7 @@ esp_err_t ble_get_device_status(ble_device_status_t *status) {
 }
 
 uint8_t ble_get_battery_level(void) {
-    return get_battery_percent();
+    device_status_t dev;
+    device_status_get(&dev);
+    return dev.battery_percent;
 }
@@ -70,12 +70,15 @@ esp_err_t ble_start_advertising(void);
 // Stop BLE advertising
 esp_err_t ble_stop_advertising(void);
 
-// Check connection status
+// Check connection status (any connection)
 bool ble_is_connected(void);
 
 // Check advertising status
 bool ble_is_advertising(void);
 
+// Whether the caller runs on the NimBLE host task (GAP/GATT callbacks)
+bool ble_is_host_task(void);
+
 // Button handler for long press (starts BLE)
 void ble_button_handler(void);
 
@@ -110,7 +113,7 @@ esp_err_t ble_start_download(const char *file_path, ble_transfer_progress_cb_t p
 // file_path: destination path on device
 esp_err_t ble_start_upload(const char *file_path, uint32_t file_size, ble_transfer_progress_cb_t progress_cb);
 
-// Cancel ongoing transfer
+// Cancel ongoing transfers (all connections)
 esp_err_t ble_cancel_transfer(void);
 
 // Get transfer state
@@ -121,11 +124,13 @@ uint32_t ble_get_transfer_progress(void);
 
 // ============ Playlist Control (via BLE) ============
 
-// These allow the app to control playback
+// These allow the app to control playback. They may block while a
+// track stops, so call them from the audio control task, not the host task.
 esp_err_t ble_cmd_play(void);
 esp_err_t ble_cmd_pause(void);
 esp_err_t ble_cmd_next(void);
 esp_err_t ble_cmd_prev(void);
+esp_err_t ble_cmd_seek(uint16_t permille);    // 0-1000 of the file
 esp_err_t ble_cmd_set_volume(uint8_t level);  // 0-4
 
 // ============ Status Notifications ============
@@ -0,0 +1,191 @@
+#include "ble_adv.h"
+#include "../Status/device_status.h"
+#include "../Storage/storage_journal.h"
+
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <services/gap/ble_svc_gap.h>
+
+static const char *TAG = "BLE_ADV";
+
+// Profile intervals (0.625 ms units)
+#define ADV_BURST_ITVL          BLE_GAP_ADV_ITVL_MS(20)
+#define ADV_FAST_ITVL_MIN       BLE_GAP_ADV_FAST_INTERVAL1_MIN  // 30 ms
+#define ADV_FAST_ITVL_MAX       BLE_GAP_ADV_FAST_INTERVAL1_MAX  // 60 ms
+#define ADV_SLOW_ITVL_MIN       1636                            // 1022.5 ms
+#define ADV_SLOW_ITVL_MAX       2056                            // 1285 ms
+
+static const char *profile_names[] = {
+    [BLE_ADV_PROFILE_DIRECTED] = "directed",
+    [BLE_ADV_PROFILE_BURST] = "burst",
+    [BLE_ADV_PROFILE_FAST] = "fast",
+    [BLE_ADV_PROFILE_SLOW] = "slow",
+};
+
+// Schedule (host task only)
+static int64_t burst_until_us = 0;
+static int64_t fast_until_us = 0;
+static int64_t disconnected_at_us = 0;
+static bool directed_pending = false;
+static ble_addr_t directed_peer;
+
+// ============ Internal Functions ============
+
+// Milliseconds left until deadline, 0 once it has passed
+static int32_t remaining_ms(int64_t deadline_us, int64_t now_us) {
+    int64_t ms = (deadline_us - now_us) / 1000;
+    return ms > 0 ? (int32_t)ms : 0;
+}
+
+// ============ Public Functions ============
+
+int ble_adv_set_fields(void) {
+    struct ble_hs_adv_fields fields;
+    uint8_t mfg[BLE_ADV_MFG_SIZE];
+
+    memset(&fields, 0, sizeof(fields));
+
+    // Flags: general discoverable, BLE only
+    fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+
+    // TX power level
+    fields.tx_pwr_lvl_is_present = 1;
+    fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
+
+    // Device name
+    const char *name = ble_svc_gap_device_name();
+    fields.name = (uint8_t *)name;
+    fields.name_len = strlen(name);
+    fields.name_is_complete = 1;
+
+    // Status for apps that decide whether to connect
+    ble_adv_pack_mfg(mfg);
+    fields.mfg_data = mfg;
+    fields.mfg_data_len = sizeof(mfg);
+
+    return ble_gap_adv_set_fields(&fields);
+}
+
+ble_adv_profile_t ble_adv_next(struct ble_gap_adv_params *params,
+                               const ble_addr_t **direct_addr, int32_t *duration_ms) {
+    int64_t now = esp_timer_get_time();
+    int32_t left;
+
+    memset(params, 0, sizeof(*params));
+    params->conn_mode = BLE_GAP_CONN_MODE_UND;  // Undirected connectable
+    params->disc_mode = BLE_GAP_DISC_MODE_GEN;  // General discoverable
+    *direct_addr = NULL;
+
+    if (directed_pending) {
+        // Bonded peer just dropped: high-duty directed at it, once. The
+        // controller ends it after 1.28 s and ADV_COMPLETE moves on.
+        directed_pending = false;
+        params->conn_mode = BLE_GAP_CONN_MODE_DIR;
+        params->disc_mode = BLE_GAP_DISC_MODE_NON;
+        params->high_duty_cycle = 1;
+        *direct_addr = &directed_peer;
+        *duration_ms = BLE_ADV_DIRECTED_MS;
+        return BLE_ADV_PROFILE_DIRECTED;
+    }
+
+    if ((left = remaining_ms(burst_until_us, now)) > 0) {
+        params->itvl_min = ADV_BURST_ITVL;
+        params->itvl_max = ADV_BURST_ITVL;
+        *duration_ms = left;
+        return BLE_ADV_PROFILE_BURST;
+    }
+
+    if ((left = remaining_ms(fast_until_us, now)) > 0) {
+        params->itvl_min = ADV_FAST_ITVL_MIN;
+        params->itvl_max = ADV_FAST_ITVL_MAX;
+        *duration_ms = left;
+        return BLE_ADV_PROFILE_FAST;
+    }
+
+    params->itvl_min = ADV_SLOW_ITVL_MIN;
+    params->itvl_max = ADV_SLOW_ITVL_MAX;
+    *duration_ms = BLE_HS_FOREVER;
+    return BLE_ADV_PROFILE_SLOW;
+}
+
+const char *ble_adv_profile_name(ble_adv_profile_t profile) {
+    if (profile > BLE_ADV_PROFILE_SLOW) {
+        return "unknown";
+    }
+    return profile_names[profile];
+}
+
+void ble_adv_on_start(void) {
+    fast_until_us = esp_timer_get_time() + (int64_t)BLE_ADV_FAST_MS * 1000;
+}
+
+void ble_adv_on_connect(void) {
+    if (disconnected_at_us != 0) {
+        ESP_LOGI(TAG, "Connected %lld ms after last disconnect",
+                 (long long)((esp_timer_get_time() - disconnected_at_us) / 1000));
+        disconnected_at_us = 0;
+    }
+
+    // Remaining slots are advertised for at the fast or slow rate
+    burst_until_us = 0;
+    directed_pending = false;
+}
+
+void ble_adv_on_disconnect(const struct ble_gap_conn_desc *desc) {
+    disconnected_at_us = esp_timer_get_time();
+    burst_until_us = disconnected_at_us + (int64_t)BLE_ADV_BURST_MS * 1000;
+    fast_until_us = burst_until_us + (int64_t)BLE_ADV_FAST_MS * 1000;
+
+    // Directed advertising only makes sense for a peer we know by identity
+    directed_pending = desc->sec_state.bonded;
+    if (directed_pending) {
+        directed_peer = desc->peer_id_addr;
+    }
+}
+
+void ble_adv_on_status_change(uint32_t changed) {
+    // Only fields that are in the payload; volume and track index are not
+    if (!(changed & (DEVICE_STATUS_AUDIO | DEVICE_STATUS_TRACK |
+                     DEVICE_STATUS_BATTERY | DEVICE_STATUS_POWER))) {
+        return;
+    }
+
+    if (!ble_gap_adv_active()) {
+        return;
+    }
+
+    int rc = ble_adv_set_fields();
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Failed to update advertising data: %d", rc);
+    }
+}
+
+void ble_adv_pack_mfg(uint8_t data[BLE_ADV_MFG_SIZE]) {
+    device_status_t status;
+    uint32_t epoch, generation;
+
+    device_status_get(&status);
+    storage_journal_get(&epoch, &generation);
+
+    uint8_t battery = (status.battery_percent / DEVICE_STATUS_BATTERY_STEP) & BLE_ADV_BATTERY_MASK;
+    if (status.is_charging) {
+        battery |= BLE_ADV_BATTERY_CHARGING;
+    }
+    if (status.power_detected) {
+        battery |= BLE_ADV_BATTERY_EXT_POWER;
+    }
+
+    data[0] = (BLE_ADV_COMPANY_ID >> 0) & 0xFF;
+    data[1] = (BLE_ADV_COMPANY_ID >> 8) & 0xFF;
+    data[2] = BLE_ADV_MFG_VERSION;
+    data[3] = battery;
+    data[4] = status.audio_state;
+    data[5] = (status.track_count >> 0) & 0xFF;
+    data[6] = (status.track_count >> 8) & 0xFF;
+    data[7] = (generation >> 0) & 0xFF;
+    data[8] = (generation >> 8) & 0xFF;
+    data[9] = (generation >> 16) & 0xFF;
+    data[10] = (generation >> 24) & 0xFF;
+}
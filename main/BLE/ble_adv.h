@@ -0,0 +1,108 @@
+#ifndef BLE_ADV_H
+#define BLE_ADV_H
+
+#include <stdint.h>
+#include <esp_err.h>
+#include <host/ble_hs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Schedule calls (ble_adv_next and the ble_adv_on_* hooks) run on the
+// NimBLE host task only; ble.c posts start/stop requests there.
+
+// Advertising profiles, in the order the schedule moves through them:
+// directed at a bonded peer that just dropped, burst for the reconnect
+// window, fast after advertising starts, then slow until a connection.
+typedef enum {
+    BLE_ADV_PROFILE_DIRECTED = 0,
+    BLE_ADV_PROFILE_BURST,
+    BLE_ADV_PROFILE_FAST,
+    BLE_ADV_PROFILE_SLOW
+} ble_adv_profile_t;
+
+// Schedule
+#define BLE_ADV_BURST_MS            5000    // After a disconnect
+#define BLE_ADV_FAST_MS             30000   // After start or burst
+#define BLE_ADV_DIRECTED_MS         1280    // High-duty directed limit
+
+// Manufacturer data, sent in every advertisement so the app can decide
+// whether to connect:
+// [company:2][version:1][battery:1][audio_state:1][track_count:2][generation:4]
+// battery: bits 0-4 percent / DEVICE_STATUS_BATTERY_STEP (0-20),
+//          bit 6 charging, bit 7 external power
+// generation: low 32 bits of the storage generation (changes on every
+//             add, delete or rename in /Storage)
+#define BLE_ADV_COMPANY_ID          0xFFFF  // Bluetooth SIG test ID
+#define BLE_ADV_MFG_VERSION         1
+#define BLE_ADV_MFG_SIZE            11
+
+#define BLE_ADV_BATTERY_MASK        0x1F
+#define BLE_ADV_BATTERY_CHARGING    0x40
+#define BLE_ADV_BATTERY_EXT_POWER   0x80
+
+/**
+ * @brief Set the advertisement data: flags, TX power, name and the
+ *        manufacturer status payload
+ *
+ * Safe while advertising; the next advertising event carries the new data.
+ *
+ * @return 0 on success, NimBLE error code otherwise
+ */
+int ble_adv_set_fields(void);
+
+/**
+ * @brief Pick the advertising parameters for the current schedule phase
+ *
+ * @param[out] params Advertising parameters
+ * @param[out] direct_addr Peer for directed advertising, or NULL
+ * @param[out] duration_ms How long to advertise (BLE_HS_FOREVER for slow);
+ *             when it ends, ADV_COMPLETE and this call move to the next phase
+ * @return Profile chosen
+ */
+ble_adv_profile_t ble_adv_next(struct ble_gap_adv_params *params,
+                               const ble_addr_t **direct_addr, int32_t *duration_ms);
+
+/**
+ * @brief Profile name for logs
+ */
+const char *ble_adv_profile_name(ble_adv_profile_t profile);
+
+/**
+ * @brief Advertising was requested: start with the fast profile
+ */
+void ble_adv_on_start(void);
+
+/**
+ * @brief A connection opened: end the burst and directed phases
+ */
+void ble_adv_on_connect(void);
+
+/**
+ * @brief A connection closed: directed (bonded peer) and burst come next
+ *
+ * @param desc Descriptor of the closed connection
+ */
+void ble_adv_on_disconnect(const struct ble_gap_conn_desc *desc);
+
+/**
+ * @brief Device status changed: refresh the manufacturer data (host task
+ *        only; ble_status posts status changes there)
+ *
+ * @param changed DEVICE_STATUS_* bits
+ */
+void ble_adv_on_status_change(uint32_t changed);
+
+/**
+ * @brief Build the manufacturer data payload
+ *
+ * @param[out] data Payload
+ */
+void ble_adv_pack_mfg(uint8_t data[BLE_ADV_MFG_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_ADV_H
@@ -0,0 +1,226 @@
+#include "ble_audio_ctrl.h"
+#include "ble.h"
+#include "ble_conn.h"
+#include "ble_notify.h"
+#include "ble_le.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include <host/ble_hs.h>
+
+static const char *TAG = "BLE_AUDIO_CTRL";
+
+#define AUDIO_CTRL_TASK_STACK   4096
+#define AUDIO_CTRL_TASK_PRIO    5
+#define AUDIO_CTRL_QUEUE_LEN    8
+
+typedef struct {
+    uint16_t conn_handle;
+    uint16_t attr_handle;
+    uint8_t req_id;
+    uint8_t cmd;
+    uint16_t arg;
+    int64_t received_us;
+} audio_cmd_t;
+
+static QueueHandle_t cmd_queue = NULL;
+
+// Write-to-ack latency since boot
+static struct {
+    uint32_t count;
+    uint32_t last_us;
+    uint32_t max_us;
+    uint64_t total_us;
+} stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// ============ Internal Functions ============
+
+static uint8_t status_from_err(esp_err_t err) {
+    switch (err) {
+    case ESP_OK:
+        return BLE_AUDIO_STATUS_OK;
+    case ESP_ERR_NOT_FOUND:
+        return BLE_AUDIO_STATUS_NOT_FOUND;
+    case ESP_ERR_INVALID_STATE:
+        return BLE_AUDIO_STATUS_BUSY;
+    case ESP_ERR_INVALID_ARG:
+        return BLE_AUDIO_STATUS_INVALID;
+    default:
+        return BLE_AUDIO_STATUS_FAILED;
+    }
+}
+
+// Queued by the notify manager if mbufs are short; safe on the host task
+static void send_ack(uint16_t conn_handle, uint16_t attr_handle, uint8_t req_id,
+                     uint8_t cmd, uint8_t status, uint32_t queued_us, uint32_t exec_us) {
+    uint8_t data[BLE_AUDIO_ACK_SIZE];
+    data[0] = req_id;
+    data[1] = cmd;
+    data[2] = status;
+    put_le32(&data[3], queued_us);
+    put_le32(&data[7], exec_us);
+
+    int rc = ble_notify_send(conn_handle, attr_handle, data, sizeof(data), BLE_NOTIFY_CTRL);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Ack %u notify failed: %d", req_id, rc);
+    }
+}
+
+static esp_err_t run_cmd(const audio_cmd_t *c) {
+    switch (c->cmd) {
+    case BLE_AUDIO_CMD_PLAY:
+        return ble_cmd_play();
+    case BLE_AUDIO_CMD_PAUSE:
+        return ble_cmd_pause();
+    case BLE_AUDIO_CMD_NEXT:
+        return ble_cmd_next();
+    case BLE_AUDIO_CMD_PREV:
+        return ble_cmd_prev();
+    case BLE_AUDIO_CMD_SEEK:
+        return ble_cmd_seek(c->arg);
+    case BLE_AUDIO_CMD_VOLUME:
+        return ble_cmd_set_volume((uint8_t)c->arg);
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+}
+
+// Runs commands one at a time, in the order they were written
+static void audio_ctrl_task(void *param) {
+    audio_cmd_t c;
+
+    while (true) {
+        if (xQueueReceive(cmd_queue, &c, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        int64_t start = esp_timer_get_time();
+        esp_err_t err = run_cmd(&c);
+        int64_t end = esp_timer_get_time();
+
+        uint32_t queued_us = (uint32_t)(start - c.received_us);
+        uint32_t exec_us = (uint32_t)(end - start);
+        uint32_t total_us = queued_us + exec_us;
+
+        taskENTER_CRITICAL(&stats_lock);
+        stats.count++;
+        stats.last_us = total_us;
+        stats.total_us += total_us;
+        if (total_us > stats.max_us) {
+            stats.max_us = total_us;
+        }
+        taskEXIT_CRITICAL(&stats_lock);
+
+        ESP_LOGI(TAG, "Command %u (0x%02x): %s, queued %lu us, ran %lu us",
+                 c.req_id, c.cmd, esp_err_to_name(err),
+                 (unsigned long)queued_us, (unsigned long)exec_us);
+
+        // The app may have gone while the command ran
+        if (ble_conn_slot(c.conn_handle) >= 0) {
+            send_ack(c.conn_handle, c.attr_handle, c.req_id, c.cmd,
+                     status_from_err(err), queued_us, exec_us);
+        }
+    }
+}
+
+// ============ Public Functions ============
+
+esp_err_t ble_audio_ctrl_init(void) {
+    if (cmd_queue != NULL) {
+        return ESP_OK;
+    }
+
+    cmd_queue = xQueueCreate(AUDIO_CTRL_QUEUE_LEN, sizeof(audio_cmd_t));
+    if (cmd_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create command queue");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(audio_ctrl_task, "audio_ctrl", AUDIO_CTRL_TASK_STACK, NULL,
+                    AUDIO_CTRL_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create audio control task");
+        vQueueDelete(cmd_queue);
+        cmd_queue = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ble_audio_ctrl_write(uint16_t conn_handle, uint16_t attr_handle,
+                               const uint8_t *buf, size_t len) {
+    if (len < BLE_AUDIO_CMD_HDR_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    audio_cmd_t c = {
+        .conn_handle = conn_handle,
+        .attr_handle = attr_handle,
+        .req_id = buf[0],
+        .cmd = buf[1],
+        .arg = 0,
+        .received_us = esp_timer_get_time(),
+    };
+    size_t arg_len = len - BLE_AUDIO_CMD_HDR_LEN;
+    const uint8_t *arg = buf + BLE_AUDIO_CMD_HDR_LEN;
+    bool valid;
+
+    switch (c.cmd) {
+    case BLE_AUDIO_CMD_PLAY:
+    case BLE_AUDIO_CMD_PAUSE:
+    case BLE_AUDIO_CMD_NEXT:
+    case BLE_AUDIO_CMD_PREV:
+        valid = (arg_len == 0);
+        break;
+    case BLE_AUDIO_CMD_SEEK:
+        valid = (arg_len == 2);
+        if (valid) {
+            c.arg = get_le16(arg);
+            valid = (c.arg <= 1000);
+        }
+        break;
+    case BLE_AUDIO_CMD_VOLUME:
+        valid = (arg_len == 1 && arg[0] <= 4);
+        if (valid) {
+            c.arg = arg[0];
+        }
+        break;
+    default:
+        valid = false;
+        break;
+    }
+
+    // Acked here too, so writes without response still hear about it
+    if (!valid) {
+        ESP_LOGW(TAG, "Invalid command %u (0x%02x, %u arg bytes)",
+                 c.req_id, c.cmd, (unsigned)arg_len);
+        send_ack(conn_handle, attr_handle, c.req_id, c.cmd, BLE_AUDIO_STATUS_INVALID, 0, 0);
+        return ESP_OK;
+    }
+    if (cmd_queue == NULL || xQueueSend(cmd_queue, &c, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Command queue full, dropped %u", c.req_id);
+        send_ack(conn_handle, attr_handle, c.req_id, c.cmd, BLE_AUDIO_STATUS_QUEUE_FULL, 0, 0);
+    }
+    return ESP_OK;
+}
+
+void ble_audio_ctrl_pack_stats(uint8_t data[BLE_AUDIO_STATS_SIZE]) {
+    uint32_t count, last_us, max_us;
+    uint64_t total_us;
+
+    taskENTER_CRITICAL(&stats_lock);
+    count = stats.count;
+    last_us = stats.last_us;
+    max_us = stats.max_us;
+    total_us = stats.total_us;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    put_le32(&data[0], count);
+    put_le32(&data[4], last_us);
+    put_le32(&data[8], count ? (uint32_t)(total_us / count) : 0);
+    put_le32(&data[12], max_us);
+}
@@ -0,0 +1,77 @@
+#ifndef BLE_AUDIO_CTRL_H
+#define BLE_AUDIO_CTRL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Command written to the Audio Command characteristic:
+// [req_id:1][cmd:1][args]. req_id is chosen by the app and echoed in the ack.
+#define BLE_AUDIO_CMD_HDR_LEN       2
+
+// Commands
+#define BLE_AUDIO_CMD_PLAY          0x01  // No args
+#define BLE_AUDIO_CMD_PAUSE         0x02  // No args
+#define BLE_AUDIO_CMD_NEXT          0x03  // No args
+#define BLE_AUDIO_CMD_PREV          0x04  // No args
+#define BLE_AUDIO_CMD_SEEK          0x05  // [permille:2] position in the file, 0-1000
+#define BLE_AUDIO_CMD_VOLUME        0x06  // [level:1] 0-4
+
+// Ack notification:
+// [req_id:1][cmd:1][status:1][queued_us:4][exec_us:4]
+// queued_us is the time from the write to the start of execution,
+// exec_us the time the command took to run
+#define BLE_AUDIO_ACK_SIZE          11
+
+// Read: [count:4][last_us:4][avg_us:4][max_us:4], write-to-ack latency
+// of the commands run since boot
+#define BLE_AUDIO_STATS_SIZE        16
+
+// Ack status
+#define BLE_AUDIO_STATUS_OK         0x00
+#define BLE_AUDIO_STATUS_NOT_FOUND  0x01  // Empty playlist or no current track
+#define BLE_AUDIO_STATUS_BUSY       0x02  // Not possible in this state (recording, idle seek)
+#define BLE_AUDIO_STATUS_INVALID    0x03  // Unknown command or bad argument
+#define BLE_AUDIO_STATUS_QUEUE_FULL 0x04  // Command dropped, try again
+#define BLE_AUDIO_STATUS_FAILED     0x05
+
+/**
+ * @brief Create the audio control queue and task
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM if the queue or task could not be created
+ */
+esp_err_t ble_audio_ctrl_init(void);
+
+/**
+ * @brief Handle an Audio Command characteristic write
+ *
+ * Queues the command for the audio control task and returns at once,
+ * so the host task never waits for playback to start or stop. Each
+ * command is acked with a notification on attr_handle once it has run,
+ * or straight away if it is invalid or the queue is full.
+ *
+ * @param conn_handle BLE connection handle
+ * @param attr_handle Audio Command characteristic value handle
+ * @param buf Written bytes
+ * @param len Written length
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE if the write has no header
+ */
+esp_err_t ble_audio_ctrl_write(uint16_t conn_handle, uint16_t attr_handle,
+                               const uint8_t *buf, size_t len);
+
+/**
+ * @brief Build the latency statistics read value
+ *
+ * @param[out] data Characteristic value
+ */
+void ble_audio_ctrl_pack_stats(uint8_t data[BLE_AUDIO_STATS_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_AUDIO_CTRL_H
@@ -1,9 +1,17 @@
 #include "ble_auth.h"
+#include "ble_conn.h"
+#include "ble_ota.h"
+#include "ble_le.h"
 
 #include <string.h>
 #include <nvs_flash.h>
 #include <nvs.h>
 #include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <mbedtls/md.h>
+
+#include <host/ble_hs.h>
 
 static const char *TAG = "BLE_AUTH";
 
@@ -16,13 +24,130 @@ static uint8_t stored_key[BLE_AUTH_KEY_SIZE];
 static size_t stored_key_len = 0;
 static bool has_stored_key = false;
 
-// Session authentication state (cleared on disconnect)
-static bool session_authenticated = false;
+// Session authentication state per connection slot (cleared on disconnect)
+static bool session_authenticated[BLE_MAX_CONNECTIONS];
+
+// Peers that hold resumption tokens, keyed by identity address. Each has
+// its own nonce, redrawn to revoke that peer's tokens; the oldest entry
+// makes room for a new peer. Host task only.
+#define TOKEN_PEERS 8
+
+typedef struct {
+    bool in_use;
+    ble_addr_t addr;
+    uint8_t nonce[16];
+    int64_t issued_us;
+} token_peer_t;
+
+static token_peer_t token_peers[TOKEN_PEERS];
+
+// ============ Internal Functions ============
+
+static bool session_get(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    return slot >= 0 && session_authenticated[slot];
+}
+
+static void session_set(uint16_t conn_handle, bool authenticated) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot >= 0) {
+        session_authenticated[slot] = authenticated;
+    }
+
+    // A phone got through with its key: the update path works
+    if (authenticated) {
+        ble_ota_confirm();
+    }
+}
+
+static void token_revoke_all(void) {
+    memset(token_peers, 0, sizeof(token_peers));
+}
+
+// Identity address of the peer (its resolved address when bonded)
+static bool token_peer_addr(uint16_t conn_handle, ble_addr_t *addr) {
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(conn_handle, &desc) != 0) {
+        return false;
+    }
+    *addr = desc.peer_id_addr;
+    return true;
+}
+
+static token_peer_t *token_peer_find(const ble_addr_t *addr) {
+    for (int i = 0; i < TOKEN_PEERS; i++) {
+        if (token_peers[i].in_use && ble_addr_cmp(&token_peers[i].addr, addr) == 0) {
+            return &token_peers[i];
+        }
+    }
+    return NULL;
+}
+
+// Entry for a peer, taking a free or the oldest one for a new peer
+static token_peer_t *token_peer_get(const ble_addr_t *addr) {
+    token_peer_t *peer = token_peer_find(addr);
+    if (peer) {
+        return peer;
+    }
+
+    peer = &token_peers[0];
+    for (int i = 0; i < TOKEN_PEERS && peer->in_use; i++) {
+        if (!token_peers[i].in_use || token_peers[i].issued_us < peer->issued_us) {
+            peer = &token_peers[i];
+        }
+    }
+    peer->in_use = true;
+    peer->addr = *addr;
+    esp_fill_random(peer->nonce, sizeof(peer->nonce));
+    return peer;
+}
+
+static uint32_t token_window(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000000 / BLE_AUTH_TOKEN_WINDOW_S);
+}
+
+// HMAC-SHA256 over nonce || peer address || window (SHA on the hardware
+// accelerator via mbedTLS), truncated
+static bool token_compute(const token_peer_t *peer, uint32_t window,
+                          uint8_t token[BLE_AUTH_TOKEN_SIZE]) {
+    uint8_t msg[sizeof(peer->nonce) + 1 + sizeof(peer->addr.val) + 4];
+    uint8_t mac[32];
+    uint8_t *p = msg;
+
+    memcpy(p, peer->nonce, sizeof(peer->nonce));
+    p += sizeof(peer->nonce);
+    *p++ = peer->addr.type;
+    memcpy(p, peer->addr.val, sizeof(peer->addr.val));
+    p += sizeof(peer->addr.val);
+    put_le32(p, window);
+
+    const mbedtls_md_info_t *md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+    if (md == NULL ||
+        mbedtls_md_hmac(md, stored_key, stored_key_len, msg, sizeof(msg), mac) != 0) {
+        return false;
+    }
+
+    memcpy(token, mac, BLE_AUTH_TOKEN_SIZE);
+    return true;
+}
+
+// Constant-time compare, so timing doesn't leak how much of a token matched
+static bool token_equal(const uint8_t *a, const uint8_t *b) {
+    uint8_t diff = 0;
+    for (int i = 0; i < BLE_AUTH_TOKEN_SIZE; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+// ============ Public Functions ============
 
 esp_err_t ble_auth_load_key(void) {
     nvs_handle_t handle;
     esp_err_t err;
 
+    token_revoke_all();
+
     err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
     if (err == ESP_ERR_NVS_NOT_FOUND) {
         ESP_LOGI(TAG, "No auth namespace found - device is in first-pairing mode");
@@ -85,6 +210,7 @@ esp_err_t ble_auth_save_key(const uint8_t *key, size_t len) {
         memcpy(stored_key, key, len);
         stored_key_len = len;
         has_stored_key = true;
+        token_revoke_all();
         ESP_LOGI(TAG, "Auth key saved successfully");
     }
 
@@ -92,8 +218,8 @@ esp_err_t ble_auth_save_key(const uint8_t *key, size_t len) {
     return err;
 }
 
-esp_err_t ble_auth_clear_key(void) {
-    if (!session_authenticated) {
+esp_err_t ble_auth_clear_key(uint16_t conn_handle) {
+    if (!session_get(conn_handle)) {
         ESP_LOGW(TAG, "Cannot clear key - session not authenticated");
         return ESP_ERR_INVALID_STATE;
     }
@@ -122,7 +248,8 @@ esp_err_t ble_auth_clear_key(void) {
         memset(stored_key, 0, sizeof(stored_key));
         stored_key_len = 0;
         has_stored_key = false;
-        session_authenticated = false;
+        memset(session_authenticated, 0, sizeof(session_authenticated));
+        token_revoke_all();
         ESP_LOGI(TAG, "Auth key cleared - device entering first-pairing mode");
     }
 
@@ -133,7 +260,7 @@ bool ble_auth_has_stored_key(void) {
     return has_stored_key;
 }
 
-bool ble_auth_check_key(const uint8_t *key, size_t len) {
+bool ble_auth_check_key(uint16_t conn_handle, const uint8_t *key, size_t len) {
     if (!key || len != BLE_AUTH_KEY_SIZE) {
         ESP_LOGW(TAG, "Invalid key length: expected %d, got %d",
                  BLE_AUTH_KEY_SIZE, (int)len);
@@ -145,7 +272,7 @@ bool ble_auth_check_key(const uint8_t *key, size_t len) {
         ESP_LOGI(TAG, "First pairing - saving provided key");
         esp_err_t err = ble_auth_save_key(key, len);
         if (err == ESP_OK) {
-            session_authenticated = true;
+            session_set(conn_handle, true);
             ESP_LOGI(TAG, "First pairing successful - session authenticated");
             return true;
         }
@@ -160,7 +287,7 @@ bool ble_auth_check_key(const uint8_t *key, size_t len) {
     }
 
     if (memcmp(key, stored_key, len) == 0) {
-        session_authenticated = true;
+        session_set(conn_handle, true);
         ESP_LOGI(TAG, "Authentication successful");
         return true;
     }
@@ -169,19 +296,78 @@ bool ble_auth_check_key(const uint8_t *key, size_t len) {
     return false;
 }
 
-bool ble_auth_is_authenticated(void) {
+bool ble_auth_is_authenticated(uint16_t conn_handle) {
     // If no key is stored, device is in first-pairing mode - considered authenticated
     if (!has_stored_key) {
         return true;
     }
-    return session_authenticated;
+    return session_get(conn_handle);
+}
+
+void ble_auth_resume(uint16_t conn_handle) {
+    session_set(conn_handle, true);
+    ESP_LOGI(TAG, "Session resumed from bond (conn %d)", conn_handle);
+}
+
+esp_err_t ble_auth_issue_token(uint16_t conn_handle, uint8_t token[BLE_AUTH_TOKEN_SIZE],
+                               uint16_t *valid_s) {
+    ble_addr_t addr;
+    if (!has_stored_key || !session_get(conn_handle) || !token_peer_addr(conn_handle, &addr)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    token_peer_t *peer = token_peer_get(&addr);
+    uint32_t window = token_window();
+    if (!token_compute(peer, window, token)) {
+        ESP_LOGE(TAG, "Failed to compute resumption token");
+        return ESP_FAIL;
+    }
+    peer->issued_us = esp_timer_get_time();
+
+    // Accepted until the end of the next window
+    int64_t end_s = (int64_t)(window + 2) * BLE_AUTH_TOKEN_WINDOW_S;
+    *valid_s = (uint16_t)(end_s - esp_timer_get_time() / 1000000);
+    return ESP_OK;
+}
+
+bool ble_auth_check_token(uint16_t conn_handle, const uint8_t *token, size_t len) {
+    ble_addr_t addr;
+    token_peer_t *peer = NULL;
+    if (token && len == BLE_AUTH_TOKEN_SIZE && has_stored_key &&
+        token_peer_addr(conn_handle, &addr)) {
+        peer = token_peer_find(&addr);
+    }
+    if (!peer) {
+        ESP_LOGW(TAG, "Resumption token rejected (conn %d)", conn_handle);
+        return false;
+    }
+
+    uint32_t window = token_window();
+    uint8_t expected[BLE_AUTH_TOKEN_SIZE];
+
+    // Issued to this peer in this window or the previous one
+    bool valid = token_compute(peer, window, expected) && token_equal(token, expected);
+    if (!valid && window > 0) {
+        valid = token_compute(peer, window - 1, expected) && token_equal(token, expected);
+    }
+
+    if (!valid) {
+        ESP_LOGW(TAG, "Resumption token rejected (conn %d)", conn_handle);
+        return false;
+    }
+
+    // Single use: drop this peer's entry, leaving other peers' tokens valid
+    memset(peer, 0, sizeof(*peer));
+    session_set(conn_handle, true);
+    ESP_LOGI(TAG, "Session resumed by token (conn %d)", conn_handle);
+    return true;
 }
 
-void ble_auth_on_disconnect(void) {
-    session_authenticated = false;
-    ESP_LOGI(TAG, "Session authentication cleared on disconnect");
+void ble_auth_on_disconnect(uint16_t conn_handle) {
+    session_set(conn_handle, false);
+    ESP_LOGI(TAG, "Session authentication cleared on disconnect (conn %d)", conn_handle);
 }
 
-uint8_t ble_auth_get_status_byte(void) {
-    return ble_auth_is_authenticated() ? 0x01 : 0x00;
+uint8_t ble_auth_get_status_byte(uint16_t conn_handle) {
+    return ble_auth_is_authenticated(conn_handle) ? 0x01 : 0x00;
 }
@@ -13,6 +13,14 @@ extern "C" {
 // Authentication key size (fixed 32 bytes)
 #define BLE_AUTH_KEY_SIZE 32
 
+// Session resumption token: HMAC-SHA256(key, nonce || peer || window),
+// truncated. It is bound to the peer's identity address. Each peer has its
+// own nonce, which is dropped when that peer uses a token. Changing the key
+// or rebooting drops all of them, so a token works once. A token is
+// accepted in the window it was issued in and the next one.
+#define BLE_AUTH_TOKEN_SIZE         16
+#define BLE_AUTH_TOKEN_WINDOW_S     60
+
 /**
  * @brief Load authentication key from NVS
  *
@@ -37,11 +45,13 @@ esp_err_t ble_auth_save_key(const uint8_t *key, size_t len);
  *
  * This performs a factory reset of the authentication.
  * Device will enter first-pairing mode on next connection.
- * Requires the session to be authenticated first.
+ * Requires the session to be authenticated first. Every other
+ * connection's session is cleared too.
  *
+ * @param conn_handle Connection asking for the clear
  * @return ESP_OK on success
  */
-esp_err_t ble_auth_clear_key(void);
+esp_err_t ble_auth_clear_key(uint16_t conn_handle);
 
 /**
  * @brief Check if a stored key exists
@@ -54,39 +64,82 @@ bool ble_auth_has_stored_key(void);
  * @brief Check provided key against stored key
  *
  * If no key is stored (first pairing), the provided key is saved
- * and session is marked as authenticated.
+ * and session is marked as authenticated. Other connections that were
+ * only authenticated by first-pairing mode then have to present it too.
  *
+ * @param conn_handle Connection presenting the key
  * @param key Pointer to key to check
  * @param len Length of key
  * @return true if key matches or first pairing succeeded
  */
-bool ble_auth_check_key(const uint8_t *key, size_t len);
+bool ble_auth_check_key(uint16_t conn_handle, const uint8_t *key, size_t len);
 
 /**
- * @brief Check if current session is authenticated
+ * @brief Check if a connection's session is authenticated
  *
  * Returns true if:
  * - No key is stored (first-pairing mode)
- * - Key was provided and matched stored key
+ * - Key was provided on this connection and matched stored key
  *
+ * @param conn_handle BLE connection handle
  * @return true if session is authenticated
  */
-bool ble_auth_is_authenticated(void);
+bool ble_auth_is_authenticated(uint16_t conn_handle);
+
+/**
+ * @brief Authenticate a session without the key write
+ *
+ * For encrypted links whose bond presented the key before (bonded mode,
+ * see ble_bond.h).
+ *
+ * @param conn_handle BLE connection handle
+ */
+void ble_auth_resume(uint16_t conn_handle);
+
+/**
+ * @brief Issue a session resumption token
+ *
+ * The token is bound to the peer's identity address.
+ *
+ * @param conn_handle Authenticated connection asking for it
+ * @param[out] token Token to present on a later connection
+ * @param[out] valid_s Seconds the token is valid for at least
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if the session is not
+ *         authenticated or no key is stored, ESP_FAIL if HMAC fails
+ */
+esp_err_t ble_auth_issue_token(uint16_t conn_handle, uint8_t token[BLE_AUTH_TOKEN_SIZE],
+                               uint16_t *valid_s);
+
+/**
+ * @brief Authenticate a session with a resumption token
+ *
+ * A valid token authenticates the session and is used up, along with any
+ * other token issued to the same peer. Tokens of other peers stay valid.
+ *
+ * @param conn_handle Connection presenting the token
+ * @param token Token from ble_auth_issue_token()
+ * @param len Length of token
+ * @return true if the token was valid
+ */
+bool ble_auth_check_token(uint16_t conn_handle, const uint8_t *token, size_t len);
 
 /**
  * @brief Called when BLE connection is disconnected
  *
- * Clears session authentication state.
+ * Clears the connection's session authentication state.
  * Next connection will need to re-authenticate.
+ *
+ * @param conn_handle BLE connection handle
  */
-void ble_auth_on_disconnect(void);
+void ble_auth_on_disconnect(uint16_t conn_handle);
 
 /**
  * @brief Get authentication status byte for BLE response
  *
+ * @param conn_handle BLE connection handle
  * @return 0x01 if authenticated, 0x00 if not
  */
-uint8_t ble_auth_get_status_byte(void);
+uint8_t ble_auth_get_status_byte(uint16_t conn_handle);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,327 @@
+#include "ble_bond.h"
+#include "ble_auth.h"
+#include "ble_gatt.h"
+
+#include <string.h>
+#include <nvs_flash.h>
+#include <nvs.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+
+#include <host/ble_hs.h>
+#include <host/ble_uuid.h>
+#include <services/gatt/ble_svc_gatt.h>
+
+static const char *TAG = "BLE_BOND";
+
+// NimBLE's NVS-backed store; it has no public header
+void ble_store_config_init(void);
+
+// NVS namespace and keys
+#define NVS_NAMESPACE       "ble_bond"
+#define NVS_KEY_GATT_FP     "gatt_fp"
+#define NVS_KEY_SC_SENT     "sc_sent"
+#define NVS_KEY_TRUSTED     "trusted"
+
+// A bonded phone, by identity address. ltk_crc ties an entry to one bond:
+// re-pairing (by the same phone or one faking its address) makes a new
+// LTK, so the entry stops matching.
+typedef struct {
+    ble_addr_t addr;
+    uint32_t ltk_crc;
+} bond_peer_t;
+
+typedef struct {
+    uint8_t count;
+    bond_peer_t peers[BLE_BOND_MAX_PEERS];
+} bond_list_t;
+
+// GATT table fingerprint, accumulated while services register
+static uint32_t gatt_fp = 0;
+static bool gatt_fp_checked = false;
+
+// Phones sent Service Changed for the current table
+static bond_list_t sc_sent;
+
+// Bonds that presented the app key; they resume without the key write
+static bond_list_t trusted;
+
+// ============ Internal Functions ============
+
+static void list_load(const char *key, bond_list_t *list) {
+    memset(list, 0, sizeof(*list));
+
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+
+    size_t len = sizeof(*list);
+    if (nvs_get_blob(handle, key, list, &len) != ESP_OK || len != sizeof(*list) ||
+        list->count > BLE_BOND_MAX_PEERS) {
+        memset(list, 0, sizeof(*list));
+    }
+    nvs_close(handle);
+}
+
+static void list_save(const char *key, const bond_list_t *list) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+        return;
+    }
+
+    err = nvs_set_blob(handle, key, list, sizeof(*list));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save %s: %s", key, esp_err_to_name(err));
+    }
+    nvs_close(handle);
+}
+
+static int list_find(const bond_list_t *list, const ble_addr_t *addr) {
+    for (int i = 0; i < list->count; i++) {
+        if (ble_addr_cmp(&list->peers[i].addr, addr) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Add or update a peer; the oldest entry goes when the list is full
+static void list_put(bond_list_t *list, const ble_addr_t *addr, uint32_t ltk_crc) {
+    int i = list_find(list, addr);
+    if (i < 0) {
+        if (list->count == BLE_BOND_MAX_PEERS) {
+            memmove(&list->peers[0], &list->peers[1],
+                    (BLE_BOND_MAX_PEERS - 1) * sizeof(bond_peer_t));
+            list->count--;
+        }
+        i = list->count++;
+    }
+    list->peers[i].addr = *addr;
+    list->peers[i].ltk_crc = ltk_crc;
+}
+
+// Fingerprint of the LTK the peer is bonded with, 0 if there is none
+static uint32_t bond_ltk_crc(const ble_addr_t *peer_id_addr) {
+    struct ble_store_key_sec key;
+    struct ble_store_value_sec value;
+
+    memset(&key, 0, sizeof(key));
+    key.peer_addr = *peer_id_addr;
+    if (ble_store_read_peer_sec(&key, &value) != 0 || !value.ltk_present) {
+        return 0;
+    }
+    return esp_rom_crc32_le(0, value.ltk, sizeof(value.ltk));
+}
+
+// Encrypted, bonded link's peer; false if the link is neither
+static bool bonded_peer(uint16_t conn_handle, ble_addr_t *addr, uint32_t *ltk_crc) {
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(conn_handle, &desc) != 0 ||
+        !desc.sec_state.encrypted || !desc.sec_state.bonded) {
+        return false;
+    }
+
+    *addr = desc.peer_id_addr;
+    *ltk_crc = bond_ltk_crc(addr);
+    return *ltk_crc != 0;
+}
+
+static void trust_peer(uint16_t conn_handle) {
+    ble_addr_t addr;
+    uint32_t ltk_crc;
+    if (!bonded_peer(conn_handle, &addr, &ltk_crc)) {
+        return;
+    }
+
+    int i = list_find(&trusted, &addr);
+    if (i >= 0 && trusted.peers[i].ltk_crc == ltk_crc) {
+        return;
+    }
+
+    list_put(&trusted, &addr, ltk_crc);
+    list_save(NVS_KEY_TRUSTED, &trusted);
+    ESP_LOGI(TAG, "Bond on conn %d will resume its session on reconnect", conn_handle);
+}
+
+// ============ Public Functions ============
+
+void ble_bond_init(void) {
+    if (!BLE_BOND_ENABLED) {
+        // Disable pairing/bonding (using app-level auth)
+        ble_hs_cfg.sm_bonding = 0;
+        ble_hs_cfg.sm_mitm = 0;
+        ble_hs_cfg.sm_sc = 0;
+        ble_hs_cfg.sm_our_key_dist = 0;
+        ble_hs_cfg.sm_their_key_dist = 0;
+        return;
+    }
+
+    // Just Works bonding. The device has no display or buttons to confirm a
+    // passkey; the app key still decides who gets a session.
+    ble_hs_cfg.sm_io_cap = BLE_SM_IO_CAP_NO_IO;
+    ble_hs_cfg.sm_bonding = 1;
+    ble_hs_cfg.sm_mitm = 0;
+    ble_hs_cfg.sm_sc = 1;
+    ble_hs_cfg.sm_our_key_dist = BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+    ble_hs_cfg.sm_their_key_dist = BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+
+    // Bond keys and CCCDs persist in NVS (CONFIG_BT_NIMBLE_NVS_PERSIST)
+    ble_store_config_init();
+
+    list_load(NVS_KEY_SC_SENT, &sc_sent);
+    list_load(NVS_KEY_TRUSTED, &trusted);
+
+    ESP_LOGI(TAG, "Bonded mode: %d resumable bond(s)", trusted.count);
+}
+
+void ble_bond_gatt_register(const struct ble_gatt_register_ctxt *ctxt) {
+    char buf[BLE_UUID_STR_LEN];
+    const ble_uuid_t *uuid;
+    uint16_t handle;
+
+    switch (ctxt->op) {
+    case BLE_GATT_REGISTER_OP_SVC:
+        uuid = ctxt->svc.svc_def->uuid;
+        handle = ctxt->svc.handle;
+        break;
+    case BLE_GATT_REGISTER_OP_CHR:
+        uuid = ctxt->chr.chr_def->uuid;
+        handle = ctxt->chr.val_handle;
+        break;
+    case BLE_GATT_REGISTER_OP_DSC:
+        uuid = ctxt->dsc.dsc_def->uuid;
+        handle = ctxt->dsc.handle;
+        break;
+    default:
+        return;
+    }
+
+    // Any added, removed or moved attribute changes some UUID/handle pair
+    ble_uuid_to_str(uuid, buf);
+    gatt_fp = esp_rom_crc32_le(gatt_fp, (const uint8_t *)buf, strlen(buf));
+    gatt_fp = esp_rom_crc32_le(gatt_fp, (const uint8_t *)&handle, sizeof(handle));
+}
+
+void ble_bond_on_sync(void) {
+    // Services register once; later syncs (host resets) see the same table
+    if (!BLE_BOND_ENABLED || gatt_fp_checked) {
+        return;
+    }
+    gatt_fp_checked = true;
+
+    nvs_handle_t handle;
+    uint32_t stored = 0;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u32(handle, NVS_KEY_GATT_FP, &stored);
+        nvs_close(handle);
+    }
+
+    if (stored == gatt_fp) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "GATT table changed (%08lx -> %08lx), bonded phones get Service Changed",
+             (unsigned long)stored, (unsigned long)gatt_fp);
+
+    memset(&sc_sent, 0, sizeof(sc_sent));
+    list_save(NVS_KEY_SC_SENT, &sc_sent);
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        if (nvs_set_u32(handle, NVS_KEY_GATT_FP, gatt_fp) == ESP_OK) {
+            nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+}
+
+void ble_bond_on_connect(uint16_t conn_handle) {
+    if (!BLE_BOND_ENABLED) {
+        return;
+    }
+
+    // Bonded phones re-encrypt with stored keys; new ones are asked to pair
+    int rc = ble_gap_security_initiate(conn_handle);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Failed to request security on conn %d: %d", conn_handle, rc);
+    }
+}
+
+void ble_bond_on_enc_change(uint16_t conn_handle, int status) {
+    if (!BLE_BOND_ENABLED) {
+        return;
+    }
+
+    if (status != 0) {
+        ESP_LOGW(TAG, "Encryption failed on conn %d: %d", conn_handle, status);
+        return;
+    }
+
+    ble_addr_t addr;
+    uint32_t ltk_crc;
+    if (!bonded_peer(conn_handle, &addr, &ltk_crc)) {
+        return;
+    }
+
+    // The phone may hold handles from an older table
+    if (list_find(&sc_sent, &addr) < 0) {
+        ESP_LOGI(TAG, "Service Changed to conn %d", conn_handle);
+        ble_svc_gatt_changed(0x0001, 0xFFFF);
+        list_put(&sc_sent, &addr, ltk_crc);
+        list_save(NVS_KEY_SC_SENT, &sc_sent);
+    }
+
+    // Key written before pairing finished: trust the bond now
+    if (ble_auth_has_stored_key() && ble_auth_is_authenticated(conn_handle)) {
+        trust_peer(conn_handle);
+        return;
+    }
+
+    int i = list_find(&trusted, &addr);
+    if (i >= 0 && trusted.peers[i].ltk_crc == ltk_crc && ble_auth_has_stored_key()) {
+        ble_auth_resume(conn_handle);
+        ble_gatt_notify_auth_status();
+    }
+}
+
+void ble_bond_on_authenticated(uint16_t conn_handle) {
+    // First-pairing mode authenticates everyone; only a real key earns trust
+    if (!BLE_BOND_ENABLED || !ble_auth_has_stored_key()) {
+        return;
+    }
+    trust_peer(conn_handle);
+}
+
+int ble_bond_on_repeat_pairing(uint16_t conn_handle) {
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(conn_handle, &desc) == 0) {
+        ESP_LOGW(TAG, "Conn %d lost its bond, pairing again", conn_handle);
+        ble_store_util_delete_peer(&desc.peer_id_addr);
+    }
+    return BLE_GAP_REPEAT_PAIRING_RETRY;
+}
+
+esp_err_t ble_bond_forget_all(void) {
+    if (!BLE_BOND_ENABLED) {
+        return ESP_OK;
+    }
+
+    memset(&trusted, 0, sizeof(trusted));
+    memset(&sc_sent, 0, sizeof(sc_sent));
+    list_save(NVS_KEY_TRUSTED, &trusted);
+    list_save(NVS_KEY_SC_SENT, &sc_sent);
+
+    int rc = ble_store_clear();
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Failed to clear bonds: %d", rc);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "All bonds deleted");
+    return ESP_OK;
+}
@@ -0,0 +1,99 @@
+#ifndef BLE_BOND_H
+#define BLE_BOND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <sdkconfig.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ble_gatt_register_ctxt;
+
+// Bonded mode (Kconfig: MyHero BLE). Off, the link stays unencrypted and
+// every connection authenticates with the app key as before.
+#ifdef CONFIG_MYHERO_BLE_BONDING
+#define BLE_BOND_ENABLED    1
+#else
+#define BLE_BOND_ENABLED    0
+#endif
+
+// Bonded phones that can resume their app session without the key write
+#define BLE_BOND_MAX_PEERS  CONFIG_BT_NIMBLE_MAX_BONDS
+
+/**
+ * @brief Configure the security manager and bond store
+ *
+ * Call after nimble_port_init() and before the host starts. In bonded
+ * mode this sets up Just Works bonding with keys kept in NVS; otherwise
+ * pairing is disabled.
+ */
+void ble_bond_init(void);
+
+/**
+ * @brief Fold a registered service, characteristic or descriptor into the
+ *        GATT table fingerprint
+ *
+ * @param ctxt Registration context from the GATT register callback
+ */
+void ble_bond_gatt_register(const struct ble_gatt_register_ctxt *ctxt);
+
+/**
+ * @brief Compare the GATT table with the one bonded phones last saw
+ *
+ * Call from the host sync callback. If the table changed (new firmware),
+ * each bonded phone is sent Service Changed on its next encrypted
+ * connection so it drops its cached handles.
+ */
+void ble_bond_on_sync(void);
+
+/**
+ * @brief Ask a new connection to encrypt (bonded peer) or pair (new peer)
+ *
+ * @param conn_handle BLE connection handle
+ */
+void ble_bond_on_connect(uint16_t conn_handle);
+
+/**
+ * @brief Handle an encryption change
+ *
+ * Sends Service Changed if the phone's cached table is stale, and resumes
+ * the app session if this bond has presented the app key before.
+ *
+ * @param conn_handle BLE connection handle
+ * @param status 0 if the link is now encrypted
+ */
+void ble_bond_on_enc_change(uint16_t conn_handle, int status);
+
+/**
+ * @brief Remember a bond that has just presented the app key
+ *
+ * Its later connections resume the session as soon as they are encrypted.
+ *
+ * @param conn_handle BLE connection handle
+ */
+void ble_bond_on_authenticated(uint16_t conn_handle);
+
+/**
+ * @brief Handle a phone that lost its keys and wants to pair again
+ *
+ * @param conn_handle BLE connection handle
+ * @return Value for the GAP event callback (BLE_GAP_REPEAT_PAIRING_RETRY)
+ */
+int ble_bond_on_repeat_pairing(uint16_t conn_handle);
+
+/**
+ * @brief Delete every bond and resumable session (call when the app key
+ *        is cleared)
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t ble_bond_forget_all(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_BOND_H
@@ -0,0 +1,206 @@
+#include "ble_coc.h"
+#include "ble_auth.h"
+#include "ble_conn.h"
+#include "ble_transfer.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#include <host/ble_hs.h>
+#include <host/ble_l2cap.h>
+
+static const char *TAG = "BLE_COC";
+
+// SDU pool. Incoming SDUs are reassembled into a chain taken from the
+// same pool as the receive buffer, so the pool holds one full SDU each
+// for RX and TX per connection plus slack. Lives in PSRAM to keep
+// internal RAM free.
+#define COC_BLOCK_SIZE      512
+#define COC_BLOCK_COUNT     (BLE_MAX_CONNECTIONS * 2 * (BLE_COC_SDU_SIZE / (COC_BLOCK_SIZE - 32) + 1) + 4)
+
+static void *coc_mem = NULL;
+static struct os_mempool coc_mempool;
+static struct os_mbuf_pool coc_mbuf_pool;
+
+// Open channel per connection slot (one channel per connection)
+static struct {
+    struct ble_l2cap_chan *chan;
+    uint16_t tx_sdu_size;
+    bool rx_held;                   // Receive buffer not yet handed back
+} coc[BLE_MAX_CONNECTIONS];
+
+// ============ Internal Functions ============
+
+static struct ble_l2cap_chan *coc_chan(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    return (slot >= 0) ? coc[slot].chan : NULL;
+}
+
+// Hand the stack a fresh receive buffer; this also returns credits to the peer
+static int coc_recv_ready(struct ble_l2cap_chan *chan) {
+    struct os_mbuf *sdu_rx = ble_coc_alloc_sdu();
+    if (!sdu_rx) {
+        ESP_LOGE(TAG, "SDU pool exhausted");
+        return BLE_HS_ENOMEM;
+    }
+
+    int rc = ble_l2cap_recv_ready(chan, sdu_rx);
+    if (rc != 0) {
+        os_mbuf_free_chain(sdu_rx);
+    }
+    return rc;
+}
+
+static int coc_event_handler(struct ble_l2cap_event *event, void *arg) {
+    struct ble_l2cap_chan_info info;
+    bool held;
+    int slot;
+
+    switch (event->type) {
+    case BLE_L2CAP_EVENT_COC_ACCEPT:
+        // Same rule as every file characteristic: app-level auth first
+        if (!ble_auth_is_authenticated(event->accept.conn_handle)) {
+            ESP_LOGW(TAG, "CoC rejected - not authenticated");
+            return BLE_HS_EAUTHEN;
+        }
+        if (coc_chan(event->accept.conn_handle)) {
+            ESP_LOGW(TAG, "CoC rejected - channel already open");
+            return BLE_HS_EALREADY;
+        }
+        return coc_recv_ready(event->accept.chan);
+
+    case BLE_L2CAP_EVENT_COC_CONNECTED:
+        if (event->connect.status != 0) {
+            ESP_LOGW(TAG, "CoC connect failed; status=%d", event->connect.status);
+            break;
+        }
+
+        slot = ble_conn_slot(event->connect.conn_handle);
+        if (slot < 0) {
+            break;
+        }
+        coc[slot].chan = event->connect.chan;
+        coc[slot].tx_sdu_size = BLE_COC_SDU_SIZE;
+        coc[slot].rx_held = false;
+        if (ble_l2cap_get_chan_info(coc[slot].chan, &info) == 0) {
+            if (info.peer_coc_mtu < coc[slot].tx_sdu_size) {
+                coc[slot].tx_sdu_size = info.peer_coc_mtu;
+            }
+            ESP_LOGI(TAG, "CoC connected (conn %d): psm=0x%04x, our mtu=%d, peer mtu=%d, "
+                     "peer mps=%d", event->connect.conn_handle, info.psm, info.our_coc_mtu,
+                     info.peer_coc_mtu, info.peer_l2cap_mtu);
+        }
+        break;
+
+    case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+        ESP_LOGI(TAG, "CoC disconnected (conn %d)", event->disconnect.conn_handle);
+        slot = ble_conn_slot(event->disconnect.conn_handle);
+        if (slot >= 0) {
+            coc[slot].chan = NULL;
+            coc[slot].tx_sdu_size = 0;
+            coc[slot].rx_held = false;
+        }
+        ble_transfer_coc_closed(event->disconnect.conn_handle);
+        break;
+
+    case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+        held = false;
+        if (event->receive.sdu_rx) {
+            held = !ble_transfer_coc_receive(event->receive.conn_handle, event->receive.sdu_rx);
+            os_mbuf_free_chain(event->receive.sdu_rx);
+        }
+        // No receive buffer means no credits: the peer waits for ble_coc_rx_resume()
+        slot = ble_conn_slot(event->receive.conn_handle);
+        if (held && slot >= 0) {
+            coc[slot].rx_held = true;
+            break;
+        }
+        coc_recv_ready(event->receive.chan);
+        break;
+
+    case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+        ble_transfer_coc_tx_ready(event->tx_unstalled.conn_handle);
+        break;
+
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+// ============ Public Functions ============
+
+esp_err_t ble_coc_init(void) {
+    int rc;
+
+    if (coc_mem == NULL) {
+        coc_mem = heap_caps_malloc(OS_MEMPOOL_BYTES(COC_BLOCK_COUNT, COC_BLOCK_SIZE),
+                                   MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!coc_mem) {
+            ESP_LOGE(TAG, "Failed to allocate SDU pool");
+            return ESP_ERR_NO_MEM;
+        }
+
+        rc = os_mempool_init(&coc_mempool, COC_BLOCK_COUNT, COC_BLOCK_SIZE,
+                             coc_mem, "coc_sdu_pool");
+        if (rc != 0) {
+            ESP_LOGE(TAG, "Failed to init SDU mempool: %d", rc);
+            return ESP_FAIL;
+        }
+
+        rc = os_mbuf_pool_init(&coc_mbuf_pool, &coc_mempool, COC_BLOCK_SIZE,
+                               COC_BLOCK_COUNT);
+        if (rc != 0) {
+            ESP_LOGE(TAG, "Failed to init SDU mbuf pool: %d", rc);
+            return ESP_FAIL;
+        }
+    }
+
+    rc = ble_l2cap_create_server(BLE_COC_PSM, BLE_COC_SDU_SIZE, coc_event_handler, NULL);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Failed to create CoC server: %d", rc);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "CoC server on PSM 0x%04x (SDU %d bytes, %d x %d byte PSRAM blocks)",
+             BLE_COC_PSM, BLE_COC_SDU_SIZE, COC_BLOCK_COUNT, COC_BLOCK_SIZE);
+    return ESP_OK;
+}
+
+bool ble_coc_is_connected(uint16_t conn_handle) {
+    return coc_chan(conn_handle) != NULL;
+}
+
+uint16_t ble_coc_tx_sdu_size(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    return (slot >= 0) ? coc[slot].tx_sdu_size : 0;
+}
+
+struct os_mbuf *ble_coc_alloc_sdu(void) {
+    return os_mbuf_get_pkthdr(&coc_mbuf_pool, 0);
+}
+
+int ble_coc_send(uint16_t conn_handle, struct os_mbuf *sdu) {
+    struct ble_l2cap_chan *chan = coc_chan(conn_handle);
+    if (!chan) {
+        os_mbuf_free_chain(sdu);
+        return BLE_HS_ENOTCONN;
+    }
+
+    int rc = ble_l2cap_send(chan, sdu);
+    if (rc != 0 && rc != BLE_HS_ESTALLED) {
+        // Not queued; the stack did not take ownership
+        os_mbuf_free_chain(sdu);
+    }
+    return rc;
+}
+
+void ble_coc_rx_resume(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot < 0 || !coc[slot].rx_held || !coc[slot].chan) {
+        return;
+    }
+    coc[slot].rx_held = false;
+    coc_recv_ready(coc[slot].chan);
+}
@@ -0,0 +1,76 @@
+#ifndef BLE_COC_H
+#define BLE_COC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct os_mbuf;
+
+// L2CAP connection-oriented channel for bulk file data.
+// LE dynamic PSM range is 0x0080-0x00FF.
+#define BLE_COC_PSM         0x0080
+
+// Largest SDU we accept (and send, if the peer accepts it too)
+#define BLE_COC_SDU_SIZE    4096
+
+/**
+ * @brief Allocate the PSRAM SDU pool and register the CoC server
+ *
+ * Must be called after nimble_port_init() and before the host task starts.
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t ble_coc_init(void);
+
+/**
+ * @brief Check if a connection has an open CoC channel
+ *
+ * @param conn_handle BLE connection handle
+ */
+bool ble_coc_is_connected(uint16_t conn_handle);
+
+/**
+ * @brief Largest SDU that can be sent on a connection's channel
+ *
+ * @param conn_handle BLE connection handle
+ * @return SDU size in bytes, or 0 if no channel is open
+ */
+uint16_t ble_coc_tx_sdu_size(uint16_t conn_handle);
+
+/**
+ * @brief Allocate an empty SDU from the PSRAM pool (shared by all connections)
+ *
+ * @return Packet header mbuf, or NULL if the pool is exhausted
+ */
+struct os_mbuf *ble_coc_alloc_sdu(void);
+
+/**
+ * @brief Send an SDU on a connection's channel
+ *
+ * The SDU is consumed in all cases. BLE_HS_ESTALLED means the SDU was
+ * queued but the peer has run out of credits; wait for
+ * ble_transfer_coc_tx_ready() before sending the next one.
+ *
+ * @param conn_handle BLE connection handle
+ * @param sdu SDU from ble_coc_alloc_sdu()
+ * @return 0, BLE_HS_ESTALLED, or a NimBLE error code
+ */
+int ble_coc_send(uint16_t conn_handle, struct os_mbuf *sdu);
+
+/**
+ * @brief Give the peer credits held back by ble_transfer_coc_receive()
+ *
+ * @param conn_handle BLE connection handle
+ */
+void ble_coc_rx_resume(uint16_t conn_handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_COC_H
@@ -0,0 +1,288 @@
+#include "ble_compress.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+#define WINDOW_SIZE  (1 << BLE_COMPRESS_WINDOW_BITS)
+#define WINDOW_MASK  (WINDOW_SIZE - 1)
+#define MIN_MATCH    3
+#define MAX_MATCH    (MIN_MATCH + 15)
+
+// Encoder keeps one window of history plus one window of lookahead
+#define ENC_BUF_SIZE (2 * WINDOW_SIZE)
+#define HASH_BITS    12
+#define HASH_SIZE    (1 << HASH_BITS)
+
+// One flag byte + 8 items of up to 2 bytes
+#define GROUP_MAX    (1 + 8 * 2)
+
+// Decoder output batch size
+#define DEC_OUT_SIZE 512
+
+struct ble_compress_enc {
+    uint8_t buf[ENC_BUF_SIZE];
+    int16_t head[HASH_SIZE];  // Last position of each 3-byte hash, -1 if none
+    size_t fill;              // Valid bytes in buf
+    size_t pos;               // Next byte to encode
+    bool finishing;
+    uint8_t group[GROUP_MAX];
+    size_t group_len;         // Bytes in group including flag byte
+    uint8_t group_items;
+    bool group_closed;        // Group complete, being emitted
+    size_t group_sent;
+};
+
+struct ble_compress_dec {
+    uint8_t window[WINDOW_SIZE];
+    size_t wpos;
+    uint32_t produced;
+    uint8_t flags;
+    uint8_t flag_bits;        // Items left in current group
+    bool have_lo;             // First byte of a match seen
+    uint8_t lo;
+    uint8_t out[DEC_OUT_SIZE];
+    size_t out_len;
+};
+
+// PSRAM when the device has it; plain heap otherwise (and on a host build)
+static void *alloc_psram(size_t size) {
+#ifdef ESP_PLATFORM
+    void *p = heap_caps_calloc(1, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (p) {
+        return p;
+    }
+#endif
+    return calloc(1, size);
+}
+
+bool ble_compress_is_precompressed(const char *filename) {
+    static const char *const exts[] = { ".aac", ".mp3" };
+
+    const char *ext = filename ? strrchr(filename, '.') : NULL;
+    if (!ext) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+        if (strcasecmp(ext, exts[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// ============ Encoder ============
+
+static inline uint32_t hash3(const uint8_t *p) {
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void group_reset(ble_compress_enc_t *enc) {
+    enc->group[0] = 0;
+    enc->group_len = 1;
+    enc->group_items = 0;
+    enc->group_closed = false;
+    enc->group_sent = 0;
+}
+
+ble_compress_enc_t *ble_compress_enc_create(void) {
+    ble_compress_enc_t *enc = alloc_psram(sizeof(*enc));
+    if (!enc) {
+        return NULL;
+    }
+    memset(enc->head, 0xFF, sizeof(enc->head));
+    group_reset(enc);
+    return enc;
+}
+
+void ble_compress_enc_destroy(ble_compress_enc_t *enc) {
+    free(enc);
+}
+
+uint8_t *ble_compress_enc_input(ble_compress_enc_t *enc, size_t *space) {
+    // Slide so exactly one window of history stays behind pos
+    if (ENC_BUF_SIZE - enc->fill < WINDOW_SIZE / 2 && enc->pos > WINDOW_SIZE) {
+        size_t shift = enc->pos - WINDOW_SIZE;
+        memmove(enc->buf, enc->buf + shift, enc->fill - shift);
+        enc->fill -= shift;
+        enc->pos -= shift;
+        for (int i = 0; i < HASH_SIZE; i++) {
+            int h = enc->head[i] - (int)shift;
+            enc->head[i] = (h < 0) ? -1 : (int16_t)h;
+        }
+    }
+
+    *space = ENC_BUF_SIZE - enc->fill;
+    return enc->buf + enc->fill;
+}
+
+void ble_compress_enc_commit(ble_compress_enc_t *enc, size_t len) {
+    enc->fill += len;
+}
+
+void ble_compress_enc_finish(ble_compress_enc_t *enc) {
+    enc->finishing = true;
+}
+
+static void encode_item(ble_compress_enc_t *enc) {
+    size_t avail = enc->fill - enc->pos;
+    size_t best_len = 0;
+    size_t best_off = 0;
+
+    if (avail >= MIN_MATCH) {
+        uint32_t h = hash3(&enc->buf[enc->pos]);
+        int cand = enc->head[h];
+        enc->head[h] = (int16_t)enc->pos;
+
+        if (cand >= 0) {
+            size_t off = enc->pos - (size_t)cand;
+            if (off > 0 && off < WINDOW_SIZE) {
+                size_t max = avail < MAX_MATCH ? avail : MAX_MATCH;
+                size_t len = 0;
+                while (len < max && enc->buf[cand + len] == enc->buf[enc->pos + len]) {
+                    len++;
+                }
+                if (len >= MIN_MATCH) {
+                    best_len = len;
+                    best_off = off;
+                }
+            }
+        }
+    }
+
+    if (best_len > 0) {
+        enc->group[0] |= (uint8_t)(1 << enc->group_items);
+        enc->group[enc->group_len++] = best_off & 0xFF;
+        enc->group[enc->group_len++] = (uint8_t)(((best_off >> 8) << 4) | (best_len - MIN_MATCH));
+
+        // Index the positions covered by the match
+        for (size_t i = 1; i < best_len; i++) {
+            size_t p = enc->pos + i;
+            if (p + MIN_MATCH <= enc->fill) {
+                enc->head[hash3(&enc->buf[p])] = (int16_t)p;
+            }
+        }
+        enc->pos += best_len;
+    } else {
+        enc->group[enc->group_len++] = enc->buf[enc->pos++];
+    }
+
+    enc->group_items++;
+}
+
+size_t ble_compress_enc_poll(ble_compress_enc_t *enc, uint8_t *out, size_t cap) {
+    size_t out_len = 0;
+
+    while (out_len < cap) {
+        if (enc->group_closed) {
+            size_t n = enc->group_len - enc->group_sent;
+            if (n > cap - out_len) {
+                n = cap - out_len;
+            }
+            memcpy(out + out_len, enc->group + enc->group_sent, n);
+            enc->group_sent += n;
+            out_len += n;
+            if (enc->group_sent == enc->group_len) {
+                group_reset(enc);
+            }
+            continue;
+        }
+
+        size_t avail = enc->fill - enc->pos;
+        if (avail == 0 || (avail < MAX_MATCH && !enc->finishing)) {
+            if (enc->finishing && avail == 0 && enc->group_items > 0) {
+                enc->group_closed = true;
+                continue;
+            }
+            break;
+        }
+
+        encode_item(enc);
+        if (enc->group_items == 8) {
+            enc->group_closed = true;
+        }
+    }
+
+    return out_len;
+}
+
+bool ble_compress_enc_is_done(const ble_compress_enc_t *enc) {
+    return enc->finishing && enc->pos == enc->fill &&
+           enc->group_items == 0 && !enc->group_closed;
+}
+
+// ============ Decoder ============
+
+ble_compress_dec_t *ble_compress_dec_create(void) {
+    return alloc_psram(sizeof(ble_compress_dec_t));
+}
+
+void ble_compress_dec_destroy(ble_compress_dec_t *dec) {
+    free(dec);
+}
+
+static inline int dec_emit(ble_compress_dec_t *dec, uint8_t c,
+                           ble_compress_write_fn write, void *arg) {
+    dec->window[dec->wpos] = c;
+    dec->wpos = (dec->wpos + 1) & WINDOW_MASK;
+    dec->produced++;
+
+    dec->out[dec->out_len++] = c;
+    if (dec->out_len == DEC_OUT_SIZE) {
+        dec->out_len = 0;
+        if (write(dec->out, DEC_OUT_SIZE, arg) != 0) {
+            return BLE_COMPRESS_ERR_WRITE;
+        }
+    }
+    return BLE_COMPRESS_OK;
+}
+
+int ble_compress_dec_feed(ble_compress_dec_t *dec, const uint8_t *in, size_t len,
+                          ble_compress_write_fn write, void *arg) {
+    int err = BLE_COMPRESS_OK;
+
+    for (size_t i = 0; i < len && err == BLE_COMPRESS_OK; i++) {
+        uint8_t b = in[i];
+
+        if (dec->flag_bits == 0) {
+            dec->flags = b;
+            dec->flag_bits = 8;
+            continue;
+        }
+
+        if (dec->flags & 1) {
+            if (!dec->have_lo) {
+                dec->lo = b;
+                dec->have_lo = true;
+                continue;
+            }
+            dec->have_lo = false;
+
+            size_t off = dec->lo | ((size_t)(b >> 4) << 8);
+            size_t mlen = (b & 0x0F) + MIN_MATCH;
+            if (off == 0 || off > dec->produced) {
+                return BLE_COMPRESS_ERR_CORRUPT;
+            }
+            for (size_t k = 0; k < mlen && err == BLE_COMPRESS_OK; k++) {
+                err = dec_emit(dec, dec->window[(dec->wpos - off) & WINDOW_MASK], write, arg);
+            }
+        } else {
+            err = dec_emit(dec, b, write, arg);
+        }
+
+        dec->flags >>= 1;
+        dec->flag_bits--;
+    }
+
+    if (err == BLE_COMPRESS_OK && dec->out_len > 0) {
+        if (write(dec->out, dec->out_len, arg) != 0) {
+            err = BLE_COMPRESS_ERR_WRITE;
+        }
+        dec->out_len = 0;
+    }
+    return err;
+}
@@ -0,0 +1,123 @@
+#ifndef BLE_COMPRESS_H
+#define BLE_COMPRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Streaming LZSS codec for BLE transfers.
+//
+// Stream format: a flag byte followed by up to 8 items, LSB-first.
+// Flag bit 0 = literal (1 byte), 1 = match (2 bytes):
+//   [offset_lo:8][offset_hi:4 | (length - 3):4]
+// offset is 1..4095 bytes back, length is 3..18 bytes.
+// Both sides keep a 4 KB window; encoder and decoder state live in PSRAM.
+// Plain C apart from that allocation, so the codec also builds for a Linux
+// host (test/host).
+#define BLE_COMPRESS_WINDOW_BITS 12
+
+// Decoder results
+#define BLE_COMPRESS_OK          0
+#define BLE_COMPRESS_ERR_CORRUPT (-1)  // Match reaches before the start of the output
+#define BLE_COMPRESS_ERR_WRITE   (-2)  // Output sink failed
+
+typedef struct ble_compress_enc ble_compress_enc_t;
+typedef struct ble_compress_dec ble_compress_dec_t;
+
+// Decoder output sink; return 0 to continue, anything else aborts decoding
+typedef int (*ble_compress_write_fn)(const uint8_t *data, size_t len, void *arg);
+
+/**
+ * @brief Check whether a file is already compressed (e.g. .aac)
+ *
+ * @param filename File name or path
+ * @return true if compression should be skipped
+ */
+bool ble_compress_is_precompressed(const char *filename);
+
+/**
+ * @brief Create a streaming encoder
+ *
+ * @return Encoder, or NULL if out of memory
+ */
+ble_compress_enc_t *ble_compress_enc_create(void);
+
+/**
+ * @brief Free an encoder
+ */
+void ble_compress_enc_destroy(ble_compress_enc_t *enc);
+
+/**
+ * @brief Get the encoder input buffer
+ *
+ * Callers read file data directly into the returned buffer and then
+ * call ble_compress_enc_commit(). Only valid after poll returned 0.
+ *
+ * @param enc Encoder
+ * @param[out] space Free bytes at the returned pointer
+ * @return Pointer to free input space
+ */
+uint8_t *ble_compress_enc_input(ble_compress_enc_t *enc, size_t *space);
+
+/**
+ * @brief Commit bytes written into the input buffer
+ */
+void ble_compress_enc_commit(ble_compress_enc_t *enc, size_t len);
+
+/**
+ * @brief Mark end of input; remaining data is flushed by poll
+ */
+void ble_compress_enc_finish(ble_compress_enc_t *enc);
+
+/**
+ * @brief Produce compressed output
+ *
+ * @param enc Encoder
+ * @param out Output buffer
+ * @param cap Output buffer size
+ * @return Bytes written to out; 0 means more input (or finish) is needed
+ */
+size_t ble_compress_enc_poll(ble_compress_enc_t *enc, uint8_t *out, size_t cap);
+
+/**
+ * @brief Check if all input has been encoded and emitted
+ */
+bool ble_compress_enc_is_done(const ble_compress_enc_t *enc);
+
+/**
+ * @brief Create a streaming decoder
+ *
+ * @return Decoder, or NULL if out of memory
+ */
+ble_compress_dec_t *ble_compress_dec_create(void);
+
+/**
+ * @brief Free a decoder
+ */
+void ble_compress_dec_destroy(ble_compress_dec_t *dec);
+
+/**
+ * @brief Decode a block of compressed input
+ *
+ * Items may be split across calls. Decoded bytes are passed to write
+ * in batches before this function returns.
+ *
+ * @param dec Decoder
+ * @param in Compressed data
+ * @param len Length of compressed data
+ * @param write Output sink
+ * @param arg Sink argument
+ * @return BLE_COMPRESS_OK or a BLE_COMPRESS_ERR_* code
+ */
+int ble_compress_dec_feed(ble_compress_dec_t *dec, const uint8_t *in, size_t len,
+                          ble_compress_write_fn write, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_COMPRESS_H
@@ -0,0 +1,105 @@
+#include "ble_conn.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <host/ble_hs.h>
+
+static const char *TAG = "BLE_CONN";
+
+// Written on the host task only; other tasks read single handles
+static uint16_t slots[BLE_MAX_CONNECTIONS] = {
+    [0 ... BLE_MAX_CONNECTIONS - 1] = BLE_HS_CONN_HANDLE_NONE,
+};
+
+// Reconnect-to-first-command timing
+static int64_t connected_us[BLE_MAX_CONNECTIONS];
+static bool first_cmd_seen[BLE_MAX_CONNECTIONS];
+
+// ============ Public Functions ============
+
+int ble_conn_add(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot >= 0) {
+        return slot;
+    }
+
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (slots[i] == BLE_HS_CONN_HANDLE_NONE) {
+            slots[i] = conn_handle;
+            connected_us[i] = esp_timer_get_time();
+            first_cmd_seen[i] = false;
+            ESP_LOGI(TAG, "Connection %d in slot %d (%d of %d)",
+                     conn_handle, i, ble_conn_count(), BLE_MAX_CONNECTIONS);
+            return i;
+        }
+    }
+
+    ESP_LOGW(TAG, "No free slot for connection %d", conn_handle);
+    return -1;
+}
+
+void ble_conn_remove(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot >= 0) {
+        slots[slot] = BLE_HS_CONN_HANDLE_NONE;
+    }
+}
+
+int ble_conn_slot(uint16_t conn_handle) {
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return -1;
+    }
+
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (slots[i] == conn_handle) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint16_t ble_conn_handle(int slot) {
+    if (slot < 0 || slot >= BLE_MAX_CONNECTIONS) {
+        return BLE_HS_CONN_HANDLE_NONE;
+    }
+    return slots[slot];
+}
+
+uint32_t ble_conn_age_ms(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot < 0) {
+        return 0;
+    }
+    return (uint32_t)((esp_timer_get_time() - connected_us[slot]) / 1000);
+}
+
+void ble_conn_note_command(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot < 0 || first_cmd_seen[slot]) {
+        return;
+    }
+    first_cmd_seen[slot] = true;
+
+    int64_t ms = (esp_timer_get_time() - connected_us[slot]) / 1000;
+
+    struct ble_gap_conn_desc desc;
+    bool encrypted = false;
+    bool bonded = false;
+    if (ble_gap_conn_find(conn_handle, &desc) == 0) {
+        encrypted = desc.sec_state.encrypted;
+        bonded = desc.sec_state.bonded;
+    }
+
+    ESP_LOGI(TAG, "Conn %d: first command %lld ms after connect (%s)", conn_handle,
+             (long long)ms, bonded ? "bonded" : (encrypted ? "encrypted" : "open"));
+}
+
+int ble_conn_count(void) {
+    int count = 0;
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (slots[i] != BLE_HS_CONN_HANDLE_NONE) {
+            count++;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,80 @@
+#ifndef BLE_CONN_H
+#define BLE_CONN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sdkconfig.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Simultaneous app connections (Kconfig: MyHero BLE)
+#define BLE_MAX_CONNECTIONS     CONFIG_MYHERO_BLE_MAX_CONNECTIONS
+
+// Connection registry. Every module that keeps per-connection state
+// (auth, link, CoC, transfer, file batches) indexes its own array by the
+// slot handed out here, so a slot means the same peer everywhere.
+
+/**
+ * @brief Claim a slot for a new connection
+ *
+ * @param conn_handle BLE connection handle
+ * @return Slot index, or -1 if every slot is taken
+ */
+int ble_conn_add(uint16_t conn_handle);
+
+/**
+ * @brief Release a connection's slot
+ *
+ * Call after the per-connection disconnect hooks, which still look the
+ * slot up.
+ *
+ * @param conn_handle BLE connection handle
+ */
+void ble_conn_remove(uint16_t conn_handle);
+
+/**
+ * @brief Find the slot of a connection
+ *
+ * @param conn_handle BLE connection handle
+ * @return Slot index, or -1 if the handle is not an open connection
+ */
+int ble_conn_slot(uint16_t conn_handle);
+
+/**
+ * @brief Get the connection in a slot
+ *
+ * @param slot Slot index
+ * @return Connection handle, or BLE_HS_CONN_HANDLE_NONE if the slot is free
+ */
+uint16_t ble_conn_handle(int slot);
+
+/**
+ * @brief Time since a connection opened
+ *
+ * @param conn_handle BLE connection handle
+ * @return Milliseconds since connect, 0 if the handle is not open
+ */
+uint32_t ble_conn_age_ms(uint16_t conn_handle);
+
+/**
+ * @brief Note a GATT request from a connection
+ *
+ * The first one is logged with the time since connect, the latency a
+ * reconnecting phone actually sees.
+ *
+ * @param conn_handle BLE connection handle
+ */
+void ble_conn_note_command(uint16_t conn_handle);
+
+/**
+ * @brief Number of open connections
+ */
+int ble_conn_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_CONN_H
@@ -0,0 +1,230 @@
+#include "ble_delta.h"
+#include "ble_le.h"
+
+#include <string.h>
+
+// ============ Internal Functions ============
+
+static size_t op_args_size(uint8_t op) {
+    switch (op) {
+    case BLE_DELTA_OP_COPY:
+    case BLE_DELTA_OP_ADD:
+        return 8;
+    case BLE_DELTA_OP_INSERT:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+// Arguments complete: check the op against both images
+static int op_start(ble_delta_t *d) {
+    if (d->op == BLE_DELTA_OP_INSERT) {
+        d->remaining = get_le32(&d->op_args[0]);
+    } else {
+        d->src_offset = get_le32(&d->op_args[0]);
+        d->remaining = get_le32(&d->op_args[4]);
+        if (d->src_offset > d->source_size ||
+            d->remaining > d->source_size - d->src_offset) {
+            return BLE_DELTA_ERR_FORMAT;
+        }
+    }
+    if (d->remaining > d->target_size - d->produced) {
+        return BLE_DELTA_ERR_FORMAT;
+    }
+    return BLE_DELTA_OK;
+}
+
+static bool budget_spent(const ble_delta_t *d) {
+    return d->budget && d->spent >= d->budget;
+}
+
+// Source bytes straight to the output, a window at a time, until the op
+// is done or the budget is spent
+static int op_copy(ble_delta_t *d) {
+    while (d->remaining > 0 && !budget_spent(d)) {
+        size_t n = d->remaining < d->window_size ? d->remaining : d->window_size;
+        if (d->read(d->src_offset, d->window, n, d->arg) != 0) {
+            return BLE_DELTA_ERR_SOURCE;
+        }
+        if (d->write(d->window, n, d->arg) != 0) {
+            return BLE_DELTA_ERR_WRITE;
+        }
+        d->src_offset += n;
+        d->remaining -= n;
+        d->produced += n;
+        d->spent += n;
+    }
+    return BLE_DELTA_OK;
+}
+
+// Apply as much of the ADD diff as this piece of the patch holds, until
+// the budget is spent. Returns the diff bytes applied, or an error.
+static int op_add(ble_delta_t *d, const uint8_t *diff, size_t len, size_t *applied) {
+    *applied = 0;
+    while (len > 0 && !budget_spent(d)) {
+        size_t n = len < d->window_size ? len : d->window_size;
+        if (d->read(d->src_offset, d->window, n, d->arg) != 0) {
+            return BLE_DELTA_ERR_SOURCE;
+        }
+        for (size_t i = 0; i < n; i++) {
+            d->window[i] += diff[i];
+        }
+        if (d->write(d->window, n, d->arg) != 0) {
+            return BLE_DELTA_ERR_WRITE;
+        }
+        diff += n;
+        len -= n;
+        *applied += n;
+        d->src_offset += n;
+        d->remaining -= n;
+        d->produced += n;
+        d->spent += n;
+    }
+    return BLE_DELTA_OK;
+}
+
+// ============ Public Functions ============
+
+void ble_delta_init(ble_delta_t *d, uint8_t *window, size_t window_size,
+                    ble_delta_read_fn read, ble_delta_write_fn write, void *arg) {
+    memset(d, 0, sizeof(*d));
+    d->window = window;
+    d->window_size = window_size;
+    d->read = read;
+    d->write = write;
+    d->arg = arg;
+}
+
+void ble_delta_set_budget(ble_delta_t *d, size_t budget) {
+    d->budget = budget;
+}
+
+int ble_delta_feed(ble_delta_t *d, const uint8_t *data, size_t len, size_t *used) {
+    const uint8_t *start = data;
+    int rc = BLE_DELTA_OK;
+
+    d->spent = 0;
+
+    while (!budget_spent(d)) {
+        // COPY needs no patch bytes once its arguments are in
+        if (ble_delta_pending(d)) {
+            rc = op_copy(d);
+            if (rc != BLE_DELTA_OK) {
+                break;
+            }
+            if (d->remaining == 0) {
+                d->op = 0;
+            }
+            continue;
+        }
+        if (len == 0) {
+            break;
+        }
+
+        // Header
+        if (d->header_len < BLE_DELTA_HEADER_LEN) {
+            size_t n = BLE_DELTA_HEADER_LEN - d->header_len;
+            if (n > len) {
+                n = len;
+            }
+            memcpy(&d->header[d->header_len], data, n);
+            d->header_len += n;
+            data += n;
+            len -= n;
+
+            if (d->header_len == BLE_DELTA_HEADER_LEN) {
+                if (memcmp(d->header, BLE_DELTA_MAGIC, 4) != 0) {
+                    rc = BLE_DELTA_ERR_FORMAT;
+                    break;
+                }
+                d->source_size = get_le32(&d->header[4]);
+                d->source_sha256 = &d->header[8];
+                d->target_size = get_le32(&d->header[8 + BLE_DELTA_SHA256_SIZE]);
+                d->target_sha256 = &d->header[12 + BLE_DELTA_SHA256_SIZE];
+            }
+            continue;
+        }
+
+        // Op code
+        if (d->op == 0) {
+            if (d->produced == d->target_size) {
+                rc = BLE_DELTA_ERR_FORMAT;  // Trailing bytes
+                break;
+            }
+            d->op = *data++;
+            len--;
+            d->op_args_len = 0;
+            if (op_args_size(d->op) == 0) {
+                rc = BLE_DELTA_ERR_FORMAT;
+                break;
+            }
+            continue;
+        }
+
+        // Op arguments
+        size_t args_size = op_args_size(d->op);
+        if (d->op_args_len < args_size) {
+            size_t n = args_size - d->op_args_len;
+            if (n > len) {
+                n = len;
+            }
+            memcpy(&d->op_args[d->op_args_len], data, n);
+            d->op_args_len += n;
+            data += n;
+            len -= n;
+
+            if (d->op_args_len < args_size) {
+                continue;
+            }
+            rc = op_start(d);
+            if (rc != BLE_DELTA_OK) {
+                break;
+            }
+            if (d->remaining == 0) {
+                d->op = 0;
+            }
+            continue;
+        }
+
+        // Op data
+        size_t n = d->remaining < len ? d->remaining : len;
+        if (d->op == BLE_DELTA_OP_ADD) {
+            rc = op_add(d, data, n, &n);
+            if (rc != BLE_DELTA_OK) {
+                break;
+            }
+        } else {
+            if (d->write(data, n, d->arg) != 0) {
+                rc = BLE_DELTA_ERR_WRITE;
+                break;
+            }
+            d->remaining -= n;
+            d->produced += n;
+        }
+        data += n;
+        len -= n;
+        if (d->remaining == 0) {
+            d->op = 0;
+        }
+    }
+
+    *used = data - start;
+    return rc;
+}
+
+bool ble_delta_pending(const ble_delta_t *d) {
+    return d->op == BLE_DELTA_OP_COPY && d->op_args_len == op_args_size(d->op) &&
+           d->remaining > 0;
+}
+
+bool ble_delta_header_ready(const ble_delta_t *d) {
+    return d->header_len == BLE_DELTA_HEADER_LEN;
+}
+
+int ble_delta_finish(const ble_delta_t *d) {
+    if (!ble_delta_header_ready(d) || d->op != 0 || d->produced != d->target_size) {
+        return BLE_DELTA_ERR_SHORT;
+    }
+    return BLE_DELTA_OK;
+}
@@ -0,0 +1,140 @@
+#ifndef BLE_DELTA_H
+#define BLE_DELTA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Delta firmware patch decoder. Rebuilds the new image from the running
+// one and a patch made by scripts/make_delta.py, as the patch streams in.
+// Plain C with no ESP-IDF or NimBLE calls, so it also builds for a Linux
+// host; source reads and output writes go through callbacks. A work
+// budget bounds the source reads and target writes of one feed, so a
+// short patch piece full of long COPYs can't hold the caller for seconds.
+//
+// Patch format (little-endian):
+//   Header: ["MHD1"][source_size:4][source_sha256:32][target_size:4][target_sha256:32]
+//   Ops, until target_size bytes have been produced:
+//     COPY   [0x01][src_offset:4][len:4]              target += source[off..off+len)
+//     ADD    [0x02][src_offset:4][len:4][diff:len]    target += source[off+i] + diff[i]
+//     INSERT [0x03][len:4][data:len]                  target += data
+
+#define BLE_DELTA_MAGIC          "MHD1"
+#define BLE_DELTA_SHA256_SIZE    32
+#define BLE_DELTA_HEADER_LEN     (4 + 4 + BLE_DELTA_SHA256_SIZE + 4 + BLE_DELTA_SHA256_SIZE)
+
+#define BLE_DELTA_OP_COPY        0x01
+#define BLE_DELTA_OP_ADD         0x02
+#define BLE_DELTA_OP_INSERT      0x03
+
+// Results
+#define BLE_DELTA_OK             0
+#define BLE_DELTA_ERR_FORMAT     (-1)  // Bad magic, unknown op, or op past the image ends
+#define BLE_DELTA_ERR_SOURCE     (-2)  // Source read failed
+#define BLE_DELTA_ERR_WRITE      (-3)  // Output write failed
+#define BLE_DELTA_ERR_SHORT      (-4)  // Patch ended before the target was complete
+
+// Read len bytes of the source image at offset; 0 on success
+typedef int (*ble_delta_read_fn)(uint32_t offset, uint8_t *buf, size_t len, void *arg);
+
+// Take the next len bytes of the target image; 0 on success
+typedef int (*ble_delta_write_fn)(const uint8_t *data, size_t len, void *arg);
+
+typedef struct {
+    // Header, collected across feeds
+    uint8_t header[BLE_DELTA_HEADER_LEN];
+    size_t header_len;
+    uint32_t source_size;
+    uint32_t target_size;
+    const uint8_t *source_sha256;    // Into header
+    const uint8_t *target_sha256;
+
+    // Op being decoded
+    uint8_t op;
+    uint8_t op_args[8];
+    size_t op_args_len;
+    uint32_t src_offset;             // Next source byte for COPY/ADD
+    uint32_t remaining;              // Target bytes left in this op
+
+    uint32_t produced;               // Target bytes written so far
+
+    size_t budget;                   // COPY/ADD bytes per feed (0: no limit)
+    size_t spent;                    // Used in the current feed
+
+    // Working window (PSRAM on the device): source bytes are read into it
+    // and the target is built in place
+    uint8_t *window;
+    size_t window_size;
+
+    ble_delta_read_fn read;
+    ble_delta_write_fn write;
+    void *arg;
+} ble_delta_t;
+
+/**
+ * @brief Start decoding a patch
+ *
+ * @param d Decoder state
+ * @param window Work buffer; bigger means fewer source reads and writes
+ * @param window_size Work buffer size
+ * @param read Source reader
+ * @param write Target writer
+ * @param arg Passed to read and write
+ */
+void ble_delta_init(ble_delta_t *d, uint8_t *window, size_t window_size,
+                    ble_delta_read_fn read, ble_delta_write_fn write, void *arg);
+
+/**
+ * @brief Limit the work of each ble_delta_feed() call
+ *
+ * COPY and ADD stop once they have rebuilt about this many target bytes
+ * in one call (at most one window more) and continue in the next call.
+ *
+ * @param d Decoder state
+ * @param budget Target bytes per call, 0 for no limit (the default)
+ */
+void ble_delta_set_budget(ble_delta_t *d, size_t budget);
+
+/**
+ * @brief Decode the next piece of the patch
+ *
+ * Any split of the patch into pieces gives the same output. When the work
+ * budget runs out, decoding stops early: pass data + *used again later
+ * (len 0 just continues a COPY, see ble_delta_pending()).
+ *
+ * @param d Decoder state
+ * @param data Patch bytes
+ * @param len Length
+ * @param[out] used Patch bytes consumed
+ * @return BLE_DELTA_OK or a BLE_DELTA_ERR_* code
+ */
+int ble_delta_feed(ble_delta_t *d, const uint8_t *data, size_t len, size_t *used);
+
+/**
+ * @brief Whether a COPY stopped by the budget still has output to write
+ *
+ * That work needs no more patch bytes; ble_delta_feed() continues it.
+ */
+bool ble_delta_pending(const ble_delta_t *d);
+
+/**
+ * @brief Whether the header has been decoded (source/target fields valid)
+ */
+bool ble_delta_header_ready(const ble_delta_t *d);
+
+/**
+ * @brief Check that the patch produced the whole target
+ *
+ * @return BLE_DELTA_OK, or BLE_DELTA_ERR_SHORT
+ */
+int ble_delta_finish(const ble_delta_t *d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_DELTA_H
@@ -0,0 +1,587 @@
+#include "ble_file_list.h"
+#include "ble_uuids.h"
+#include "ble_xfer_proto.h"
+#include "ble_conn.h"
+#include "ble_notify.h"
+#include "ble_le.h"
+#include "../Storage/storage.h"
+#include "../Storage/storage_journal.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include <host/ble_hs.h>
+
+static const char *TAG = "BLE_FILE_LIST";
+
+// Largest ATT payload at our preferred MTU of 512
+#define FILE_LIST_BUF_SIZE      509
+
+// Initial capacity of the listing snapshot buffers (grown by doubling)
+#define FILE_LIST_INIT_ENTRIES  64
+#define FILE_LIST_INIT_POOL     2048
+
+// Producer task
+#define FILE_LIST_TASK_STACK    4096
+#define FILE_LIST_TASK_PRIO     5
+#define FILE_LIST_QUEUE_LEN     4
+
+// Flow control: listings are bulk notifications, which the notify
+// manager holds back while control messages wait or its pool runs low
+#define FILE_LIST_RETRY_MS       10
+// Give up when no notification could be queued for this long
+#define FILE_LIST_STALL_MS       5000
+
+// One entry of a listing snapshot. name_off indexes the name pool while
+// it is still growing; name is set once the pool stops moving.
+typedef struct {
+    size_t name_off;
+    const char *name;
+    uint32_t size;
+    int number;
+    uint8_t type;                // BLE_FILE_TYPE_* or BLE_FILE_CHANGE_*
+} list_entry_t;
+
+typedef struct {
+    list_entry_t *entries;
+    int count;
+    int capacity;
+    char *pool;
+    size_t pool_len;
+    size_t pool_capacity;
+    bool failed;                 // Out of memory
+} list_snap_t;
+
+// One queued reply, snapshotted when the request arrives and sent by the
+// producer task
+typedef struct {
+    int slot;                    // Connection slot, for cancel_seq
+    uint32_t cancel_seq;         // cancel_seq[slot] when queued
+    uint16_t conn_handle;
+    uint16_t attr_handle;        // Entries and end entry
+    uint16_t hdr_handle;         // File Changes header, if hdr_len
+    uint8_t hdr[BLE_FILE_CHANGES_HDR_LEN];
+    size_t hdr_len;
+    bool has_list;               // Entries and end entry follow the header
+    bool packed;
+    bool ext_end;                // Extended end entry
+    bool desc;
+    int first;                   // Page of snap to send
+    int end;
+    int total;                   // Value of the end entry's total field
+    uint32_t epoch;
+    uint32_t generation;
+    uint16_t start;              // Request, for the log
+    uint8_t sort;
+    list_snap_t snap;
+} list_job_t;
+
+// Notification being filled
+typedef struct {
+    const list_job_t *job;
+    uint16_t attr_handle;
+    size_t payload;              // Max bytes per notification
+    size_t len;
+    int entries;                 // Entries sent
+    uint32_t crc;                // CRC32 of the entries sent
+    int notifies;
+    int retries;                 // Waits for free mbufs
+    bool aborted;                // Cancelled, disconnected or stalled
+} list_tx_t;
+
+// Only used from the producer task
+static uint8_t tx_buf[FILE_LIST_BUF_SIZE];
+
+static QueueHandle_t job_queue = NULL;
+
+// Bumped per connection slot by ble_file_list_cancel(); that connection's
+// queued and running jobs from before the bump are dropped
+static atomic_uint cancel_seq[BLE_MAX_CONNECTIONS];
+
+// Directory order scan state
+typedef struct {
+    list_snap_t *snap;
+    const ble_file_list_req_t *req;
+    int index;
+} list_stream_t;
+
+// ============ Internal Functions ============
+
+static bool job_cancelled(const list_job_t *job) {
+    return job->slot < 0 || atomic_load(&cancel_seq[job->slot]) != job->cancel_seq;
+}
+
+static void tx_init(list_tx_t *tx, const list_job_t *job, uint16_t attr_handle) {
+    uint16_t mtu = ble_att_mtu(job->conn_handle);
+    size_t payload = (mtu > 3) ? mtu - 3 : BLE_ATT_MTU_DFLT - 3;
+    if (payload > sizeof(tx_buf)) {
+        payload = sizeof(tx_buf);
+    }
+
+    memset(tx, 0, sizeof(*tx));
+    tx->job = job;
+    tx->attr_handle = attr_handle;
+    tx->payload = payload;
+}
+
+// Send the filled notification. Waits while the notify manager holds
+// bulk back and retries on ENOMEM, so entries are delayed rather than dropped.
+static void tx_flush(list_tx_t *tx) {
+    if (tx->len == 0 || tx->aborted) {
+        tx->len = 0;
+        return;
+    }
+
+    int64_t stall_start = esp_timer_get_time();
+
+    while (true) {
+        if (job_cancelled(tx->job)) {
+            tx->aborted = true;
+            break;
+        }
+
+        int rc = ble_notify_send(tx->job->conn_handle, tx->attr_handle, tx_buf, tx->len,
+                                 BLE_NOTIFY_BULK);
+        if (rc == 0) {
+            tx->notifies++;
+            break;
+        }
+        if (rc != BLE_HS_ENOMEM) {
+            ESP_LOGW(TAG, "Notify failed: %d - listing aborted", rc);
+            tx->aborted = true;
+            break;
+        }
+
+        if (esp_timer_get_time() - stall_start > FILE_LIST_STALL_MS * 1000LL) {
+            ESP_LOGW(TAG, "No free mbufs for %d ms - listing aborted", FILE_LIST_STALL_MS);
+            tx->aborted = true;
+            break;
+        }
+        tx->retries++;
+        vTaskDelay(pdMS_TO_TICKS(FILE_LIST_RETRY_MS));
+    }
+
+    tx->len = 0;
+}
+
+// Append [type][size][name\0], starting a new notification if it won't fit
+static void tx_entry(list_tx_t *tx, uint8_t type, uint32_t size, const char *name) {
+    size_t name_len = strlen(name) + 1;
+    size_t entry_len = BLE_FILE_LIST_ENTRY_HDR + name_len;
+
+    if (entry_len > sizeof(tx_buf)) {
+        ESP_LOGW(TAG, "Name too long, skipped: %s", name);
+        return;
+    }
+    if (tx->len + entry_len > tx->payload) {
+        tx_flush(tx);
+    }
+
+    uint8_t *p = &tx_buf[tx->len];
+    p[0] = type;
+    put_le32(&p[1], size);
+    memcpy(&p[BLE_FILE_LIST_ENTRY_HDR], name, name_len);
+    tx->len += entry_len;
+    tx->entries++;
+    tx->crc = ble_xfer_crc32(tx->crc, p, entry_len);
+
+    if (!tx->job->packed) {
+        tx_flush(tx);
+    }
+}
+
+// Append [0xFF][total:4], plus [epoch:4][generation:4][count:4][crc32:4]
+// if the app asked for the extended entry, and send what is left
+static void tx_end(list_tx_t *tx) {
+    size_t end_len = tx->job->ext_end ? BLE_FILE_LIST_END_EXT_LEN : BLE_FILE_LIST_END_LEN;
+    if (tx->len + end_len > tx->payload) {
+        tx_flush(tx);
+    }
+
+    uint8_t *p = &tx_buf[tx->len];
+    p[0] = BLE_FILE_TYPE_END;
+    put_le32(&p[1], tx->job->total);
+    if (tx->job->ext_end) {
+        put_le32(&p[5], tx->job->epoch);
+        put_le32(&p[9], tx->job->generation);
+        put_le32(&p[13], tx->entries);
+        put_le32(&p[17], tx->crc);
+    }
+    tx->len += end_len;
+    tx_flush(tx);
+}
+
+static bool snap_reserve(list_snap_t *l, size_t name_len) {
+    if (l->count == l->capacity) {
+        int capacity = l->capacity ? l->capacity * 2 : FILE_LIST_INIT_ENTRIES;
+        list_entry_t *entries = heap_caps_realloc(l->entries, capacity * sizeof(*entries),
+                                                  MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!entries) {
+            return false;
+        }
+        l->entries = entries;
+        l->capacity = capacity;
+    }
+
+    if (l->pool_len + name_len > l->pool_capacity) {
+        size_t capacity = l->pool_capacity ? l->pool_capacity : FILE_LIST_INIT_POOL;
+        while (l->pool_len + name_len > capacity) {
+            capacity *= 2;
+        }
+        char *pool = heap_caps_realloc(l->pool, capacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!pool) {
+            return false;
+        }
+        l->pool = pool;
+        l->pool_capacity = capacity;
+    }
+    return true;
+}
+
+static void snap_add(list_snap_t *l, uint8_t type, uint32_t size, const char *name) {
+    if (l->failed) {
+        return;
+    }
+
+    size_t name_len = strlen(name) + 1;
+    if (!snap_reserve(l, name_len)) {
+        l->failed = true;
+        return;
+    }
+
+    list_entry_t *e = &l->entries[l->count++];
+    e->name_off = l->pool_len;
+    e->size = size;
+    e->type = type;
+    e->number = storage_recording_number(name);
+    memcpy(&l->pool[l->pool_len], name, name_len);
+    l->pool_len += name_len;
+}
+
+// Point the entries at their names once the pool is complete
+static void snap_finish(list_snap_t *l) {
+    for (int i = 0; i < l->count; i++) {
+        l->entries[i].name = &l->pool[l->entries[i].name_off];
+    }
+}
+
+static void snap_free(list_snap_t *l) {
+    heap_caps_free(l->entries);
+    heap_caps_free(l->pool);
+}
+
+// Directory order: copy only the requested page
+static void stream_callback(const storage_entry_t *entry, void *user_data) {
+    list_stream_t *s = (list_stream_t *)user_data;
+    if (!entry->meta.is_audio) {
+        return;
+    }
+
+    if (s->index >= s->req->start && (s->req->count == 0 || s->snap->count < s->req->count)) {
+        snap_add(s->snap, BLE_FILE_TYPE_FILE, entry->meta.size, entry->name);
+    }
+    s->index++;
+}
+
+static void sorted_callback(const storage_entry_t *entry, void *user_data) {
+    if (entry->meta.is_audio) {
+        snap_add((list_snap_t *)user_data, BLE_FILE_TYPE_FILE, entry->meta.size, entry->name);
+    }
+}
+
+static void changes_callback(const storage_change_t *change, void *user_data) {
+    uint8_t op = (change->op == STORAGE_CHANGE_DELETE) ? BLE_FILE_CHANGE_DELETE
+                                                       : BLE_FILE_CHANGE_ADD;
+    snap_add((list_snap_t *)user_data, op, change->size, change->name);
+}
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp(((const list_entry_t *)a)->name, ((const list_entry_t *)b)->name);
+}
+
+static int cmp_size(const void *a, const void *b) {
+    const list_entry_t *ea = a;
+    const list_entry_t *eb = b;
+    if (ea->size != eb->size) {
+        return ea->size < eb->size ? -1 : 1;
+    }
+    return strcmp(ea->name, eb->name);
+}
+
+static int cmp_number(const void *a, const void *b) {
+    const list_entry_t *ea = a;
+    const list_entry_t *eb = b;
+    if (ea->number != eb->number) {
+        return ea->number < eb->number ? -1 : 1;
+    }
+    return strcmp(ea->name, eb->name);
+}
+
+static list_job_t *job_new(uint16_t conn_handle, uint16_t attr_handle) {
+    list_job_t *job = calloc(1, sizeof(list_job_t));
+    if (job) {
+        job->slot = ble_conn_slot(conn_handle);
+        job->cancel_seq = job->slot >= 0 ? atomic_load(&cancel_seq[job->slot]) : 0;
+        job->conn_handle = conn_handle;
+        job->attr_handle = attr_handle;
+    }
+    return job;
+}
+
+static void job_free(list_job_t *job) {
+    snap_free(&job->snap);
+    free(job);
+}
+
+static void job_set_header(list_job_t *job, uint16_t hdr_handle, uint8_t status) {
+    job->hdr[0] = status;
+    put_le32(&job->hdr[1], job->epoch);
+    put_le32(&job->hdr[5], job->generation);
+    job->hdr_len = BLE_FILE_CHANGES_HDR_LEN;
+    job->hdr_handle = hdr_handle;
+}
+
+// Snapshot one page of the cached listing into the job
+static esp_err_t job_snap_list(list_job_t *job, const ble_file_list_req_t *req) {
+    uint8_t key = req->sort & BLE_FILE_LIST_SORT_KEY_MASK;
+    list_snap_t *l = &job->snap;
+
+    job->has_list = true;
+    job->packed = req->packed;
+    job->ext_end = req->ext_end;
+    job->start = req->start;
+    job->sort = req->sort;
+
+    if (key == BLE_FILE_LIST_SORT_NONE) {
+        list_stream_t s = {
+            .snap = l,
+            .req = req,
+        };
+        storage_cache_foreach(stream_callback, &s);
+        job->total = s.index;
+        job->first = 0;
+        job->end = l->count;
+    } else {
+        storage_cache_foreach(sorted_callback, l);
+        job->total = l->count;
+        job->first = (req->start < l->count) ? req->start : l->count;
+        job->end = l->count;
+        if (req->count != 0 && req->start + req->count < job->end) {
+            job->end = req->start + req->count;
+        }
+        job->desc = (req->sort & BLE_FILE_LIST_SORT_DESC) != 0;
+    }
+
+    if (l->failed) {
+        ESP_LOGE(TAG, "Out of memory buffering %d files", l->count);
+        return ESP_ERR_NO_MEM;
+    }
+    snap_finish(l);
+
+    switch (key) {
+    case BLE_FILE_LIST_SORT_NONE:
+        break;
+    case BLE_FILE_LIST_SORT_NAME:
+        qsort(l->entries, l->count, sizeof(list_entry_t), cmp_name);
+        break;
+    case BLE_FILE_LIST_SORT_SIZE:
+        qsort(l->entries, l->count, sizeof(list_entry_t), cmp_size);
+        break;
+    default:
+        qsort(l->entries, l->count, sizeof(list_entry_t), cmp_number);
+        break;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t job_post(list_job_t *job) {
+    if (job_queue == NULL || xQueueSend(job_queue, &job, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "File list request dropped - queue full");
+        job_free(job);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static void job_run(list_job_t *job) {
+    int64_t start_us = esp_timer_get_time();
+    list_tx_t tx;
+
+    if (job->hdr_len) {
+        tx_init(&tx, job, job->hdr_handle);
+        memcpy(tx_buf, job->hdr, job->hdr_len);
+        tx.len = job->hdr_len;
+        if (!job->has_list || job->hdr_handle != job->attr_handle) {
+            // UP_TO_DATE, or RESYNC with the list on File List
+            tx_flush(&tx);
+            tx.attr_handle = job->attr_handle;
+        }
+    } else {
+        tx_init(&tx, job, job->attr_handle);
+    }
+
+    if (job->has_list) {
+        const list_snap_t *l = &job->snap;
+        for (int i = job->first; i < job->end && !tx.aborted; i++) {
+            const list_entry_t *e = job->desc ? &l->entries[l->count - 1 - i] : &l->entries[i];
+            tx_entry(&tx, e->type, e->size, e->name);
+        }
+        tx_end(&tx);
+    }
+
+    if (tx.aborted) {
+        ESP_LOGW(TAG, "File list aborted after %d of %d entries", tx.entries,
+                 job->end - job->first);
+        return;
+    }
+
+    ESP_LOGI(TAG, "File list sent: %d entries of %d (start=%u, sort=0x%02x, %s) "
+             "in %d notifications (%d mbuf waits), crc %08lx, %lld ms",
+             tx.entries, job->total, job->start, job->sort, job->packed ? "packed" : "single",
+             tx.notifies, tx.retries, (unsigned long)tx.crc,
+             (esp_timer_get_time() - start_us) / 1000);
+}
+
+static void producer_task(void *param) {
+    list_job_t *job;
+
+    while (true) {
+        if (xQueueReceive(job_queue, &job, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (!job_cancelled(job)) {
+            job_run(job);
+        }
+        job_free(job);
+    }
+}
+
+// ============ Public Functions ============
+
+esp_err_t ble_file_list_init(void) {
+    if (job_queue != NULL) {
+        return ESP_OK;
+    }
+
+    job_queue = xQueueCreate(FILE_LIST_QUEUE_LEN, sizeof(list_job_t *));
+    if (job_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create file list queue");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(producer_task, "file_list", FILE_LIST_TASK_STACK, NULL,
+                    FILE_LIST_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create file list task");
+        vQueueDelete(job_queue);
+        job_queue = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void ble_file_list_cancel(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot >= 0) {
+        atomic_fetch_add(&cancel_seq[slot], 1);
+    }
+}
+
+esp_err_t ble_file_list_parse(const uint8_t *buf, size_t len, ble_file_list_req_t *req) {
+    if (len < BLE_FILE_LIST_REQ_MIN_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    req->start = get_le16(buf);
+    req->count = get_le16(buf + 2);
+    req->sort = (len > BLE_FILE_LIST_REQ_MIN_LEN) ? buf[4] : BLE_FILE_LIST_SORT_NONE;
+    req->packed = true;
+    req->ext_end = (len > BLE_FILE_LIST_REQ_MIN_LEN + 1) &&
+                   (buf[5] & BLE_FILE_LIST_FLAG_EXT_END);
+
+    if ((req->sort & BLE_FILE_LIST_SORT_KEY_MASK) > BLE_FILE_LIST_SORT_NUMBER) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ble_file_list_send(uint16_t conn_handle, uint16_t attr_handle,
+                             const ble_file_list_req_t *req) {
+    list_job_t *job = job_new(conn_handle, attr_handle);
+    if (!job) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Taken before listing: a change racing the listing is also replayed
+    // by the next changes request, and replaying it is harmless
+    storage_journal_get(&job->epoch, &job->generation);
+
+    esp_err_t err = job_snap_list(job, req);
+    if (err != ESP_OK) {
+        job_free(job);
+        return err;
+    }
+    return job_post(job);
+}
+
+esp_err_t ble_file_list_send_changes(uint16_t conn_handle, uint16_t changes_handle,
+                                     uint16_t list_handle, uint32_t epoch,
+                                     uint32_t generation) {
+    list_job_t *job = job_new(conn_handle, changes_handle);
+    if (!job) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    storage_journal_get(&job->epoch, NULL);
+    esp_err_t err = storage_journal_since(epoch, generation, &job->generation,
+                                          changes_callback, &job->snap);
+    if (err == ESP_OK && job->snap.failed) {
+        ESP_LOGE(TAG, "Out of memory buffering %d changes", job->snap.count);
+        err = ESP_ERR_NO_MEM;
+    }
+
+    if (err != ESP_OK) {
+        // Journal doesn't reach back to the app's generation
+        ESP_LOGI(TAG, "File changes since %lu: resync at %lu", (unsigned long)generation,
+                 (unsigned long)job->generation);
+        snap_free(&job->snap);
+        memset(&job->snap, 0, sizeof(job->snap));
+
+        ble_file_list_req_t req = {
+            .sort = BLE_FILE_LIST_SORT_NONE,
+            .packed = true,
+            .ext_end = true,  // Only apps that sync by generation get here
+        };
+        job->attr_handle = list_handle;
+        storage_journal_get(&job->epoch, &job->generation);
+        job_set_header(job, changes_handle, BLE_FILE_CHANGES_RESYNC);
+        err = job_snap_list(job, &req);
+        if (err != ESP_OK) {
+            job_free(job);
+            return err;
+        }
+        return job_post(job);
+    }
+
+    snap_finish(&job->snap);
+    job->packed = true;
+    job->ext_end = true;
+    if (job->snap.count == 0) {
+        job_set_header(job, changes_handle, BLE_FILE_CHANGES_UP_TO_DATE);
+    } else {
+        job_set_header(job, changes_handle, BLE_FILE_CHANGES_DELTA);
+        job->has_list = true;
+        job->end = job->snap.count;
+        job->total = job->snap.count;
+    }
+
+    ESP_LOGI(TAG, "File changes since %lu: %d to %lu", (unsigned long)generation,
+             job->snap.count, (unsigned long)job->generation);
+    return job_post(job);
+}
@@ -0,0 +1,134 @@
+#ifndef BLE_FILE_LIST_H
+#define BLE_FILE_LIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// File list request written to the File List characteristic:
+// [start:2][count:2][sort:1 optional][flags:1 optional] in little-endian
+#define BLE_FILE_LIST_REQ_MIN_LEN   4
+#define BLE_FILE_LIST_REQ_MAX_LEN   6
+
+// Sort keys (low bits of the sort byte)
+#define BLE_FILE_LIST_SORT_NONE     0x00  // Directory order
+#define BLE_FILE_LIST_SORT_NAME     0x01
+#define BLE_FILE_LIST_SORT_SIZE     0x02
+#define BLE_FILE_LIST_SORT_NUMBER   0x03  // Recording number
+#define BLE_FILE_LIST_SORT_KEY_MASK 0x7F
+#define BLE_FILE_LIST_SORT_DESC     0x80  // Descending order
+
+// Request flags
+#define BLE_FILE_LIST_FLAG_EXT_END  0x01  // Send the extended end entry
+
+// Entry header: [type:1][size:4], NUL-terminated name follows
+#define BLE_FILE_LIST_ENTRY_HDR     5
+
+// End entry: [0xFF][total:4], the original format. Requests with
+// BLE_FILE_LIST_FLAG_EXT_END, and File Changes replies, get the extended
+// [0xFF][total:4][epoch:4][generation:4][count:4][crc32:4].
+#define BLE_FILE_LIST_END_LEN       5
+#define BLE_FILE_LIST_END_EXT_LEN   21
+
+// File changes request: [epoch:4][generation:4] the app last synced at
+#define BLE_FILE_CHANGES_REQ_LEN    8
+
+// File changes reply header: [status:1][epoch:4][generation:4]
+#define BLE_FILE_CHANGES_HDR_LEN    9
+#define BLE_FILE_CHANGES_UP_TO_DATE 0x00  // Nothing changed
+#define BLE_FILE_CHANGES_DELTA      0x01  // Change entries and an end entry follow
+#define BLE_FILE_CHANGES_RESYNC     0x02  // Full list follows on the File List characteristic
+
+// Change entry ops, in the type byte of [op:1][size:4][name\0]
+#define BLE_FILE_CHANGE_ADD         0x00  // Added or rewritten
+#define BLE_FILE_CHANGE_DELETE      0x01
+
+// Decoded list request
+typedef struct {
+    uint16_t start;              // First entry to send (after sorting)
+    uint16_t count;              // Max entries to send, 0 = all remaining
+    uint8_t sort;                // BLE_FILE_LIST_SORT_* | BLE_FILE_LIST_SORT_DESC
+    bool packed;                 // Pack entries up to the ATT payload size
+    bool ext_end;                // Extended end entry
+} ble_file_list_req_t;
+
+/**
+ * @brief Start the file list producer task
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t ble_file_list_init(void);
+
+/**
+ * @brief Drop a connection's queued and in-progress listings (call on
+ *        disconnect, before the connection's slot is released)
+ *
+ * @param conn_handle BLE connection handle
+ */
+void ble_file_list_cancel(uint16_t conn_handle);
+
+/**
+ * @brief Parse a File List characteristic write
+ *
+ * @param buf Request bytes
+ * @param len Request length
+ * @param[out] req Decoded request (packed is always set, ext_end from the flags byte)
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE if the request is too short
+ */
+esp_err_t ble_file_list_parse(const uint8_t *buf, size_t len, ble_file_list_req_t *req);
+
+/**
+ * @brief Queue one page of the audio file list for sending as notifications
+ *
+ * The page is snapshotted from the storage cache before returning and
+ * sent by the producer task, which waits for free mbufs instead of
+ * dropping notifications. Packed requests fill each notification with as
+ * many [type:1][size:4][name\0] entries as fit in the ATT payload;
+ * unpacked requests send one entry per notification (the original Read
+ * behaviour). The page ends with [0xFF][total:4]: total is the number of
+ * audio files on the device, so the app knows whether to request another
+ * page. With req->ext_end the end entry is
+ * [0xFF][total:4][epoch:4][generation:4][count:4][crc32:4]: epoch and
+ * generation identify the storage state the listing was taken at, for
+ * later ble_file_list_send_changes(), and count/crc32 cover the entries
+ * sent so the app can check it got them all.
+ *
+ * @param conn_handle BLE connection handle
+ * @param attr_handle File List characteristic value handle
+ * @param req Page, sort key and packing
+ * @return ESP_OK, or ESP_ERR_NO_MEM if the page could not be buffered or queued
+ */
+esp_err_t ble_file_list_send(uint16_t conn_handle, uint16_t attr_handle,
+                             const ble_file_list_req_t *req);
+
+/**
+ * @brief Queue the changes since the app's last sync
+ *
+ * Replies on the File Changes characteristic with a header, then, if the
+ * storage journal still covers the app's generation, packed change
+ * entries and an extended end entry as for ble_file_list_send()
+ * (total = count). Otherwise the header says RESYNC and a full packed
+ * listing with an extended end entry follows on the File List
+ * characteristic.
+ *
+ * @param conn_handle BLE connection handle
+ * @param changes_handle File Changes characteristic value handle
+ * @param list_handle File List characteristic value handle
+ * @param epoch Storage epoch the app last synced with (0 if never)
+ * @param generation Storage generation the app last synced at
+ * @return ESP_OK, or ESP_ERR_NO_MEM if the reply could not be buffered or queued
+ */
+esp_err_t ble_file_list_send_changes(uint16_t conn_handle, uint16_t changes_handle,
+                                     uint16_t list_handle, uint32_t epoch,
+                                     uint32_t generation);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_FILE_LIST_H
@@ -0,0 +1,381 @@
+#include "ble_file_ops.h"
+#include "ble_transfer.h"
+#include "ble_conn.h"
+#include "ble_notify.h"
+#include "../Storage/storage.h"
+#include "../Storage/storage_journal.h"
+#include "../Storage/storage_worker.h"
+#include "../Playlist/playlist.h"
+#include "../Audio/audio.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <host/ble_hs.h>
+
+static const char *TAG = "BLE_FILE_OPS";
+
+#define STORAGE_ROOT        "/Storage"
+#define STORAGE_ROOT_LEN    (sizeof(STORAGE_ROOT) - 1)
+
+// Same limit as File Delete
+#define FILE_OPS_PATH_LEN   128
+
+// Largest ATT payload at our preferred MTU of 512
+#define FILE_OPS_BUF_SIZE   509
+
+// Result notifications wait this long in total for free mbufs
+#define FILE_OPS_NOTIFY_WAIT_MS  500
+
+// A batch being collected (host task) or run (storage worker)
+typedef struct {
+    uint16_t conn_handle;
+    uint16_t attr_handle;
+    uint8_t seq;
+    uint16_t op_count;
+    size_t len;
+    uint8_t ops[BLE_FILE_OPS_MAX_BYTES];
+} file_batch_t;
+
+// Per connection slot, the batch waiting for the write without the MORE
+// flag (host task only)
+static file_batch_t *pending_batches[BLE_MAX_CONNECTIONS];
+
+// Only used from the storage worker
+static uint8_t result_buf[FILE_OPS_BUF_SIZE];
+static uint8_t op_status[BLE_FILE_OPS_MAX_OPS];
+
+// ============ Internal Functions ============
+
+static void batch_free(file_batch_t *batch) {
+    heap_caps_free(batch);
+}
+
+static void pending_drop(int slot) {
+    if (pending_batches[slot]) {
+        batch_free(pending_batches[slot]);
+        pending_batches[slot] = NULL;
+    }
+}
+
+// Length of the NUL-terminated string at p, or 0 if it runs past end
+static size_t string_len(const uint8_t *p, const uint8_t *end) {
+    const uint8_t *nul = memchr(p, '\0', end - p);
+    return nul ? (size_t)(nul - p) + 1 : 0;
+}
+
+// Count the operations in a write body; -1 if malformed
+static int count_ops(const uint8_t *p, size_t len) {
+    const uint8_t *end = p + len;
+    int count = 0;
+
+    while (p < end) {
+        uint8_t op = *p++;
+        int strings;
+
+        switch (op) {
+        case BLE_FILE_OP_DELETE:
+            strings = 1;
+            break;
+        case BLE_FILE_OP_RENAME:
+        case BLE_FILE_OP_MOVE:
+            strings = 2;
+            break;
+        default:
+            return -1;
+        }
+
+        while (strings--) {
+            size_t n = string_len(p, end);
+            if (n == 0) {
+                return -1;
+            }
+            p += n;
+        }
+        count++;
+    }
+    return count;
+}
+
+// A filename: no separators, not . or ..
+static bool valid_name(const char *name) {
+    return name[0] != '\0' && strchr(name, '/') == NULL &&
+           strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+// Full path under /Storage for a relative or absolute app path; false if
+// it would leave /Storage or does not fit
+static bool resolve_path(const char *in, char *out, size_t size) {
+    const char *rel;
+
+    if (strncmp(in, STORAGE_ROOT, STORAGE_ROOT_LEN) == 0 &&
+        (in[STORAGE_ROOT_LEN] == '/' || in[STORAGE_ROOT_LEN] == '\0')) {
+        rel = in + STORAGE_ROOT_LEN;
+        if (*rel == '/') {
+            rel++;
+        }
+    } else if (in[0] == '/') {
+        return false;
+    } else {
+        rel = in;
+    }
+
+    // Every component must be a plain name
+    const char *p = rel;
+    while (*p) {
+        const char *slash = strchr(p, '/');
+        size_t n = slash ? (size_t)(slash - p) : strlen(p);
+        if (n == 0 || (n == 1 && p[0] == '.') || (n == 2 && p[0] == '.' && p[1] == '.')) {
+            return false;
+        }
+        p += n;
+        if (*p == '/') {
+            p++;
+        }
+    }
+
+    int written = rel[0] ? snprintf(out, size, "%s/%s", STORAGE_ROOT, rel)
+                         : snprintf(out, size, "%s", STORAGE_ROOT);
+    return written > 0 && (size_t)written < size;
+}
+
+static uint8_t run_op(uint8_t op, const char *arg1, const char *arg2) {
+    char path[FILE_OPS_PATH_LEN];
+    char target[FILE_OPS_PATH_LEN];
+    struct stat st;
+
+    if (!resolve_path(arg1, path, sizeof(path))) {
+        return BLE_FILE_OP_INVALID;
+    }
+    if (stat(path, &st) != 0) {
+        return BLE_FILE_OP_NOT_FOUND;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return BLE_FILE_OP_INVALID;
+    }
+    if (audio_is_file_in_use(path) || ble_transfer_is_file_in_use(path)) {
+        return BLE_FILE_OP_BUSY;
+    }
+
+    const char *name = strrchr(path, '/') + 1;
+    int written;
+
+    switch (op) {
+    case BLE_FILE_OP_DELETE:
+        if (storage_delete_file(path) != ESP_OK) {
+            return BLE_FILE_OP_FAILED;
+        }
+        playlist_remove(path);
+        return BLE_FILE_OP_OK;
+
+    case BLE_FILE_OP_RENAME:
+        if (!valid_name(arg2)) {
+            return BLE_FILE_OP_INVALID;
+        }
+        written = snprintf(target, sizeof(target), "%.*s/%s",
+                           (int)(name - 1 - path), path, arg2);
+        break;
+
+    case BLE_FILE_OP_MOVE: {
+        char dir[FILE_OPS_PATH_LEN];
+        if (!resolve_path(arg2, dir, sizeof(dir))) {
+            return BLE_FILE_OP_INVALID;
+        }
+        if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            return BLE_FILE_OP_NOT_FOUND;
+        }
+        written = snprintf(target, sizeof(target), "%s/%s", dir, name);
+        break;
+    }
+
+    default:
+        return BLE_FILE_OP_INVALID;
+    }
+
+    if (written < 0 || (size_t)written >= sizeof(target)) {
+        return BLE_FILE_OP_INVALID;
+    }
+    if (strcmp(target, path) == 0) {
+        return BLE_FILE_OP_OK;
+    }
+    if (stat(target, &st) == 0) {
+        return BLE_FILE_OP_EXISTS;
+    }
+    if (storage_rename_file(path, target) != ESP_OK) {
+        return BLE_FILE_OP_FAILED;
+    }
+    // After the cache has the new name: a move into a subdirectory drops
+    // the track
+    playlist_rename(path, target);
+    return BLE_FILE_OP_OK;
+}
+
+static void notify_results(const file_batch_t *batch) {
+    uint16_t mtu = ble_att_mtu(batch->conn_handle);
+    size_t payload = (mtu > 3) ? mtu - 3 : BLE_ATT_MTU_DFLT - 3;
+    if (payload > sizeof(result_buf)) {
+        payload = sizeof(result_buf);
+    }
+    size_t per_notify = payload - BLE_FILE_OPS_RESULT_HDR_LEN;
+
+    uint16_t index = 0;
+    do {
+        uint16_t count = batch->op_count - index;
+        if (count > per_notify) {
+            count = per_notify;
+        }
+
+        // Format: [seq:1][index:2][count:2][status:1 x count]
+        result_buf[0] = batch->seq;
+        result_buf[1] = index & 0xFF;
+        result_buf[2] = (index >> 8) & 0xFF;
+        result_buf[3] = count & 0xFF;
+        result_buf[4] = (count >> 8) & 0xFF;
+        memcpy(&result_buf[BLE_FILE_OPS_RESULT_HDR_LEN], &op_status[index], count);
+
+        int rc = ble_notify_send_wait(batch->conn_handle, batch->attr_handle, result_buf,
+                                      BLE_FILE_OPS_RESULT_HDR_LEN + count,
+                                      FILE_OPS_NOTIFY_WAIT_MS);
+        if (rc != 0) {
+            ESP_LOGW(TAG, "Batch %u: result notify failed: %d", batch->seq, rc);
+            return;
+        }
+
+        index += count;
+    } while (index < batch->op_count);
+}
+
+// Storage worker: run every operation (each updates the playlist as it
+// succeeds), then notify the results
+static void batch_run(void *arg) {
+    file_batch_t *batch = (file_batch_t *)arg;
+    int64_t start = esp_timer_get_time();
+    const uint8_t *p = batch->ops;
+    int ok = 0;
+
+    // One NVS commit of the storage generation for the whole batch
+    storage_journal_batch_begin();
+
+    for (int i = 0; i < batch->op_count; i++) {
+        uint8_t op = *p++;
+        const char *arg1 = (const char *)p;
+        p += strlen(arg1) + 1;
+        const char *arg2 = NULL;
+        if (op != BLE_FILE_OP_DELETE) {
+            arg2 = (const char *)p;
+            p += strlen(arg2) + 1;
+        }
+
+        op_status[i] = run_op(op, arg1, arg2);
+        if (op_status[i] == BLE_FILE_OP_OK) {
+            ok++;
+        } else {
+            ESP_LOGW(TAG, "Batch %u: op %d (0x%02x %s) failed: %d",
+                     batch->seq, i, op, arg1, op_status[i]);
+        }
+    }
+
+    storage_journal_batch_end();
+
+    ESP_LOGI(TAG, "Batch %u: %d of %u operations done in %lld ms",
+             batch->seq, ok, batch->op_count, (esp_timer_get_time() - start) / 1000);
+
+    notify_results(batch);
+    batch_free(batch);
+}
+
+// ============ Public Functions ============
+
+esp_err_t ble_file_ops_write(uint16_t conn_handle, uint16_t attr_handle,
+                             const uint8_t *buf, size_t len) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (len < BLE_FILE_OPS_HDR_LEN) {
+        pending_drop(slot);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t seq = buf[0];
+    uint8_t flags = buf[1];
+    const uint8_t *body = buf + BLE_FILE_OPS_HDR_LEN;
+    size_t body_len = len - BLE_FILE_OPS_HDR_LEN;
+
+    file_batch_t *pending = pending_batches[slot];
+    if (pending && pending->seq != seq) {
+        ESP_LOGW(TAG, "Batch %u interrupted by batch %u", pending->seq, seq);
+        pending_drop(slot);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int count = count_ops(body, body_len);
+    if (count < 0) {
+        ESP_LOGW(TAG, "Batch %u: malformed operation", seq);
+        pending_drop(slot);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (!pending) {
+        pending = heap_caps_malloc(sizeof(file_batch_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!pending) {
+            return ESP_ERR_NO_MEM;
+        }
+        pending_batches[slot] = pending;
+        pending->conn_handle = conn_handle;
+        pending->attr_handle = attr_handle;
+        pending->seq = seq;
+        pending->op_count = 0;
+        pending->len = 0;
+    }
+
+    if (pending->len + body_len > sizeof(pending->ops) ||
+        pending->op_count + count > BLE_FILE_OPS_MAX_OPS) {
+        ESP_LOGW(TAG, "Batch %u too large", seq);
+        pending_drop(slot);
+        return ESP_ERR_NO_MEM;
+    }
+
+    memcpy(&pending->ops[pending->len], body, body_len);
+    pending->len += body_len;
+    pending->op_count += count;
+
+    if (flags & BLE_FILE_OPS_FLAG_MORE) {
+        return ESP_OK;
+    }
+
+    file_batch_t *batch = pending;
+    pending_batches[slot] = NULL;
+
+    ESP_LOGI(TAG, "Batch %u: %u operations queued", batch->seq, batch->op_count);
+    if (storage_worker_submit(batch_run, batch) != ESP_OK) {
+        batch_free(batch);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+uint8_t ble_file_ops_run_one(const uint8_t *op, size_t len) {
+    if (count_ops(op, len) != 1) {
+        return BLE_FILE_OP_INVALID;
+    }
+
+    const char *arg1 = (const char *)&op[1];
+    const char *arg2 = (op[0] != BLE_FILE_OP_DELETE) ? arg1 + strlen(arg1) + 1 : NULL;
+
+    return run_op(op[0], arg1, arg2);
+}
+
+void ble_file_ops_reset(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot >= 0) {
+        pending_drop(slot);
+    }
+}
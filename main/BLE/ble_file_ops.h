@@ -0,0 +1,85 @@
+#ifndef BLE_FILE_OPS_H
+#define BLE_FILE_OPS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Batch request written to the File Batch characteristic:
+// [seq:1][flags:1] followed by whole operations. A write with
+// BLE_FILE_OPS_FLAG_MORE set is held until a write without it arrives,
+// then all held operations run as one batch.
+#define BLE_FILE_OPS_HDR_LEN        2
+#define BLE_FILE_OPS_FLAG_MORE      0x01
+
+// Operations. Paths are relative to /Storage or absolute under it.
+#define BLE_FILE_OP_DELETE          0x01  // [0x01][path\0]
+#define BLE_FILE_OP_RENAME          0x02  // [0x02][path\0][new_name\0], same directory
+#define BLE_FILE_OP_MOVE            0x03  // [0x03][path\0][dest_dir\0], keeps the name
+
+// Limits of one batch
+#define BLE_FILE_OPS_MAX_OPS        128
+#define BLE_FILE_OPS_MAX_BYTES      4096
+
+// Result notification: [seq:1][index:2][count:2][status:1 x count],
+// split across notifications when it doesn't fit the ATT payload
+#define BLE_FILE_OPS_RESULT_HDR_LEN 5
+
+// Per-operation status
+#define BLE_FILE_OP_OK              0x00
+#define BLE_FILE_OP_NOT_FOUND       0x01
+#define BLE_FILE_OP_BUSY            0x02  // Playing, recording or transferring
+#define BLE_FILE_OP_INVALID         0x03  // Bad path or name
+#define BLE_FILE_OP_EXISTS          0x04  // Target name already taken
+#define BLE_FILE_OP_FAILED          0x05
+
+/**
+ * @brief Handle a File Batch characteristic write
+ *
+ * Validates the operations and either holds them (MORE flag) or hands
+ * the whole batch to the storage worker. The worker runs the operations
+ * in order, moving or dropping each affected playlist track as its
+ * operation succeeds, and notifies one status per operation on
+ * attr_handle.
+ *
+ * @param conn_handle BLE connection handle
+ * @param attr_handle File Batch characteristic value handle
+ * @param buf Written bytes
+ * @param len Written length
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE for a malformed write,
+ *         ESP_ERR_INVALID_ARG for a sequence number that doesn't continue
+ *         the held batch, or ESP_ERR_NO_MEM if the batch is too large or
+ *         could not be queued
+ */
+esp_err_t ble_file_ops_write(uint16_t conn_handle, uint16_t attr_handle,
+                             const uint8_t *buf, size_t len);
+
+/**
+ * @brief Run one operation in File Batch format (storage worker only)
+ *
+ * Same as a batch of one: the affected playlist track is moved or
+ * dropped if it succeeds.
+ *
+ * @param op One operation: [op:1][path\0] or [op:1][path\0][arg\0]
+ * @param len Length
+ * @return BLE_FILE_OP_* status, BLE_FILE_OP_INVALID if op is malformed
+ */
+uint8_t ble_file_ops_run_one(const uint8_t *op, size_t len);
+
+/**
+ * @brief Discard a connection's batch still waiting for writes (call on
+ *        disconnect, before the connection's slot is released)
+ *
+ * @param conn_handle BLE connection handle
+ */
+void ble_file_ops_reset(uint16_t conn_handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_FILE_OPS_H
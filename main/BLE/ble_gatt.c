@@ -2,8 +2,19 @@
 #include "ble_uuids.h"
 #include "ble_auth.h"
 #include "ble_transfer.h"
+#include "ble_link.h"
+#include "ble_file_ops.h"
+#include "ble_status.h"
+#include "ble_audio_ctrl.h"
+#include "ble_rpc.h"
+#include "ble_conn.h"
+#include "ble_bond.h"
+#include "ble_notify.h"
+#include "ble_le.h"
 #include "../Storage/storage.h"
+#include "../Storage/storage_journal.h"
 #include "../Playlist/playlist.h"
+#include "../Audio/audio.h"
 #include "../Power/power.h"
 
 #include <string.h>
@@ -21,18 +32,30 @@
 
 static const char *TAG = "BLE_GATT";
 
-// Current connection handle
-static uint16_t current_conn_handle = BLE_HS_CONN_HANDLE_NONE;
-
 // Characteristic value handles (set during registration)
 static uint16_t auth_status_handle;
 static uint16_t auth_key_write_handle;
 static uint16_t auth_key_clear_handle;
+static uint16_t auth_resume_handle;
 static uint16_t file_list_handle;
 static uint16_t file_delete_handle;
 static uint16_t transfer_ctrl_handle;
 static uint16_t transfer_data_handle;
 static uint16_t transfer_progress_handle;
+static uint16_t link_diag_handle;
+static uint16_t transfer_telemetry_handle;
+static uint16_t file_changes_handle;
+static uint16_t file_batch_handle;
+static uint16_t device_status_handle;
+static uint16_t audio_cmd_handle;
+static uint16_t rpc_handle;
+
+// File Batch write, flattened (host task only). Long writes are
+// reassembled by the host up to the ATT maximum attribute length.
+static uint8_t file_batch_buf[BLE_ATT_ATTR_MAX_LEN];
+
+// RPC write, flattened (host task only)
+static uint8_t rpc_buf[BLE_ATT_ATTR_MAX_LEN];
 
 // UUID declarations (static instances)
 static const ble_uuid128_t auth_svc_uuid = BLE_UUID128_INIT(
@@ -51,6 +74,10 @@ static const ble_uuid128_t auth_key_clear_uuid = BLE_UUID128_INIT(
     0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
     0x42, 0x48, 0x59, 0x4D, 0x03, 0x01, 0x00, 0x00);
 
+static const ble_uuid128_t auth_resume_uuid = BLE_UUID128_INIT(
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x42, 0x48, 0x59, 0x4D, 0x04, 0x01, 0x00, 0x00);
+
 static const ble_uuid128_t file_svc_uuid = BLE_UUID128_INIT(
     0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
     0x42, 0x48, 0x59, 0x4D, 0x02, 0x00, 0x00, 0x00);
@@ -75,6 +102,46 @@ static const ble_uuid128_t transfer_progress_uuid = BLE_UUID128_INIT(
     0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
     0x42, 0x48, 0x59, 0x4D, 0x05, 0x02, 0x00, 0x00);
 
+static const ble_uuid128_t link_diag_uuid = BLE_UUID128_INIT(
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x42, 0x48, 0x59, 0x4D, 0x06, 0x02, 0x00, 0x00);
+
+static const ble_uuid128_t transfer_telemetry_uuid = BLE_UUID128_INIT(
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x42, 0x48, 0x59, 0x4D, 0x07, 0x02, 0x00, 0x00);
+
+static const ble_uuid128_t file_changes_uuid = BLE_UUID128_INIT(
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x42, 0x48, 0x59, 0x4D, 0x08, 0x02, 0x00, 0x00);
+
+static const ble_uuid128_t file_batch_uuid = BLE_UUID128_INIT(
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x42, 0x48, 0x59, 0x4D, 0x09, 0x02, 0x00, 0x00);
+
+static const ble_uuid128_t device_svc_uuid = BLE_UUID128_INIT(
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x42, 0x48, 0x59, 0x4D, 0x03, 0x00, 0x00, 0x00);
+
+static const ble_uuid128_t device_status_uuid = BLE_UUID128_INIT(
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x42, 0x48, 0x59, 0x4D, 0x01, 0x03, 0x00, 0x00);
+
+static const ble_uuid128_t audio_svc_uuid = BLE_UUID128_INIT(
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x42, 0x48, 0x59, 0x4D, 0x04, 0x00, 0x00, 0x00);
+
+static const ble_uuid128_t audio_cmd_uuid = BLE_UUID128_INIT(
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x42, 0x48, 0x59, 0x4D, 0x01, 0x04, 0x00, 0x00);
+
+static const ble_uuid128_t control_svc_uuid = BLE_UUID128_INIT(
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x42, 0x48, 0x59, 0x4D, 0x05, 0x00, 0x00, 0x00);
+
+static const ble_uuid128_t rpc_uuid = BLE_UUID128_INIT(
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x42, 0x48, 0x59, 0x4D, 0x01, 0x05, 0x00, 0x00);
+
 // Forward declarations for access callbacks
 static int auth_key_write_access(uint16_t conn_handle, uint16_t attr_handle,
                                   struct ble_gatt_access_ctxt *ctxt, void *arg);
@@ -82,6 +149,8 @@ static int auth_status_access(uint16_t conn_handle, uint16_t attr_handle,
                                struct ble_gatt_access_ctxt *ctxt, void *arg);
 static int auth_key_clear_access(uint16_t conn_handle, uint16_t attr_handle,
                                   struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int auth_resume_access(uint16_t conn_handle, uint16_t attr_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg);
 static int file_list_access(uint16_t conn_handle, uint16_t attr_handle,
                              struct ble_gatt_access_ctxt *ctxt, void *arg);
 static int file_delete_access(uint16_t conn_handle, uint16_t attr_handle,
@@ -92,6 +161,20 @@ static int transfer_data_access(uint16_t conn_handle, uint16_t attr_handle,
                                  struct ble_gatt_access_ctxt *ctxt, void *arg);
 static int transfer_progress_access(uint16_t conn_handle, uint16_t attr_handle,
                                      struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int link_diag_access(uint16_t conn_handle, uint16_t attr_handle,
+                            struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int transfer_telemetry_access(uint16_t conn_handle, uint16_t attr_handle,
+                                     struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int file_changes_access(uint16_t conn_handle, uint16_t attr_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int file_batch_access(uint16_t conn_handle, uint16_t attr_handle,
+                             struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int device_status_access(uint16_t conn_handle, uint16_t attr_handle,
+                                struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int audio_cmd_access(uint16_t conn_handle, uint16_t attr_handle,
+                            struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int rpc_access(uint16_t conn_handle, uint16_t attr_handle,
+                      struct ble_gatt_access_ctxt *ctxt, void *arg);
 
 // ============ Service Definitions ============
 
@@ -122,6 +205,14 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
                 .val_handle = &auth_key_clear_handle,
                 .flags = BLE_GATT_CHR_F_WRITE,
             },
+            {
+                // Auth Resume - read a token, write it back on a later connection
+                .uuid = &auth_resume_uuid.u,
+                .access_cb = auth_resume_access,
+                .val_handle = &auth_resume_handle,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |
+                         BLE_GATT_CHR_F_WRITE_NO_RSP,
+            },
             { 0 } // Terminator
         },
     },
@@ -131,11 +222,11 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
         .uuid = &file_svc_uuid.u,
         .characteristics = (struct ble_gatt_chr_def[]) {
             {
-                // File List - read triggers file listing via notify
+                // File List - read or paged write triggers file listing via notify
                 .uuid = &file_list_uuid.u,
                 .access_cb = file_list_access,
                 .val_handle = &file_list_handle,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY,
             },
             {
                 // File Delete - write path to delete
@@ -153,11 +244,12 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
             },
             {
                 // Transfer Data - file data chunks
-                // Write: upload chunks, Read: download chunks
+                // Write: upload chunks (with or without response), Read: download chunks
                 .uuid = &transfer_data_uuid.u,
                 .access_cb = transfer_data_access,
                 .val_handle = &transfer_data_handle,
-                .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+                .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP |
+                         BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
             },
             {
                 // Transfer Progress - current progress
@@ -166,6 +258,83 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
                 .val_handle = &transfer_progress_handle,
                 .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
             },
+            {
+                // Link Diagnostics - effective PHY, interval and data length
+                .uuid = &link_diag_uuid.u,
+                .access_cb = link_diag_access,
+                .val_handle = &link_diag_handle,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+            },
+            {
+                // Transfer Telemetry - throughput, timing and buffer state
+                .uuid = &transfer_telemetry_uuid.u,
+                .access_cb = transfer_telemetry_access,
+                .val_handle = &transfer_telemetry_handle,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+            },
+            {
+                // File Changes - storage generation and delta sync
+                .uuid = &file_changes_uuid.u,
+                .access_cb = file_changes_access,
+                .val_handle = &file_changes_handle,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY,
+            },
+            {
+                // File Batch - multi-delete/rename/move with per-item status
+                .uuid = &file_batch_uuid.u,
+                .access_cb = file_batch_access,
+                .val_handle = &file_batch_handle,
+                .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY,
+            },
+            { 0 } // Terminator
+        },
+    },
+    // Device Service
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &device_svc_uuid.u,
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            {
+                // Device Status - playback, volume, track and power, notified on change
+                .uuid = &device_status_uuid.u,
+                .access_cb = device_status_access,
+                .val_handle = &device_status_handle,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+            },
+            { 0 } // Terminator
+        },
+    },
+    // Audio Control Service
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &audio_svc_uuid.u,
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            {
+                // Audio Command - queued playback commands, acked by notify;
+                // read returns command latency statistics
+                .uuid = &audio_cmd_uuid.u,
+                .access_cb = audio_cmd_access,
+                .val_handle = &audio_cmd_handle,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |
+                         BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_NOTIFY,
+            },
+            { 0 } // Terminator
+        },
+    },
+    // Control Service
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &control_svc_uuid.u,
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            {
+                // RPC - pipelined requests with IDs, answered by notify;
+                // read returns response latency statistics
+                .uuid = &rpc_uuid.u,
+                .access_cb = rpc_access,
+                .val_handle = &rpc_handle,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |
+                         BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_NOTIFY,
+            },
             { 0 } // Terminator
         },
     },
@@ -174,12 +343,20 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
 
 // ============ Access Callbacks ============
 
+// Gate for every authenticated request; also times the first one
+static bool command_allowed(uint16_t conn_handle) {
+    ble_conn_note_command(conn_handle);
+    return ble_auth_is_authenticated(conn_handle);
+}
+
 static int auth_key_write_access(uint16_t conn_handle, uint16_t attr_handle,
                                   struct ble_gatt_access_ctxt *ctxt, void *arg) {
     if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
         return BLE_ATT_ERR_UNLIKELY;
     }
 
+    ble_conn_note_command(conn_handle);
+
     uint16_t len = OS_MBUF_PKTLEN(ctxt->om);
     if (len != BLE_AUTH_KEY_SIZE) {
         ESP_LOGW(TAG, "Invalid auth key length: %d (expected %d)", len, BLE_AUTH_KEY_SIZE);
@@ -192,8 +369,13 @@ static int auth_key_write_access(uint16_t conn_handle, uint16_t attr_handle,
         return BLE_ATT_ERR_UNLIKELY;
     }
 
-    bool success = ble_auth_check_key(key, len);
-    ESP_LOGI(TAG, "Auth key write: %s", success ? "SUCCESS" : "FAILED");
+    bool success = ble_auth_check_key(conn_handle, key, len);
+    ESP_LOGI(TAG, "Auth key write (conn %d): %s, %lu ms after connect", conn_handle,
+             success ? "SUCCESS" : "FAILED", (unsigned long)ble_conn_age_ms(conn_handle));
+
+    if (success) {
+        ble_bond_on_authenticated(conn_handle);
+    }
 
     // Notify auth status change
     ble_gatt_notify_auth_status();
@@ -207,7 +389,7 @@ static int auth_status_access(uint16_t conn_handle, uint16_t attr_handle,
         return BLE_ATT_ERR_UNLIKELY;
     }
 
-    uint8_t status = ble_auth_get_status_byte();
+    uint8_t status = ble_auth_get_status_byte(conn_handle);
     int rc = os_mbuf_append(ctxt->om, &status, sizeof(status));
     if (rc != 0) {
         return BLE_ATT_ERR_INSUFFICIENT_RES;
@@ -225,12 +407,12 @@ static int auth_key_clear_access(uint16_t conn_handle, uint16_t attr_handle,
         return BLE_ATT_ERR_UNLIKELY;
     }
 
-    if (!ble_auth_is_authenticated()) {
+    if (!command_allowed(conn_handle)) {
         ESP_LOGW(TAG, "Key clear rejected - not authenticated");
         return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
     }
 
-    esp_err_t err = ble_auth_clear_key();
+    esp_err_t err = ble_auth_clear_key(conn_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to clear auth key");
         return BLE_ATT_ERR_UNLIKELY;
@@ -238,6 +420,60 @@ static int auth_key_clear_access(uint16_t conn_handle, uint16_t attr_handle,
 
     ESP_LOGI(TAG, "Auth key cleared - device now in first-pairing mode");
 
+    // Bonds were only kept to resume sessions under the old key
+    ble_bond_forget_all();
+
+    // Notify auth status change
+    ble_gatt_notify_auth_status();
+
+    return 0;
+}
+
+static int auth_resume_access(uint16_t conn_handle, uint16_t attr_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+        if (!command_allowed(conn_handle)) {
+            return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+        }
+
+        // [token:16][valid_s:2]
+        uint8_t data[BLE_AUTH_TOKEN_SIZE + 2];
+        uint16_t valid_s;
+        if (ble_auth_issue_token(conn_handle, data, &valid_s) != ESP_OK) {
+            // First-pairing mode: nothing to resume
+            return BLE_ATT_ERR_UNLIKELY;
+        }
+        data[BLE_AUTH_TOKEN_SIZE + 0] = (valid_s >> 0) & 0xFF;
+        data[BLE_AUTH_TOKEN_SIZE + 1] = (valid_s >> 8) & 0xFF;
+
+        int rc = os_mbuf_append(ctxt->om, data, sizeof(data));
+        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    // Usually a Write Without Response followed at once by the first real
+    // request; ATT handles them in order, so that request is authenticated
+    ble_conn_note_command(conn_handle);
+
+    uint16_t len = OS_MBUF_PKTLEN(ctxt->om);
+    if (len != BLE_AUTH_TOKEN_SIZE) {
+        ESP_LOGW(TAG, "Invalid resume token length: %d", len);
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    uint8_t token[BLE_AUTH_TOKEN_SIZE];
+    int rc = ble_hs_mbuf_to_flat(ctxt->om, token, len, NULL);
+    if (rc != 0) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    bool success = ble_auth_check_token(conn_handle, token, len);
+    ESP_LOGI(TAG, "Auth resume (conn %d): %s, %lu ms after connect", conn_handle,
+             success ? "SUCCESS" : "FAILED", (unsigned long)ble_conn_age_ms(conn_handle));
+
     // Notify auth status change
     ble_gatt_notify_auth_status();
 
@@ -246,24 +482,55 @@ static int auth_key_clear_access(uint16_t conn_handle, uint16_t attr_handle,
 
 static int file_list_access(uint16_t conn_handle, uint16_t attr_handle,
                              struct ble_gatt_access_ctxt *ctxt, void *arg) {
-    if (!ble_auth_is_authenticated()) {
+    if (!command_allowed(conn_handle)) {
         ESP_LOGW(TAG, "File list rejected - not authenticated");
         return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
     }
 
     if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
-        // Trigger async file listing via notifications
-        ble_gatt_send_file_list(conn_handle);
+        // Original behaviour: whole list, one entry per notification
+        ble_file_list_req_t req = {
+            .sort = BLE_FILE_LIST_SORT_NONE,
+            .packed = false,
+        };
+        ble_gatt_send_file_list(conn_handle, &req);
         // Return empty for initial read
         return 0;
     }
 
+    if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+        // Paged request: [start:2][count:2][sort:1 optional][flags:1 optional],
+        // packed replies
+        uint8_t buf[BLE_FILE_LIST_REQ_MAX_LEN];
+        uint16_t len = 0;
+
+        int rc = ble_hs_mbuf_to_flat(ctxt->om, buf, sizeof(buf), &len);
+        if (rc != 0) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+
+        ble_file_list_req_t req;
+        esp_err_t err = ble_file_list_parse(buf, len, &req);
+        if (err == ESP_ERR_INVALID_SIZE) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "File list: unknown sort key 0x%02x", req.sort);
+            return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+        }
+
+        if (ble_gatt_send_file_list(conn_handle, &req) != ESP_OK) {
+            return BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+        return 0;
+    }
+
     return BLE_ATT_ERR_UNLIKELY;
 }
 
 static int file_delete_access(uint16_t conn_handle, uint16_t attr_handle,
                                struct ble_gatt_access_ctxt *ctxt, void *arg) {
-    if (!ble_auth_is_authenticated()) {
+    if (!command_allowed(conn_handle)) {
         ESP_LOGW(TAG, "File delete rejected - not authenticated");
         return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
     }
@@ -293,23 +560,37 @@ static int file_delete_access(uint16_t conn_handle, uint16_t attr_handle,
         snprintf(full_path, sizeof(full_path), "/Storage/%s", path);
     }
 
+    if (audio_is_file_in_use(full_path) || ble_transfer_is_file_in_use(full_path)) {
+        ESP_LOGW(TAG, "File in use, not deleted: %s", full_path);
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
     ESP_LOGI(TAG, "Deleting file: %s", full_path);
 
-    if (unlink(full_path) != 0) {
+    if (storage_delete_file(full_path) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to delete file: %s", full_path);
         return BLE_ATT_ERR_UNLIKELY;
     }
 
-    // Rescan playlist
-    playlist_rescan();
+    // Drop it from the playlist
+    playlist_remove(full_path);
 
     ESP_LOGI(TAG, "File deleted successfully: %s", full_path);
     return 0;
 }
 
+// Largest transfer control write (ATT attribute value limit); batch name
+// lists are the only commands that get anywhere near it
+#define TRANSFER_CTRL_MAX_LEN   512
+
+// Transfer Control write, flattened and NUL-terminated by the parser (host
+// task only). Kept off the stack: access callbacks run deep in the host's
+// call chain. The command is consumed before the callback returns.
+static uint8_t transfer_ctrl_buf[TRANSFER_CTRL_MAX_LEN + 1];
+
 static int transfer_ctrl_access(uint16_t conn_handle, uint16_t attr_handle,
                                  struct ble_gatt_access_ctxt *ctxt, void *arg) {
-    if (!ble_auth_is_authenticated()) {
+    if (!command_allowed(conn_handle)) {
         ESP_LOGW(TAG, "Transfer ctrl rejected - not authenticated");
         return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
     }
@@ -323,66 +604,38 @@ static int transfer_ctrl_access(uint16_t conn_handle, uint16_t attr_handle,
         return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
     }
 
-    uint8_t buf[256];
-    int rc = ble_hs_mbuf_to_flat(ctxt->om, buf, sizeof(buf) - 1, NULL);
+    int rc = ble_hs_mbuf_to_flat(ctxt->om, transfer_ctrl_buf, sizeof(transfer_ctrl_buf) - 1, NULL);
     if (rc != 0) {
         return BLE_ATT_ERR_UNLIKELY;
     }
 
-    uint8_t opcode = buf[0];
-
-    if (opcode == BLE_TRANSFER_OP_CANCEL) {
-        ble_transfer_cancel();
-    } else if (opcode == BLE_TRANSFER_OP_UPLOAD) {
-        // Upload: [0x01][size:4][filename\0]
-        if (len < 6) {
-            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
-        }
-        uint32_t size = buf[1] | (buf[2] << 8) | (buf[3] << 16) | (buf[4] << 24);
-        char *filename = (char *)&buf[5];
-        filename[len - 5] = '\0';  // Ensure null termination
-
-        ble_transfer_start_upload(filename, size, conn_handle);
-    } else if (opcode == BLE_TRANSFER_OP_DOWNLOAD) {
-        // Download: [0x02][filename\0]
-        if (len < 2) {
-            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
-        }
-        char *filename = (char *)&buf[1];
-        filename[len - 1] = '\0';
-
-        ble_transfer_start_download(filename, conn_handle);
-    } else {
+    ble_xfer_cmd_t cmd;
+    rc = ble_xfer_parse_command(transfer_ctrl_buf, len, &cmd);
+    if (rc == BLE_XFER_PARSE_BAD_OPCODE) {
         return BLE_ATT_ERR_UNLIKELY;
     }
+    if (rc != BLE_XFER_PARSE_OK) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
 
+    ble_transfer_command(conn_handle, &cmd);
     return 0;
 }
 
 static int transfer_data_access(uint16_t conn_handle, uint16_t attr_handle,
                                  struct ble_gatt_access_ctxt *ctxt, void *arg) {
-    if (!ble_auth_is_authenticated()) {
+    if (!command_allowed(conn_handle)) {
         return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
     }
 
     if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
-        // Download: app reads chunk data
-        const uint8_t *chunk_data;
-        size_t chunk_len;
-
-        esp_err_t err = ble_transfer_get_chunk_data(&chunk_data, &chunk_len);
+        // Download: the chunk's mbufs go into the response, then the next
+        // chunk is prepared (will notify when ready)
+        esp_err_t err = ble_transfer_read_chunk(conn_handle, ctxt->om);
         if (err != ESP_OK) {
             return BLE_ATT_ERR_UNLIKELY;
         }
 
-        int rc = os_mbuf_append(ctxt->om, chunk_data, chunk_len);
-        if (rc != 0) {
-            return BLE_ATT_ERR_INSUFFICIENT_RES;
-        }
-
-        // Mark chunk as read and prepare next (will notify when ready)
-        ble_transfer_chunk_read_complete();
-
         return 0;
     }
 
@@ -394,13 +647,8 @@ static int transfer_data_access(uint16_t conn_handle, uint16_t attr_handle,
             return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
         }
 
-        uint8_t data[BLE_TRANSFER_CHUNK_SIZE + 1];
-        int rc = ble_hs_mbuf_to_flat(ctxt->om, data, len, NULL);
-        if (rc != 0) {
-            return BLE_ATT_ERR_UNLIKELY;
-        }
-
-        esp_err_t err = ble_transfer_receive_chunk(data, len);
+        // Written to the file straight from the mbuf chain
+        esp_err_t err = ble_transfer_receive_chunk(conn_handle, ctxt->om);
         if (err != ESP_OK) {
             return BLE_ATT_ERR_UNLIKELY;
         }
@@ -413,7 +661,7 @@ static int transfer_data_access(uint16_t conn_handle, uint16_t attr_handle,
 
 static int transfer_progress_access(uint16_t conn_handle, uint16_t attr_handle,
                                      struct ble_gatt_access_ctxt *ctxt, void *arg) {
-    if (!ble_auth_is_authenticated()) {
+    if (!command_allowed(conn_handle)) {
         return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
     }
 
@@ -421,8 +669,8 @@ static int transfer_progress_access(uint16_t conn_handle, uint16_t attr_handle,
         return BLE_ATT_ERR_UNLIKELY;
     }
 
-    uint32_t transferred = ble_transfer_get_progress();
-    uint32_t total = ble_transfer_get_total();
+    uint32_t transferred = ble_transfer_get_progress(conn_handle);
+    uint32_t total = ble_transfer_get_total(conn_handle);
 
     // Format: [transferred:4][total:4]
     uint8_t data[8];
@@ -443,6 +691,267 @@ static int transfer_progress_access(uint16_t conn_handle, uint16_t attr_handle,
     return 0;
 }
 
+// Format: [profile:1][tx_phy:1][rx_phy:1][interval:2][latency:2]
+//         [timeout:2][tx_octets:2][rx_octets:2][mtu:2]
+static void pack_link_diag(uint16_t conn_handle, uint8_t data[BLE_LINK_DIAG_SIZE]) {
+    ble_link_info_t info;
+    ble_link_get_info(conn_handle, &info);
+
+    data[0] = info.profile;
+    data[1] = info.tx_phy;
+    data[2] = info.rx_phy;
+    data[3] = (info.conn_itvl >> 0) & 0xFF;
+    data[4] = (info.conn_itvl >> 8) & 0xFF;
+    data[5] = (info.conn_latency >> 0) & 0xFF;
+    data[6] = (info.conn_latency >> 8) & 0xFF;
+    data[7] = (info.supervision_timeout >> 0) & 0xFF;
+    data[8] = (info.supervision_timeout >> 8) & 0xFF;
+    data[9] = (info.max_tx_octets >> 0) & 0xFF;
+    data[10] = (info.max_tx_octets >> 8) & 0xFF;
+    data[11] = (info.max_rx_octets >> 0) & 0xFF;
+    data[12] = (info.max_rx_octets >> 8) & 0xFF;
+    data[13] = (info.mtu >> 0) & 0xFF;
+    data[14] = (info.mtu >> 8) & 0xFF;
+}
+
+static int link_diag_access(uint16_t conn_handle, uint16_t attr_handle,
+                            struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    if (!command_allowed(conn_handle)) {
+        return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+    }
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    uint8_t data[BLE_LINK_DIAG_SIZE];
+    pack_link_diag(conn_handle, data);
+
+    int rc = os_mbuf_append(ctxt->om, data, sizeof(data));
+    if (rc != 0) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    return 0;
+}
+
+// Format: [state:1][flags:1][bytes:4][elapsed_ms:4][avg_bps:4][inst_bps:4]
+//         [chunks:4][io_ms:4][wait_ms:4][notify_fail:2][buffered:2][buf_flags:1]
+//         [mtu:2][tx_phy:1][rx_phy:1][interval:2][queue_max:1][queue_drops:2]
+//         [active:1][aggregate_bps:4]
+// The link and transfer fields are this connection's, the last two cover
+// all connections
+static void pack_transfer_telemetry(uint16_t conn_handle,
+                                    uint8_t data[BLE_TRANSFER_TELEMETRY_SIZE]) {
+    ble_transfer_telemetry_t t;
+    ble_link_info_t info;
+    ble_transfer_get_telemetry(conn_handle, &t);
+    ble_link_get_info(conn_handle, &info);
+
+    data[0] = t.state;
+    data[1] = t.flags;
+    put_le32(&data[2], t.bytes);
+    put_le32(&data[6], t.elapsed_ms);
+    put_le32(&data[10], t.avg_bps);
+    put_le32(&data[14], t.inst_bps);
+    put_le32(&data[18], t.chunks);
+    put_le32(&data[22], t.io_ms);
+    put_le32(&data[26], t.wait_ms);
+    put_le16(&data[30], t.notify_failures);
+    put_le16(&data[32], t.buffered);
+    data[34] = t.buf_flags;
+    put_le16(&data[35], info.mtu);
+    data[37] = info.tx_phy;
+    data[38] = info.rx_phy;
+    put_le16(&data[39], info.conn_itvl);
+    data[41] = t.queue_max;
+    put_le16(&data[42], t.queue_drops);
+    data[44] = t.active_transfers;
+    put_le32(&data[45], t.aggregate_bps);
+}
+
+static int transfer_telemetry_access(uint16_t conn_handle, uint16_t attr_handle,
+                                     struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    if (!command_allowed(conn_handle)) {
+        return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+    }
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    uint8_t data[BLE_TRANSFER_TELEMETRY_SIZE];
+    pack_transfer_telemetry(conn_handle, data);
+
+    int rc = os_mbuf_append(ctxt->om, data, sizeof(data));
+    if (rc != 0) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    return 0;
+}
+
+static int file_changes_access(uint16_t conn_handle, uint16_t attr_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    if (!command_allowed(conn_handle)) {
+        return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+    }
+
+    if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+        // Format: [epoch:4][generation:4]
+        uint32_t epoch;
+        uint32_t generation;
+        uint8_t data[BLE_FILE_CHANGES_REQ_LEN];
+
+        storage_journal_get(&epoch, &generation);
+        put_le32(&data[0], epoch);
+        put_le32(&data[4], generation);
+
+        int rc = os_mbuf_append(ctxt->om, data, sizeof(data));
+        return (rc == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+        // Changes since: [epoch:4][generation:4]
+        uint8_t buf[BLE_FILE_CHANGES_REQ_LEN];
+        uint16_t len = 0;
+
+        int rc = ble_hs_mbuf_to_flat(ctxt->om, buf, sizeof(buf), &len);
+        if (rc != 0 || len != BLE_FILE_CHANGES_REQ_LEN) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+
+        uint32_t epoch = get_le32(buf);
+        uint32_t generation = get_le32(buf + 4);
+
+        if (ble_file_list_send_changes(conn_handle, file_changes_handle, file_list_handle,
+                                       epoch, generation) != ESP_OK) {
+            return BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+        return 0;
+    }
+
+    return BLE_ATT_ERR_UNLIKELY;
+}
+
+static int file_batch_access(uint16_t conn_handle, uint16_t attr_handle,
+                             struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    if (!command_allowed(conn_handle)) {
+        return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+    }
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    // Batch: [seq:1][flags:1][operations...]
+    uint16_t len = 0;
+    int rc = ble_hs_mbuf_to_flat(ctxt->om, file_batch_buf, sizeof(file_batch_buf), &len);
+    if (rc != 0) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    esp_err_t err = ble_file_ops_write(conn_handle, file_batch_handle, file_batch_buf, len);
+    switch (err) {
+    case ESP_OK:
+        return 0;
+    case ESP_ERR_INVALID_SIZE:
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    case ESP_ERR_INVALID_ARG:
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    default:
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+}
+
+static int device_status_access(uint16_t conn_handle, uint16_t attr_handle,
+                                struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    if (!command_allowed(conn_handle)) {
+        return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+    }
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    // Cached values only - reads never wait on the ADC
+    uint8_t data[BLE_DEVICE_STATUS_SIZE];
+    ble_status_pack(data, 0);
+
+    int rc = os_mbuf_append(ctxt->om, data, sizeof(data));
+    if (rc != 0) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    return 0;
+}
+
+static int audio_cmd_access(uint16_t conn_handle, uint16_t attr_handle,
+                            struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    if (!command_allowed(conn_handle)) {
+        return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+    }
+
+    if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+        uint8_t data[BLE_AUDIO_STATS_SIZE];
+        ble_audio_ctrl_pack_stats(data);
+
+        int rc = os_mbuf_append(ctxt->om, data, sizeof(data));
+        return (rc == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    // Command: [req_id:1][cmd:1][args]; queued, acked once it has run
+    uint8_t buf[8];
+    uint16_t len = 0;
+    int rc = ble_hs_mbuf_to_flat(ctxt->om, buf, sizeof(buf), &len);
+    if (rc != 0) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    if (ble_audio_ctrl_write(conn_handle, audio_cmd_handle, buf, len) != ESP_OK) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+    return 0;
+}
+
+static int rpc_access(uint16_t conn_handle, uint16_t attr_handle,
+                      struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    // Authentication is checked per request; AUTH itself comes in here
+    ble_conn_note_command(conn_handle);
+
+    if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+        if (!ble_auth_is_authenticated(conn_handle)) {
+            return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+        }
+
+        uint8_t data[BLE_RPC_STATS_SIZE];
+        ble_rpc_pack_stats(data);
+
+        int rc = os_mbuf_append(ctxt->om, data, sizeof(data));
+        return (rc == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    // Requests: [id:2][method:1][len:2][payload] repeated
+    uint16_t len = 0;
+    int rc = ble_hs_mbuf_to_flat(ctxt->om, rpc_buf, sizeof(rpc_buf), &len);
+    if (rc != 0) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    if (ble_rpc_write(conn_handle, rpc_handle, rpc_buf, len) != ESP_OK) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+    return 0;
+}
+
 // ============ Public Functions ============
 
 int ble_gatt_svr_init(void) {
@@ -473,6 +982,8 @@ int ble_gatt_svr_init(void) {
 void ble_gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
     char buf[BLE_UUID_STR_LEN];
 
+    ble_bond_gatt_register(ctxt);
+
     switch (ctxt->op) {
     case BLE_GATT_REGISTER_OP_SVC:
         ESP_LOGD(TAG, "Registered service: %s, handle=%d",
@@ -498,94 +1009,61 @@ void ble_gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
     }
 }
 
-// File listing callback context
-typedef struct {
-    uint16_t conn_handle;
-    int count;
-} file_list_ctx_t;
-
-static void file_list_callback(const char *file_path, void *user_data) {
-    file_list_ctx_t *ctx = (file_list_ctx_t *)user_data;
+esp_err_t ble_gatt_send_file_list(uint16_t conn_handle, const ble_file_list_req_t *req) {
+    return ble_file_list_send(conn_handle, file_list_handle, req);
+}
 
-    struct stat st;
-    if (stat(file_path, &st) != 0) {
-        return;
-    }
+void ble_gatt_on_connect(uint16_t conn_handle) {
+    // Update transfer module with handles
+    ble_transfer_set_handles(transfer_ctrl_handle, transfer_data_handle,
+                              transfer_progress_handle);
+}
 
-    // Extract just the filename from full path
-    const char *filename = strrchr(file_path, '/');
-    filename = filename ? filename + 1 : file_path;
+void ble_gatt_notify_auth_status(void) {
+    // Key changes affect every connection; each gets its own status
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        uint16_t conn_handle = ble_conn_handle(i);
+        if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+            continue;
+        }
 
-    // Format: [type:1][size:4][filename\0]
-    size_t name_len = strlen(filename) + 1;  // Include null terminator
-    size_t entry_len = 1 + 4 + name_len;
-    uint8_t *entry = malloc(entry_len);
-    if (!entry) {
-        return;
+        uint8_t status = ble_auth_get_status_byte(conn_handle);
+        ble_notify_send(conn_handle, auth_status_handle, &status, 1, BLE_NOTIFY_CTRL);
     }
+}
 
-    entry[0] = S_ISDIR(st.st_mode) ? BLE_FILE_TYPE_DIRECTORY : BLE_FILE_TYPE_FILE;
-    entry[1] = (st.st_size >> 0) & 0xFF;
-    entry[2] = (st.st_size >> 8) & 0xFF;
-    entry[3] = (st.st_size >> 16) & 0xFF;
-    entry[4] = (st.st_size >> 24) & 0xFF;
-    memcpy(&entry[5], filename, name_len);
-
-    // Send notification
-    struct os_mbuf *om = ble_hs_mbuf_from_flat(entry, entry_len);
-    if (om) {
-        ble_gatts_notify_custom(ctx->conn_handle, file_list_handle, om);
+void ble_gatt_notify_link_diag(uint16_t conn_handle) {
+    if (!ble_auth_is_authenticated(conn_handle)) {
+        return;
     }
 
-    free(entry);
-    ctx->count++;
+    uint8_t data[BLE_LINK_DIAG_SIZE];
+    pack_link_diag(conn_handle, data);
+    ble_notify_send(conn_handle, link_diag_handle, data, sizeof(data), BLE_NOTIFY_PROGRESS);
 }
 
-esp_err_t ble_gatt_send_file_list(uint16_t conn_handle) {
-    file_list_ctx_t ctx = {
-        .conn_handle = conn_handle,
-        .count = 0
-    };
-
-    // Get base path
-    char base_path[32];
-    get_base_path(base_path, sizeof(base_path));
-
-    // Scan files and send notifications
-    storage_scan_audio_files(file_list_callback, &ctx);
-
-    // Send end marker
-    uint8_t end_marker[5] = {BLE_FILE_TYPE_END, 0, 0, 0, 0};
-    struct os_mbuf *om = ble_hs_mbuf_from_flat(end_marker, sizeof(end_marker));
-    if (om) {
-        ble_gatts_notify_custom(conn_handle, file_list_handle, om);
+void ble_gatt_notify_transfer_telemetry(uint16_t conn_handle) {
+    if (!ble_auth_is_authenticated(conn_handle)) {
+        return;
     }
 
-    ESP_LOGI(TAG, "File list sent: %d files", ctx.count);
-    return ESP_OK;
-}
-
-uint16_t ble_gatt_get_conn_handle(void) {
-    return current_conn_handle;
+    uint8_t data[BLE_TRANSFER_TELEMETRY_SIZE];
+    pack_transfer_telemetry(conn_handle, data);
+    ble_notify_send(conn_handle, transfer_telemetry_handle, data, sizeof(data),
+                    BLE_NOTIFY_PROGRESS);
 }
 
-void ble_gatt_set_conn_handle(uint16_t conn_handle) {
-    current_conn_handle = conn_handle;
+void ble_gatt_notify_device_status(uint8_t changed) {
+    uint8_t data[BLE_DEVICE_STATUS_SIZE];
+    ble_status_pack(data, changed);
 
-    // Update transfer module with handles
-    ble_transfer_set_handles(transfer_ctrl_handle, transfer_data_handle,
-                              transfer_progress_handle);
-}
-
-void ble_gatt_notify_auth_status(void) {
-    if (current_conn_handle == BLE_HS_CONN_HANDLE_NONE) {
-        return;
-    }
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        uint16_t conn_handle = ble_conn_handle(i);
+        if (!ble_auth_is_authenticated(conn_handle)) {
+            continue;
+        }
 
-    uint8_t status = ble_auth_get_status_byte();
-    struct os_mbuf *om = ble_hs_mbuf_from_flat(&status, 1);
-    if (om) {
-        ble_gatts_notify_custom(current_conn_handle, auth_status_handle, om);
+        ble_notify_send(conn_handle, device_status_handle, data, sizeof(data), BLE_NOTIFY_CTRL);
     }
 }
 
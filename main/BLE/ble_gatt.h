@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <esp_err.h>
 #include <host/ble_hs.h>
+#include "ble_file_list.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,29 +29,26 @@ void ble_gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
 /**
  * @brief Start sending file list notifications
  *
- * Sends file entries one by one via notifications on the file list characteristic.
+ * Sends one page of file entries via notifications on the file list
+ * characteristic. See ble_file_list_send().
  *
  * @param conn_handle BLE connection handle
+ * @param req Page, sort key and packing
  * @return ESP_OK on success
  */
-esp_err_t ble_gatt_send_file_list(uint16_t conn_handle);
+esp_err_t ble_gatt_send_file_list(uint16_t conn_handle, const ble_file_list_req_t *req);
 
 /**
- * @brief Get the current BLE connection handle
- *
- * @return Connection handle, or BLE_HS_CONN_HANDLE_NONE if not connected
- */
-uint16_t ble_gatt_get_conn_handle(void);
-
-/**
- * @brief Set the current BLE connection handle
+ * @brief Set up GATT state for a new connection
  *
  * @param conn_handle New connection handle
  */
-void ble_gatt_set_conn_handle(uint16_t conn_handle);
+void ble_gatt_on_connect(uint16_t conn_handle);
 
 /**
- * @brief Notify authentication status change
+ * @brief Notify authentication status to every connection
+ *
+ * Each connection is sent its own session's status.
  */
 void ble_gatt_notify_auth_status(void);
 
@@ -61,6 +59,28 @@ void ble_gatt_notify_auth_status(void);
  */
 void ble_gatt_update_battery_level(uint8_t level);
 
+/**
+ * @brief Notify a connection's link parameters on the diagnostics characteristic
+ *
+ * @param conn_handle BLE connection handle; skipped if not authenticated
+ */
+void ble_gatt_notify_link_diag(uint16_t conn_handle);
+
+/**
+ * @brief Notify a connection's transfer telemetry on the telemetry characteristic
+ *
+ * @param conn_handle BLE connection handle; skipped if not authenticated
+ */
+void ble_gatt_notify_transfer_telemetry(uint16_t conn_handle);
+
+/**
+ * @brief Notify the Device Status characteristic to every authenticated
+ *        connection
+ *
+ * @param changed DEVICE_STATUS_* bits that changed since the last notification
+ */
+void ble_gatt_notify_device_status(uint8_t changed);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,37 @@
+#ifndef BLE_LE_H
+#define BLE_LE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Little-endian field access for the wire formats of the custom services.
+// Byte-wise, so the pointers need no alignment. Plain C (test/host uses it).
+
+static inline void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = (v >> 0) & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (v >> 0) & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static inline uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_LE_H
@@ -0,0 +1,239 @@
+#include "ble_link.h"
+#include "ble_gatt.h"
+#include "ble_conn.h"
+
+#include <string.h>
+#include <esp_log.h>
+
+#include <host/ble_hs.h>
+#include <host/ble_gap.h>
+#include <host/ble_att.h>
+
+static const char *TAG = "BLE_LINK";
+
+// Default profile: 7.5-15ms interval for responsive request/response traffic.
+// Supervision timeout: 4s (400 * 10ms)
+#define LINK_ITVL_MIN           6       // 7.5ms (fastest allowed)
+#define LINK_ITVL_MAX           12      // 15ms
+#define LINK_LATENCY            0       // No peripheral latency for fastest response
+#define LINK_SUPERVISION_TMO    400     // 4 seconds
+
+// Bulk profile keeps the same interval (every chunk is a request/response
+// round trip, so a shorter interval wins) but lets the controller use the
+// whole interval for the connection event (CE length is in 0.625ms units).
+#define LINK_BULK_MIN_CE_LEN    0
+#define LINK_BULK_MAX_CE_LEN    (LINK_ITVL_MAX * 2)
+
+// Link state, one per connection slot
+typedef struct {
+    uint16_t conn_handle;
+    ble_link_profile_t wanted;      // Profile last asked for by the app
+    ble_link_profile_t requested;   // Profile of the in-flight/last update
+    bool update_pending;            // Connection update procedure in flight
+    bool dle_requested;             // DLE only needs requesting once per link
+    ble_link_info_t info;
+} link_t;
+
+static link_t links[BLE_MAX_CONNECTIONS];
+
+// ============ Internal Functions ============
+
+static link_t *link_get(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot < 0 || links[slot].conn_handle != conn_handle) {
+        return NULL;
+    }
+    return &links[slot];
+}
+
+static void refresh_conn_params(link_t *link) {
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(link->conn_handle, &desc) == 0) {
+        link->info.conn_itvl = desc.conn_itvl;
+        link->info.conn_latency = desc.conn_latency;
+        link->info.supervision_timeout = desc.supervision_timeout;
+    }
+}
+
+static void request_conn_params(link_t *link, ble_link_profile_t profile) {
+    struct ble_gap_upd_params params = {
+        .itvl_min = LINK_ITVL_MIN,
+        .itvl_max = LINK_ITVL_MAX,
+        .latency = LINK_LATENCY,
+        .supervision_timeout = LINK_SUPERVISION_TMO,
+        .min_ce_len = 0,
+        .max_ce_len = 0,
+    };
+
+    if (profile == BLE_LINK_PROFILE_BULK) {
+        params.min_ce_len = LINK_BULK_MIN_CE_LEN;
+        params.max_ce_len = LINK_BULK_MAX_CE_LEN;
+    }
+
+    int rc = ble_gap_update_params(link->conn_handle, &params);
+    if (rc == BLE_HS_EALREADY) {
+        // Another update is running; re-request when it completes
+        link->update_pending = true;
+        return;
+    }
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Failed to request connection param update: %d", rc);
+        return;
+    }
+
+    link->requested = profile;
+    link->update_pending = true;
+    ESP_LOGI(TAG, "Conn %d: requested %s connection parameters (7.5-15ms interval, CE up to %dms)",
+             link->conn_handle, profile == BLE_LINK_PROFILE_BULK ? "bulk" : "default",
+             params.max_ce_len * 625 / 1000);
+}
+
+static void request_bulk_phy_and_dle(link_t *link) {
+    // 2M PHY halves the air time per packet
+    int rc = ble_gap_set_prefered_le_phy(link->conn_handle,
+                                         BLE_GAP_LE_PHY_2M_MASK,
+                                         BLE_GAP_LE_PHY_2M_MASK,
+                                         BLE_GAP_LE_PHY_CODED_ANY);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Failed to request 2M PHY: %d", rc);
+    }
+
+    // Data length extension: one 251-byte LL PDU instead of 27-byte fragments
+    if (!link->dle_requested) {
+        rc = ble_gap_set_data_len(link->conn_handle, BLE_LINK_MAX_TX_OCTETS,
+                                  BLE_LINK_MAX_TX_TIME);
+        if (rc != 0) {
+            ESP_LOGW(TAG, "Failed to request data length %d: %d",
+                     BLE_LINK_MAX_TX_OCTETS, rc);
+        } else {
+            link->dle_requested = true;
+        }
+    }
+}
+
+// ============ Public Functions ============
+
+void ble_link_on_connect(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot < 0) {
+        return;
+    }
+
+    link_t *link = &links[slot];
+    memset(link, 0, sizeof(*link));
+    link->conn_handle = conn_handle;
+    link->wanted = BLE_LINK_PROFILE_DEFAULT;
+
+    // Until the controller reports otherwise, a new link is 1M PHY, 27-byte PDUs
+    link->info.tx_phy = BLE_GAP_LE_PHY_1M;
+    link->info.rx_phy = BLE_GAP_LE_PHY_1M;
+    link->info.max_tx_octets = 27;
+    link->info.max_rx_octets = 27;
+    link->info.mtu = ble_att_mtu(conn_handle);
+    refresh_conn_params(link);
+
+    request_conn_params(link, BLE_LINK_PROFILE_DEFAULT);
+}
+
+void ble_link_on_disconnect(uint16_t conn_handle) {
+    link_t *link = link_get(conn_handle);
+    if (link) {
+        memset(link, 0, sizeof(*link));
+        link->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+}
+
+esp_err_t ble_link_set_profile(uint16_t conn_handle, ble_link_profile_t profile) {
+    link_t *link = link_get(conn_handle);
+    if (!link) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (profile == link->wanted) {
+        return ESP_OK;
+    }
+    link->wanted = profile;
+    link->info.profile = profile;
+
+    // PHY and DLE are left in place when the transfer ends: both only
+    // shorten air time, so there is nothing to gain by reverting them
+    if (profile == BLE_LINK_PROFILE_BULK) {
+        request_bulk_phy_and_dle(link);
+    }
+
+    if (!link->update_pending) {
+        request_conn_params(link, profile);
+    }
+
+    ble_gatt_notify_link_diag(conn_handle);
+    return ESP_OK;
+}
+
+void ble_link_on_conn_update(uint16_t conn_handle, int status) {
+    link_t *link = link_get(conn_handle);
+    if (!link) {
+        return;
+    }
+
+    link->update_pending = false;
+    if (status == 0) {
+        refresh_conn_params(link);
+        ESP_LOGI(TAG, "Conn %d params: interval=%d (%.2fms), latency=%d, timeout=%d",
+                 conn_handle, link->info.conn_itvl, link->info.conn_itvl * 1.25,
+                 link->info.conn_latency, link->info.supervision_timeout);
+        ble_gatt_notify_link_diag(conn_handle);
+    }
+
+    // Profile changed while the previous update was in flight
+    if (link->wanted != link->requested) {
+        request_conn_params(link, link->wanted);
+    }
+}
+
+void ble_link_on_phy_update(uint16_t conn_handle, int status,
+                            uint8_t tx_phy, uint8_t rx_phy) {
+    link_t *link = link_get(conn_handle);
+    if (!link || status != 0) {
+        return;
+    }
+
+    link->info.tx_phy = tx_phy;
+    link->info.rx_phy = rx_phy;
+    ESP_LOGI(TAG, "Conn %d PHY updated: tx=%dM rx=%dM", conn_handle,
+             tx_phy == BLE_GAP_LE_PHY_2M ? 2 : 1,
+             rx_phy == BLE_GAP_LE_PHY_2M ? 2 : 1);
+    ble_gatt_notify_link_diag(conn_handle);
+}
+
+void ble_link_on_data_len(uint16_t conn_handle, uint16_t max_tx_octets,
+                          uint16_t max_rx_octets) {
+    link_t *link = link_get(conn_handle);
+    if (!link) {
+        return;
+    }
+
+    link->info.max_tx_octets = max_tx_octets;
+    link->info.max_rx_octets = max_rx_octets;
+    ESP_LOGI(TAG, "Conn %d data length: tx=%d rx=%d octets",
+             conn_handle, max_tx_octets, max_rx_octets);
+    ble_gatt_notify_link_diag(conn_handle);
+}
+
+void ble_link_on_mtu(uint16_t conn_handle, uint16_t mtu) {
+    link_t *link = link_get(conn_handle);
+    if (!link) {
+        return;
+    }
+
+    link->info.mtu = mtu;
+    ble_gatt_notify_link_diag(conn_handle);
+}
+
+void ble_link_get_info(uint16_t conn_handle, ble_link_info_t *info) {
+    link_t *link = link_get(conn_handle);
+    if (!link) {
+        memset(info, 0, sizeof(*info));
+        return;
+    }
+    *info = link->info;
+}
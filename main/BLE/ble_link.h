@@ -0,0 +1,99 @@
+#ifndef BLE_LINK_H
+#define BLE_LINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum LE data length (bytes per LL PDU and time on air in us)
+#define BLE_LINK_MAX_TX_OCTETS  251
+#define BLE_LINK_MAX_TX_TIME    2120
+
+// Diagnostics characteristic value size
+#define BLE_LINK_DIAG_SIZE      15
+
+// Link profiles
+typedef enum {
+    BLE_LINK_PROFILE_DEFAULT = 0,   // Interactive use (lists, auth, commands)
+    BLE_LINK_PROFILE_BULK,          // File transfer: 2M PHY, max DLE, long CE
+} ble_link_profile_t;
+
+// Effective link parameters, as reported by the controller
+typedef struct {
+    uint8_t profile;                // ble_link_profile_t currently requested
+    uint8_t tx_phy;                 // BLE_GAP_LE_PHY_1M / 2M / CODED
+    uint8_t rx_phy;
+    uint16_t conn_itvl;             // Connection interval (1.25 ms units)
+    uint16_t conn_latency;          // Peripheral latency (events)
+    uint16_t supervision_timeout;   // Supervision timeout (10 ms units)
+    uint16_t max_tx_octets;         // LL payload length (DLE)
+    uint16_t max_rx_octets;
+    uint16_t mtu;                   // ATT MTU
+} ble_link_info_t;
+
+/**
+ * @brief Start tracking a new connection and request the default profile
+ *
+ * The connection must already have a slot (ble_conn_add()).
+ *
+ * @param conn_handle BLE connection handle
+ */
+void ble_link_on_connect(uint16_t conn_handle);
+
+/**
+ * @brief Forget a connection
+ *
+ * @param conn_handle BLE connection handle
+ */
+void ble_link_on_disconnect(uint16_t conn_handle);
+
+/**
+ * @brief Switch between the default and bulk-transfer link profiles
+ *
+ * Safe to call for a connection that has gone; the request is dropped.
+ *
+ * @param conn_handle BLE connection handle
+ * @param profile Profile to request
+ * @return ESP_OK if the request was sent or is queued
+ */
+esp_err_t ble_link_set_profile(uint16_t conn_handle, ble_link_profile_t profile);
+
+/**
+ * @brief Handle BLE_GAP_EVENT_CONN_UPDATE
+ */
+void ble_link_on_conn_update(uint16_t conn_handle, int status);
+
+/**
+ * @brief Handle BLE_GAP_EVENT_PHY_UPDATE_COMPLETE
+ */
+void ble_link_on_phy_update(uint16_t conn_handle, int status,
+                            uint8_t tx_phy, uint8_t rx_phy);
+
+/**
+ * @brief Handle BLE_GAP_EVENT_DATA_LEN_CHG
+ */
+void ble_link_on_data_len(uint16_t conn_handle, uint16_t max_tx_octets,
+                          uint16_t max_rx_octets);
+
+/**
+ * @brief Handle BLE_GAP_EVENT_MTU
+ */
+void ble_link_on_mtu(uint16_t conn_handle, uint16_t mtu);
+
+/**
+ * @brief Get a connection's link parameters
+ *
+ * @param conn_handle BLE connection handle
+ * @param[out] info Link parameters (zeroed when not connected)
+ */
+void ble_link_get_info(uint16_t conn_handle, ble_link_info_t *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_LINK_H
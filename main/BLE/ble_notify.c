@@ -0,0 +1,346 @@
+#include "ble_notify.h"
+#include "ble.h"
+
+#include <assert.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <host/ble_hs.h>
+
+static const char *TAG = "BLE_NOTIFY";
+
+// Room left in front of the value for the ATT, L2CAP and HCI headers,
+// so the stack prepends them without taking another mbuf
+#define NOTIFY_LEADING_SPACE    16
+
+typedef struct {
+    uint16_t conn_handle;
+    uint16_t attr_handle;
+    uint8_t prio;
+    uint8_t len;
+    uint8_t data[BLE_NOTIFY_QUEUE_MAX_LEN];
+} pending_t;
+
+// Notify pool (PSRAM)
+static struct os_mempool notify_mempool;
+static struct os_mbuf_pool notify_mbuf_pool;
+static void *notify_mem = NULL;
+
+// Waiting messages, oldest first; guarded by queue_lock, which is held
+// across sends so nothing overtakes what is already waiting
+static pending_t queue[BLE_NOTIFY_QUEUE_LEN];
+static int queue_count = 0;
+static SemaphoreHandle_t queue_lock = NULL;
+static esp_timer_handle_t retry_timer = NULL;
+
+static ble_notify_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// ============ Internal Functions ============
+
+#define STAT_INC(field) do {                \
+        taskENTER_CRITICAL(&stats_lock);    \
+        stats.field++;                      \
+        taskEXIT_CRITICAL(&stats_lock);     \
+    } while (0)
+
+static struct os_mbuf *notify_mbuf(const void *data, size_t len, ble_notify_prio_t prio) {
+    struct os_mbuf *om = NULL;
+
+    // Leave the reserve to control messages
+    if (prio == BLE_NOTIFY_CTRL || notify_mempool.mp_num_free > BLE_NOTIFY_CTRL_RESERVE) {
+        om = os_mbuf_get_pkthdr(&notify_mbuf_pool, 0);
+    }
+    if (om) {
+        om->om_data += NOTIFY_LEADING_SPACE;
+        if (os_mbuf_append(om, data, len) != 0) {
+            os_mbuf_free_chain(om);
+            STAT_INC(alloc_failures);
+            return NULL;
+        }
+        STAT_INC(allocs);
+        return om;
+    }
+
+    // Control messages may still fit in the host's own pools
+    if (prio == BLE_NOTIFY_CTRL) {
+        om = ble_hs_mbuf_from_flat(data, len);
+        if (om) {
+            STAT_INC(alloc_fallbacks);
+            return om;
+        }
+    }
+
+    STAT_INC(alloc_failures);
+    return NULL;
+}
+
+static int send_now(uint16_t conn_handle, uint16_t attr_handle,
+                    const void *data, size_t len, ble_notify_prio_t prio) {
+    struct os_mbuf *om = notify_mbuf(data, len, prio);
+    if (!om) {
+        return BLE_HS_ENOMEM;
+    }
+
+    // Consumes om whatever the outcome; NOTIFY_TX reports it
+    return ble_gatts_notify_custom(conn_handle, attr_handle, om);
+}
+
+static bool queue_has(ble_notify_prio_t prio) {
+    for (int i = 0; i < queue_count; i++) {
+        if (queue[i].prio == prio) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void queue_remove(int index) {
+    memmove(&queue[index], &queue[index + 1], (queue_count - index - 1) * sizeof(pending_t));
+    queue_count--;
+}
+
+// Send the waiting messages of one class in order; false if one still
+// doesn't fit (the rest of the class stays behind it)
+static bool drain_class(ble_notify_prio_t prio) {
+    int i = 0;
+    while (i < queue_count) {
+        pending_t *p = &queue[i];
+        if (p->prio != prio) {
+            i++;
+            continue;
+        }
+
+        int rc = send_now(p->conn_handle, p->attr_handle, p->data, p->len, prio);
+        if (rc == BLE_HS_ENOMEM) {
+            STAT_INC(retries);
+            return false;
+        }
+        if (rc != 0) {
+            ESP_LOGD(TAG, "Queued notify on handle %d dropped: %d", p->attr_handle, rc);
+            STAT_INC(dropped);
+        }
+        queue_remove(i);
+    }
+    return true;
+}
+
+// Control first, then progress
+static void drain_locked(void) {
+    if (queue_count == 0) {
+        return;
+    }
+    if (drain_class(BLE_NOTIFY_CTRL)) {
+        drain_class(BLE_NOTIFY_PROGRESS);
+    }
+    if (queue_count == 0) {
+        esp_timer_stop(retry_timer);
+    }
+}
+
+static int enqueue_locked(uint16_t conn_handle, uint16_t attr_handle,
+                          const void *data, size_t len, ble_notify_prio_t prio) {
+    if (len > BLE_NOTIFY_QUEUE_MAX_LEN) {
+        STAT_INC(dropped);
+        return BLE_HS_ENOMEM;
+    }
+
+    int index = -1;
+
+    // A newer progress value replaces the waiting one
+    if (prio == BLE_NOTIFY_PROGRESS) {
+        for (int i = 0; i < queue_count; i++) {
+            if (queue[i].prio == prio && queue[i].conn_handle == conn_handle &&
+                queue[i].attr_handle == attr_handle) {
+                index = i;
+                STAT_INC(coalesced);
+                break;
+            }
+        }
+    }
+
+    // Full: control messages push out a progress value
+    if (index < 0 && queue_count == BLE_NOTIFY_QUEUE_LEN && prio == BLE_NOTIFY_CTRL) {
+        for (int i = 0; i < queue_count; i++) {
+            if (queue[i].prio == BLE_NOTIFY_PROGRESS) {
+                queue_remove(i);
+                STAT_INC(dropped);
+                break;
+            }
+        }
+    }
+
+    if (index < 0) {
+        if (queue_count == BLE_NOTIFY_QUEUE_LEN) {
+            ESP_LOGW(TAG, "Notify queue full, handle %d dropped", attr_handle);
+            STAT_INC(dropped);
+            return BLE_HS_ENOMEM;
+        }
+        index = queue_count++;
+        STAT_INC(queued);
+    }
+
+    pending_t *p = &queue[index];
+    p->conn_handle = conn_handle;
+    p->attr_handle = attr_handle;
+    p->prio = prio;
+    p->len = len;
+    memcpy(p->data, data, len);
+
+    if (!esp_timer_is_active(retry_timer)) {
+        esp_timer_start_periodic(retry_timer, BLE_NOTIFY_RETRY_MS * 1000);
+    }
+    return 0;
+}
+
+// Timer task: mbufs come back as the controller sends, with no event
+static void retry_timer_callback(void *arg) {
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    drain_locked();
+    xSemaphoreGive(queue_lock);
+}
+
+// ============ Public Functions ============
+
+esp_err_t ble_notify_init(void) {
+    if (notify_mem != NULL) {
+        return ESP_OK;
+    }
+
+    // OS_MEMPOOL_BYTES rounds each block up to the pool's alignment
+    notify_mem = heap_caps_malloc(OS_MEMPOOL_BYTES(BLE_NOTIFY_POOL_BLOCKS,
+                                                   BLE_NOTIFY_POOL_BLOCK_SIZE),
+                                  MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (notify_mem == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate notify pool");
+        return ESP_ERR_NO_MEM;
+    }
+
+    int rc = os_mempool_init(&notify_mempool, BLE_NOTIFY_POOL_BLOCKS,
+                             BLE_NOTIFY_POOL_BLOCK_SIZE, notify_mem, "ble_notify");
+    if (rc == 0) {
+        rc = os_mbuf_pool_init(&notify_mbuf_pool, &notify_mempool,
+                               BLE_NOTIFY_POOL_BLOCK_SIZE, BLE_NOTIFY_POOL_BLOCKS);
+    }
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Failed to initialize notify pool: %d", rc);
+        heap_caps_free(notify_mem);
+        notify_mem = NULL;
+        return ESP_FAIL;
+    }
+
+    queue_lock = xSemaphoreCreateMutex();
+    esp_timer_create_args_t timer_args = {
+        .callback = retry_timer_callback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ble_notify"
+    };
+    if (queue_lock == NULL || esp_timer_create(&timer_args, &retry_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create notify retry timer");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Notify pool: %d x %d bytes in PSRAM",
+             BLE_NOTIFY_POOL_BLOCKS, BLE_NOTIFY_POOL_BLOCK_SIZE);
+    return ESP_OK;
+}
+
+int ble_notify_send(uint16_t conn_handle, uint16_t attr_handle,
+                    const void *data, size_t len, ble_notify_prio_t prio) {
+    if (queue_lock == NULL) {
+        return BLE_HS_ENOMEM;
+    }
+
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+
+    // Earlier messages go first
+    drain_locked();
+
+    int rc;
+    if (prio == BLE_NOTIFY_BULK) {
+        // Behind any waiting control message; the sender retries
+        rc = queue_has(BLE_NOTIFY_CTRL) ? BLE_HS_ENOMEM :
+             send_now(conn_handle, attr_handle, data, len, prio);
+    } else if (queue_has(BLE_NOTIFY_CTRL) ||
+               (prio == BLE_NOTIFY_PROGRESS && queue_has(BLE_NOTIFY_PROGRESS))) {
+        rc = enqueue_locked(conn_handle, attr_handle, data, len, prio);
+    } else {
+        rc = send_now(conn_handle, attr_handle, data, len, prio);
+        if (rc == BLE_HS_ENOMEM) {
+            rc = enqueue_locked(conn_handle, attr_handle, data, len, prio);
+        }
+    }
+
+    xSemaphoreGive(queue_lock);
+    return rc;
+}
+
+int ble_notify_send_wait(uint16_t conn_handle, uint16_t attr_handle,
+                         const void *data, size_t len, uint32_t timeout_ms) {
+    // Sleeping here would stall the task that frees the mbufs
+    assert(!ble_is_host_task());
+
+    int64_t start = esp_timer_get_time();
+
+    while (true) {
+        int rc = ble_notify_send(conn_handle, attr_handle, data, len, BLE_NOTIFY_BULK);
+        if (rc != BLE_HS_ENOMEM ||
+            esp_timer_get_time() - start > (int64_t)timeout_ms * 1000) {
+            return rc;
+        }
+        STAT_INC(retries);
+        vTaskDelay(pdMS_TO_TICKS(BLE_NOTIFY_RETRY_MS));
+    }
+}
+
+void ble_notify_on_tx(int status) {
+    if (status == 0) {
+        STAT_INC(sent);
+    } else {
+        STAT_INC(tx_errors);
+    }
+}
+
+void ble_notify_on_disconnect(uint16_t conn_handle) {
+    if (queue_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    for (int i = queue_count - 1; i >= 0; i--) {
+        if (queue[i].conn_handle == conn_handle) {
+            queue_remove(i);
+        }
+    }
+    if (queue_count == 0) {
+        esp_timer_stop(retry_timer);
+    }
+    xSemaphoreGive(queue_lock);
+}
+
+void ble_notify_get_stats(ble_notify_stats_t *out) {
+    taskENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    out->pool_free = notify_mempool.mp_num_free;
+    out->pool_min_free = notify_mempool.mp_min_free;
+}
+
+void ble_notify_log_stats(void) {
+    ble_notify_stats_t s;
+    ble_notify_get_stats(&s);
+
+    ESP_LOGI(TAG, "Notify: %lu sent, %lu tx errors, %lu allocs (%lu msys, %lu failed), "
+             "%lu retries, %lu queued, %lu coalesced, %lu dropped, pool %u/%d free (min %u)",
+             (unsigned long)s.sent, (unsigned long)s.tx_errors, (unsigned long)s.allocs,
+             (unsigned long)s.alloc_fallbacks, (unsigned long)s.alloc_failures,
+             (unsigned long)s.retries, (unsigned long)s.queued, (unsigned long)s.coalesced,
+             (unsigned long)s.dropped, s.pool_free, BLE_NOTIFY_POOL_BLOCKS, s.pool_min_free);
+}
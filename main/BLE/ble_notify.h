@@ -0,0 +1,121 @@
+#ifndef BLE_NOTIFY_H
+#define BLE_NOTIFY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Notification manager. Every GATT notification goes through here: mbufs
+// come from a dedicated PSRAM pool sized for MTU-sized streaming, and
+// what the stack can't take yet is retried by priority instead of lost.
+
+// Notify pool: blocks hold one MTU-sized notification plus headers
+#define BLE_NOTIFY_POOL_BLOCKS      32
+#define BLE_NOTIFY_POOL_BLOCK_SIZE  576     // 512 MTU + ATT/L2CAP/HCI + mbuf headers
+
+// Blocks only control messages may take, so streaming can't starve them
+#define BLE_NOTIFY_CTRL_RESERVE     4
+
+// Control and progress messages waiting for mbufs
+#define BLE_NOTIFY_QUEUE_LEN        12
+#define BLE_NOTIFY_QUEUE_MAX_LEN    112     // Largest queued value
+#define BLE_NOTIFY_RETRY_MS         10
+
+typedef enum {
+    BLE_NOTIFY_CTRL = 0,    // Responses, status, acks: queued and retried in order
+    BLE_NOTIFY_BULK,        // Listings, batch results: the sender waits and retries
+    BLE_NOTIFY_PROGRESS,    // Progress, telemetry: only the latest value is kept
+} ble_notify_prio_t;
+
+typedef struct {
+    uint32_t allocs;            // mbufs taken from the notify pool
+    uint32_t alloc_fallbacks;   // Control mbufs taken from msys, pool empty
+    uint32_t alloc_failures;    // No mbuf anywhere
+    uint32_t retries;           // Sends tried again after BLE_HS_ENOMEM
+    uint32_t queued;            // Control/progress messages that had to wait
+    uint32_t coalesced;         // Progress values replaced by a newer one
+    uint32_t dropped;           // Queue full, or the stack refused for good
+    uint32_t sent;              // NOTIFY_TX with status 0
+    uint32_t tx_errors;         // NOTIFY_TX with an error
+    uint16_t pool_free;         // Blocks free now (the rest are in flight)
+    uint16_t pool_min_free;     // Low-water mark
+} ble_notify_stats_t;
+
+/**
+ * @brief Create the notify pool and retry timer
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM
+ */
+esp_err_t ble_notify_init(void);
+
+/**
+ * @brief Send a notification without blocking
+ *
+ * Control messages queue behind any control message already waiting and
+ * are retried until sent. A progress message that can't go now replaces
+ * the waiting value for the same characteristic. Bulk messages are not
+ * queued: BLE_HS_ENOMEM tells the sender to try again.
+ *
+ * @param conn_handle BLE connection handle
+ * @param attr_handle Characteristic value handle
+ * @param data Value
+ * @param len Value length
+ * @param prio Priority class
+ * @return 0 if sent or queued, BLE_HS_ENOMEM (bulk only), or the NimBLE
+ *         error that made the stack refuse it
+ */
+int ble_notify_send(uint16_t conn_handle, uint16_t attr_handle,
+                    const void *data, size_t len, ble_notify_prio_t prio);
+
+/**
+ * @brief Send a bulk notification, waiting for mbufs
+ *
+ * For tasks that may block: the storage worker (batch file operation
+ * results) and other worker tasks. Never the NimBLE host task, which frees
+ * the mbufs being waited for; asserted.
+ *
+ * @param conn_handle BLE connection handle
+ * @param attr_handle Characteristic value handle
+ * @param data Value
+ * @param len Value length
+ * @param timeout_ms Longest wait for mbufs
+ * @return 0 if sent, BLE_HS_ENOMEM on timeout, or a NimBLE error
+ */
+int ble_notify_send_wait(uint16_t conn_handle, uint16_t attr_handle,
+                         const void *data, size_t len, uint32_t timeout_ms);
+
+/**
+ * @brief Count the outcome of a notification (BLE_GAP_EVENT_NOTIFY_TX)
+ *
+ * @param status 0 if the notification went to the controller
+ */
+void ble_notify_on_tx(int status);
+
+/**
+ * @brief Drop messages still waiting for a closed connection
+ *
+ * @param conn_handle BLE connection handle
+ */
+void ble_notify_on_disconnect(uint16_t conn_handle);
+
+/**
+ * @brief Copy the counters
+ *
+ * @param[out] stats Counters since boot
+ */
+void ble_notify_get_stats(ble_notify_stats_t *stats);
+
+/**
+ * @brief Log the counters
+ */
+void ble_notify_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_NOTIFY_H
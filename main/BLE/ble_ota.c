@@ -0,0 +1,491 @@
+#include "ble_ota.h"
+#include "ble_delta.h"
+#include "ble_link.h"
+#include "ble_transfer.h"
+#include "../Storage/storage.h"
+
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_heap_caps.h>
+#include <esp_ota_ops.h>
+#include <esp_app_desc.h>
+#include <mbedtls/sha256.h>
+
+#include <host/ble_hs.h>
+#include <nimble/nimble_port.h>
+
+static const char *TAG = "BLE_OTA";
+
+// The update being received; one at a time, there is one inactive slot
+static esp_ota_handle_t ota_handle = 0;
+static const esp_partition_t *ota_partition = NULL;
+static uint16_t ota_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+static uint32_t ota_size = 0;
+static uint32_t ota_written = 0;
+static uint8_t ota_sha256[BLE_OTA_SHA256_SIZE];
+static mbedtls_sha256_context ota_sha;     // Over every byte written (image or patch)
+static int64_t ota_start_us = 0;
+
+// Delta mode: the patch is applied against the running image, and the
+// rebuilt image is hashed on its way into the slot. Patch bytes queue in
+// a backlog and are applied BLE_OTA_DELTA_STEP target bytes at a time,
+// one slice per write and then one per host-task event, so a piece of
+// patch full of COPYs never holds the host task for more than a slice.
+// The running image is hashed a step per slice for the same reason.
+static bool ota_delta = false;
+static bool ota_header_checked = false;
+static ble_delta_t delta;
+static uint8_t *delta_window = NULL;         // Decoder window, then source_buf, then backlog
+static uint8_t *source_buf = NULL;
+static uint8_t *backlog = NULL;              // Patch bytes not yet applied
+static size_t backlog_head = 0;
+static size_t backlog_len = 0;
+static struct ble_npl_event delta_ev;
+static const esp_partition_t *delta_source = NULL;
+static mbedtls_sha256_context target_sha;
+static mbedtls_sha256_context source_sha;
+static uint32_t source_hashed = 0;           // Running image bytes hashed so far
+static bool source_verified = false;
+static int64_t source_hash_us = 0;
+
+static esp_timer_handle_t restart_timer = NULL;
+static bool ota_confirmed = false;
+
+// ============ Internal Functions ============
+
+static void ota_reset(void) {
+    mbedtls_sha256_free(&ota_sha);
+    if (ota_delta) {
+        mbedtls_sha256_free(&target_sha);
+        mbedtls_sha256_free(&source_sha);
+        heap_caps_free(delta_window);
+        delta_window = NULL;
+        source_buf = NULL;
+        backlog = NULL;
+        backlog_head = 0;
+        backlog_len = 0;
+        ble_npl_eventq_remove(nimble_port_get_dflt_eventq(), &delta_ev);
+        delta_source = NULL;
+        ota_delta = false;
+    }
+    ota_handle = 0;
+    ota_partition = NULL;
+    ota_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    ota_size = 0;
+    ota_written = 0;
+}
+
+static int delta_read(uint32_t offset, uint8_t *buf, size_t len, void *arg) {
+    return (esp_partition_read(delta_source, offset, buf, len) == ESP_OK) ? 0 : -1;
+}
+
+static int delta_write(const uint8_t *data, size_t len, void *arg) {
+    if (esp_ota_write(ota_handle, data, len) != ESP_OK) {
+        return -1;
+    }
+    mbedtls_sha256_update(&target_sha, data, len);
+    return 0;
+}
+
+// Header in: check the sizes and start hashing the running image
+static esp_err_t delta_check_header(void) {
+    if (delta.source_size > delta_source->size || delta.target_size == 0 ||
+        delta.target_size > ota_partition->size) {
+        ESP_LOGE(TAG, "Patch sizes don't fit: %lu -> %lu bytes",
+                 (unsigned long)delta.source_size, (unsigned long)delta.target_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    ESP_LOGI(TAG, "Patch rebuilds %lu bytes from a %lu byte image",
+             (unsigned long)delta.target_size, (unsigned long)delta.source_size);
+    return ESP_OK;
+}
+
+// A patch only rebuilds the image it was made against. Hash up to budget
+// more bytes of the running slot; once all of it is in, compare. Whatever
+// was rebuilt before then sits in the unbootable slot until finish.
+static esp_err_t delta_hash_source(uint32_t budget) {
+    if (source_verified) {
+        return ESP_OK;
+    }
+
+    int64_t start = esp_timer_get_time();
+    while (source_hashed < delta.source_size && budget > 0) {
+        size_t n = delta.source_size - source_hashed;
+        if (n > BLE_OTA_DELTA_WINDOW_SIZE) {
+            n = BLE_OTA_DELTA_WINDOW_SIZE;
+        }
+        if (n > budget) {
+            n = budget;
+        }
+        esp_err_t err = esp_partition_read(delta_source, source_hashed, source_buf, n);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Running image read failed: %s", esp_err_to_name(err));
+            return err;
+        }
+        mbedtls_sha256_update(&source_sha, source_buf, n);
+        source_hashed += n;
+        budget -= n;
+    }
+    source_hash_us += esp_timer_get_time() - start;
+
+    if (source_hashed < delta.source_size) {
+        return ESP_OK;
+    }
+
+    uint8_t digest[BLE_OTA_SHA256_SIZE];
+    mbedtls_sha256_finish(&source_sha, digest);
+    if (memcmp(digest, delta.source_sha256, BLE_OTA_SHA256_SIZE) != 0) {
+        ESP_LOGE(TAG, "Patch was made for a different firmware than the one running");
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    source_verified = true;
+    ESP_LOGI(TAG, "Patch matches running image (%lu bytes hashed in %lld ms, by patch byte %lu)",
+             (unsigned long)delta.source_size, (long long)(source_hash_us / 1000),
+             (unsigned long)ota_written);
+    return ESP_OK;
+}
+
+static bool delta_busy(void) {
+    return backlog_len > 0 || ble_delta_pending(&delta);
+}
+
+// Apply one slice of the backlog
+static esp_err_t delta_step(void) {
+    const uint8_t *data = backlog + backlog_head;
+    size_t used;
+
+    // Stop at the end of the header so the sizes are checked first
+    if (!ota_header_checked) {
+        size_t head = BLE_DELTA_HEADER_LEN - delta.header_len;
+        if (head > backlog_len) {
+            head = backlog_len;
+        }
+        if (ble_delta_feed(&delta, data, head, &used) != BLE_DELTA_OK) {
+            ESP_LOGE(TAG, "Not a delta patch");
+            return ESP_ERR_INVALID_ARG;
+        }
+        backlog_head += used;
+        backlog_len -= used;
+        if (!ble_delta_header_ready(&delta)) {
+            return ESP_OK;
+        }
+
+        esp_err_t err = delta_check_header();
+        if (err != ESP_OK) {
+            return err;
+        }
+        ota_header_checked = true;
+        data += used;
+    }
+
+    int rc = ble_delta_feed(&delta, data, backlog_len, &used);
+    backlog_head += used;
+    backlog_len -= used;
+    if (backlog_len == 0) {
+        backlog_head = 0;
+    }
+    if (rc != BLE_DELTA_OK) {
+        ESP_LOGE(TAG, "Patch failed at %lu of %lu bytes rebuilt: %d",
+                 (unsigned long)delta.produced, (unsigned long)delta.target_size, rc);
+        return (rc == BLE_DELTA_ERR_FORMAT) ? ESP_ERR_INVALID_ARG : ESP_FAIL;
+    }
+    return delta_hash_source(BLE_OTA_SOURCE_HASH_STEP);
+}
+
+// Queue patch bytes and apply the first slice
+static esp_err_t delta_write_patch(const uint8_t *data, size_t len) {
+    if (backlog_head + backlog_len + len > BLE_OTA_PATCH_BACKLOG) {
+        memmove(backlog, backlog + backlog_head, backlog_len);
+        backlog_head = 0;
+    }
+    if (backlog_len + len > BLE_OTA_PATCH_BACKLOG) {
+        ESP_LOGE(TAG, "Patch backlog full (%u bytes) - sender ignored Ready",
+                 (unsigned)backlog_len);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(backlog + backlog_head + backlog_len, data, len);
+    backlog_len += len;
+
+    esp_err_t err = delta_step();
+    if (err == ESP_OK && delta_busy()) {
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &delta_ev);
+    }
+    return err;
+}
+
+// Host task: next slice, until the backlog is applied; then the transfer
+// may take more patch bytes
+static void delta_continue(struct ble_npl_event *ev) {
+    if (!ota_delta || !delta_busy()) {
+        return;
+    }
+
+    esp_err_t err = delta_step();
+    if (err == ESP_OK && delta_busy()) {
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &delta_ev);
+        return;
+    }
+    ble_transfer_ota_resume(ota_conn_handle, err);
+}
+
+// End of the patch: the whole image rebuilt, with the digest it announced
+static esp_err_t delta_finish(void) {
+    uint8_t digest[BLE_OTA_SHA256_SIZE];
+
+    // Short patches end before the running image is fully hashed
+    esp_err_t err = delta_hash_source(UINT32_MAX);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (ble_delta_finish(&delta) != BLE_DELTA_OK) {
+        ESP_LOGE(TAG, "Patch ended after %lu of %lu bytes",
+                 (unsigned long)delta.produced, (unsigned long)delta.target_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    mbedtls_sha256_finish(&target_sha, digest);
+    if (memcmp(digest, delta.target_sha256, BLE_OTA_SHA256_SIZE) != 0) {
+        ESP_LOGE(TAG, "Rebuilt image digest mismatch");
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    ESP_LOGI(TAG, "Patch of %lu bytes rebuilt a %lu byte image (%lu%% sent)",
+             (unsigned long)ota_written, (unsigned long)delta.target_size,
+             (unsigned long)((uint64_t)ota_written * 100 / delta.target_size));
+    return ESP_OK;
+}
+
+static void restart_timer_callback(void *arg) {
+    ESP_LOGI(TAG, "Restarting into the new firmware");
+    esp_restart();
+}
+
+// ============ Public Functions ============
+
+esp_err_t ble_ota_init(void) {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state = ESP_OTA_IMG_UNDEFINED;
+    esp_ota_get_state_partition(running, &state);
+
+    ESP_LOGI(TAG, "Running %s from %s%s", esp_app_get_description()->version,
+             running->label,
+             (state == ESP_OTA_IMG_PENDING_VERIFY) ? " (new, not yet confirmed)" : "");
+
+    // Set when the bootloader gave up on an update and went back
+    const esp_partition_t *invalid = esp_ota_get_last_invalid_partition();
+    if (invalid) {
+        esp_app_desc_t desc;
+        if (esp_ota_get_partition_description(invalid, &desc) == ESP_OK) {
+            ESP_LOGW(TAG, "Update to %s in %s was rolled back", desc.version, invalid->label);
+        }
+    }
+
+    ble_npl_event_init(&delta_ev, delta_continue, NULL);
+
+    if (restart_timer == NULL) {
+        esp_timer_create_args_t timer_args = {
+            .callback = restart_timer_callback,
+            .arg = NULL,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "ota_restart"
+        };
+        if (esp_timer_create(&timer_args, &restart_timer) != ESP_OK) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+void ble_ota_confirm(void) {
+    if (ota_confirmed) {
+        return;
+    }
+
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) != ESP_OK ||
+        state != ESP_OTA_IMG_PENDING_VERIFY) {
+        ota_confirmed = true;
+        return;
+    }
+
+    // Recordings live there; an image that can't mount it isn't healthy
+    if (!storage_is_mounted()) {
+        ESP_LOGW(TAG, "Storage not mounted - new firmware left unconfirmed");
+        return;
+    }
+
+    esp_err_t err = esp_ota_mark_app_valid_cancel_rollback();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to confirm firmware: %s", esp_err_to_name(err));
+        return;
+    }
+    ota_confirmed = true;
+    ESP_LOGI(TAG, "New firmware confirmed, rollback cancelled");
+}
+
+esp_err_t ble_ota_begin(uint16_t conn_handle, uint32_t size,
+                        const uint8_t sha256[BLE_OTA_SHA256_SIZE], bool delta_mode) {
+    if (ota_partition) {
+        ESP_LOGW(TAG, "Update rejected - one is already running");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (!partition) {
+        ESP_LOGE(TAG, "Update rejected - no OTA slot in the partition table");
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (size == 0 || size > partition->size) {
+        ESP_LOGE(TAG, "Update rejected - %lu bytes, slot holds %lu",
+                 (unsigned long)size, (unsigned long)partition->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    mbedtls_sha256_init(&ota_sha);
+    mbedtls_sha256_starts(&ota_sha, 0);
+
+    if (delta_mode) {
+        delta_window = heap_caps_malloc(2 * BLE_OTA_DELTA_WINDOW_SIZE + BLE_OTA_PATCH_BACKLOG,
+                                        MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!delta_window) {
+            ESP_LOGE(TAG, "Update rejected - no memory for the delta window");
+            return ESP_ERR_NO_MEM;
+        }
+        source_buf = delta_window + BLE_OTA_DELTA_WINDOW_SIZE;
+        backlog = source_buf + BLE_OTA_DELTA_WINDOW_SIZE;
+        backlog_head = 0;
+        backlog_len = 0;
+        ota_delta = true;
+        ota_header_checked = false;
+        delta_source = esp_ota_get_running_partition();
+        ble_delta_init(&delta, delta_window, BLE_OTA_DELTA_WINDOW_SIZE,
+                       delta_read, delta_write, NULL);
+        ble_delta_set_budget(&delta, BLE_OTA_DELTA_STEP);
+        mbedtls_sha256_init(&target_sha);
+        mbedtls_sha256_starts(&target_sha, 0);
+        mbedtls_sha256_init(&source_sha);
+        mbedtls_sha256_starts(&source_sha, 0);
+        source_hashed = 0;
+        source_verified = false;
+        source_hash_us = 0;
+    }
+
+    // Sequential writes erase each sector as it is reached, not the whole
+    // slot up front, so the host task never stalls for seconds
+    esp_err_t err = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &ota_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+        ota_reset();
+        return err;
+    }
+
+    ota_partition = partition;
+    ota_conn_handle = conn_handle;
+    ota_size = size;
+    ota_written = 0;
+    memcpy(ota_sha256, sha256, BLE_OTA_SHA256_SIZE);
+    ota_start_us = esp_timer_get_time();
+
+    ESP_LOGI(TAG, "Update started on conn %d: %lu %s into %s",
+             conn_handle, (unsigned long)size, delta_mode ? "byte patch" : "bytes",
+             partition->label);
+    return ESP_OK;
+}
+
+esp_err_t ble_ota_write(const uint8_t *data, size_t len) {
+    if (!ota_partition) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (ota_written + len > ota_size) {
+        ESP_LOGE(TAG, "Image longer than announced");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t err = ota_delta ? delta_write_patch(data, len) :
+                                esp_ota_write(ota_handle, data, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_write failed at %lu: %s",
+                 (unsigned long)ota_written, esp_err_to_name(err));
+        return err;
+    }
+    mbedtls_sha256_update(&ota_sha, data, len);
+    ota_written += len;
+    return ESP_OK;
+}
+
+esp_err_t ble_ota_finish(void) {
+    if (!ota_partition || ble_ota_busy()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Digest of what actually reached ble_ota_write, not what the caller saw
+    uint8_t digest[BLE_OTA_SHA256_SIZE];
+    mbedtls_sha256_finish(&ota_sha, digest);
+    if (ota_written != ota_size || memcmp(digest, ota_sha256, BLE_OTA_SHA256_SIZE) != 0) {
+        ESP_LOGE(TAG, "Image digest mismatch - update discarded");
+        ble_ota_abort();
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    if (ota_delta) {
+        esp_err_t err = delta_finish();
+        if (err != ESP_OK) {
+            ble_ota_abort();
+            return err;
+        }
+    }
+
+    // Checks the image header, segments and appended hash
+    esp_err_t err = esp_ota_end(ota_handle);
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(ota_partition);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Image rejected: %s", esp_err_to_name(err));
+        ota_reset();
+        return err;
+    }
+
+    // Update time depends mostly on the PHY the phone granted
+    uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - ota_start_us) / 1000);
+    ble_link_info_t link;
+    ble_link_get_info(ota_conn_handle, &link);
+    ESP_LOGI(TAG, "Update complete: %lu bytes in %lu ms = %lu B/s (phy %dM, interval %.2fms), "
+             "boots from %s",
+             (unsigned long)ota_written, (unsigned long)elapsed_ms,
+             (unsigned long)(elapsed_ms ? (uint64_t)ota_written * 1000 / elapsed_ms : 0),
+             link.tx_phy == BLE_GAP_LE_PHY_2M ? 2 : 1, link.conn_itvl * 1.25,
+             ota_partition->label);
+
+    ota_reset();
+    return ESP_OK;
+}
+
+void ble_ota_abort(void) {
+    if (!ota_partition) {
+        return;
+    }
+
+    esp_ota_abort(ota_handle);
+    ESP_LOGW(TAG, "Update aborted after %lu of %lu bytes",
+             (unsigned long)ota_written, (unsigned long)ota_size);
+    ota_reset();
+}
+
+void ble_ota_restart(void) {
+    if (restart_timer) {
+        esp_timer_start_once(restart_timer, BLE_OTA_RESTART_DELAY_MS * 1000);
+    }
+}
+
+bool ble_ota_is_active(void) {
+    return ota_partition != NULL;
+}
+
+bool ble_ota_busy(void) {
+    return ota_delta && delta_busy();
+}
@@ -0,0 +1,135 @@
+#ifndef BLE_OTA_H
+#define BLE_OTA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Firmware update over BLE. The image arrives through the transfer engine
+// (BLE_TRANSFER_OP_OTA) and is written straight into the inactive OTA
+// slot as chunks come in. The bootloader's rollback check keeps the old
+// image until the new one has booted far enough to confirm itself.
+
+// Digest the app sends with the OTA command (SHA-256 of the image)
+#define BLE_OTA_SHA256_SIZE         32
+
+// Time for the Complete notification to go out before the restart
+#define BLE_OTA_RESTART_DELAY_MS    1000
+
+// PSRAM work buffer for applying a delta patch; the running image is read
+// and the new one written this much at a time (allocated twice: decoder
+// and source hash)
+#define BLE_OTA_DELTA_WINDOW_SIZE   4096
+
+// Running image bytes hashed per patch slice, so checking a ~1.9 MB source
+// is spread over the transfer instead of stalling the host task
+#define BLE_OTA_SOURCE_HASH_STEP    (16 * 1024)
+
+// Target bytes a patch slice may rebuild by COPY/ADD (flash read and
+// write), so one host-task turn stays in the tens of milliseconds
+#define BLE_OTA_DELTA_STEP          (16 * 1024)
+
+// Patch bytes waiting to be applied. While any are, the transfer holds
+// Ready (and CoC credits), so this only has to hold what a sender may
+// have in flight: one ACK window of GATT chunks, decompressed (LZSS
+// expands at most ~8.5x, so 16 x 490 B becomes ~67 KB)
+#define BLE_OTA_PATCH_BACKLOG       (80 * 1024)
+
+/**
+ * @brief Log the running image and whether the last update rolled back
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM if the restart timer can't be created
+ */
+esp_err_t ble_ota_init(void);
+
+/**
+ * @brief Mark a freshly updated image as good
+ *
+ * Called on the first authenticated connection: storage mounted, GATT
+ * served and a phone able to send the next update. Host sync alone would
+ * keep an image whose storage or GATT table is broken. Until then the
+ * bootloader rolls back to the previous image on the next reset.
+ */
+void ble_ota_confirm(void);
+
+/**
+ * @brief Start writing a new image to the inactive OTA slot
+ *
+ * Flash is erased sector by sector as data arrives, so this returns
+ * without a long erase. In delta mode the data is a patch made by
+ * scripts/make_delta.py; it is applied against the running image and only
+ * the rebuilt image reaches the slot.
+ *
+ * @param conn_handle Connection sending the image (for the timing log)
+ * @param size Image (or patch) size in bytes
+ * @param sha256 Expected SHA-256 of the image (or patch)
+ * @param delta Data is a delta patch
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if an update is running,
+ *         ESP_ERR_NOT_FOUND if there is no OTA slot, ESP_ERR_INVALID_SIZE
+ *         if the image does not fit, ESP_ERR_NO_MEM if there is no room for
+ *         the delta window
+ */
+esp_err_t ble_ota_begin(uint16_t conn_handle, uint32_t size,
+                        const uint8_t sha256[BLE_OTA_SHA256_SIZE], bool delta);
+
+/**
+ * @brief Write the next piece of the image (or patch)
+ *
+ * A patch is queued and applied a slice at a time on the host task. While
+ * ble_ota_busy() the caller must not send Ready for more data; ble_ota
+ * calls ble_transfer_ota_resume() once the queue is applied, or with the
+ * error that stopped it.
+ *
+ * @param data Image bytes
+ * @param len Length
+ * @return ESP_OK on success; ESP_ERR_INVALID_VERSION if a patch was made
+ *         for a different running image (known once the running image is
+ *         hashed, BLE_OTA_SOURCE_HASH_STEP bytes per slice, or at finish);
+ *         ESP_ERR_NO_MEM if the patch backlog overflowed
+ */
+esp_err_t ble_ota_write(const uint8_t *data, size_t len);
+
+/**
+ * @brief Check the image and make it the boot image
+ *
+ * The SHA-256 of everything passed to ble_ota_write() (image or patch)
+ * must match the one given to ble_ota_begin().
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if a patch is still being applied,
+ *         ESP_ERR_INVALID_CRC if the digest (or that of the rebuilt
+ *         image) does not match, ESP_ERR_INVALID_VERSION if a patch was
+ *         made for a different running image, or the esp_ota_end() error
+ *         if the image does not validate
+ */
+esp_err_t ble_ota_finish(void);
+
+/**
+ * @brief Drop an unfinished update; the inactive slot stays unbootable
+ */
+void ble_ota_abort(void);
+
+/**
+ * @brief Restart into the new image after BLE_OTA_RESTART_DELAY_MS
+ */
+void ble_ota_restart(void);
+
+/**
+ * @brief Whether an image is being received
+ */
+bool ble_ota_is_active(void);
+
+/**
+ * @brief Whether received patch bytes are still being applied
+ */
+bool ble_ota_busy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_OTA_H
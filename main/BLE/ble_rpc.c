@@ -0,0 +1,339 @@
+#include "ble_rpc.h"
+#include "ble_auth.h"
+#include "ble_bond.h"
+#include "ble_conn.h"
+#include "ble_gatt.h"
+#include "ble_uuids.h"
+#include "ble_transfer.h"
+#include "ble_file_ops.h"
+#include "ble_file_list.h"
+#include "ble_le.h"
+#include "../Storage/storage_worker.h"
+
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <host/ble_hs.h>
+
+static const char *TAG = "BLE_RPC";
+
+// Largest Transfer Control command (ATT attribute value limit)
+#define RPC_TRANSFER_MAX_LEN    512
+
+// A request handed to the storage worker
+typedef struct {
+    uint16_t conn_handle;
+    uint16_t attr_handle;
+    uint16_t id;
+    uint8_t method;
+    int slot;
+    int64_t received_us;
+    size_t len;
+    uint8_t payload[];
+} rpc_job_t;
+
+// Worker requests outstanding per connection slot; a job frees its place
+// when it finishes, even if its connection has gone
+static uint8_t in_flight[BLE_MAX_CONNECTIONS];
+
+// Write-to-response time since boot
+static struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint8_t max_in_flight;
+} stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// TRANSFER payload copy for the parser, which terminates names in place
+// (host task only; off the stack of the access callback)
+static uint8_t transfer_buf[RPC_TRANSFER_MAX_LEN + 1];
+
+// ============ Internal Functions ============
+
+static uint8_t status_from_err(esp_err_t err) {
+    switch (err) {
+    case ESP_OK:
+        return BLE_RPC_STATUS_OK;
+    case ESP_ERR_INVALID_STATE:
+    case ESP_ERR_NO_MEM:
+        return BLE_RPC_STATUS_BUSY;
+    case ESP_ERR_INVALID_ARG:
+    case ESP_ERR_INVALID_SIZE:
+    case ESP_ERR_NOT_SUPPORTED:
+        return BLE_RPC_STATUS_INVALID;
+    default:
+        return BLE_RPC_STATUS_FAILED;
+    }
+}
+
+// Queued by the notify manager if mbufs are short; safe on any task
+static void send_response(uint16_t conn_handle, uint16_t attr_handle, uint16_t id,
+                          uint8_t method, uint8_t status, const uint8_t *payload,
+                          size_t len, int64_t received_us) {
+    uint8_t data[BLE_RPC_RESP_HDR_LEN + BLE_RPC_MAX_RESP_PAYLOAD];
+    put_le16(&data[0], id);
+    data[2] = method;
+    data[3] = status;
+    put_le16(&data[4], len);
+    if (len > 0) {
+        memcpy(&data[BLE_RPC_RESP_HDR_LEN], payload, len);
+    }
+
+    int rc = ble_notify_send(conn_handle, attr_handle, data, BLE_RPC_RESP_HDR_LEN + len,
+                             BLE_NOTIFY_CTRL);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Response %u notify failed: %d", id, rc);
+    }
+
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - received_us);
+    taskENTER_CRITICAL(&stats_lock);
+    stats.count++;
+    stats.total_us += elapsed_us;
+    if (elapsed_us > stats.max_us) {
+        stats.max_us = elapsed_us;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+// Take a worker place for the slot; false if it has too many outstanding
+static bool in_flight_take(int slot) {
+    bool ok = false;
+
+    taskENTER_CRITICAL(&stats_lock);
+    if (in_flight[slot] < BLE_RPC_MAX_IN_FLIGHT) {
+        in_flight[slot]++;
+        if (in_flight[slot] > stats.max_in_flight) {
+            stats.max_in_flight = in_flight[slot];
+        }
+        ok = true;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+    return ok;
+}
+
+static void in_flight_release(int slot) {
+    taskENTER_CRITICAL(&stats_lock);
+    in_flight[slot]--;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+// Storage worker
+static void job_run(void *arg) {
+    rpc_job_t *job = (rpc_job_t *)arg;
+
+    uint8_t result = ble_file_ops_run_one(job->payload, job->len);
+    in_flight_release(job->slot);
+
+    // The app may have gone while the request waited
+    if (ble_conn_slot(job->conn_handle) >= 0) {
+        send_response(job->conn_handle, job->attr_handle, job->id, job->method,
+                      BLE_RPC_STATUS_OK, &result, 1, job->received_us);
+    }
+    heap_caps_free(job);
+}
+
+static uint8_t job_submit(uint16_t conn_handle, uint16_t attr_handle, uint16_t id,
+                          uint8_t method, const uint8_t *payload, size_t len,
+                          int64_t received_us) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot < 0 || !in_flight_take(slot)) {
+        return BLE_RPC_STATUS_BUSY;
+    }
+
+    rpc_job_t *job = heap_caps_malloc(sizeof(rpc_job_t) + len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!job) {
+        in_flight_release(slot);
+        return BLE_RPC_STATUS_BUSY;
+    }
+    job->conn_handle = conn_handle;
+    job->attr_handle = attr_handle;
+    job->id = id;
+    job->method = method;
+    job->slot = slot;
+    job->received_us = received_us;
+    job->len = len;
+    memcpy(job->payload, payload, len);
+
+    if (storage_worker_submit(job_run, job) != ESP_OK) {
+        heap_caps_free(job);
+        in_flight_release(slot);
+        return BLE_RPC_STATUS_BUSY;
+    }
+    return BLE_RPC_STATUS_OK;
+}
+
+static uint8_t run_auth(uint16_t conn_handle, const uint8_t *payload, size_t len) {
+    if (len != BLE_AUTH_KEY_SIZE) {
+        return BLE_RPC_STATUS_INVALID;
+    }
+
+    bool success = ble_auth_check_key(conn_handle, payload, len);
+    ESP_LOGI(TAG, "Auth key (conn %d): %s, %lu ms after connect", conn_handle,
+             success ? "SUCCESS" : "FAILED", (unsigned long)ble_conn_age_ms(conn_handle));
+
+    if (success) {
+        ble_bond_on_authenticated(conn_handle);
+    }
+    ble_gatt_notify_auth_status();
+    return success ? BLE_RPC_STATUS_OK : BLE_RPC_STATUS_NOT_AUTH;
+}
+
+static uint8_t run_transfer(uint16_t conn_handle, const uint8_t *payload, size_t len) {
+    if (len == 0 || len > RPC_TRANSFER_MAX_LEN) {
+        return BLE_RPC_STATUS_INVALID;
+    }
+    memcpy(transfer_buf, payload, len);
+
+    ble_xfer_cmd_t cmd;
+    if (ble_xfer_parse_command(transfer_buf, len, &cmd) != BLE_XFER_PARSE_OK) {
+        return BLE_RPC_STATUS_INVALID;
+    }
+    return status_from_err(ble_transfer_command(conn_handle, &cmd));
+}
+
+static uint8_t run_file_list(uint16_t conn_handle, const uint8_t *payload, size_t len) {
+    ble_file_list_req_t req;
+    if (ble_file_list_parse(payload, len, &req) != ESP_OK) {
+        return BLE_RPC_STATUS_INVALID;
+    }
+    return status_from_err(ble_gatt_send_file_list(conn_handle, &req));
+}
+
+// Run or queue one request; every path ends in exactly one response
+static void run_request(uint16_t conn_handle, uint16_t attr_handle, uint16_t id,
+                        uint8_t method, const uint8_t *payload, size_t len,
+                        int64_t received_us) {
+    uint8_t status;
+    uint8_t resp[1];
+    const uint8_t *resp_data = NULL;
+    size_t resp_len = 0;
+
+    if (method != BLE_RPC_AUTH && method != BLE_RPC_AUTH_STATUS &&
+        !ble_auth_is_authenticated(conn_handle)) {
+        send_response(conn_handle, attr_handle, id, method, BLE_RPC_STATUS_NOT_AUTH,
+                      NULL, 0, received_us);
+        return;
+    }
+
+    switch (method) {
+    case BLE_RPC_PING:
+        if (len > BLE_RPC_MAX_RESP_PAYLOAD) {
+            status = BLE_RPC_STATUS_INVALID;
+            break;
+        }
+        status = BLE_RPC_STATUS_OK;
+        resp_data = payload;
+        resp_len = len;
+        break;
+
+    case BLE_RPC_AUTH:
+        status = run_auth(conn_handle, payload, len);
+        break;
+
+    case BLE_RPC_AUTH_STATUS:
+        resp[0] = ble_auth_get_status_byte(conn_handle);
+        status = BLE_RPC_STATUS_OK;
+        resp_data = resp;
+        resp_len = 1;
+        break;
+
+    case BLE_RPC_TRANSFER:
+        status = run_transfer(conn_handle, payload, len);
+        break;
+
+    case BLE_RPC_FILE_LIST:
+        status = run_file_list(conn_handle, payload, len);
+        break;
+
+    case BLE_RPC_FILE_OP:
+        // Answered by the worker once it has run
+        status = job_submit(conn_handle, attr_handle, id, method, payload, len, received_us);
+        if (status == BLE_RPC_STATUS_OK) {
+            return;
+        }
+        ESP_LOGW(TAG, "Request %u rejected - worker busy", id);
+        break;
+
+    default:
+        status = BLE_RPC_STATUS_UNKNOWN;
+        break;
+    }
+
+    send_response(conn_handle, attr_handle, id, method, status, resp_data, resp_len,
+                  received_us);
+}
+
+// ============ Public Functions ============
+
+esp_err_t ble_rpc_write(uint16_t conn_handle, uint16_t attr_handle,
+                        const uint8_t *buf, size_t len) {
+    int64_t received_us = esp_timer_get_time();
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+
+    while (p < end) {
+        if (end - p < BLE_RPC_REQ_HDR_LEN) {
+            ESP_LOGW(TAG, "Truncated request header (%d bytes)", (int)(end - p));
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        uint16_t id = get_le16(p);
+        uint8_t method = p[2];
+        uint16_t payload_len = get_le16(p + 3);
+        p += BLE_RPC_REQ_HDR_LEN;
+
+        if (payload_len > end - p) {
+            ESP_LOGW(TAG, "Request %u: payload runs past the write", id);
+            send_response(conn_handle, attr_handle, id, method, BLE_RPC_STATUS_INVALID,
+                          NULL, 0, received_us);
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        run_request(conn_handle, attr_handle, id, method, p, payload_len, received_us);
+        p += payload_len;
+    }
+    return ESP_OK;
+}
+
+void ble_rpc_pack_stats(uint8_t data[BLE_RPC_STATS_SIZE]) {
+    uint32_t count, max_us;
+    uint64_t total_us;
+    uint8_t max_in_flight;
+
+    taskENTER_CRITICAL(&stats_lock);
+    count = stats.count;
+    max_us = stats.max_us;
+    total_us = stats.total_us;
+    max_in_flight = stats.max_in_flight;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    put_le32(&data[0], count);
+    data[4] = max_in_flight;
+    put_le32(&data[5], count ? (uint32_t)(total_us / count) : 0);
+    put_le32(&data[9], max_us);
+}
+
+void ble_rpc_log_stats(void) {
+    uint32_t count, max_us;
+    uint64_t total_us;
+    uint8_t max_in_flight;
+
+    taskENTER_CRITICAL(&stats_lock);
+    count = stats.count;
+    max_us = stats.max_us;
+    total_us = stats.total_us;
+    max_in_flight = stats.max_in_flight;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    if (count == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "RPC: %lu requests, avg %lu us, max %lu us to respond, %u in flight at most",
+             (unsigned long)count, (unsigned long)(total_us / count),
+             (unsigned long)max_us, max_in_flight);
+}
@@ -0,0 +1,84 @@
+#ifndef BLE_RPC_H
+#define BLE_RPC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include "ble_notify.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Requests written to the RPC characteristic, one or more per write:
+// [id:2][method:1][len:2][payload:len]. id is chosen by the app and
+// echoed in the response, so several requests can be outstanding at once.
+#define BLE_RPC_REQ_HDR_LEN         5
+
+// Response notification, one per request:
+// [id:2][method:1][status:1][len:2][payload:len]. Requests that touch
+// storage run on the storage worker, so responses may come back in a
+// different order than the requests went out.
+#define BLE_RPC_RESP_HDR_LEN        6
+
+// Largest response payload (fits a queued notification)
+#define BLE_RPC_MAX_RESP_PAYLOAD    (BLE_NOTIFY_QUEUE_MAX_LEN - BLE_RPC_RESP_HDR_LEN)
+
+// Worker requests a connection may have outstanding
+#define BLE_RPC_MAX_IN_FLIGHT       8
+
+// Methods
+#define BLE_RPC_PING                0x01  // [data] -> [data], echoed (round trip measurement)
+#define BLE_RPC_AUTH                0x02  // [key:32] -> []; allowed before authentication
+#define BLE_RPC_AUTH_STATUS         0x03  // [] -> [status:1]; allowed before authentication
+#define BLE_RPC_TRANSFER            0x04  // [Transfer Control command] -> []
+#define BLE_RPC_FILE_LIST           0x05  // [start:2][count:2][sort:1][flags:1] -> [], entries on File List
+#define BLE_RPC_FILE_OP             0x06  // [File Batch operation] -> [result:1] (storage worker)
+
+// Response status
+#define BLE_RPC_STATUS_OK           0x00
+#define BLE_RPC_STATUS_NOT_AUTH     0x01  // Not authenticated, or wrong key
+#define BLE_RPC_STATUS_UNKNOWN      0x02  // Unknown method
+#define BLE_RPC_STATUS_INVALID      0x03  // Malformed payload or bad argument
+#define BLE_RPC_STATUS_BUSY         0x04  // Too many requests outstanding, or not in this state
+#define BLE_RPC_STATUS_FAILED       0x05
+
+// Read: [count:4][max_in_flight:1][avg_us:4][max_us:4], write-to-response
+// time of the requests answered since boot
+#define BLE_RPC_STATS_SIZE          13
+
+/**
+ * @brief Handle an RPC characteristic write
+ *
+ * Runs each request in the write in order. Quick ones are answered before
+ * this returns; storage requests are handed to the storage worker and
+ * answered when done. Every request gets a response notification on
+ * attr_handle, including ones that are rejected.
+ *
+ * @param conn_handle BLE connection handle
+ * @param attr_handle RPC characteristic value handle
+ * @param buf Written bytes
+ * @param len Written length
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE if the write ends inside a request
+ *         (the requests before it have run)
+ */
+esp_err_t ble_rpc_write(uint16_t conn_handle, uint16_t attr_handle,
+                        const uint8_t *buf, size_t len);
+
+/**
+ * @brief Build the latency statistics read value
+ *
+ * @param[out] data Characteristic value
+ */
+void ble_rpc_pack_stats(uint8_t data[BLE_RPC_STATS_SIZE]);
+
+/**
+ * @brief Log the request counters and latency
+ */
+void ble_rpc_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_RPC_H
@@ -0,0 +1,141 @@
+#include "ble_status.h"
+#include "ble_gatt.h"
+#include "ble_link.h"
+#include "ble_conn.h"
+#include "ble_adv.h"
+#include "../Status/device_status.h"
+
+#include <stdatomic.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nimble/nimble_port.h>
+
+static const char *TAG = "BLE_STATUS";
+
+// Wait at least this long when no connection interval is known
+#define STATUS_DEFAULT_DELAY_US     30000
+
+static esp_timer_handle_t status_timer = NULL;
+
+// DEVICE_STATUS_* bits not yet notified
+static atomic_uint pending_changes;
+
+// Only touched from the timer task
+static int64_t last_notify_us = 0;
+
+// Host-task event that refreshes the advertised status. Status changes
+// are published from any task, but GAP calls belong on the host task.
+static struct ble_npl_event adv_ev;
+
+// DEVICE_STATUS_* bits not yet applied to the advertisement
+static atomic_uint adv_changes;
+
+// ============ Internal Functions ============
+
+// Timer task: one notification for everything that changed since it was armed
+static void status_timer_callback(void *arg) {
+    uint8_t changed = (uint8_t)atomic_exchange(&pending_changes, 0);
+    if (changed == 0) {
+        return;
+    }
+
+    if (changed & DEVICE_STATUS_BATTERY) {
+        device_status_t status;
+        device_status_get(&status);
+        ble_gatt_update_battery_level(status.battery_percent);
+    }
+
+    ble_gatt_notify_device_status(changed);
+    last_notify_us = esp_timer_get_time();
+}
+
+// Host task: apply everything that changed since the event was queued
+static void adv_update_run(struct ble_npl_event *ev) {
+    uint32_t changed = atomic_exchange(&adv_changes, 0);
+    if (changed) {
+        ble_adv_on_status_change(changed);
+    }
+}
+
+// Publishing task: remember the change and arm the timer if it isn't
+static void on_status_change(uint32_t changed) {
+    // Advertised status is kept current whether or not anyone is connected;
+    // a no-op put if the event is already queued
+    atomic_fetch_or(&adv_changes, changed);
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &adv_ev);
+
+    // A new connection reads the whole value, so only track changes while connected
+    if (ble_conn_count() == 0) {
+        return;
+    }
+
+    atomic_fetch_or(&pending_changes, changed);
+    if (esp_timer_is_active(status_timer)) {
+        return;
+    }
+
+    // Let changes from the same connection event land in one notification,
+    // on the connection with the longest interval
+    uint16_t conn_itvl = 0;
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        ble_link_info_t info;
+        ble_link_get_info(ble_conn_handle(i), &info);
+        if (info.conn_itvl > conn_itvl) {
+            conn_itvl = info.conn_itvl;
+        }
+    }
+    int64_t delay_us = conn_itvl ? (int64_t)conn_itvl * 1250 : STATUS_DEFAULT_DELAY_US;
+
+    // And keep to the minimum spacing between notifications
+    int64_t wait_us = last_notify_us + BLE_DEVICE_STATUS_MIN_INTERVAL_MS * 1000LL -
+                      esp_timer_get_time();
+    if (wait_us > delay_us) {
+        delay_us = wait_us;
+    }
+
+    esp_timer_start_once(status_timer, delay_us);
+}
+
+// ============ Public Functions ============
+
+esp_err_t ble_status_init(void) {
+    if (status_timer == NULL) {
+        esp_timer_create_args_t timer_args = {
+            .callback = status_timer_callback,
+            .arg = NULL,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "ble_status"
+        };
+        if (esp_timer_create(&timer_args, &status_timer) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create status timer");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    ble_npl_event_init(&adv_ev, adv_update_run, NULL);
+    device_status_set_listener(on_status_change);
+    return ESP_OK;
+}
+
+void ble_status_reset(void) {
+    if (status_timer) {
+        esp_timer_stop(status_timer);
+    }
+    atomic_store(&pending_changes, 0);
+}
+
+void ble_status_pack(uint8_t data[BLE_DEVICE_STATUS_SIZE], uint8_t changed) {
+    device_status_t status;
+    device_status_get(&status);
+
+    data[0] = changed;
+    data[1] = status.audio_state;
+    data[2] = status.volume_level;
+    data[3] = (status.track_index >> 0) & 0xFF;
+    data[4] = (status.track_index >> 8) & 0xFF;
+    data[5] = (status.track_count >> 0) & 0xFF;
+    data[6] = (status.track_count >> 8) & 0xFF;
+    data[7] = status.battery_percent;
+    data[8] = (status.is_charging ? BLE_DEVICE_STATUS_FLAG_CHARGING : 0) |
+              (status.power_detected ? BLE_DEVICE_STATUS_FLAG_EXT_POWER : 0);
+}
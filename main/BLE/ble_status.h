@@ -0,0 +1,50 @@
+#ifndef BLE_STATUS_H
+#define BLE_STATUS_H
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Device Status characteristic value:
+// [changed:1][audio_state:1][volume:1][track_index:2][track_count:2]
+// [battery:1][flags:1]. changed holds DEVICE_STATUS_* bits (0 on read).
+#define BLE_DEVICE_STATUS_SIZE      9
+
+#define BLE_DEVICE_STATUS_FLAG_CHARGING     0x01
+#define BLE_DEVICE_STATUS_FLAG_EXT_POWER    0x02
+
+// Minimum spacing between Device Status notifications
+#define BLE_DEVICE_STATUS_MIN_INTERVAL_MS   200
+
+/**
+ * @brief Start listening for device status changes
+ *
+ * Changes are collected and sent as one Device Status notification,
+ * no sooner than one connection interval after the first change and
+ * BLE_DEVICE_STATUS_MIN_INTERVAL_MS after the previous notification.
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM if the timer could not be created
+ */
+esp_err_t ble_status_init(void);
+
+/**
+ * @brief Drop pending changes (call when the last connection closes)
+ */
+void ble_status_reset(void);
+
+/**
+ * @brief Build the Device Status value from the cached device status
+ *
+ * @param[out] data Characteristic value
+ * @param changed DEVICE_STATUS_* bits to report
+ */
+void ble_status_pack(uint8_t data[BLE_DEVICE_STATUS_SIZE], uint8_t changed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_STATUS_H
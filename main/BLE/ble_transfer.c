@@ -1,505 +1,1006 @@
 #include "ble_transfer.h"
 #include "ble_uuids.h"
 #include "ble_auth.h"
+#include "ble_link.h"
+#include "ble_coc.h"
+#include "ble_gatt.h"
+#include "ble_conn.h"
+#include "ble_notify.h"
+#include "ble_ota.h"
 #include "../Playlist/playlist.h"
+#include "../Storage/storage.h"
 #include "../Indicator/indicator.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <esp_log.h>
 #include <esp_timer.h>
+#include <esp_cpu.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
 #include <host/ble_hs.h>
+#include <nimble/nimble_port.h>
 
 static const char *TAG = "BLE_TRANSFER";
 
-// Timer delay for deferred notifications (microseconds)
-// Reduced from 1000us to 100us for faster throughput
-#define NOTIFY_TIMER_DELAY_US  100
-
-// Timer for deferred notifications (can't send from GATT callback context)
-static esp_timer_handle_t notify_timer = NULL;
-typedef enum {
-    DEFERRED_NONE = 0,
-    DEFERRED_CHUNK_READY,
-    DEFERRED_COMPLETE,
-    DEFERRED_ERROR,
-} deferred_action_t;
-static deferred_action_t deferred_action = DEFERRED_NONE;
-static uint32_t deferred_size = 0;
+// NimBLE binding of the transfer engine (ble_xfer_engine.h): GATT and
+// L2CAP CoC transport, /Storage and OTA file ops, one engine per
+// connection, the CoC download scheduler and telemetry.
+
+// Download chunk pool (PSRAM). One block holds a whole chunk; each
+// connection has at most one chunk prepared and one in a read response.
+#define CHUNK_BLOCK_SIZE    (BLE_TRANSFER_CHUNK_SIZE + 32)  // + mbuf and packet headers
+#define CHUNK_BLOCK_COUNT   (BLE_MAX_CONNECTIONS * 2 + 2)
+
+static struct os_mempool chunk_mempool;
+static struct os_mbuf_pool chunk_mbuf_pool;
+static void *chunk_mem = NULL;
+
+// CoC download scheduler quantum (deficit round robin). One full SDU per
+// turn, so peers with a smaller CoC MTU still get the same byte share.
+#define SCHED_QUANTUM       BLE_COC_SDU_SIZE
 
 // Transfer context
 typedef struct {
-    ble_xfer_state_t state;
-    ble_xfer_dir_t direction;
-    char file_path[128];
-    uint32_t total_bytes;
-    uint32_t transferred_bytes;
-    FILE *file_handle;
+    ble_xfer_engine_t engine;
     uint16_t conn_handle;
-    bool delete_on_error;  // For uploads, delete partial file on error
-    // Download chunk buffer (for read-based flow) - raw binary, no base64
-    uint8_t chunk_buffer[BLE_TRANSFER_CHUNK_SIZE];
-    size_t chunk_len;
-    bool chunk_ready;
+    bool ota;              // Upload is a firmware image, written to the OTA slot
+    // Deferred notifications (can't send from GATT callback context)
+    struct ble_npl_event notify_ev;
+    // Periodic telemetry notify while a transfer runs
+    esp_timer_handle_t telemetry_timer;
+    uint32_t deficit;      // CoC scheduler byte credit
 } ble_transfer_ctx_t;
 
-static ble_transfer_ctx_t ctx = {
-    .state = BLE_XFER_STATE_IDLE,
-    .direction = BLE_XFER_DIR_NONE,
-    .file_handle = NULL,
-    .chunk_ready = false,
-};
+// One transfer context per connection slot
+static ble_transfer_ctx_t contexts[BLE_MAX_CONNECTIONS];
+
+// Host-task event that sends the next CoC download SDU. A single event
+// serves every connection; the scheduler picks whose SDU goes next.
+static struct ble_npl_event sched_ev;
+static int sched_cursor = 0;
+
+// Aggregate throughput, bucketed by how many transfers were running at
+// once (index 0 = one transfer). Updated from the host and timer tasks.
+static struct {
+    int active;                  // Transfers running now
+    uint32_t bytes;              // File bytes moved by all transfers
+    uint32_t sample_bytes;       // bytes at the last sample
+    int64_t sample_us;
+    uint64_t bucket_bytes[BLE_MAX_CONNECTIONS];
+    int64_t bucket_us[BLE_MAX_CONNECTIONS];
+} aggregate;
+static portMUX_TYPE aggregate_lock = portMUX_INITIALIZER_UNLOCKED;
 
 // Characteristic handles for notifications
 static uint16_t ctrl_attr_handle = 0;
 static uint16_t data_attr_handle = 0;
 static uint16_t progress_attr_handle = 0;
 
-// Forward declarations
-static void notify_status(uint8_t status, uint32_t size);
-static void notify_data_ready(uint32_t size);
-static void notify_progress(void);
-static void cleanup_transfer(bool success);
-
-// Timer callback for deferred notifications
-static void deferred_notify_callback(void *arg) {
-    switch (deferred_action) {
-        case DEFERRED_CHUNK_READY:
-            notify_data_ready(deferred_size);
-            notify_progress();
-            break;
-        case DEFERRED_COMPLETE:
-            ESP_LOGI(TAG, "Download complete");
-            notify_status(BLE_TRANSFER_STATUS_COMPLETE, 0);
-            led_set_mode(LED_MODE_BLE_PAIRING);
-            // Reset state to allow new transfers
-            ctx.state = BLE_XFER_STATE_IDLE;
-            ctx.direction = BLE_XFER_DIR_NONE;
-            break;
-        case DEFERRED_ERROR:
-            ESP_LOGE(TAG, "Transfer error");
-            notify_status(BLE_TRANSFER_STATUS_ERROR, 0);
-            led_set_mode(LED_MODE_BLE_PAIRING);
-            // Reset state to allow new transfers
-            ctx.state = BLE_XFER_STATE_IDLE;
-            ctx.direction = BLE_XFER_DIR_NONE;
-            break;
-        default:
-            break;
-    }
-    deferred_action = DEFERRED_NONE;
+// ============ Telemetry ============
+
+// Close the running aggregate sample into the bucket for the number of
+// transfers that ran during it. Caller holds aggregate_lock.
+static void aggregate_sample_locked(int64_t now) {
+    if (aggregate.active > 0) {
+        int i = aggregate.active - 1;
+        aggregate.bucket_bytes[i] += aggregate.bytes - aggregate.sample_bytes;
+        aggregate.bucket_us[i] += now - aggregate.sample_us;
+    }
+    aggregate.sample_bytes = aggregate.bytes;
+    aggregate.sample_us = now;
 }
 
-void ble_transfer_init(void) {
-    memset(&ctx, 0, sizeof(ctx));
-    ctx.state = BLE_XFER_STATE_IDLE;
-    ctx.direction = BLE_XFER_DIR_NONE;
+// A transfer started (+1) or ended (-1)
+static void aggregate_change(int delta) {
+    taskENTER_CRITICAL(&aggregate_lock);
+    aggregate_sample_locked(esp_timer_get_time());
+    aggregate.active += delta;
+    taskEXIT_CRITICAL(&aggregate_lock);
+}
 
-    // Create one-shot timer for deferred notifications
-    if (notify_timer == NULL) {
-        esp_timer_create_args_t timer_args = {
-            .callback = deferred_notify_callback,
-            .arg = NULL,
-            .dispatch_method = ESP_TIMER_TASK,
-            .name = "xfer_notify"
-        };
-        esp_timer_create(&timer_args, &notify_timer);
+static void aggregate_log(void) {
+    ble_transfer_aggregate_t agg;
+    ble_transfer_get_aggregate(&agg);
+
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (agg.ms[i] > 0) {
+            ESP_LOGI(TAG, "Aggregate with %d transfer%s running: %lu B/s over %lu ms",
+                     i + 1, i ? "s" : "", (unsigned long)agg.bps[i],
+                     (unsigned long)agg.ms[i]);
+        }
     }
+}
+
+static void telemetry_timer_callback(void *arg) {
+    ble_transfer_ctx_t *ctx = (ble_transfer_ctx_t *)arg;
+    ble_xfer_stats_t *stats = &ctx->engine.stats;
+    int64_t now = esp_timer_get_time();
+    uint32_t bytes = stats->bytes;
+
+    if (now > stats->sample_us) {
+        stats->inst_bps = (uint32_t)((uint64_t)(bytes - stats->sample_bytes) *
+                                     1000000 / (now - stats->sample_us));
+    }
+    stats->sample_us = now;
+    stats->sample_bytes = bytes;
+
+    taskENTER_CRITICAL(&aggregate_lock);
+    aggregate_sample_locked(now);
+    taskEXIT_CRITICAL(&aggregate_lock);
 
-    ESP_LOGI(TAG, "Transfer module initialized");
+    ble_gatt_notify_transfer_telemetry(ctx->conn_handle);
 }
 
-void ble_transfer_set_handles(uint16_t ctrl_handle, uint16_t data_handle,
-                               uint16_t progress_handle) {
-    ctrl_attr_handle = ctrl_handle;
-    data_attr_handle = data_handle;
-    progress_attr_handle = progress_handle;
+// Log the session counters of a transfer that just ended
+static void telemetry_log(ble_transfer_ctx_t *ctx) {
+    const ble_xfer_engine_t *e = &ctx->engine;
+    ble_transfer_telemetry_t t;
+    ble_link_info_t link;
+    ble_transfer_get_telemetry(ctx->conn_handle, &t);
+    ble_link_get_info(ctx->conn_handle, &link);
+
+    ESP_LOGI(TAG, "Telemetry conn %d (%s %s): %lu bytes in %lu ms = %lu B/s, %lu chunks, "
+             "file I/O %lu ms, peer wait %lu ms, %u notify failures, "
+             "deferred queue max %d (%u dropped)",
+             ctx->conn_handle,
+             (e->flags & BLE_TRANSFER_FLAG_L2CAP) ? "L2CAP CoC" : "GATT",
+             e->batch ? "batch" :
+                 (e->direction == BLE_XFER_DIR_UPLOAD ? "upload" : "download"),
+             (unsigned long)t.bytes, (unsigned long)t.elapsed_ms,
+             (unsigned long)t.avg_bps, (unsigned long)t.chunks,
+             (unsigned long)t.io_ms, (unsigned long)t.wait_ms, t.notify_failures,
+             t.queue_max, t.queue_drops);
+    ESP_LOGI(TAG, "Telemetry link: mtu=%d, phy=%dM/%dM, interval=%.2fms, data len=%d",
+             link.mtu,
+             link.tx_phy == BLE_GAP_LE_PHY_2M ? 2 : 1,
+             link.rx_phy == BLE_GAP_LE_PHY_2M ? 2 : 1,
+             link.conn_itvl * 1.25, link.max_tx_octets);
+    uint32_t kb = (t.bytes + 1023) / 1024;
+    ESP_LOGI(TAG, "Telemetry host task: %llu cycles in the data path (%lu cycles/KB)",
+             (unsigned long long)e->stats.host_cycles,
+             (unsigned long)(kb ? e->stats.host_cycles / kb : 0));
+    aggregate_log();
 }
 
-esp_err_t ble_transfer_start_upload(const char *filename, uint32_t total_size,
-                                     uint16_t conn_handle) {
-    if (!ble_auth_is_authenticated()) {
-        ESP_LOGW(TAG, "Upload rejected - not authenticated");
-        return ESP_ERR_INVALID_STATE;
+// Back to the pairing pattern once no connection is transferring
+static void transfer_led_update(void) {
+    if (!ble_transfer_is_active()) {
+        led_set_mode(LED_MODE_BLE_PAIRING);
     }
+}
 
-    if (ctx.state != BLE_XFER_STATE_IDLE) {
-        ESP_LOGW(TAG, "Upload rejected - transfer already in progress");
-        notify_status(BLE_TRANSFER_STATUS_ERROR, 0);
-        return ESP_ERR_INVALID_STATE;
-    }
+// ============ NimBLE Transport ============
 
-    if (!filename || total_size == 0) {
-        ESP_LOGE(TAG, "Invalid upload parameters");
-        notify_status(BLE_TRANSFER_STATUS_ERROR, 0);
-        return ESP_ERR_INVALID_ARG;
+static int nimble_notify(void *arg, ble_xfer_channel_t ch, const uint8_t *data, size_t len) {
+    ble_transfer_ctx_t *ctx = (ble_transfer_ctx_t *)arg;
+    uint16_t attr_handle = (ch == BLE_XFER_CH_DATA) ? data_attr_handle :
+                           (ch == BLE_XFER_CH_PROGRESS) ? progress_attr_handle :
+                           ctrl_attr_handle;
+    if (attr_handle == 0 || ctx->conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return 0;
     }
 
-    // Build full path
-    snprintf(ctx.file_path, sizeof(ctx.file_path), "/Storage/%s", filename);
-
-    // Open file for writing
-    ctx.file_handle = fopen(ctx.file_path, "wb");
-    if (!ctx.file_handle) {
-        ESP_LOGE(TAG, "Failed to create file: %s", ctx.file_path);
-        notify_status(BLE_TRANSFER_STATUS_ERROR, 0);
-        return ESP_FAIL;
+    // Progress only keeps its latest value; everything else is queued until sent
+    ble_notify_prio_t prio = (ch == BLE_XFER_CH_PROGRESS) ? BLE_NOTIFY_PROGRESS : BLE_NOTIFY_CTRL;
+    int rc = ble_notify_send(ctx->conn_handle, attr_handle, data, len, prio);
+    if (rc != 0) {
+        ESP_LOGD(TAG, "Notify on handle %d failed: %d", attr_handle, rc);
     }
+    return rc;
+}
 
-    ctx.state = BLE_XFER_STATE_UPLOAD_PENDING;
-    ctx.direction = BLE_XFER_DIR_UPLOAD;
-    ctx.total_bytes = total_size;
-    ctx.transferred_bytes = 0;
-    ctx.conn_handle = conn_handle;
-    ctx.delete_on_error = true;
+// Deferred notifications are sent by a host-task event, so both ends of
+// the engine's queue run on the host task and need no lock
+static void nimble_defer(void *arg) {
+    ble_transfer_ctx_t *ctx = (ble_transfer_ctx_t *)arg;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &ctx->notify_ev);
+}
 
-    ESP_LOGI(TAG, "Upload started: %s (%lu bytes)", ctx.file_path,
-             (unsigned long)total_size);
+static const uint8_t *nimble_rx_segment(void *arg, const void **seg, size_t *len) {
+    const struct os_mbuf *om = *seg;
+    if (!om) {
+        return NULL;
+    }
 
-    // Set LED to transfer mode
-    led_set_mode(LED_MODE_BLE_TRANSFER);
+    *seg = SLIST_NEXT(om, om_next);
+    *len = om->om_len;
+    return om->om_data;
+}
 
-    // Notify ready
-    notify_status(BLE_TRANSFER_STATUS_READY, 0);
+static void *nimble_buf_alloc(void *arg, bool sdu) {
+    if (sdu) {
+        return ble_coc_alloc_sdu();
+    }
 
-    return ESP_OK;
+    // Read straight into a pool mbuf and handed to the ATT read response as is
+    struct os_mbuf *om = chunk_mem ? os_mbuf_get_pkthdr(&chunk_mbuf_pool, 0) : NULL;
+    if (!om) {
+        om = os_msys_get_pkthdr(BLE_TRANSFER_CHUNK_SIZE, 0);
+    }
+    return om;
 }
 
-// Forward declaration
-static void notify_data_ready(uint32_t size);
+// Free space at the end of the chain, adding an mbuf from the same pool
+// when the last one is full
+static uint8_t *nimble_buf_space(void *arg, void *buf, size_t *space) {
+    struct os_mbuf *tail = buf;
+    while (SLIST_NEXT(tail, om_next)) {
+        tail = SLIST_NEXT(tail, om_next);
+    }
 
-esp_err_t ble_transfer_start_download(const char *filename, uint16_t conn_handle) {
-    if (!ble_auth_is_authenticated()) {
-        ESP_LOGW(TAG, "Download rejected - not authenticated");
-        return ESP_ERR_INVALID_STATE;
+    if (OS_MBUF_TRAILINGSPACE(tail) == 0) {
+        struct os_mbuf *next = os_mbuf_get(tail->om_omp, 0);
+        if (!next) {
+            return NULL;
+        }
+        SLIST_NEXT(tail, om_next) = next;
+        tail = next;
     }
 
-    if (ctx.state != BLE_XFER_STATE_IDLE) {
-        ESP_LOGW(TAG, "Download rejected - transfer in progress");
-        notify_data_ready(0);  // Error on data characteristic
-        return ESP_ERR_INVALID_STATE;
+    *space = OS_MBUF_TRAILINGSPACE(tail);
+    return tail->om_data + tail->om_len;
+}
+
+static void nimble_buf_commit(void *arg, void *buf, size_t len) {
+    struct os_mbuf *om = buf;
+    struct os_mbuf *tail = om;
+    while (SLIST_NEXT(tail, om_next)) {
+        tail = SLIST_NEXT(tail, om_next);
     }
 
-    if (!filename) {
-        ESP_LOGE(TAG, "Download rejected - filename is NULL");
-        notify_data_ready(0);
-        return ESP_ERR_INVALID_ARG;
+    tail->om_len += len;
+    OS_MBUF_PKTHDR(om)->omp_len += len;
+}
+
+static void nimble_buf_free(void *arg, void *buf) {
+    os_mbuf_free_chain(buf);
+}
+
+static size_t nimble_sdu_size(void *arg) {
+    ble_transfer_ctx_t *ctx = (ble_transfer_ctx_t *)arg;
+    return ble_coc_is_connected(ctx->conn_handle) ? ble_coc_tx_sdu_size(ctx->conn_handle) : 0;
+}
+
+static int nimble_sdu_send(void *arg, void *buf) {
+    ble_transfer_ctx_t *ctx = (ble_transfer_ctx_t *)arg;
+    int rc = ble_coc_send(ctx->conn_handle, buf);
+    if (rc == 0) {
+        return BLE_XFER_SEND_OK;
     }
+    return (rc == BLE_HS_ESTALLED) ? BLE_XFER_SEND_STALLED : -rc;
+}
 
-    // Build full path
-    snprintf(ctx.file_path, sizeof(ctx.file_path), "/Storage/%s", filename);
+// Queue a scheduler run; a no-op if one is already queued
+static void nimble_sdu_schedule(void *arg) {
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &sched_ev);
+}
+
+static void nimble_rx_resume(void *arg) {
+    ble_transfer_ctx_t *ctx = (ble_transfer_ctx_t *)arg;
+    ble_coc_rx_resume(ctx->conn_handle);
+}
+
+// Wall cycles on the host task's core
+static uint32_t nimble_cycles(void *arg) {
+    return esp_cpu_get_cycle_count();
+}
+
+static const ble_xfer_transport_t nimble_transport = {
+    .notify = nimble_notify,
+    .defer = nimble_defer,
+    .rx_segment = nimble_rx_segment,
+    .buf_alloc = nimble_buf_alloc,
+    .buf_space = nimble_buf_space,
+    .buf_commit = nimble_buf_commit,
+    .buf_free = nimble_buf_free,
+    .sdu_size = nimble_sdu_size,
+    .sdu_send = nimble_sdu_send,
+    .sdu_schedule = nimble_sdu_schedule,
+    .rx_resume = nimble_rx_resume,
+    .cycles = nimble_cycles,
+};
+
+// ============ Storage File Ops ============
+
+static void *storage_open(void *arg, const char *path, ble_xfer_open_t mode, uint32_t *size) {
+    if (mode == BLE_XFER_OPEN_CREATE) {
+        *size = 0;
+        return fopen(path, "w+b");
+    }
 
-    // Get file size
     struct stat st;
-    if (stat(ctx.file_path, &st) != 0) {
-        ESP_LOGE(TAG, "File not found: %s", ctx.file_path);
-        notify_data_ready(0);
-        return ESP_ERR_NOT_FOUND;
+    if (stat(path, &st) != 0) {
+        return NULL;
     }
+    *size = st.st_size;
+    return fopen(path, mode == BLE_XFER_OPEN_UPDATE ? "r+b" : "rb");
+}
+
+static int storage_read(void *arg, void *file, uint8_t *buf, size_t len, size_t *out) {
+    *out = fread(buf, 1, len, file);
+    return (*out < len && ferror(file)) ? -1 : 0;
+}
+
+static int storage_write(void *arg, void *file, const uint8_t *data, size_t len) {
+    return fwrite(data, 1, len, file) == len ? 0 : -1;
+}
+
+static int storage_seek(void *arg, void *file, uint32_t offset) {
+    return fseek(file, offset, SEEK_SET);
+}
+
+static int storage_close(void *arg, void *file) {
+    return fclose(file);
+}
+
+static void storage_remove(void *arg, const char *path) {
+    storage_delete_file(path);
+}
 
-    // Open file for reading
-    ctx.file_handle = fopen(ctx.file_path, "rb");
-    if (!ctx.file_handle) {
-        ESP_LOGE(TAG, "Failed to open file: %s", ctx.file_path);
-        notify_data_ready(0);
-        return ESP_FAIL;
+// Verify the size that landed on storage, cache the digest for listings
+// and add audio files to the playlist
+static esp_err_t storage_commit(void *arg, const char *path, uint32_t size,
+                                const uint8_t sha256[BLE_TRANSFER_SHA256_SIZE]) {
+    storage_meta_t meta = { 0 };
+    storage_file_written(path);
+    if (storage_cache_get(path, &meta) != ESP_OK || meta.size != size) {
+        ESP_LOGE(TAG, "Upload size mismatch: expected %lu, got %lu",
+                 (unsigned long)size, (unsigned long)meta.size);
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    ctx.state = BLE_XFER_STATE_DOWNLOAD_PENDING;
-    ctx.direction = BLE_XFER_DIR_DOWNLOAD;
-    ctx.total_bytes = st.st_size;
-    ctx.transferred_bytes = 0;
-    ctx.conn_handle = conn_handle;
-    ctx.delete_on_error = false;
-    ctx.chunk_ready = false;
-    ctx.chunk_len = 0;
+    storage_cache_set_hash(path, sha256);
+    playlist_add(path);
+    return ESP_OK;
+}
+
+static void storage_hashed(void *arg, const char *path,
+                           const uint8_t sha256[BLE_TRANSFER_SHA256_SIZE]) {
+    storage_cache_set_hash(path, sha256);
+}
+
+static const ble_xfer_file_ops_t storage_fops = {
+    .open = storage_open,
+    .read = storage_read,
+    .write = storage_write,
+    .seek = storage_seek,
+    .close = storage_close,
+    .remove = storage_remove,
+    .commit = storage_commit,
+    .hashed = storage_hashed,
+};
+
+// ============ OTA File Ops ============
+// Written straight to the inactive OTA slot, nothing staged on storage;
+// a delta patch is applied against the running image on the way
+
+static int ota_write(void *arg, void *file, const uint8_t *data, size_t len) {
+    return ble_ota_write(data, len) == ESP_OK ? 0 : -1;
+}
+
+// Whole image received: ble_ota checks its digest against the one the
+// app announced and makes it the boot image
+static esp_err_t ota_commit(void *arg, const char *path, uint32_t size,
+                            const uint8_t sha256[BLE_TRANSFER_SHA256_SIZE]) {
+    return ble_ota_finish();
+}
+
+// A delta patch still being applied
+static bool ota_busy(void *arg, void *file) {
+    return ble_ota_busy();
+}
+
+static const ble_xfer_file_ops_t ota_fops = {
+    .write = ota_write,
+    .commit = ota_commit,
+    .busy = ota_busy,
+};
+
+// ============ Lifecycle Hooks ============
 
-    ESP_LOGI(TAG, "Download started: %s (%lu bytes)", ctx.file_path,
-             (unsigned long)ctx.total_bytes);
+static void hook_begin(void *arg) {
+    ble_transfer_ctx_t *ctx = (ble_transfer_ctx_t *)arg;
+
+    aggregate_change(1);
+    esp_timer_start_periodic(ctx->telemetry_timer, BLE_TRANSFER_TELEMETRY_INTERVAL_MS * 1000);
+
+    ESP_LOGI(TAG, "Transfer on conn %d started %lu ms after connect",
+             ctx->conn_handle, (unsigned long)ble_conn_age_ms(ctx->conn_handle));
 
     // Set LED to transfer mode
     led_set_mode(LED_MODE_BLE_TRANSFER);
 
-    // Prepare first chunk
-    ble_transfer_prepare_next_chunk();
+    // Switch the link to 2M PHY / max DLE / long connection events
+    ble_link_set_profile(ctx->conn_handle, BLE_LINK_PROFILE_BULK);
+}
 
-    // Notify on transfer_data: [0x01][filesize:4] to signal ready
-    notify_data_ready(ctx.total_bytes);
+static void hook_end(void *arg, bool ok) {
+    ble_transfer_ctx_t *ctx = (ble_transfer_ctx_t *)arg;
 
-    return ESP_OK;
+    esp_timer_stop(ctx->telemetry_timer);
+    aggregate_change(-1);
+    telemetry_log(ctx);
+    ble_gatt_notify_transfer_telemetry(ctx->conn_handle);
+
+    ctx->deficit = 0;
+    ble_link_set_profile(ctx->conn_handle, BLE_LINK_PROFILE_DEFAULT);
+
+    if (ctx->ota) {
+        ctx->ota = false;
+        if (ok) {
+            // Complete carries the digest; the restart waits for it to go out
+            ble_ota_restart();
+        } else {
+            ble_ota_abort();
+        }
+    }
+
+    // Every transfer ends here, so the LED can't stay in transfer mode
+    transfer_led_update();
 }
 
-esp_err_t ble_transfer_receive_chunk(const uint8_t *data, size_t len) {
-    if (ctx.state != BLE_XFER_STATE_UPLOAD_PENDING &&
-        ctx.state != BLE_XFER_STATE_UPLOADING) {
-        ESP_LOGW(TAG, "Unexpected data chunk - not in upload state");
-        return ESP_ERR_INVALID_STATE;
+static void hook_moved(void *arg, size_t len) {
+    taskENTER_CRITICAL(&aggregate_lock);
+    aggregate.bytes += len;
+    taskEXIT_CRITICAL(&aggregate_lock);
+}
+
+static const ble_xfer_hooks_t transfer_hooks = {
+    .begin = hook_begin,
+    .end = hook_end,
+    .moved = hook_moved,
+};
+
+// ============ Contexts ============
+
+// Host task: send the deferred notifications of one connection
+static void deferred_notify_run(struct ble_npl_event *nev) {
+    ble_transfer_ctx_t *ctx = ble_npl_event_get_arg(nev);
+    ble_xfer_engine_run_deferred(&ctx->engine);
+}
+
+static void sched_run(struct ble_npl_event *ev);
+
+void ble_transfer_init(void) {
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        ble_transfer_ctx_t *ctx = &contexts[i];
+        esp_timer_handle_t telemetry_timer = ctx->telemetry_timer;
+
+        memset(ctx, 0, sizeof(*ctx));
+        ble_xfer_engine_init(&ctx->engine, &nimble_transport, &transfer_hooks, ctx);
+        ctx->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        ctx->telemetry_timer = telemetry_timer;
+        ble_npl_event_init(&ctx->notify_ev, deferred_notify_run, ctx);
+
+        if (ctx->telemetry_timer == NULL) {
+            esp_timer_create_args_t timer_args = {
+                .callback = telemetry_timer_callback,
+                .arg = ctx,
+                .dispatch_method = ESP_TIMER_TASK,
+                .name = "xfer_telemetry"
+            };
+            esp_timer_create(&timer_args, &ctx->telemetry_timer);
+        }
     }
 
-    if (!data || len == 0) {
-        ESP_LOGE(TAG, "Invalid chunk data");
-        return ESP_ERR_INVALID_ARG;
+    ble_npl_event_init(&sched_ev, sched_run, NULL);
+
+    if (chunk_mem == NULL) {
+        chunk_mem = heap_caps_malloc(OS_MEMPOOL_BYTES(CHUNK_BLOCK_COUNT, CHUNK_BLOCK_SIZE),
+                                     MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        int rc = chunk_mem ? os_mempool_init(&chunk_mempool, CHUNK_BLOCK_COUNT, CHUNK_BLOCK_SIZE,
+                                             chunk_mem, "xfer_chunk") : -1;
+        if (rc == 0) {
+            rc = os_mbuf_pool_init(&chunk_mbuf_pool, &chunk_mempool, CHUNK_BLOCK_SIZE,
+                                   CHUNK_BLOCK_COUNT);
+        }
+        if (rc != 0) {
+            // Chunks still come from msys, just not reserved
+            ESP_LOGW(TAG, "No download chunk pool: %d", rc);
+            heap_caps_free(chunk_mem);
+            chunk_mem = NULL;
+        }
     }
 
-    ctx.state = BLE_XFER_STATE_UPLOADING;
+    ESP_LOGI(TAG, "Transfer module initialized (%d connections)", BLE_MAX_CONNECTIONS);
+}
 
-    // Write raw binary data directly to file (no base64 decoding)
-    size_t written = fwrite(data, 1, len, ctx.file_handle);
-    if (written != len) {
-        ESP_LOGE(TAG, "Write failed: wrote %d of %d bytes", (int)written, (int)len);
-        cleanup_transfer(false);
-        notify_status(BLE_TRANSFER_STATUS_ERROR, 0);
-        return ESP_FAIL;
+// Context of a connection. Contexts follow connection slots, so the
+// context is (re)bound to whichever connection holds the slot now.
+static ble_transfer_ctx_t *ctx_get(uint16_t conn_handle) {
+    int slot = ble_conn_slot(conn_handle);
+    if (slot < 0) {
+        return NULL;
     }
 
-    ctx.transferred_bytes += len;
+    ble_transfer_ctx_t *ctx = &contexts[slot];
+    ctx->conn_handle = conn_handle;
+    return ctx;
+}
 
-    // Notify progress
-    notify_progress();
+// Another connection has the file open in a way that conflicts: any use
+// when we would write it, an upload when we would only read it
+static bool file_busy(const ble_transfer_ctx_t *self, const char *path, bool writing) {
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        const ble_xfer_engine_t *e = &contexts[i].engine;
+        if (&contexts[i] == self || !ble_xfer_engine_is_active(e) ||
+            strcmp(e->path, path) != 0) {
+            continue;
+        }
+        if (writing || e->direction == BLE_XFER_DIR_UPLOAD) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    ESP_LOGD(TAG, "Received chunk: %d bytes, progress: %lu/%lu",
-             (int)len, (unsigned long)ctx.transferred_bytes,
-             (unsigned long)ctx.total_bytes);
+void ble_transfer_set_handles(uint16_t ctrl_handle, uint16_t data_handle,
+                               uint16_t progress_handle) {
+    ctrl_attr_handle = ctrl_handle;
+    data_attr_handle = data_handle;
+    progress_attr_handle = progress_handle;
+}
 
-    // Check if complete
-    if (ctx.transferred_bytes >= ctx.total_bytes) {
-        fflush(ctx.file_handle);
-        fclose(ctx.file_handle);
-        ctx.file_handle = NULL;
+// ============ Transfer Start ============
 
-        // Verify actual file size
-        struct stat st;
-        if (stat(ctx.file_path, &st) == 0 &&
-            (uint32_t)st.st_size == ctx.total_bytes) {
-            ESP_LOGI(TAG, "Upload complete: %s", ctx.file_path);
-            notify_status(BLE_TRANSFER_STATUS_COMPLETE, 0);
+esp_err_t ble_transfer_start_upload(uint16_t conn_handle, const char *filename,
+                                     uint32_t total_size, uint8_t flags, uint32_t offset) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx || !ble_auth_is_authenticated(conn_handle)) {
+        ESP_LOGW(TAG, "Upload rejected - not authenticated");
+        return ESP_ERR_INVALID_STATE;
+    }
 
-            // Rescan playlist for new audio files
-            playlist_rescan();
+    if (!filename) {
+        ESP_LOGE(TAG, "Invalid upload parameters");
+        ble_xfer_engine_reject(&ctx->engine, BLE_XFER_CH_CTRL);
+        return ESP_ERR_INVALID_ARG;
+    }
 
-            // Restore LED mode
-            led_set_mode(LED_MODE_BLE_PAIRING);
+    // Build full path
+    char path[BLE_XFER_PATH_LEN];
+    snprintf(path, sizeof(path), "/Storage/%s", filename);
 
-            // Reset state to allow new transfers
-            ctx.state = BLE_XFER_STATE_IDLE;
-            ctx.direction = BLE_XFER_DIR_NONE;
-        } else {
-            ESP_LOGE(TAG, "Upload size mismatch: expected %lu, got %lu",
-                     (unsigned long)ctx.total_bytes,
-                     (unsigned long)(st.st_size));
-            // Delete partial/corrupt file
-            unlink(ctx.file_path);
-            notify_status(BLE_TRANSFER_STATUS_ERROR, 0);
-            led_set_mode(LED_MODE_BLE_PAIRING);
-
-            // Reset state to allow new transfers
-            ctx.state = BLE_XFER_STATE_IDLE;
-            ctx.direction = BLE_XFER_DIR_NONE;
-        }
-        ctx.delete_on_error = false;
-    } else {
-        // Ready for next chunk
-        notify_status(BLE_TRANSFER_STATUS_READY, 0);
+    if (file_busy(ctx, path, true)) {
+        ESP_LOGW(TAG, "Upload rejected - %s in use by another connection", path);
+        ble_xfer_engine_reject(&ctx->engine, BLE_XFER_CH_CTRL);
+        return ESP_ERR_INVALID_STATE;
     }
 
-    return ESP_OK;
+    ble_xfer_start_t p = {
+        .fops = &storage_fops,
+        .path = path,
+        .name = filename,
+        .size = total_size,
+        .flags = flags,
+        .offset = offset,
+    };
+    return ble_xfer_engine_start_upload(&ctx->engine, &p);
 }
 
-esp_err_t ble_transfer_prepare_next_chunk(void) {
-    if (ctx.state != BLE_XFER_STATE_DOWNLOAD_PENDING &&
-        ctx.state != BLE_XFER_STATE_DOWNLOADING) {
+esp_err_t ble_transfer_start_ota(uint16_t conn_handle, uint32_t image_size,
+                                 const uint8_t *sha256, uint8_t flags) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx || !ble_auth_is_authenticated(conn_handle)) {
+        ESP_LOGW(TAG, "OTA rejected - not authenticated");
         return ESP_ERR_INVALID_STATE;
     }
 
-    ctx.state = BLE_XFER_STATE_DOWNLOADING;
+    if (ctx->engine.state != BLE_XFER_STATE_IDLE) {
+        ESP_LOGW(TAG, "OTA rejected - transfer already in progress");
+        ble_xfer_engine_reject(&ctx->engine, BLE_XFER_CH_CTRL);
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    // Read raw binary data directly into chunk buffer (no base64)
-    size_t read_len = fread(ctx.chunk_buffer, 1, BLE_TRANSFER_CHUNK_SIZE, ctx.file_handle);
+    esp_err_t err = ble_ota_begin(conn_handle, image_size, sha256,
+                                  (flags & BLE_TRANSFER_FLAG_DELTA) != 0);
+    if (err != ESP_OK) {
+        ble_xfer_engine_reject(&ctx->engine, BLE_XFER_CH_CTRL);
+        return err;
+    }
 
-    if (read_len == 0) {
-        // EOF - no more data
-        ctx.chunk_ready = false;
-        ctx.chunk_len = 0;
-        return ESP_ERR_NOT_FINISHED;
+    // An image restarts from its first byte; Delta was accepted by ble_ota_begin()
+    ble_xfer_start_t p = {
+        .fops = &ota_fops,
+        .name = (flags & BLE_TRANSFER_FLAG_DELTA) ? "firmware.delta" : "firmware.bin",
+        .size = image_size,
+        .flags = flags & ~BLE_TRANSFER_FLAG_RESUME,
+        .granted = flags & BLE_TRANSFER_FLAG_DELTA,
+    };
+    ctx->ota = true;
+    err = ble_xfer_engine_start_upload(&ctx->engine, &p);
+    if (err != ESP_OK) {
+        ctx->ota = false;
+        ble_ota_abort();
     }
+    return err;
+}
 
-    ctx.chunk_len = read_len;
-    ctx.chunk_ready = true;
-    ctx.transferred_bytes += read_len;
+esp_err_t ble_transfer_start_download(uint16_t conn_handle, const char *filename,
+                                       uint8_t flags, uint32_t offset) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx || !ble_auth_is_authenticated(conn_handle)) {
+        ESP_LOGW(TAG, "Download rejected - not authenticated");
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    ESP_LOGD(TAG, "Prepared chunk: %d bytes, progress: %lu/%lu",
-             (int)read_len,
-             (unsigned long)ctx.transferred_bytes,
-             (unsigned long)ctx.total_bytes);
+    if (!filename) {
+        ESP_LOGE(TAG, "Download rejected - filename is NULL");
+        ble_xfer_engine_reject(&ctx->engine, BLE_XFER_CH_DATA);
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    return ESP_OK;
-}
+    // Build full path
+    char path[BLE_XFER_PATH_LEN];
+    snprintf(path, sizeof(path), "/Storage/%s", filename);
 
-esp_err_t ble_transfer_get_chunk_data(const uint8_t **data, size_t *len) {
-    if (!ctx.chunk_ready) {
+    if (file_busy(ctx, path, false)) {
+        ESP_LOGW(TAG, "Download rejected - %s is being uploaded", path);
+        ble_xfer_engine_reject(&ctx->engine, BLE_XFER_CH_DATA);
         return ESP_ERR_INVALID_STATE;
     }
 
-    *data = ctx.chunk_buffer;
-    *len = ctx.chunk_len;
-    return ESP_OK;
+    ble_xfer_start_t p = {
+        .fops = &storage_fops,
+        .path = path,
+        .name = filename,
+        .flags = flags,
+        .offset = offset,
+    };
+    return ble_xfer_engine_start_download(&ctx->engine, &p);
 }
 
-void ble_transfer_chunk_read_complete(void) {
-    if (ctx.direction != BLE_XFER_DIR_DOWNLOAD) {
-        return;
+static ble_xfer_batch_t *batch_prepare(ble_transfer_ctx_t *ctx) {
+    if (!ble_auth_is_authenticated(ctx->conn_handle)) {
+        ESP_LOGW(TAG, "Batch rejected - not authenticated");
+        return NULL;
     }
 
-    ctx.chunk_ready = false;
+    if (ctx->engine.state != BLE_XFER_STATE_IDLE) {
+        ESP_LOGW(TAG, "Batch rejected - transfer in progress");
+        ble_xfer_engine_reject(&ctx->engine, BLE_XFER_CH_CTRL);
+        return NULL;
+    }
 
-    // Prepare next chunk
-    esp_err_t err = ble_transfer_prepare_next_chunk();
+    ble_xfer_batch_t *b = ble_xfer_batch_alloc("/Storage");
+    if (!b) {
+        ESP_LOGE(TAG, "Batch rejected - out of memory");
+        ble_xfer_engine_reject(&ctx->engine, BLE_XFER_CH_CTRL);
+    }
+    return b;
+}
+
+esp_err_t ble_transfer_start_batch_list(uint16_t conn_handle, const char *names,
+                                        size_t len, uint8_t flags) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx) {
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    if (err == ESP_ERR_NOT_FINISHED) {
-        // Transfer complete
-        fclose(ctx.file_handle);
-        ctx.file_handle = NULL;
-        ctx.state = BLE_XFER_STATE_COMPLETE;
+    ble_xfer_batch_t *b = batch_prepare(ctx);
+    if (!b) {
+        return ESP_ERR_INVALID_STATE;
+    }
 
-        // Defer notification (can't send from GATT callback context)
-        deferred_action = DEFERRED_COMPLETE;
-        esp_timer_start_once(notify_timer, NOTIFY_TIMER_DELAY_US);
-    } else if (err == ESP_OK) {
-        // Defer notification for next chunk ready
-        deferred_action = DEFERRED_CHUNK_READY;
-        deferred_size = ctx.chunk_len;
-        esp_timer_start_once(notify_timer, NOTIFY_TIMER_DELAY_US);
-    } else {
-        // Error - defer notification
-        ESP_LOGE(TAG, "Error preparing chunk");
-        cleanup_transfer(false);
-        deferred_action = DEFERRED_ERROR;
-        esp_timer_start_once(notify_timer, NOTIFY_TIMER_DELAY_US);
+    // NUL-separated names; the last one may be unterminated
+    size_t pos = 0;
+    while (pos < len) {
+        char name[BLE_TRANSFER_BATCH_NAME_LEN];
+        size_t name_len = strnlen(&names[pos], len - pos);
+        if (name_len < sizeof(name)) {
+            memcpy(name, &names[pos], name_len);
+            name[name_len] = '\0';
+            if (!ble_xfer_batch_add(b, name)) {
+                break;
+            }
+        } else {
+            ESP_LOGW(TAG, "Batch: skipping invalid name (%d bytes)", (int)name_len);
+        }
+        pos += name_len + 1;
     }
+
+    return ble_xfer_engine_start_batch(&ctx->engine, &storage_fops, b, flags);
 }
 
-void ble_transfer_cancel(void) {
-    if (ctx.state == BLE_XFER_STATE_IDLE) {
-        return;
+typedef struct {
+    ble_xfer_batch_t *batch;
+    int after;
+} batch_scan_ctx_t;
+
+static void batch_scan_callback(const char *file_path, void *user_data) {
+    batch_scan_ctx_t *scan = (batch_scan_ctx_t *)user_data;
+
+    const char *filename = strrchr(file_path, '/');
+    filename = filename ? filename + 1 : file_path;
+
+    if (storage_recording_number(filename) > scan->after) {
+        ble_xfer_batch_add(scan->batch, filename);
     }
+}
 
-    ESP_LOGI(TAG, "Transfer cancelled");
-    cleanup_transfer(false);
+static int batch_name_cmp(const void *a, const void *b) {
+    return storage_recording_number(a) - storage_recording_number(b);
+}
 
-    // Restore LED mode
-    led_set_mode(LED_MODE_BLE_PAIRING);
+esp_err_t ble_transfer_start_batch_since(uint16_t conn_handle, uint32_t after,
+                                         uint8_t flags) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ble_xfer_batch_t *b = batch_prepare(ctx);
+    if (!b) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    batch_scan_ctx_t scan = {
+        .batch = b,
+        .after = (after > INT32_MAX) ? INT32_MAX : (int)after,
+    };
+    storage_scan_audio_files(batch_scan_callback, &scan);
+
+    // Oldest first, so an interrupted sync can resume from the last number
+    qsort(b->names, b->count, BLE_TRANSFER_BATCH_NAME_LEN, batch_name_cmp);
+
+    return ble_xfer_engine_start_batch(&ctx->engine, &storage_fops, b, flags);
 }
 
-static void cleanup_transfer(bool success) {
-    if (ctx.file_handle) {
-        fclose(ctx.file_handle);
-        ctx.file_handle = NULL;
+// ============ Data Path ============
+
+esp_err_t ble_transfer_receive_chunk(uint16_t conn_handle, const struct os_mbuf *om) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx) {
+        return ESP_ERR_INVALID_STATE;
     }
 
-    // Delete partial uploads on error
-    if (!success && ctx.delete_on_error && ctx.file_path[0] != '\0') {
-        ESP_LOGW(TAG, "Deleting partial upload: %s", ctx.file_path);
-        unlink(ctx.file_path);
+    if (!om || OS_MBUF_PKTLEN(om) == 0) {
+        ESP_LOGE(TAG, "Invalid chunk data");
+        return ESP_ERR_INVALID_ARG;
     }
 
-    // Reset to IDLE to allow new transfers
-    ctx.state = BLE_XFER_STATE_IDLE;
-    ctx.direction = BLE_XFER_DIR_NONE;
-    ctx.delete_on_error = false;
+    return ble_xfer_engine_receive(&ctx->engine, om, false);
 }
 
-static void notify_status(uint8_t status, uint32_t size) {
-    if (ctrl_attr_handle == 0 || ctx.conn_handle == 0) {
-        return;
+esp_err_t ble_transfer_prepare_next_chunk(uint16_t conn_handle) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    return ctx ? ble_xfer_engine_prepare(&ctx->engine) : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t ble_transfer_read_chunk(uint16_t conn_handle, struct os_mbuf *om) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    void *chunk;
+    esp_err_t err = ble_xfer_engine_take_chunk(&ctx->engine, &chunk);
+    if (err != ESP_OK) {
+        return err;
     }
 
-    // Format: [status:1][size:4]
-    uint8_t response[5];
-    response[0] = status;
-    response[1] = (size >> 0) & 0xFF;
-    response[2] = (size >> 8) & 0xFF;
-    response[3] = (size >> 16) & 0xFF;
-    response[4] = (size >> 24) & 0xFF;
+    // The response takes the chunk's mbufs; nothing is copied
+    os_mbuf_concat(om, chunk);
+    return ESP_OK;
+}
+
+// Deficit round robin over the CoC downloads. Each pass sends one SDU and
+// re-posts the event, so other host work interleaves and every download
+// gets SCHED_QUANTUM bytes of credit per turn however big its SDUs are.
+static void sched_run(struct ble_npl_event *ev) {
+    for (int visited = 0; visited <= BLE_MAX_CONNECTIONS; visited++) {
+        ble_transfer_ctx_t *c = &contexts[sched_cursor];
+
+        if (ble_xfer_engine_pumpable(&c->engine)) {
+            uint32_t sdu_size = ble_coc_tx_sdu_size(c->conn_handle);
+            if (c->deficit >= sdu_size) {
+                c->deficit -= sdu_size;
+                ble_xfer_engine_pump(&c->engine);
+                nimble_sdu_schedule(NULL);
+                return;
+            }
+        } else {
+            c->deficit = 0;
+        }
 
-    struct os_mbuf *om = ble_hs_mbuf_from_flat(response, sizeof(response));
-    if (om) {
-        ble_gatts_notify_custom(ctx.conn_handle, ctrl_attr_handle, om);
+        // Turn over: the next download earns its quantum
+        sched_cursor = (sched_cursor + 1) % BLE_MAX_CONNECTIONS;
+        ble_transfer_ctx_t *next = &contexts[sched_cursor];
+        if (ble_xfer_engine_pumpable(&next->engine)) {
+            next->deficit += SCHED_QUANTUM;
+        }
     }
 }
 
-static void notify_data_ready(uint32_t size) {
-    if (data_attr_handle == 0 || ctx.conn_handle == 0) {
-        return;
+bool ble_transfer_coc_receive(uint16_t conn_handle, const struct os_mbuf *sdu) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx || ble_xfer_engine_receive(&ctx->engine, sdu, true) != ESP_OK) {
+        return true;
     }
+    return !ble_xfer_engine_rx_held(&ctx->engine);
+}
 
-    // Format: [0x01=ready][size:4] or [0x00=error][0:4]
-    uint8_t response[5];
-    response[0] = (size > 0) ? BLE_TRANSFER_STATUS_READY : BLE_TRANSFER_STATUS_ERROR;
-    response[1] = (size >> 0) & 0xFF;
-    response[2] = (size >> 8) & 0xFF;
-    response[3] = (size >> 16) & 0xFF;
-    response[4] = (size >> 24) & 0xFF;
+void ble_transfer_ota_resume(uint16_t conn_handle, esp_err_t err) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx || !ctx->ota) {
+        return;
+    }
+    ble_xfer_engine_resume(&ctx->engine, err);
+}
 
-    struct os_mbuf *om = ble_hs_mbuf_from_flat(response, sizeof(response));
-    if (om) {
-        ble_gatts_notify_custom(ctx.conn_handle, data_attr_handle, om);
+void ble_transfer_coc_tx_ready(uint16_t conn_handle) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (ctx) {
+        ble_xfer_engine_tx_ready(&ctx->engine);
     }
 }
 
-static void notify_progress(void) {
-    if (progress_attr_handle == 0 || ctx.conn_handle == 0) {
+void ble_transfer_coc_closed(uint16_t conn_handle) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx || ctx->engine.state == BLE_XFER_STATE_IDLE ||
+        !(ctx->engine.flags & BLE_TRANSFER_FLAG_L2CAP)) {
         return;
     }
 
-    // Format: [transferred:4][total:4]
-    uint8_t data[8];
-    data[0] = (ctx.transferred_bytes >> 0) & 0xFF;
-    data[1] = (ctx.transferred_bytes >> 8) & 0xFF;
-    data[2] = (ctx.transferred_bytes >> 16) & 0xFF;
-    data[3] = (ctx.transferred_bytes >> 24) & 0xFF;
-    data[4] = (ctx.total_bytes >> 0) & 0xFF;
-    data[5] = (ctx.total_bytes >> 8) & 0xFF;
-    data[6] = (ctx.total_bytes >> 16) & 0xFF;
-    data[7] = (ctx.total_bytes >> 24) & 0xFF;
+    ESP_LOGW(TAG, "CoC channel closed during transfer (conn %d)", conn_handle);
+    ble_xfer_engine_fail(&ctx->engine);
+}
 
-    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, sizeof(data));
-    if (om) {
-        ble_gatts_notify_custom(ctx.conn_handle, progress_attr_handle, om);
+esp_err_t ble_transfer_command(uint16_t conn_handle, const ble_xfer_cmd_t *cmd) {
+    switch (cmd->opcode) {
+    case BLE_TRANSFER_OP_CANCEL:
+        ble_transfer_cancel(conn_handle);
+        return ESP_OK;
+    case BLE_TRANSFER_OP_UPLOAD:
+        return ble_transfer_start_upload(conn_handle, cmd->name, cmd->size, cmd->flags,
+                                         cmd->offset);
+    case BLE_TRANSFER_OP_DOWNLOAD:
+        return ble_transfer_start_download(conn_handle, cmd->name, cmd->flags, cmd->offset);
+    case BLE_TRANSFER_OP_OTA:
+        return ble_transfer_start_ota(conn_handle, cmd->size, cmd->sha256, cmd->flags);
+    case BLE_TRANSFER_OP_BATCH:
+        if (cmd->batch_mode == BLE_TRANSFER_BATCH_LIST) {
+            return ble_transfer_start_batch_list(conn_handle, cmd->names, cmd->names_len,
+                                                 cmd->flags);
+        }
+        return ble_transfer_start_batch_since(conn_handle, cmd->after, cmd->flags);
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
     }
 }
 
-ble_xfer_state_t ble_transfer_get_state(void) {
-    return ctx.state;
+void ble_transfer_cancel(uint16_t conn_handle) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx || ctx->engine.state == BLE_XFER_STATE_IDLE) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Transfer cancelled (conn %d)", conn_handle);
+    ble_xfer_engine_cancel(&ctx->engine);
+}
+
+// ============ Status ============
+
+ble_xfer_state_t ble_transfer_get_state(uint16_t conn_handle) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    return ctx ? ctx->engine.state : BLE_XFER_STATE_IDLE;
 }
 
-ble_xfer_dir_t ble_transfer_get_direction(void) {
-    return ctx.direction;
+ble_xfer_dir_t ble_transfer_get_direction(uint16_t conn_handle) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    return ctx ? ctx->engine.direction : BLE_XFER_DIR_NONE;
 }
 
-uint32_t ble_transfer_get_progress(void) {
-    return ctx.transferred_bytes;
+uint32_t ble_transfer_get_progress(uint16_t conn_handle) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    return ctx ? ctx->engine.transferred_bytes : 0;
 }
 
-uint32_t ble_transfer_get_total(void) {
-    return ctx.total_bytes;
+uint32_t ble_transfer_get_total(uint16_t conn_handle) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    return ctx ? ctx->engine.total_bytes : 0;
 }
 
-uint8_t ble_transfer_get_percent(void) {
-    if (ctx.total_bytes == 0) {
+uint8_t ble_transfer_get_percent(uint16_t conn_handle) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx || ctx->engine.total_bytes == 0) {
         return 0;
     }
-    return (uint8_t)((ctx.transferred_bytes * 100) / ctx.total_bytes);
+    return (uint8_t)((ctx->engine.transferred_bytes * 100) / ctx->engine.total_bytes);
+}
+
+void ble_transfer_get_telemetry(uint16_t conn_handle, ble_transfer_telemetry_t *telem) {
+    memset(telem, 0, sizeof(*telem));
+
+    ble_transfer_aggregate_t agg;
+    ble_transfer_get_aggregate(&agg);
+    telem->active_transfers = agg.active;
+    telem->aggregate_bps = agg.active ? agg.bps[agg.active - 1] : 0;
+
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    if (!ctx) {
+        return;
+    }
+
+    const ble_xfer_engine_t *e = &ctx->engine;
+    int64_t now = e->stats.active ? esp_timer_get_time() : e->stats.end_us;
+    int64_t elapsed_us = e->stats.start_us ? now - e->stats.start_us : 0;
+    int64_t wait_us = ble_xfer_engine_wait_us(e, now);
+
+    telem->state = e->state;
+    telem->flags = e->flags;
+    telem->bytes = e->stats.bytes;
+    telem->elapsed_ms = (uint32_t)(elapsed_us / 1000);
+    telem->avg_bps = elapsed_us > 0 ?
+        (uint32_t)((uint64_t)e->stats.bytes * 1000000 / elapsed_us) : 0;
+    telem->inst_bps = e->stats.inst_bps;
+    telem->chunks = e->stats.chunks;
+    telem->io_ms = (uint32_t)(e->stats.io_us / 1000);
+    telem->wait_ms = (uint32_t)(wait_us / 1000);
+    telem->notify_failures = e->stats.notify_failures;
+    telem->queue_max = e->deferred_q.max_depth;
+    telem->queue_drops = e->deferred_q.drops;
+
+    if (e->chunk) {
+        telem->buf_flags |= BLE_TRANSFER_BUF_CHUNK_READY;
+        telem->buffered = e->chunk_len;
+    }
+    if (e->coc_stalled) {
+        telem->buf_flags |= BLE_TRANSFER_BUF_COC_STALLED;
+    }
+}
+
+void ble_transfer_get_aggregate(ble_transfer_aggregate_t *agg) {
+    int64_t now = esp_timer_get_time();
+
+    memset(agg, 0, sizeof(*agg));
+    taskENTER_CRITICAL(&aggregate_lock);
+    agg->active = aggregate.active;
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        uint64_t bytes = aggregate.bucket_bytes[i];
+        int64_t us = aggregate.bucket_us[i];
+
+        // Include the sample still running at the current concurrency
+        if (aggregate.active == i + 1 && aggregate.sample_us != 0) {
+            bytes += aggregate.bytes - aggregate.sample_bytes;
+            us += now - aggregate.sample_us;
+        }
+
+        agg->ms[i] = (uint32_t)(us / 1000);
+        agg->bps[i] = us > 0 ? (uint32_t)(bytes * 1000000 / us) : 0;
+    }
+    taskEXIT_CRITICAL(&aggregate_lock);
 }
 
 bool ble_transfer_is_active(void) {
-    return ctx.state == BLE_XFER_STATE_UPLOAD_PENDING ||
-           ctx.state == BLE_XFER_STATE_UPLOADING ||
-           ctx.state == BLE_XFER_STATE_DOWNLOAD_PENDING ||
-           ctx.state == BLE_XFER_STATE_DOWNLOADING;
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (ble_xfer_engine_is_active(&contexts[i].engine)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ble_transfer_is_file_in_use(const char *path) {
+    if (!path) {
+        return false;
+    }
+
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        const ble_xfer_engine_t *e = &contexts[i].engine;
+        if (ble_xfer_engine_is_active(e) && strcmp(e->path, path) == 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
-uint32_t ble_transfer_get_file_size(void) {
-    return ctx.total_bytes;
+uint32_t ble_transfer_get_file_size(uint16_t conn_handle) {
+    ble_transfer_ctx_t *ctx = ctx_get(conn_handle);
+    return ctx ? ctx->engine.total_bytes : 0;
 }
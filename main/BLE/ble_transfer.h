@@ -5,143 +5,250 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <esp_err.h>
+#include "ble_xfer_proto.h"
+#include "ble_xfer_engine.h"
+#include "ble_conn.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Chunk size for raw binary transfer (no Base64)
-// With MTU=512, max ATT payload is 509 bytes (MTU - 3)
-// Use 490 bytes to leave margin for protocol overhead
-#define BLE_TRANSFER_CHUNK_SIZE   490
-
-// Internal transfer states (more detailed than public API)
-typedef enum {
-    BLE_XFER_STATE_IDLE = 0,
-    BLE_XFER_STATE_UPLOAD_PENDING,   // Waiting for first data chunk
-    BLE_XFER_STATE_UPLOADING,        // Receiving chunks
-    BLE_XFER_STATE_DOWNLOAD_PENDING, // About to send file info
-    BLE_XFER_STATE_DOWNLOADING,      // Sending chunks
-    BLE_XFER_STATE_COMPLETE,
-    BLE_XFER_STATE_ERROR,
-} ble_xfer_state_t;
-
-// Transfer direction
-typedef enum {
-    BLE_XFER_DIR_NONE = 0,
-    BLE_XFER_DIR_UPLOAD,   // Phone -> Device
-    BLE_XFER_DIR_DOWNLOAD, // Device -> Phone
-} ble_xfer_dir_t;
+struct os_mbuf;
+
+// Telemetry is notified at this interval while a transfer runs
+#define BLE_TRANSFER_TELEMETRY_INTERVAL_MS  1000
+
+// Telemetry characteristic value size
+#define BLE_TRANSFER_TELEMETRY_SIZE  49
+
+// Buffer state bits (ble_transfer_telemetry_t.buf_flags)
+#define BLE_TRANSFER_BUF_CHUNK_READY  0x01  // Download chunk staged, waiting for the app's read
+#define BLE_TRANSFER_BUF_COC_STALLED  0x02  // CoC download out of peer credits
+
+// Transfer telemetry for the current (or last) session
+typedef struct {
+    uint8_t state;               // ble_xfer_state_t
+    uint8_t flags;               // Negotiated BLE_TRANSFER_FLAG_*
+    uint32_t bytes;              // File bytes moved (all files of a batch)
+    uint32_t elapsed_ms;
+    uint32_t avg_bps;
+    uint32_t inst_bps;           // Over the last telemetry interval
+    uint32_t chunks;             // GATT chunks or CoC SDUs
+    uint32_t io_ms;              // Time in file reads/writes
+    uint32_t wait_ms;            // Time waiting on the peer (reads, writes, credits)
+    uint16_t notify_failures;    // Notifications the stack refused
+    uint16_t buffered;           // Download bytes staged for the app
+    uint8_t buf_flags;           // BLE_TRANSFER_BUF_*
+    uint8_t queue_max;           // Deferred notification queue high-water mark
+    uint16_t queue_drops;        // Deferred notifications lost to a full queue
+    uint8_t active_transfers;    // Transfers running on all connections
+    uint32_t aggregate_bps;      // All connections, at the current concurrency
+} ble_transfer_telemetry_t;
+
+// Aggregate throughput of all connections, by number of concurrent
+// transfers: bps[0] was measured while one transfer ran, bps[1] while two
+// ran, and so on. ms[] is how long each concurrency level lasted.
+typedef struct {
+    uint8_t active;              // Transfers running now
+    uint32_t bps[BLE_MAX_CONNECTIONS];
+    uint32_t ms[BLE_MAX_CONNECTIONS];
+} ble_transfer_aggregate_t;
 
 /**
  * @brief Initialize transfer module
+ *
+ * Every connection gets its own transfer context, so each connected app
+ * can run one transfer at the same time as the others. All functions
+ * taking a conn_handle act on that connection's transfer only.
  */
 void ble_transfer_init(void);
 
 /**
  * @brief Start file upload (Phone -> Device)
  *
+ * Rejected if another connection is transferring the same file. With
+ * BLE_TRANSFER_FLAG_RESUME the file keeps its first offset bytes from an
+ * interrupted upload and the app sends the rest.
+ *
+ * @param conn_handle BLE connection handle
  * @param filename Filename to create (without /Storage/ prefix)
- * @param total_size Expected file size in bytes
- * @param conn_handle BLE connection handle for notifications
+ * @param total_size Expected file size in bytes (uncompressed)
+ * @param flags Requested BLE_TRANSFER_FLAG_* options
+ * @param offset With BLE_TRANSFER_FLAG_RESUME: bytes already on the device
  * @return ESP_OK on success
  */
-esp_err_t ble_transfer_start_upload(const char *filename, uint32_t total_size,
-                                     uint16_t conn_handle);
+esp_err_t ble_transfer_start_upload(uint16_t conn_handle, const char *filename,
+                                     uint32_t total_size, uint8_t flags, uint32_t offset);
 
 /**
  * @brief Start file download (Device -> Phone)
  *
+ * Rejected if another connection is uploading the same file.
+ *
+ * @param conn_handle BLE connection handle
  * @param filename Filename to send (without /Storage/ prefix)
- * @param conn_handle BLE connection handle for notifications
+ * @param flags Requested BLE_TRANSFER_FLAG_* options
+ * @param offset With BLE_TRANSFER_FLAG_RESUME: bytes the app already has
  * @return ESP_OK on success
  */
-esp_err_t ble_transfer_start_download(const char *filename, uint16_t conn_handle);
+esp_err_t ble_transfer_start_download(uint16_t conn_handle, const char *filename,
+                                       uint8_t flags, uint32_t offset);
 
 /**
- * @brief Receive a raw binary data chunk (for upload)
+ * @brief Start a batch download of named files (Device -> Phone)
  *
- * @param data Raw binary data
- * @param len Length of data
+ * Files are sent back-to-back, each preceded by a FILE header and
+ * followed by its own Complete status.
+ *
+ * @param conn_handle BLE connection handle
+ * @param names NUL-separated filenames (without /Storage/ prefix)
+ * @param len Length of names in bytes
+ * @param flags Requested BLE_TRANSFER_FLAG_* options
+ * @return ESP_OK on success
+ */
+esp_err_t ble_transfer_start_batch_list(uint16_t conn_handle, const char *names,
+                                        size_t len, uint8_t flags);
+
+/**
+ * @brief Start a batch download of all recordings numbered above a value
+ *
+ * @param conn_handle BLE connection handle
+ * @param after Send recording_NNNN.aac files with NNNN > after, oldest first
+ * @param flags Requested BLE_TRANSFER_FLAG_* options
  * @return ESP_OK on success
  */
-esp_err_t ble_transfer_receive_chunk(const uint8_t *data, size_t len);
+esp_err_t ble_transfer_start_batch_since(uint16_t conn_handle, uint32_t after,
+                                         uint8_t flags);
 
 /**
- * @brief Prepare next download chunk into internal buffer
+ * @brief Start a firmware update (BLE_TRANSFER_OP_OTA)
  *
- * Call this to load the next chunk from file into buffer.
- * App will then read via ble_transfer_get_chunk_data().
+ * The image is uploaded like a file, but written into the inactive OTA
+ * slot as it arrives. When the last chunk is in, its SHA-256 is checked
+ * against sha256, the slot becomes the boot image and the device restarts.
+ * With BLE_TRANSFER_FLAG_DELTA the upload is a patch against the running
+ * image instead, and size and sha256 describe the patch.
  *
+ * @param conn_handle BLE connection handle
+ * @param image_size Image (or patch) size in bytes
+ * @param sha256 Expected SHA-256 of the upload (BLE_TRANSFER_SHA256_SIZE bytes)
+ * @param flags Requested BLE_TRANSFER_FLAG_* options
+ * @return ESP_OK on success
+ */
+esp_err_t ble_transfer_start_ota(uint16_t conn_handle, uint32_t image_size,
+                                 const uint8_t *sha256, uint8_t flags);
+
+/**
+ * @brief Receive an upload chunk
+ *
+ * The chunk is written to the file segment by segment, straight from the
+ * mbufs it arrived in.
+ *
+ * @param conn_handle BLE connection handle
+ * @param om Chunk as received (the write's mbuf chain)
+ * @return ESP_OK on success
+ */
+esp_err_t ble_transfer_receive_chunk(uint16_t conn_handle, const struct os_mbuf *om);
+
+/**
+ * @brief Prepare next download chunk
+ *
+ * Call this to read the next chunk from file into an mbuf.
+ * App will then read via ble_transfer_read_chunk().
+ *
+ * @param conn_handle BLE connection handle
  * @return ESP_OK on success, ESP_ERR_NOT_FINISHED when complete
  */
-esp_err_t ble_transfer_prepare_next_chunk(void);
+esp_err_t ble_transfer_prepare_next_chunk(uint16_t conn_handle);
 
 /**
- * @brief Get pointer to current chunk data for reading
+ * @brief Hand the prepared chunk to a read response, prepare the next
  *
- * @param[out] data Pointer to chunk buffer
- * @param[out] len Length of data in buffer
- * @return ESP_OK if chunk is ready, ESP_ERR_INVALID_STATE if no chunk available
+ * The chunk's mbufs are chained onto the response, not copied. The next
+ * chunk is then prepared and announced by notify.
+ *
+ * @param conn_handle BLE connection handle
+ * @param om Read response (the access context's mbuf)
+ * @return ESP_OK if a chunk was added, ESP_ERR_INVALID_STATE if none is ready
  */
-esp_err_t ble_transfer_get_chunk_data(const uint8_t **data, size_t *len);
+esp_err_t ble_transfer_read_chunk(uint16_t conn_handle, struct os_mbuf *om);
 
 /**
- * @brief Mark current chunk as read by app, prepare next
+ * @brief Run a parsed Transfer Control command
+ *
+ * Dispatches to the start/cancel function for cmd->opcode. Used by the
+ * Transfer Control characteristic and the RPC TRANSFER method.
  *
- * Called after app reads the chunk. Prepares next chunk and notifies.
+ * @param conn_handle BLE connection handle
+ * @param cmd Command from ble_xfer_parse_command()
+ * @return The start function's result; ESP_OK for Cancel
  */
-void ble_transfer_chunk_read_complete(void);
+esp_err_t ble_transfer_command(uint16_t conn_handle, const ble_xfer_cmd_t *cmd);
 
 /**
- * @brief Cancel ongoing transfer
+ * @brief Cancel a connection's ongoing transfer
  *
  * Closes file, deletes partial uploads, resets state
+ *
+ * @param conn_handle BLE connection handle
  */
-void ble_transfer_cancel(void);
+void ble_transfer_cancel(uint16_t conn_handle);
 
 /**
- * @brief Get current transfer state
+ * @brief Get a connection's transfer state
  *
- * @return Current transfer state
+ * @param conn_handle BLE connection handle
+ * @return Current transfer state, IDLE for an unknown connection
  */
-ble_xfer_state_t ble_transfer_get_state(void);
+ble_xfer_state_t ble_transfer_get_state(uint16_t conn_handle);
 
 /**
- * @brief Get current transfer direction
+ * @brief Get a connection's transfer direction
  *
+ * @param conn_handle BLE connection handle
  * @return Current transfer direction
  */
-ble_xfer_dir_t ble_transfer_get_direction(void);
+ble_xfer_dir_t ble_transfer_get_direction(uint16_t conn_handle);
 
 /**
  * @brief Get bytes transferred so far
  *
+ * @param conn_handle BLE connection handle
  * @return Number of bytes transferred
  */
-uint32_t ble_transfer_get_progress(void);
+uint32_t ble_transfer_get_progress(uint16_t conn_handle);
 
 /**
  * @brief Get total transfer size
  *
+ * @param conn_handle BLE connection handle
  * @return Total file size in bytes
  */
-uint32_t ble_transfer_get_total(void);
+uint32_t ble_transfer_get_total(uint16_t conn_handle);
 
 /**
  * @brief Get transfer progress as percentage (0-100)
  *
+ * @param conn_handle BLE connection handle
  * @return Progress percentage
  */
-uint8_t ble_transfer_get_percent(void);
+uint8_t ble_transfer_get_percent(uint16_t conn_handle);
 
 /**
- * @brief Check if transfer is active
+ * @brief Check if any connection has a transfer running
  *
- * @return true if upload or download is in progress
+ * @return true if an upload or download is in progress
  */
 bool ble_transfer_is_active(void);
 
+/**
+ * @brief Check if a transfer is reading or writing a file
+ *
+ * @param path Full file path
+ * @return true if an active upload or download on any connection uses path
+ */
+bool ble_transfer_is_file_in_use(const char *path);
+
 /**
  * @brief Set the attribute handles for notifications
  *
@@ -152,12 +259,71 @@ bool ble_transfer_is_active(void);
 void ble_transfer_set_handles(uint16_t ctrl_handle, uint16_t data_handle,
                                uint16_t progress_handle);
 
+/**
+ * @brief Handle an SDU received on the L2CAP CoC channel (upload data)
+ *
+ * Called from the host task. The caller keeps ownership of the SDU.
+ *
+ * @param conn_handle Connection the channel belongs to
+ * @param sdu Received SDU mbuf chain
+ * @return true to give the peer credits now; false while a firmware patch
+ *         is being applied, until ble_coc_rx_resume() is called
+ */
+bool ble_transfer_coc_receive(uint16_t conn_handle, const struct os_mbuf *sdu);
+
+/**
+ * @brief Continue an OTA upload held while ble_ota applied patch data
+ *
+ * Called from the host task by ble_ota. Sends the held Ready (GATT) or
+ * returns the held CoC credits; with an error, fails the transfer.
+ *
+ * @param conn_handle Connection the OTA upload runs on
+ * @param err ESP_OK, or why applying the patch failed
+ */
+void ble_transfer_ota_resume(uint16_t conn_handle, esp_err_t err);
+
+/**
+ * @brief Resume a stalled CoC download once the peer grants credits
+ *
+ * @param conn_handle Connection the channel belongs to
+ */
+void ble_transfer_coc_tx_ready(uint16_t conn_handle);
+
+/**
+ * @brief Abort an L2CAP-mode transfer when its CoC channel closes
+ *
+ * @param conn_handle Connection the channel belonged to
+ */
+void ble_transfer_coc_closed(uint16_t conn_handle);
+
 /**
  * @brief Get the file size for download response
  *
+ * @param conn_handle BLE connection handle
  * @return File size set during start_download
  */
-uint32_t ble_transfer_get_file_size(void);
+uint32_t ble_transfer_get_file_size(uint16_t conn_handle);
+
+/**
+ * @brief Get telemetry for a connection's running transfer, or its last
+ *        one if idle
+ *
+ * active_transfers and aggregate_bps cover all connections.
+ *
+ * @param conn_handle BLE connection handle
+ * @param[out] telem Telemetry snapshot
+ */
+void ble_transfer_get_telemetry(uint16_t conn_handle, ble_transfer_telemetry_t *telem);
+
+/**
+ * @brief Get aggregate throughput of all connections since boot
+ *
+ * Concurrent CoC downloads share the radio through a deficit round robin
+ * scheduler; this shows what that sharing costs as peers are added.
+ *
+ * @param[out] agg Throughput per number of concurrent transfers
+ */
+void ble_transfer_get_aggregate(ble_transfer_aggregate_t *agg);
 
 #ifdef __cplusplus
 }
@@ -2,6 +2,7 @@
 #define BLE_UUIDS_H
 
 #include "host/ble_uuid.h"
+#include "ble_xfer_proto.h"  // Transfer status/opcode/flag values
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,6 +37,13 @@ extern "C" {
     BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
                         0x42, 0x48, 0x59, 0x4D, 0x03, 0x01, 0x00, 0x00)
 
+// Auth Resume Characteristic: 00000104-4D59-4842-8000-00805F9B34FB
+// Read (requires auth): [token:16][valid_s:2] session resumption token
+// Write / Write Without Response: [token:16] authenticates without the key
+#define BLE_UUID_AUTH_RESUME \
+    BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
+                        0x42, 0x48, 0x59, 0x4D, 0x04, 0x01, 0x00, 0x00)
+
 // ============ File Service (0x0002) ============
 // Service UUID: 00000002-4D59-4842-8000-00805F9B34FB
 #define BLE_UUID_FILE_SERVICE \
@@ -43,7 +51,11 @@ extern "C" {
                         0x42, 0x48, 0x59, 0x4D, 0x02, 0x00, 0x00, 0x00)
 
 // File List Characteristic: 00000201-4D59-4842-8000-00805F9B34FB
-// Read/Notify: Lists files with format [type:1][size:4][path\0]
+// Read/Notify: Lists files with format [type:1][size:4][path\0], one per notification
+// Write: [start:2][count:2][sort:1] requests one page, packed into MTU-sized
+//        notifications; the end entry
+//        [0xFF][total:4][epoch:4][generation:4][count:4][crc32:4] carries the
+//        file count, the storage generation listed and a check of the entries
 #define BLE_UUID_FILE_LIST \
     BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
                         0x42, 0x48, 0x59, 0x4D, 0x01, 0x02, 0x00, 0x00)
@@ -57,6 +69,8 @@ extern "C" {
 // Transfer Control Characteristic: 00000203-4D59-4842-8000-00805F9B34FB
 // Write/Notify: Upload [0x01][size:4][filename] or Download [0x02][filename]
 // Notify response: [status:1][size:4] where status: 0x01=ready, 0x00=error, 0x02=complete
+// Complete carries the file SHA-256: [0x02][size:4][sha256:32]
+// Window ack: [0x03][crc32:4][offset:4] every BLE_TRANSFER_WINDOW_CHUNKS chunks
 #define BLE_UUID_TRANSFER_CONTROL \
     BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
                         0x42, 0x48, 0x59, 0x4D, 0x03, 0x02, 0x00, 0x00)
@@ -73,6 +87,79 @@ extern "C" {
     BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
                         0x42, 0x48, 0x59, 0x4D, 0x05, 0x02, 0x00, 0x00)
 
+// Link Diagnostics Characteristic: 00000206-4D59-4842-8000-00805F9B34FB
+// Read/Notify: [profile:1][tx_phy:1][rx_phy:1][interval:2][latency:2]
+//              [timeout:2][tx_octets:2][rx_octets:2][mtu:2] in little-endian
+#define BLE_UUID_LINK_DIAG \
+    BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
+                        0x42, 0x48, 0x59, 0x4D, 0x06, 0x02, 0x00, 0x00)
+
+// Transfer Telemetry Characteristic: 00000207-4D59-4842-8000-00805F9B34FB
+// Read/Notify (1 Hz during transfers): [state:1][flags:1][bytes:4][elapsed_ms:4]
+//              [avg_bps:4][inst_bps:4][chunks:4][io_ms:4][wait_ms:4][notify_fail:2]
+//              [buffered:2][buf_flags:1][mtu:2][tx_phy:1][rx_phy:1][interval:2]
+//              [queue_max:1][queue_drops:2]
+#define BLE_UUID_TRANSFER_TELEMETRY \
+    BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
+                        0x42, 0x48, 0x59, 0x4D, 0x07, 0x02, 0x00, 0x00)
+
+// File Changes Characteristic: 00000208-4D59-4842-8000-00805F9B34FB
+// Read: [epoch:4][generation:4] current storage generation
+// Write: [epoch:4][generation:4] last synced; notifies [status:1][epoch:4][generation:4]
+//        then packed [op:1][size:4][name\0] changes, or RESYNC and a full File List
+#define BLE_UUID_FILE_CHANGES \
+    BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
+                        0x42, 0x48, 0x59, 0x4D, 0x08, 0x02, 0x00, 0x00)
+
+// File Batch Characteristic: 00000209-4D59-4842-8000-00805F9B34FB
+// Write: [seq:1][flags:1][op...] delete/rename/move operations, run as one batch
+// Notify: [seq:1][index:2][count:2][status:1 x count] per-operation results
+#define BLE_UUID_FILE_BATCH \
+    BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
+                        0x42, 0x48, 0x59, 0x4D, 0x09, 0x02, 0x00, 0x00)
+
+// ============ Device Service (0x0003) ============
+// Service UUID: 00000003-4D59-4842-8000-00805F9B34FB
+#define BLE_UUID_DEVICE_SERVICE \
+    BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
+                        0x42, 0x48, 0x59, 0x4D, 0x03, 0x00, 0x00, 0x00)
+
+// Device Status Characteristic: 00000301-4D59-4842-8000-00805F9B34FB
+// Read/Notify: [changed:1][audio_state:1][volume:1][track_index:2][track_count:2]
+//              [battery:1][flags:1], notified only when a field changes
+#define BLE_UUID_DEVICE_STATUS \
+    BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
+                        0x42, 0x48, 0x59, 0x4D, 0x01, 0x03, 0x00, 0x00)
+
+// ============ Audio Control Service (0x0004) ============
+// Service UUID: 00000004-4D59-4842-8000-00805F9B34FB
+#define BLE_UUID_AUDIO_SERVICE \
+    BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
+                        0x42, 0x48, 0x59, 0x4D, 0x04, 0x00, 0x00, 0x00)
+
+// Audio Command Characteristic: 00000401-4D59-4842-8000-00805F9B34FB
+// Write (with or without response): [req_id:1][cmd:1][args] queued command
+// Notify: [req_id:1][cmd:1][status:1][queued_us:4][exec_us:4] once it has run
+// Read: [count:4][last_us:4][avg_us:4][max_us:4] command latency
+#define BLE_UUID_AUDIO_COMMAND \
+    BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
+                        0x42, 0x48, 0x59, 0x4D, 0x01, 0x04, 0x00, 0x00)
+
+// ============ Control Service (0x0005) ============
+// Service UUID: 00000005-4D59-4842-8000-00805F9B34FB
+#define BLE_UUID_CONTROL_SERVICE \
+    BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
+                        0x42, 0x48, 0x59, 0x4D, 0x05, 0x00, 0x00, 0x00)
+
+// RPC Characteristic: 00000501-4D59-4842-8000-00805F9B34FB
+// Write (with or without response): [id:2][method:1][len:2][payload] requests,
+//        several per write and several outstanding
+// Notify: [id:2][method:1][status:1][len:2][payload] one response per request
+// Read: [count:4][max_in_flight:1][avg_us:4][max_us:4] response latency
+#define BLE_UUID_RPC \
+    BLE_UUID128_DECLARE(0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, \
+                        0x42, 0x48, 0x59, 0x4D, 0x01, 0x05, 0x00, 0x00)
+
 // ============ Standard Services ============
 // Battery Service: 0x180F (standard BLE SIG)
 // Battery Level Characteristic: 0x2A19 (uint8_t 0-100%)
@@ -80,16 +167,6 @@ extern "C" {
 // Device Information Service: 0x180A (standard BLE SIG)
 // These are handled by NimBLE's built-in services
 
-// ============ Transfer Status Codes ============
-#define BLE_TRANSFER_STATUS_ERROR     0x00
-#define BLE_TRANSFER_STATUS_READY     0x01
-#define BLE_TRANSFER_STATUS_COMPLETE  0x02
-
-// ============ Transfer Operation Codes ============
-#define BLE_TRANSFER_OP_CANCEL   0x00
-#define BLE_TRANSFER_OP_UPLOAD   0x01
-#define BLE_TRANSFER_OP_DOWNLOAD 0x02
-
 // ============ File List Entry Types ============
 #define BLE_FILE_TYPE_FILE      0x00
 #define BLE_FILE_TYPE_DIRECTORY 0x01
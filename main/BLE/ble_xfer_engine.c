@@ -0,0 +1,1398 @@
+#include "ble_xfer_engine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+static const char *TAG = "BLE_XFER";
+
+// Prefix bytes read back per call when a transfer resumes
+#define RESUME_READ_SIZE    512
+
+// Forward declarations
+static esp_err_t prepare_chunk(ble_xfer_engine_t *e);
+static void chunk_drop(ble_xfer_engine_t *e);
+
+// ============ Notifications ============
+
+// Send a notification, counting failures for telemetry
+static void notify(ble_xfer_engine_t *e, ble_xfer_channel_t ch, const uint8_t *data, size_t len) {
+    if (e->tx->notify(e->arg, ch, data, len) != 0) {
+        e->stats.notify_failures++;
+    }
+}
+
+static void notify_status(ble_xfer_engine_t *e, uint8_t status, uint32_t size) {
+    // Format: [status:1][size:4]
+    uint8_t response[BLE_XFER_STATUS_LEN];
+    size_t len = ble_xfer_encode_status(response, status, size);
+    notify(e, BLE_XFER_CH_CTRL, response, len);
+}
+
+static void notify_status_flags(ble_xfer_engine_t *e, uint8_t status, uint32_t size, uint8_t flags) {
+    // Format: [status:1][size:4][flags:1]
+    uint8_t response[BLE_XFER_STATUS_FLAGS_LEN];
+    size_t len = ble_xfer_encode_status_flags(response, status, size, flags);
+    notify(e, BLE_XFER_CH_CTRL, response, len);
+}
+
+static void notify_complete(ble_xfer_engine_t *e) {
+    // Format: [0x02][size:4][sha256:32]
+    uint8_t response[BLE_XFER_COMPLETE_LEN];
+    size_t len = ble_xfer_encode_complete(response, e->integ.sha256);
+    notify(e, BLE_XFER_CH_CTRL, response, len);
+}
+
+static void notify_window(ble_xfer_engine_t *e, uint32_t crc, uint32_t offset) {
+    // Format: [0x03][crc32:4][offset:4] - offset is the end of the window
+    uint8_t response[BLE_XFER_WINDOW_LEN];
+    size_t len = ble_xfer_encode_window(response, crc, offset);
+    notify(e, BLE_XFER_CH_CTRL, response, len);
+}
+
+static void notify_batch_file(ble_xfer_engine_t *e) {
+    ble_xfer_batch_t *b = e->batch;
+
+    // Format: [0x04][index:2][size:4][flags:1][name\0] - size is uncompressed
+    uint8_t response[BLE_XFER_BATCH_FILE_HDR + BLE_TRANSFER_BATCH_NAME_LEN];
+    size_t len = ble_xfer_encode_batch_file(response, b->file_index, e->total_bytes,
+                                            e->flags, b->names[b->file_index]);
+    notify(e, BLE_XFER_CH_CTRL, response, len);
+}
+
+static void notify_batch_end(ble_xfer_engine_t *e) {
+    // Format: [0x05][files_sent:2][bytes_sent:4]
+    uint8_t response[BLE_XFER_BATCH_END_LEN];
+    size_t len = ble_xfer_encode_batch_end(response, e->batch->files_sent,
+                                           e->batch->bytes_sent);
+    notify(e, BLE_XFER_CH_CTRL, response, len);
+}
+
+static void notify_data_ready(ble_xfer_engine_t *e, uint32_t size) {
+    // Format: [0x01=ready][size:4] or [0x00=error][0:4]
+    uint8_t status = (size > 0) ? BLE_TRANSFER_STATUS_READY : BLE_TRANSFER_STATUS_ERROR;
+    uint8_t response[BLE_XFER_STATUS_LEN];
+    size_t len = ble_xfer_encode_status(response, status, size);
+    notify(e, BLE_XFER_CH_DATA, response, len);
+}
+
+static void notify_download_ready(ble_xfer_engine_t *e) {
+    // Format: [0x01][filesize:4][flags:1] - filesize is the uncompressed size
+    uint8_t response[BLE_XFER_STATUS_FLAGS_LEN];
+    size_t len = ble_xfer_encode_status_flags(response, BLE_TRANSFER_STATUS_READY,
+                                              e->total_bytes, e->flags);
+    notify(e, BLE_XFER_CH_DATA, response, len);
+}
+
+static void notify_progress(ble_xfer_engine_t *e) {
+    // Format: [transferred:4][total:4]
+    uint8_t data[BLE_XFER_PROGRESS_LEN];
+    size_t len = ble_xfer_encode_progress(data, e->transferred_bytes, e->total_bytes);
+    notify(e, BLE_XFER_CH_PROGRESS, data, len);
+}
+
+// ============ Integrity ============
+// Thin wrappers over the protocol core that add timing and session counters
+
+static void integrity_begin(ble_xfer_engine_t *e) {
+    ble_xfer_integrity_begin(&e->integ);
+    e->integrity_us = 0;
+}
+
+// Feed file bytes into the running SHA-256
+static void integrity_hash(ble_xfer_engine_t *e, const uint8_t *data, size_t len) {
+    int64_t start = esp_timer_get_time();
+    ble_xfer_integrity_hash(&e->integ, data, len);
+    e->integrity_us += esp_timer_get_time() - start;
+}
+
+// Feed wire bytes into a window CRC32
+static void integrity_crc(ble_xfer_engine_t *e, ble_xfer_window_t *w, const uint8_t *data, size_t len) {
+    int64_t start = esp_timer_get_time();
+    ble_xfer_window_crc(w, data, len);
+    e->integrity_us += esp_timer_get_time() - start;
+}
+
+// Count one chunk (or CoC SDU).
+// Returns true when this chunk closed an ACK window (crc in *window_crc).
+static bool integrity_chunk_done(ble_xfer_engine_t *e, uint32_t *window_crc) {
+    e->stats.chunks++;
+    return ble_xfer_window_chunk_done(&e->integ.window, window_crc);
+}
+
+// The prepared download chunk (or SDU) was CRCed into chunk_window as it
+// was read; it joins the window once it is on its way to the app
+static bool integrity_window(ble_xfer_engine_t *e, uint32_t *window_crc) {
+    e->integ.window = e->chunk_window;
+    return integrity_chunk_done(e, window_crc);
+}
+
+// Close a trailing partial window. Returns true if there was one.
+static bool integrity_flush_window(ble_xfer_engine_t *e, uint32_t *window_crc) {
+    return ble_xfer_window_flush(&e->integ.window, window_crc);
+}
+
+static void integrity_finish(ble_xfer_engine_t *e) {
+    if (!e->integ.sha_active) {
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    ble_xfer_integrity_finish(&e->integ);
+    e->integrity_us += esp_timer_get_time() - start;
+
+    uint32_t chunks = e->integ.window.chunk_count;
+    ESP_LOGI(TAG, "Integrity: %lu chunks, %lld us hashing (%lu us/chunk)",
+             (unsigned long)chunks, (long long)e->integrity_us,
+             (unsigned long)(chunks ? e->integrity_us / chunks : 0));
+}
+
+// ============ Telemetry ============
+
+static void stats_begin(ble_xfer_engine_t *e) {
+    memset(&e->stats, 0, sizeof(e->stats));
+    e->stats.active = true;
+    e->stats.start_us = esp_timer_get_time();
+    e->stats.sample_us = e->stats.start_us;
+    e->deferred_q.max_depth = 0;
+    e->deferred_q.drops = 0;
+}
+
+// Peer wait: from handing the app a chunk (or READY, or running out of
+// credits) until the app's next read, write or credit grant
+static void stats_wait_begin(ble_xfer_engine_t *e) {
+    if (e->stats.wait_start_us == 0) {
+        e->stats.wait_start_us = esp_timer_get_time();
+    }
+}
+
+static void stats_wait_end(ble_xfer_engine_t *e) {
+    if (e->stats.wait_start_us != 0) {
+        e->stats.wait_us += esp_timer_get_time() - e->stats.wait_start_us;
+        e->stats.wait_start_us = 0;
+    }
+}
+
+static void stats_end(ble_xfer_engine_t *e) {
+    stats_wait_end(e);
+    e->stats.end_us = esp_timer_get_time();
+    e->stats.active = false;
+}
+
+// File bytes moved
+static void count_bytes(ble_xfer_engine_t *e, size_t len) {
+    e->stats.bytes += len;
+    if (e->hooks->moved) {
+        e->hooks->moved(e->arg, len);
+    }
+}
+
+// Cycles spent moving one chunk or SDU: file I/O, copies, integrity and
+// codec. Wall cycles, so time blocked on the SD card counts too.
+static uint32_t cycles_now(const ble_xfer_engine_t *e) {
+    return e->tx->cycles ? e->tx->cycles(e->arg) : 0;
+}
+
+static void cycles_add(ble_xfer_engine_t *e, uint32_t start) {
+    if (e->tx->cycles) {
+        e->stats.host_cycles += e->tx->cycles(e->arg) - start;
+    }
+}
+
+// ============ Compression ============
+
+// Grant the requested flags that apply to this file; returns the negotiated set
+static uint8_t codec_begin(ble_xfer_engine_t *e, const char *name, uint8_t flags, ble_xfer_dir_t dir) {
+    e->codec_us = 0;
+    e->codec_io_us = 0;
+
+    if (!(flags & BLE_TRANSFER_FLAG_COMPRESS)) {
+        return 0;
+    }
+
+    if (ble_compress_is_precompressed(name)) {
+        ESP_LOGI(TAG, "Compression skipped for already-compressed file");
+        return 0;
+    }
+
+    if (dir == BLE_XFER_DIR_DOWNLOAD) {
+        e->enc = ble_compress_enc_create();
+    } else {
+        e->dec = ble_compress_dec_create();
+    }
+    if (!e->enc && !e->dec) {
+        ESP_LOGW(TAG, "No memory for compressor - sending uncompressed");
+        return 0;
+    }
+
+    return BLE_TRANSFER_FLAG_COMPRESS;
+}
+
+static void codec_end(ble_xfer_engine_t *e) {
+    if (e->flags & BLE_TRANSFER_FLAG_COMPRESS) {
+        uint32_t kb = (e->transferred_bytes + 1023) / 1024;
+        ESP_LOGI(TAG, "Compression: %lu -> %lu bytes (%lu%%), %lld us (%lu us/KB)",
+                 (unsigned long)e->transferred_bytes, (unsigned long)e->integ.window.wire_bytes,
+                 (unsigned long)(e->transferred_bytes ?
+                     (uint64_t)e->integ.window.wire_bytes * 100 / e->transferred_bytes : 0),
+                 (long long)e->codec_us,
+                 (unsigned long)(kb ? e->codec_us / kb : 0));
+    }
+
+    if (e->enc) {
+        ble_compress_enc_destroy(e->enc);
+        e->enc = NULL;
+    }
+    if (e->dec) {
+        ble_compress_dec_destroy(e->dec);
+        e->dec = NULL;
+    }
+}
+
+// ============ L2CAP CoC ============
+
+// Grant the CoC data path if the app has the channel open
+static uint8_t coc_begin(ble_xfer_engine_t *e, uint8_t flags) {
+    e->coc_stalled = false;
+    e->coc_sdus = 0;
+
+    if (!(flags & BLE_TRANSFER_FLAG_L2CAP)) {
+        return 0;
+    }
+
+    if (e->tx->sdu_size(e->arg) == 0) {
+        ESP_LOGW(TAG, "L2CAP requested but no CoC channel open - using GATT");
+        return 0;
+    }
+
+    return BLE_TRANSFER_FLAG_L2CAP;
+}
+
+// ============ Deferred Notifications ============
+
+// Queue a notification to send once the GATT callback has returned
+static void deferred_post(ble_xfer_engine_t *e, ble_xfer_deferred_t action,
+                          uint32_t arg, uint32_t offset) {
+    ble_xfer_deferred_queue_t *q = &e->deferred_q;
+    unsigned depth = q->head - q->tail;
+
+    if (depth >= BLE_XFER_DEFERRED_QUEUE_LEN) {
+        q->drops++;
+        ESP_LOGE(TAG, "Deferred queue full - dropped action %d", action);
+        return;
+    }
+
+    ble_xfer_deferred_event_t *ev = &q->events[q->head % BLE_XFER_DEFERRED_QUEUE_LEN];
+    ev->action = action;
+    ev->seq = e->seq;
+    ev->arg = arg;
+    ev->offset = offset;
+    q->head++;
+
+    if (depth + 1 > q->max_depth) {
+        q->max_depth = depth + 1;
+    }
+
+    // Already posted is fine: one run drains every event
+    e->tx->defer(e->arg);
+}
+
+// ============ Batch Download ============
+
+ble_xfer_batch_t *ble_xfer_batch_alloc(const char *dir) {
+    // Queue storage lives in PSRAM; only the small header is internal
+    ble_xfer_batch_t *b = calloc(1, sizeof(ble_xfer_batch_t));
+    if (!b) {
+        return NULL;
+    }
+
+    b->dir = dir;
+    b->names = heap_caps_calloc(BLE_TRANSFER_BATCH_MAX_FILES, BLE_TRANSFER_BATCH_NAME_LEN,
+                                MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    b->prefetch_buf = heap_caps_malloc(BLE_TRANSFER_BATCH_PREFETCH,
+                                       MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!b->names || !b->prefetch_buf) {
+        ble_xfer_batch_free(b);
+        return NULL;
+    }
+    return b;
+}
+
+void ble_xfer_batch_free(ble_xfer_batch_t *b) {
+    if (!b) {
+        return;
+    }
+
+    heap_caps_free(b->names);
+    heap_caps_free(b->prefetch_buf);
+    free(b);
+}
+
+bool ble_xfer_batch_add(ble_xfer_batch_t *b, const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= BLE_TRANSFER_BATCH_NAME_LEN) {
+        ESP_LOGW(TAG, "Batch: skipping invalid name (%d bytes)", (int)len);
+        return true;
+    }
+    if (b->count >= BLE_TRANSFER_BATCH_MAX_FILES) {
+        ESP_LOGW(TAG, "Batch: queue full (%d files)", BLE_TRANSFER_BATCH_MAX_FILES);
+        return false;
+    }
+
+    memcpy(b->names[b->count++], name, len + 1);
+    return true;
+}
+
+// Drop the batch, closing a prefetched file
+static void batch_release(ble_xfer_engine_t *e) {
+    ble_xfer_batch_t *b = e->batch;
+    if (!b) {
+        return;
+    }
+
+    if (b->next_handle) {
+        e->fops->close(e->arg, b->next_handle);
+    }
+    ble_xfer_batch_free(b);
+    e->batch = NULL;
+}
+
+// Open the next queued file and read its first block, skipping files
+// that have disappeared since the batch was queued
+static void batch_prefetch(ble_xfer_engine_t *e) {
+    ble_xfer_batch_t *b = e->batch;
+    if (!b || b->next_handle) {
+        return;
+    }
+
+    char path[BLE_XFER_PATH_LEN];
+    while (b->next_index < b->count) {
+        snprintf(path, sizeof(path), "%s/%s", b->dir, b->names[b->next_index]);
+
+        uint32_t size;
+        void *f = e->fops->open(e->arg, path, BLE_XFER_OPEN_READ, &size);
+        if (f) {
+            size_t n = 0;
+            if (e->fops->read(e->arg, f, b->prefetch_buf, BLE_TRANSFER_BATCH_PREFETCH, &n) != 0) {
+                // Read again, and fail, when the file's turn comes
+                n = 0;
+            }
+            b->next_handle = f;
+            b->next_size = size;
+            b->prefetch_len = n;
+            b->prefetch_pos = 0;
+            b->prefetch_current = false;
+            return;
+        }
+
+        ESP_LOGW(TAG, "Batch: skipping missing file %s", path);
+        b->next_index++;
+    }
+}
+
+// Make the prefetched file current. Returns ESP_ERR_NOT_FOUND when the
+// queue is exhausted.
+static esp_err_t batch_open_next(ble_xfer_engine_t *e) {
+    ble_xfer_batch_t *b = e->batch;
+
+    batch_prefetch(e);
+    if (!b->next_handle) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    b->file_index = b->next_index++;
+    e->file = b->next_handle;
+    b->next_handle = NULL;
+    b->prefetch_current = true;
+
+    snprintf(e->path, sizeof(e->path), "%s/%s", b->dir, b->names[b->file_index]);
+    e->total_bytes = b->next_size;
+    e->transferred_bytes = 0;
+    chunk_drop(e);
+    e->state = BLE_XFER_STATE_DOWNLOAD_PENDING;
+
+    // Integrity and compression are per file
+    integrity_begin(e);
+    codec_end(e);
+    e->flags = (e->flags & BLE_TRANSFER_FLAG_L2CAP) |
+               codec_begin(e, b->names[b->file_index], b->req_flags, BLE_XFER_DIR_DOWNLOAD);
+
+    ESP_LOGI(TAG, "Batch file %d/%d: %s (%lu bytes)", b->file_index + 1, b->count,
+             e->path, (unsigned long)e->total_bytes);
+    return ESP_OK;
+}
+
+// Read file data, draining the prefetched block first
+static esp_err_t file_read(ble_xfer_engine_t *e, uint8_t *buf, size_t len, size_t *out) {
+    ble_xfer_batch_t *b = e->batch;
+    size_t n = 0;
+
+    if (b && b->prefetch_current && b->prefetch_pos < b->prefetch_len) {
+        n = b->prefetch_len - b->prefetch_pos;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buf, b->prefetch_buf + b->prefetch_pos, n);
+        b->prefetch_pos += n;
+    }
+
+    if (n < len) {
+        size_t got = 0;
+        int64_t start = esp_timer_get_time();
+        int rc = e->fops->read(e->arg, e->file, buf + n, len - n, &got);
+        e->stats.io_us += esp_timer_get_time() - start;
+        if (rc != 0) {
+            return ESP_FAIL;
+        }
+        n += got;
+    }
+
+    *out = n;
+    return ESP_OK;
+}
+
+// ============ Transfer Lifecycle ============
+
+// Release per-transfer resources and return to IDLE. Without ok a partial
+// upload is deleted. The end hook still sees the flags and batch of the
+// transfer that ended.
+static void transfer_end(ble_xfer_engine_t *e, bool ok) {
+    // Anything still deferred belongs to this transfer
+    e->seq++;
+    if (e->held) {
+        // The channel outlives the transfer
+        e->held = false;
+        e->tx->rx_resume(e->arg);
+    }
+    chunk_drop(e);
+    ble_xfer_integrity_abort(&e->integ);
+    stats_end(e);
+    codec_end(e);
+    e->coc_stalled = false;
+
+    if (e->file) {
+        e->fops->close(e->arg, e->file);
+        e->file = NULL;
+    }
+    if (!ok && e->delete_on_error && e->path[0] != '\0' && e->fops->remove) {
+        ESP_LOGW(TAG, "Deleting partial upload: %s", e->path);
+        e->fops->remove(e->arg, e->path);
+    }
+
+    e->state = BLE_XFER_STATE_IDLE;
+    e->hooks->end(e->arg, ok);
+
+    batch_release(e);
+    e->flags = 0;
+    e->direction = BLE_XFER_DIR_NONE;
+    e->delete_on_error = false;
+}
+
+// Successful completion: report digest, return to idle
+static void transfer_finish(ble_xfer_engine_t *e) {
+    // Batch files each got their own Complete; close the batch instead
+    if (e->batch) {
+        notify_batch_end(e);
+    } else {
+        notify_complete(e);
+    }
+    transfer_end(e, true);
+}
+
+// Failure: clean up, then tell the app
+static void transfer_fail(ble_xfer_engine_t *e) {
+    transfer_end(e, false);
+    notify_status(e, BLE_TRANSFER_STATUS_ERROR, 0);
+}
+
+// Resume: hash the first offset bytes already in the file, so Complete
+// still covers the whole file, and continue after them
+static esp_err_t resume_prefix(ble_xfer_engine_t *e, uint32_t offset) {
+    uint8_t buf[RESUME_READ_SIZE];
+
+    if (e->fops->seek(e->arg, e->file, 0) != 0) {
+        return ESP_FAIL;
+    }
+    for (uint32_t pos = 0; pos < offset; ) {
+        size_t want = (offset - pos < sizeof(buf)) ? offset - pos : sizeof(buf);
+        size_t n = 0;
+        if (e->fops->read(e->arg, e->file, buf, want, &n) != 0 || n != want) {
+            return ESP_FAIL;
+        }
+        integrity_hash(e, buf, n);
+        pos += n;
+    }
+    if (e->fops->seek(e->arg, e->file, offset) != 0) {
+        return ESP_FAIL;
+    }
+
+    // Window offsets stay file offsets
+    e->transferred_bytes = offset;
+    e->integ.window.wire_bytes = offset;
+    return ESP_OK;
+}
+
+// Close the current download file and send its trailing window ack
+static void download_file_close(ble_xfer_engine_t *e) {
+    if (e->file) {
+        e->fops->close(e->arg, e->file);
+        e->file = NULL;
+    }
+
+    uint32_t window_crc;
+    if (integrity_flush_window(e, &window_crc)) {
+        notify_window(e, window_crc, e->integ.window.wire_bytes);
+    }
+    integrity_finish(e);
+
+    // The digest covers the whole file, so it may be cached for listings
+    if (e->transferred_bytes == e->total_bytes && e->fops->hashed) {
+        e->fops->hashed(e->arg, e->path, e->integ.sha256);
+    }
+}
+
+// Start the next batch file: announce it, then queue its first data.
+// Returns ESP_ERR_NOT_FOUND when the batch has no more files.
+static esp_err_t batch_advance(ble_xfer_engine_t *e) {
+    esp_err_t err;
+
+    while ((err = batch_open_next(e)) == ESP_OK) {
+        notify_batch_file(e);
+
+        if (e->flags & BLE_TRANSFER_FLAG_L2CAP) {
+            e->tx->sdu_schedule(e->arg);
+            return ESP_OK;
+        }
+
+        err = prepare_chunk(e);
+        if (err == ESP_OK) {
+            notify_data_ready(e, e->chunk_len);
+            return ESP_OK;
+        }
+        if (err != ESP_ERR_NOT_FINISHED) {
+            return err;
+        }
+
+        // Empty file: nothing to read, report it and move on
+        download_file_close(e);
+        notify_complete(e);
+        e->batch->files_sent++;
+    }
+
+    return err;
+}
+
+// The app has received the last chunk of the current download file
+static void download_eof(ble_xfer_engine_t *e) {
+    download_file_close(e);
+
+    if (!e->batch) {
+        if (e->flags & BLE_TRANSFER_FLAG_L2CAP) {
+            ESP_LOGI(TAG, "Download complete (%lu CoC SDUs)", (unsigned long)e->coc_sdus);
+        } else {
+            ESP_LOGI(TAG, "Download complete");
+        }
+        transfer_finish(e);
+        return;
+    }
+
+    // Per-file Complete, then straight on to the next file without
+    // dropping back to IDLE (LED and link profile stay as they are)
+    notify_complete(e);
+    e->batch->files_sent++;
+    e->batch->bytes_sent += e->transferred_bytes;
+
+    esp_err_t err = batch_advance(e);
+    if (err == ESP_ERR_NOT_FOUND) {
+        ESP_LOGI(TAG, "Batch complete: %d files, %lu CoC SDUs", e->batch->files_sent,
+                 (unsigned long)e->coc_sdus);
+        transfer_finish(e);
+    } else if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Batch aborted: %s", esp_err_to_name(err));
+        transfer_fail(e);
+    }
+}
+
+void ble_xfer_engine_init(ble_xfer_engine_t *e, const ble_xfer_transport_t *tx,
+                          const ble_xfer_hooks_t *hooks, void *arg) {
+    memset(e, 0, sizeof(*e));
+    e->tx = tx;
+    e->hooks = hooks;
+    e->arg = arg;
+    e->state = BLE_XFER_STATE_IDLE;
+    e->direction = BLE_XFER_DIR_NONE;
+}
+
+bool ble_xfer_engine_is_active(const ble_xfer_engine_t *e) {
+    return e->state == BLE_XFER_STATE_UPLOAD_PENDING ||
+           e->state == BLE_XFER_STATE_UPLOADING ||
+           e->state == BLE_XFER_STATE_DOWNLOAD_PENDING ||
+           e->state == BLE_XFER_STATE_DOWNLOADING;
+}
+
+void ble_xfer_engine_reject(ble_xfer_engine_t *e, ble_xfer_channel_t ch) {
+    if (ch == BLE_XFER_CH_DATA) {
+        notify_data_ready(e, 0);
+    } else {
+        notify_status(e, BLE_TRANSFER_STATUS_ERROR, 0);
+    }
+}
+
+// ============ Upload ============
+
+// A Resume for the upload already running on this link: go back to an
+// offset it has written, e.g. after a window CRC mismatch
+static bool upload_rewindable(const ble_xfer_engine_t *e, const ble_xfer_start_t *p) {
+    return e->direction == BLE_XFER_DIR_UPLOAD && p->path && e->file && !e->held &&
+           e->fops->seek && strcmp(e->path, p->path) == 0 &&
+           !(e->flags & (BLE_TRANSFER_FLAG_COMPRESS | BLE_TRANSFER_FLAG_L2CAP)) &&
+           p->offset <= e->transferred_bytes;
+}
+
+static esp_err_t upload_rewind(ble_xfer_engine_t *e, uint32_t offset) {
+    ble_xfer_integrity_abort(&e->integ);
+    integrity_begin(e);
+    esp_err_t err = resume_prefix(e, offset);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Upload rewind to %lu failed", (unsigned long)offset);
+        transfer_fail(e);
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Upload rewound to %lu of %lu", (unsigned long)offset,
+             (unsigned long)e->total_bytes);
+    e->state = BLE_XFER_STATE_UPLOAD_PENDING;
+    e->flags |= BLE_TRANSFER_FLAG_RESUME;
+    notify_status_flags(e, BLE_TRANSFER_STATUS_READY, offset, e->flags);
+    stats_wait_begin(e);
+    return ESP_OK;
+}
+
+// Write decoded (or raw) upload data to the sink
+static esp_err_t upload_write(const uint8_t *data, size_t len, void *arg) {
+    ble_xfer_engine_t *e = (ble_xfer_engine_t *)arg;
+    int64_t start = esp_timer_get_time();
+    int rc = e->fops->write(e->arg, e->file, data, len);
+    int64_t io_us = esp_timer_get_time() - start;
+    e->codec_io_us += io_us;
+    e->stats.io_us += io_us;
+
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Write of %d bytes failed", (int)len);
+        return ESP_FAIL;
+    }
+
+    integrity_hash(e, data, len);
+    e->transferred_bytes += len;
+    count_bytes(e, len);
+    return ESP_OK;
+}
+
+// Decompressor output sink
+static int upload_sink(const uint8_t *data, size_t len, void *arg) {
+    return upload_write(data, len, arg) == ESP_OK ? 0 : -1;
+}
+
+// Write received wire bytes, decompressing first if negotiated
+static esp_err_t upload_feed(ble_xfer_engine_t *e, const uint8_t *data, size_t len) {
+    esp_err_t err;
+    if (e->dec) {
+        int64_t start = esp_timer_get_time();
+        int64_t io_before = e->codec_io_us;
+        int rc = ble_compress_dec_feed(e->dec, data, len, upload_sink, e);
+        if (rc == BLE_COMPRESS_ERR_CORRUPT) {
+            ESP_LOGE(TAG, "Corrupt compressed stream");
+            err = ESP_ERR_INVALID_RESPONSE;
+        } else {
+            err = (rc == BLE_COMPRESS_OK) ? ESP_OK : ESP_FAIL;
+        }
+        e->codec_us += (esp_timer_get_time() - start) - (e->codec_io_us - io_before);
+    } else {
+        err = upload_write(data, len, e);
+    }
+
+    if (err == ESP_OK) {
+        integrity_crc(e, &e->integ.window, data, len);
+    }
+    return err;
+}
+
+// Whole upload received: close it, hand it to the sink to check and
+// publish, then report the digest
+static void upload_complete(ble_xfer_engine_t *e) {
+    int rc = 0;
+    if (e->file) {
+        rc = e->fops->close(e->arg, e->file);
+        e->file = NULL;
+    }
+
+    uint32_t window_crc;
+    if (integrity_flush_window(e, &window_crc)) {
+        notify_window(e, window_crc, e->integ.window.wire_bytes);
+    }
+    integrity_finish(e);
+
+    esp_err_t err = (rc == 0) ?
+        e->fops->commit(e->arg, e->path, e->total_bytes, e->integ.sha256) : ESP_FAIL;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Upload of %s not accepted: %s",
+                 e->path[0] ? e->path : "image", esp_err_to_name(err));
+        transfer_fail(e);
+        return;
+    }
+
+    ESP_LOGI(TAG, "Upload complete: %s", e->path[0] ? e->path : "image");
+    e->delete_on_error = false;
+    transfer_finish(e);
+}
+
+// Completion, or Ready for the next chunk
+static void upload_next(ble_xfer_engine_t *e, bool notify_ready) {
+    if (e->transferred_bytes >= e->total_bytes) {
+        upload_complete(e);
+        return;
+    }
+
+    if (notify_ready) {
+        // Ready for next chunk
+        notify_status(e, BLE_TRANSFER_STATUS_READY, 0);
+    }
+    stats_wait_begin(e);
+}
+
+// Finish one received chunk (or CoC SDU): window ack, progress, completion
+static void upload_chunk_done(ble_xfer_engine_t *e, bool notify_ready) {
+    uint32_t window_crc;
+    if (integrity_chunk_done(e, &window_crc)) {
+        notify_window(e, window_crc, e->integ.window.wire_bytes);
+    }
+
+    notify_progress(e);
+
+    ESP_LOGD(TAG, "Received chunk, progress: %lu/%lu",
+             (unsigned long)e->transferred_bytes,
+             (unsigned long)e->total_bytes);
+
+    // The sink is still applying data (a delta patch): the sender waits
+    // until ble_xfer_engine_resume(), so its backlog stays bounded
+    if (e->fops->busy && e->fops->busy(e->arg, e->file)) {
+        e->held = true;
+        return;
+    }
+    upload_next(e, notify_ready);
+}
+
+esp_err_t ble_xfer_engine_start_upload(ble_xfer_engine_t *e, const ble_xfer_start_t *p) {
+    bool resume = (p->flags & BLE_TRANSFER_FLAG_RESUME) != 0;
+
+    if (e->state != BLE_XFER_STATE_IDLE) {
+        if (resume && upload_rewindable(e, p)) {
+            return upload_rewind(e, p->offset);
+        }
+        ESP_LOGW(TAG, "Upload rejected - transfer already in progress");
+        notify_status(e, BLE_TRANSFER_STATUS_ERROR, 0);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (p->size == 0 || (resume && (!p->path || !p->fops->seek || p->offset > p->size))) {
+        ESP_LOGE(TAG, "Invalid upload parameters");
+        notify_status(e, BLE_TRANSFER_STATUS_ERROR, 0);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    e->fops = p->fops;
+    e->file = NULL;
+    e->path[0] = '\0';
+    if (p->path) {
+        snprintf(e->path, sizeof(e->path), "%s", p->path);
+
+        // A resumed upload keeps what an earlier, interrupted one wrote
+        uint32_t have = 0;
+        e->file = e->fops->open(e->arg, e->path,
+                                resume ? BLE_XFER_OPEN_UPDATE : BLE_XFER_OPEN_CREATE, &have);
+        if (!e->file) {
+            ESP_LOGE(TAG, "Failed to open file: %s", e->path);
+            notify_status(e, BLE_TRANSFER_STATUS_ERROR, 0);
+            return ESP_FAIL;
+        }
+        if (resume && (have < p->offset || have > p->size)) {
+            ESP_LOGE(TAG, "Cannot resume %s at %lu: %lu bytes there",
+                     e->path, (unsigned long)p->offset, (unsigned long)have);
+            e->fops->close(e->arg, e->file);
+            e->file = NULL;
+            notify_status(e, BLE_TRANSFER_STATUS_ERROR, 0);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    e->total_bytes = p->size;
+    e->transferred_bytes = 0;
+    integrity_begin(e);
+    if (resume && resume_prefix(e, p->offset) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read back %s", e->path);
+        ble_xfer_integrity_abort(&e->integ);
+        e->fops->close(e->arg, e->file);
+        e->file = NULL;
+        notify_status(e, BLE_TRANSFER_STATUS_ERROR, 0);
+        return ESP_FAIL;
+    }
+
+    e->state = BLE_XFER_STATE_UPLOAD_PENDING;
+    e->direction = BLE_XFER_DIR_UPLOAD;
+    e->delete_on_error = p->path != NULL;
+    e->held = false;
+    stats_begin(e);
+
+    // A resumed stream is never compressed: the decoder can't restart mid-stream
+    uint8_t want = resume ? (p->flags & ~BLE_TRANSFER_FLAG_COMPRESS) : p->flags;
+    e->flags = codec_begin(e, p->name, want, BLE_XFER_DIR_UPLOAD) | coc_begin(e, want) |
+               (p->granted & want) | (want & BLE_TRANSFER_FLAG_RESUME);
+
+    ESP_LOGI(TAG, "Upload started: %s (%lu bytes from %lu, flags 0x%02x)",
+             e->path[0] ? e->path : p->name, (unsigned long)p->size,
+             (unsigned long)e->transferred_bytes, e->flags);
+    e->hooks->begin(e->arg);
+
+    // Notify ready with the negotiated flags; size is where to continue
+    notify_status_flags(e, BLE_TRANSFER_STATUS_READY, e->transferred_bytes, e->flags);
+    stats_wait_begin(e);
+
+    if (e->transferred_bytes >= e->total_bytes) {
+        // Resumed after the last byte: nothing left to send
+        upload_next(e, false);
+    }
+    return ESP_OK;
+}
+
+esp_err_t ble_xfer_engine_receive(ble_xfer_engine_t *e, const void *pkt, bool sdu) {
+    if ((e->state != BLE_XFER_STATE_UPLOAD_PENDING &&
+         e->state != BLE_XFER_STATE_UPLOADING) ||
+        (sdu && !(e->flags & BLE_TRANSFER_FLAG_L2CAP))) {
+        ESP_LOGW(TAG, "Unexpected %s - not in upload state", sdu ? "CoC SDU" : "data chunk");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint32_t cycles = cycles_now(e);
+    e->state = BLE_XFER_STATE_UPLOADING;
+    stats_wait_end(e);
+
+    // Written segment by segment from the buffers it arrived in; no
+    // flattening copy
+    esp_err_t err = ESP_OK;
+    const void *seg = pkt;
+    const uint8_t *data;
+    size_t len;
+    while (err == ESP_OK && (data = e->tx->rx_segment(e->arg, &seg, &len)) != NULL) {
+        if (len > 0) {
+            err = upload_feed(e, data, len);
+        }
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Upload %s rejected: %s", sdu ? "SDU" : "chunk", esp_err_to_name(err));
+        transfer_fail(e);
+        return err;
+    }
+    cycles_add(e, cycles);
+
+    // Credits, not READY notifications, pace CoC uploads
+    upload_chunk_done(e, !sdu);
+    return ESP_OK;
+}
+
+bool ble_xfer_engine_rx_held(const ble_xfer_engine_t *e) {
+    return e->held;
+}
+
+void ble_xfer_engine_resume(ble_xfer_engine_t *e, esp_err_t err) {
+    if (e->direction != BLE_XFER_DIR_UPLOAD) {
+        return;
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Upload sink failed: %s", esp_err_to_name(err));
+        transfer_fail(e);
+        return;
+    }
+    if (!e->held) {
+        return;
+    }
+
+    e->held = false;
+    bool l2cap = (e->flags & BLE_TRANSFER_FLAG_L2CAP) != 0;
+    upload_next(e, !l2cap);
+    if (l2cap) {
+        e->tx->rx_resume(e->arg);
+    }
+}
+
+// ============ Download ============
+
+// Read compressed data into buf, feeding the file into the encoder's own
+// input buffer as needed
+static esp_err_t read_compressed(ble_xfer_engine_t *e, uint8_t *buf, size_t cap, size_t *out_len) {
+    size_t len = 0;
+
+    while (len < cap) {
+        int64_t start = esp_timer_get_time();
+        size_t n = ble_compress_enc_poll(e->enc, buf + len, cap - len);
+        e->codec_us += esp_timer_get_time() - start;
+        len += n;
+        if (n > 0) {
+            continue;
+        }
+
+        if (ble_compress_enc_is_done(e->enc)) {
+            break;
+        }
+
+        size_t space;
+        uint8_t *in = ble_compress_enc_input(e->enc, &space);
+        size_t read_len;
+        if (file_read(e, in, space, &read_len) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        if (read_len > 0) {
+            integrity_hash(e, in, read_len);
+            e->transferred_bytes += read_len;
+            count_bytes(e, read_len);
+            ble_compress_enc_commit(e->enc, read_len);
+        } else {
+            ble_compress_enc_finish(e->enc);
+        }
+    }
+
+    *out_len = len;
+    return (len == 0) ? ESP_ERR_NOT_FINISHED : ESP_OK;
+}
+
+// Read the next piece of download data (compressed if negotiated) into buf.
+// Returns ESP_ERR_NOT_FINISHED at end of file.
+static esp_err_t read_download_data(ble_xfer_engine_t *e, uint8_t *buf, size_t cap, size_t *out_len) {
+    esp_err_t err;
+
+    if (e->enc) {
+        err = read_compressed(e, buf, cap, out_len);
+    } else {
+        err = file_read(e, buf, cap, out_len);
+        if (err == ESP_OK && *out_len == 0) {
+            // EOF - no more data
+            return ESP_ERR_NOT_FINISHED;
+        }
+        if (err == ESP_OK) {
+            integrity_hash(e, buf, *out_len);
+            e->transferred_bytes += *out_len;
+            count_bytes(e, *out_len);
+        }
+    }
+
+    // Whole file read: open the next batch file while this tail is in flight
+    if (err == ESP_OK && e->batch && e->transferred_bytes >= e->total_bytes) {
+        batch_prefetch(e);
+    }
+    return err;
+}
+
+// Read up to cap bytes of download data straight into the free space of
+// buf, which the transport grows as it fills. File data (or encoder
+// output) lands where the link sends it from, with no staging copy, and
+// is CRCed into chunk_window on the way. Returns ESP_ERR_NOT_FINISHED at
+// end of file.
+static esp_err_t read_download_buf(ble_xfer_engine_t *e, void *buf, size_t cap, size_t *out_len) {
+    size_t total = 0;
+
+    e->chunk_window = e->integ.window;
+    while (total < cap) {
+        size_t space;
+        uint8_t *dst = e->tx->buf_space(e->arg, buf, &space);
+        if (!dst) {
+            // Out of buffers: send what is already in this one
+            break;
+        }
+
+        size_t want = (cap - total < space) ? cap - total : space;
+        size_t len;
+        esp_err_t err = read_download_data(e, dst, want, &len);
+        if (err == ESP_ERR_NOT_FINISHED) {
+            break;
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        integrity_crc(e, &e->chunk_window, dst, len);
+        e->tx->buf_commit(e->arg, buf, len);
+        total += len;
+        if (len < want) {
+            // End of file (or of the compressed stream)
+            break;
+        }
+    }
+
+    *out_len = total;
+    return (total == 0) ? ESP_ERR_NOT_FINISHED : ESP_OK;
+}
+
+static void chunk_drop(ble_xfer_engine_t *e) {
+    if (e->chunk) {
+        e->tx->buf_free(e->arg, e->chunk);
+        e->chunk = NULL;
+    }
+    e->chunk_len = 0;
+}
+
+static esp_err_t prepare_chunk(ble_xfer_engine_t *e) {
+    if (e->state != BLE_XFER_STATE_DOWNLOAD_PENDING &&
+        e->state != BLE_XFER_STATE_DOWNLOADING) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    e->state = BLE_XFER_STATE_DOWNLOADING;
+    chunk_drop(e);
+
+    void *buf = e->tx->buf_alloc(e->arg, false);
+    if (!buf) {
+        ESP_LOGE(TAG, "No buffer for download chunk");
+        return ESP_ERR_NO_MEM;
+    }
+
+    size_t len;
+    esp_err_t err = read_download_buf(e, buf, BLE_TRANSFER_CHUNK_SIZE, &len);
+    if (err != ESP_OK) {
+        e->tx->buf_free(e->arg, buf);
+        return err;
+    }
+
+    e->chunk = buf;
+    e->chunk_len = len;
+    stats_wait_begin(e);
+
+    ESP_LOGD(TAG, "Prepared chunk: %d bytes, progress: %lu/%lu",
+             (int)e->chunk_len,
+             (unsigned long)e->transferred_bytes,
+             (unsigned long)e->total_bytes);
+
+    return ESP_OK;
+}
+
+// Announce a (re)started download and queue its first data
+static void download_announce(ble_xfer_engine_t *e) {
+    // Notify on transfer_data: [0x01][filesize:4][flags:1] to signal ready
+    if (e->flags & BLE_TRANSFER_FLAG_L2CAP) {
+        // Data is pushed on the CoC channel when the link's turn comes
+        notify_download_ready(e);
+        e->tx->sdu_schedule(e->arg);
+        return;
+    }
+
+    esp_err_t err = prepare_chunk(e);
+    notify_download_ready(e);
+    if (err == ESP_ERR_NOT_FINISHED) {
+        // Empty file, or resumed at its end: nothing for the app to read
+        e->state = BLE_XFER_STATE_COMPLETE;
+        download_eof(e);
+    }
+}
+
+// A Resume for the download already running on this link: restart it
+// from an offset, e.g. after a window CRC mismatch on the app side
+static bool download_rewindable(const ble_xfer_engine_t *e, const ble_xfer_start_t *p) {
+    return e->direction == BLE_XFER_DIR_DOWNLOAD && !e->batch && p->path && e->file &&
+           e->fops->seek && strcmp(e->path, p->path) == 0 &&
+           !(e->flags & (BLE_TRANSFER_FLAG_COMPRESS | BLE_TRANSFER_FLAG_L2CAP)) &&
+           p->offset <= e->total_bytes;
+}
+
+static esp_err_t download_rewind(ble_xfer_engine_t *e, uint32_t offset) {
+    // Chunk and window notifications still deferred describe the old position
+    e->seq++;
+    chunk_drop(e);
+    ble_xfer_integrity_abort(&e->integ);
+    integrity_begin(e);
+    esp_err_t err = resume_prefix(e, offset);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Download rewind to %lu failed", (unsigned long)offset);
+        transfer_fail(e);
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Download rewound to %lu of %lu", (unsigned long)offset,
+             (unsigned long)e->total_bytes);
+    e->state = BLE_XFER_STATE_DOWNLOAD_PENDING;
+    e->flags |= BLE_TRANSFER_FLAG_RESUME;
+    download_announce(e);
+    return ESP_OK;
+}
+
+esp_err_t ble_xfer_engine_start_download(ble_xfer_engine_t *e, const ble_xfer_start_t *p) {
+    bool resume = (p->flags & BLE_TRANSFER_FLAG_RESUME) != 0;
+
+    if (e->state != BLE_XFER_STATE_IDLE) {
+        if (resume && download_rewindable(e, p)) {
+            return download_rewind(e, p->offset);
+        }
+        ESP_LOGW(TAG, "Download rejected - transfer in progress");
+        notify_data_ready(e, 0);  // Error on data characteristic
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    e->fops = p->fops;
+    snprintf(e->path, sizeof(e->path), "%s", p->path);
+
+    uint32_t size;
+    e->file = e->fops->open(e->arg, e->path, BLE_XFER_OPEN_READ, &size);
+    if (!e->file) {
+        ESP_LOGE(TAG, "File not found: %s", e->path);
+        notify_data_ready(e, 0);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    e->total_bytes = size;
+    e->transferred_bytes = 0;
+    chunk_drop(e);
+    integrity_begin(e);
+    if (resume && (p->offset > size || !e->fops->seek || resume_prefix(e, p->offset) != ESP_OK)) {
+        ESP_LOGE(TAG, "Cannot resume %s at %lu", e->path, (unsigned long)p->offset);
+        ble_xfer_integrity_abort(&e->integ);
+        e->fops->close(e->arg, e->file);
+        e->file = NULL;
+        notify_data_ready(e, 0);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    e->state = BLE_XFER_STATE_DOWNLOAD_PENDING;
+    e->direction = BLE_XFER_DIR_DOWNLOAD;
+    e->delete_on_error = false;
+    stats_begin(e);
+
+    // A resumed stream is never compressed: the app can't join mid-stream
+    uint8_t want = resume ? (p->flags & ~BLE_TRANSFER_FLAG_COMPRESS) : p->flags;
+    e->flags = codec_begin(e, p->name, want, BLE_XFER_DIR_DOWNLOAD) | coc_begin(e, want) |
+               (want & BLE_TRANSFER_FLAG_RESUME);
+
+    ESP_LOGI(TAG, "Download started: %s (%lu bytes from %lu, flags 0x%02x)",
+             e->path, (unsigned long)e->total_bytes,
+             (unsigned long)e->transferred_bytes, e->flags);
+    e->hooks->begin(e->arg);
+
+    download_announce(e);
+    return ESP_OK;
+}
+
+esp_err_t ble_xfer_engine_start_batch(ble_xfer_engine_t *e, const ble_xfer_file_ops_t *fops,
+                                      ble_xfer_batch_t *b, uint8_t flags) {
+    if (e->state != BLE_XFER_STATE_IDLE) {
+        ESP_LOGW(TAG, "Batch rejected - transfer in progress");
+        ble_xfer_batch_free(b);
+        notify_status(e, BLE_TRANSFER_STATUS_ERROR, 0);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Batches always start every file from its beginning
+    flags &= ~BLE_TRANSFER_FLAG_RESUME;
+
+    e->fops = fops;
+    e->batch = b;
+    e->file = NULL;
+    e->state = BLE_XFER_STATE_DOWNLOAD_PENDING;
+    e->direction = BLE_XFER_DIR_DOWNLOAD;
+    e->delete_on_error = false;
+    stats_begin(e);
+    b->req_flags = flags;
+
+    // The data path is chosen once; compression is decided per file
+    e->flags = coc_begin(e, flags);
+
+    ESP_LOGI(TAG, "Batch download started: %d files, flags 0x%02x", b->count, flags);
+    e->hooks->begin(e->arg);
+
+    // Notify ready: [0x01][file_count:4][flags:1]
+    notify_status_flags(e, BLE_TRANSFER_STATUS_READY, b->count, e->flags);
+
+    esp_err_t err = batch_advance(e);
+    if (err == ESP_ERR_NOT_FOUND) {
+        // Nothing (left) to send
+        transfer_finish(e);
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Batch start failed: %s", esp_err_to_name(err));
+        transfer_fail(e);
+    }
+    return err;
+}
+
+esp_err_t ble_xfer_engine_prepare(ble_xfer_engine_t *e) {
+    return prepare_chunk(e);
+}
+
+esp_err_t ble_xfer_engine_take_chunk(ble_xfer_engine_t *e, void **buf) {
+    if (e->direction != BLE_XFER_DIR_DOWNLOAD || !e->chunk) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint32_t cycles = cycles_now(e);
+    stats_wait_end(e);
+
+    // Window CRCs cover the chunks the app has read
+    uint32_t window_crc;
+    if (integrity_window(e, &window_crc)) {
+        deferred_post(e, BLE_XFER_DEFERRED_WINDOW, window_crc, e->integ.window.wire_bytes);
+    }
+
+    *buf = e->chunk;
+    e->chunk = NULL;
+    e->chunk_len = 0;
+
+    // Prepare next chunk
+    esp_err_t err = prepare_chunk(e);
+
+    if (err == ESP_ERR_NOT_FINISHED) {
+        // App has read the whole file
+        e->state = BLE_XFER_STATE_COMPLETE;
+
+        // Defer notification (can't send from GATT callback context)
+        deferred_post(e, BLE_XFER_DEFERRED_COMPLETE, 0, 0);
+    } else if (err == ESP_OK) {
+        // Defer notification for next chunk ready
+        deferred_post(e, BLE_XFER_DEFERRED_CHUNK_READY, e->chunk_len, 0);
+    } else {
+        // Error - the deferred run cleans up, unless the transfer ends
+        // some other way first
+        ESP_LOGE(TAG, "Error preparing chunk");
+        deferred_post(e, BLE_XFER_DEFERRED_ERROR, 0, 0);
+    }
+
+    cycles_add(e, cycles);
+    return ESP_OK;
+}
+
+void ble_xfer_engine_run_deferred(ble_xfer_engine_t *e) {
+    ble_xfer_deferred_queue_t *q = &e->deferred_q;
+
+    while (q->tail != q->head) {
+        ble_xfer_deferred_event_t ev = q->events[q->tail % BLE_XFER_DEFERRED_QUEUE_LEN];
+        q->tail++;
+
+        if (ev.seq != e->seq) {
+            ESP_LOGD(TAG, "Dropped stale deferred action %d", ev.action);
+            continue;
+        }
+
+        switch (ev.action) {
+        case BLE_XFER_DEFERRED_WINDOW:
+            notify_window(e, ev.arg, ev.offset);
+            break;
+        case BLE_XFER_DEFERRED_CHUNK_READY:
+            notify_data_ready(e, ev.arg);
+            notify_progress(e);
+            break;
+        case BLE_XFER_DEFERRED_COMPLETE:
+            download_eof(e);
+            break;
+        case BLE_XFER_DEFERRED_ERROR:
+            ESP_LOGE(TAG, "Transfer error");
+            transfer_fail(e);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+bool ble_xfer_engine_pumpable(const ble_xfer_engine_t *e) {
+    return e->direction == BLE_XFER_DIR_DOWNLOAD &&
+           (e->flags & BLE_TRANSFER_FLAG_L2CAP) && !e->coc_stalled;
+}
+
+void ble_xfer_engine_pump(ble_xfer_engine_t *e) {
+    if (!ble_xfer_engine_pumpable(e)) {
+        return;
+    }
+
+    uint32_t cycles = cycles_now(e);
+    e->state = BLE_XFER_STATE_DOWNLOADING;
+
+    void *sdu = e->tx->buf_alloc(e->arg, true);
+    if (!sdu) {
+        ESP_LOGE(TAG, "CoC SDU pool exhausted");
+        transfer_fail(e);
+        return;
+    }
+
+    // File data is read into the SDU's own buffers
+    size_t len;
+    esp_err_t err = read_download_buf(e, sdu, e->tx->sdu_size(e->arg), &len);
+
+    if (err == ESP_ERR_NOT_FINISHED) {
+        // All SDUs handed to the link, and not stalled, so the last one
+        // is ahead of the Complete notification
+        e->tx->buf_free(e->arg, sdu);
+        e->state = BLE_XFER_STATE_COMPLETE;
+        notify_progress(e);
+        download_eof(e);
+        return;
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error preparing SDU");
+        e->tx->buf_free(e->arg, sdu);
+        transfer_fail(e);
+        return;
+    }
+
+    uint32_t window_crc;
+    if (integrity_window(e, &window_crc)) {
+        notify_window(e, window_crc, e->integ.window.wire_bytes);
+        notify_progress(e);
+    }
+
+    cycles_add(e, cycles);
+
+    int rc = e->tx->sdu_send(e->arg, sdu);
+    if (rc == BLE_XFER_SEND_OK) {
+        // Sent; the scheduler comes back for the next SDU
+        e->coc_sdus++;
+    } else if (rc == BLE_XFER_SEND_STALLED) {
+        // Queued, but out of credits; ble_xfer_engine_tx_ready() resumes
+        e->coc_sdus++;
+        e->coc_stalled = true;
+        stats_wait_begin(e);
+    } else {
+        ESP_LOGE(TAG, "CoC send failed: %d", rc);
+        transfer_fail(e);
+    }
+}
+
+void ble_xfer_engine_tx_ready(ble_xfer_engine_t *e) {
+    if (!e->coc_stalled) {
+        return;
+    }
+    e->coc_stalled = false;
+    stats_wait_end(e);
+    e->tx->sdu_schedule(e->arg);
+}
+
+void ble_xfer_engine_cancel(ble_xfer_engine_t *e) {
+    if (e->state == BLE_XFER_STATE_IDLE) {
+        return;
+    }
+    transfer_end(e, false);
+}
+
+void ble_xfer_engine_fail(ble_xfer_engine_t *e) {
+    if (e->state == BLE_XFER_STATE_IDLE) {
+        return;
+    }
+    transfer_fail(e);
+}
+
+int64_t ble_xfer_engine_wait_us(const ble_xfer_engine_t *e, int64_t now) {
+    int64_t wait_us = e->stats.wait_us;
+    if (e->stats.active && e->stats.wait_start_us != 0) {
+        wait_us += now - e->stats.wait_start_us;
+    }
+    return wait_us;
+}
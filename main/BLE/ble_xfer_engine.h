@@ -0,0 +1,411 @@
+#ifndef BLE_XFER_ENGINE_H
+#define BLE_XFER_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include "ble_xfer_proto.h"
+#include "ble_xfer_integrity.h"
+#include "ble_compress.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// File transfer engine: the upload/download state machine, ACK windows,
+// integrity, compression, batch downloads, resume and the deferred
+// notification queue. It has no NimBLE, GATT or stdio calls: the link
+// goes through a transport, files through file ops, and the rest of the
+// firmware (LED, link profile, telemetry timer) through lifecycle hooks.
+// ble_transfer.c binds it to NimBLE; test/host drives it over a simulated
+// link. All calls for one engine must come from one task (the host task).
+
+// Chunk size for raw binary transfer (no Base64)
+// With MTU=512, max ATT payload is 509 bytes (MTU - 3)
+// Use 490 bytes to leave margin for protocol overhead
+#define BLE_TRANSFER_CHUNK_SIZE   490
+
+// Batch download limits
+#define BLE_TRANSFER_BATCH_MAX_FILES  100
+#define BLE_TRANSFER_BATCH_NAME_LEN   96
+#define BLE_TRANSFER_BATCH_PREFETCH   4096  // First block of the next file read ahead
+
+#define BLE_XFER_PATH_LEN         128
+
+// Internal transfer states (more detailed than public API)
+typedef enum {
+    BLE_XFER_STATE_IDLE = 0,
+    BLE_XFER_STATE_UPLOAD_PENDING,   // Waiting for first data chunk
+    BLE_XFER_STATE_UPLOADING,        // Receiving chunks
+    BLE_XFER_STATE_DOWNLOAD_PENDING, // About to send file info
+    BLE_XFER_STATE_DOWNLOADING,      // Sending chunks
+    BLE_XFER_STATE_COMPLETE,
+    BLE_XFER_STATE_ERROR,
+} ble_xfer_state_t;
+
+// Transfer direction
+typedef enum {
+    BLE_XFER_DIR_NONE = 0,
+    BLE_XFER_DIR_UPLOAD,   // Phone -> Device
+    BLE_XFER_DIR_DOWNLOAD, // Device -> Phone
+} ble_xfer_dir_t;
+
+// Notification targets
+typedef enum {
+    BLE_XFER_CH_CTRL = 0,  // Transfer Control: status, windows, batch headers
+    BLE_XFER_CH_DATA,      // Transfer Data: download ready / chunk ready
+    BLE_XFER_CH_PROGRESS,  // Transfer Progress
+} ble_xfer_channel_t;
+
+// ble_xfer_transport_t.sdu_send results (negative: failed, SDU dropped)
+#define BLE_XFER_SEND_OK       0
+#define BLE_XFER_SEND_STALLED  1   // Queued, but the peer is out of credits
+
+// How ble_xfer_file_ops_t.open opens a file
+typedef enum {
+    BLE_XFER_OPEN_READ = 0,   // Existing file, for a download
+    BLE_XFER_OPEN_CREATE,     // New or truncated, read/write
+    BLE_XFER_OPEN_UPDATE,     // Existing file kept as is, read/write (resumed upload)
+} ble_xfer_open_t;
+
+// Link side. Every callback gets the engine's arg.
+typedef struct {
+    // Send a notification; 0 on success
+    int (*notify)(void *arg, ble_xfer_channel_t ch, const uint8_t *data, size_t len);
+    // Call ble_xfer_engine_run_deferred() soon, once the current GATT
+    // callback has returned. Posting again before it runs is harmless.
+    void (*defer)(void *arg);
+
+    // Walk a received chunk or SDU (an mbuf chain on the device): return
+    // the segment at *seg and move *seg on, NULL past the end
+    const uint8_t *(*rx_segment)(void *arg, const void **seg, size_t *len);
+
+    // Download buffers: a chunk the app reads (GATT) or an SDU (L2CAP).
+    // The engine fills them in place, segment by segment.
+    void *(*buf_alloc)(void *arg, bool sdu);
+    // Free space at the end of buf, growing it if it is full; NULL if it can't grow
+    uint8_t *(*buf_space)(void *arg, void *buf, size_t *space);
+    void (*buf_commit)(void *arg, void *buf, size_t len);
+    void (*buf_free)(void *arg, void *buf);
+
+    // L2CAP CoC data path
+    size_t (*sdu_size)(void *arg);          // Largest SDU to send; 0 with no channel open
+    int (*sdu_send)(void *arg, void *buf);  // Takes buf; BLE_XFER_SEND_* or negative
+    void (*sdu_schedule)(void *arg);        // Call ble_xfer_engine_pump() when it is this link's turn
+    void (*rx_resume)(void *arg);           // Give the peer back held receive credits
+
+    // Free-running cycle counter for the data path benchmark (may be NULL)
+    uint32_t (*cycles)(void *arg);
+} ble_xfer_transport_t;
+
+// Storage side. A transfer either uses the files on storage or another
+// sink (the OTA slot); the ops are chosen when it starts.
+typedef struct {
+    // Open path; *size gets the file size. NULL if it can't be opened.
+    void *(*open)(void *arg, const char *path, ble_xfer_open_t mode, uint32_t *size);
+    // Read len bytes, fewer only at end of file. 0, or -1 on a read error.
+    int (*read)(void *arg, void *file, uint8_t *buf, size_t len, size_t *out);
+    // Write all of data; 0 on success
+    int (*write)(void *arg, void *file, const uint8_t *data, size_t len);
+    // Move to offset; NULL if the sink can't resume
+    int (*seek)(void *arg, void *file, uint32_t offset);
+    // Flush and close; 0 on success
+    int (*close)(void *arg, void *file);
+    // Delete a partial upload (may be NULL)
+    void (*remove)(void *arg, const char *path);
+    // Upload written and closed: check it and make it visible (path is
+    // empty for a sink without one). ESP_OK sends Complete; anything else
+    // fails the transfer.
+    esp_err_t (*commit)(void *arg, const char *path, uint32_t size,
+                        const uint8_t sha256[BLE_TRANSFER_SHA256_SIZE]);
+    // Whole file sent; its digest may be cached (may be NULL)
+    void (*hashed)(void *arg, const char *path, const uint8_t sha256[BLE_TRANSFER_SHA256_SIZE]);
+    // Written data is still being applied (may be NULL); while true the
+    // engine holds Ready and credits until ble_xfer_engine_resume()
+    bool (*busy)(void *arg, void *file);
+} ble_xfer_file_ops_t;
+
+// Transfer start and end, for what lives outside the engine
+typedef struct {
+    void (*begin)(void *arg);               // Started (flags negotiated, Ready not yet sent)
+    void (*end)(void *arg, bool ok);        // Over; state is IDLE again
+    void (*moved)(void *arg, size_t len);   // File bytes moved (may be NULL)
+} ble_xfer_hooks_t;
+
+// Batch download queue (BLE_TRANSFER_OP_BATCH)
+typedef struct {
+    char (*names)[BLE_TRANSFER_BATCH_NAME_LEN];  // Queued filenames (PSRAM)
+    const char *dir;             // Directory the names are in
+    uint16_t count;
+    uint16_t next_index;         // Next name to open
+    uint16_t file_index;         // Index of the file being sent
+    uint16_t files_sent;
+    uint32_t bytes_sent;
+    uint8_t req_flags;           // Flags requested by the app, applied per file
+    // Next file, opened while the tail of the current one is still sending
+    void *next_handle;
+    uint32_t next_size;
+    uint8_t *prefetch_buf;
+    size_t prefetch_len;
+    size_t prefetch_pos;
+    bool prefetch_current;       // Prefetched data belongs to the current file
+} ble_xfer_batch_t;
+
+// Session counters; kept after the transfer ends so they can still be read
+typedef struct {
+    bool active;
+    int64_t start_us;
+    int64_t end_us;
+    uint32_t bytes;              // File bytes moved, across batch files
+    uint32_t chunks;
+    int64_t io_us;
+    int64_t wait_us;
+    int64_t wait_start_us;       // Non-zero while waiting on the peer
+    uint16_t notify_failures;
+    int64_t sample_us;           // Last instantaneous rate sample
+    uint32_t sample_bytes;
+    uint32_t inst_bps;
+    uint64_t host_cycles;        // Cycles in the data path (benchmark)
+} ble_xfer_stats_t;
+
+typedef enum {
+    BLE_XFER_DEFERRED_NONE = 0,
+    BLE_XFER_DEFERRED_WINDOW,
+    BLE_XFER_DEFERRED_CHUNK_READY,
+    BLE_XFER_DEFERRED_COMPLETE,
+    BLE_XFER_DEFERRED_ERROR,
+} ble_xfer_deferred_t;
+
+typedef struct {
+    ble_xfer_deferred_t action;
+    uint32_t seq;                // Transfer the event belongs to
+    uint32_t arg;                // WINDOW: crc, CHUNK_READY: chunk size
+    uint32_t offset;             // WINDOW: end of window
+} ble_xfer_deferred_event_t;
+
+// Deferred notification ring. A GATT read can't notify from inside its
+// callback, so it queues events for ble_xfer_engine_run_deferred(). Events
+// carry the transfer sequence number; ones left over from a transfer that
+// has since ended are dropped instead of acting on its successor.
+#define BLE_XFER_DEFERRED_QUEUE_LEN  16   // Power of two
+
+typedef struct {
+    ble_xfer_deferred_event_t events[BLE_XFER_DEFERRED_QUEUE_LEN];
+    unsigned head;
+    unsigned tail;
+    uint8_t max_depth;           // High-water mark this session
+    uint16_t drops;              // Events lost to a full ring this session
+} ble_xfer_deferred_queue_t;
+
+typedef struct {
+    const ble_xfer_transport_t *tx;
+    const ble_xfer_file_ops_t *fops;  // Of the running transfer
+    const ble_xfer_hooks_t *hooks;
+    void *arg;
+
+    ble_xfer_state_t state;
+    ble_xfer_dir_t direction;
+    uint8_t flags;               // Negotiated BLE_TRANSFER_FLAG_*
+    char path[BLE_XFER_PATH_LEN];  // Empty for a sink without a path
+    uint32_t total_bytes;
+    uint32_t transferred_bytes;
+    void *file;
+    bool delete_on_error;        // Uploads: delete the partial file on error
+    bool held;                   // Ready (or CoC credits) held while the sink is busy
+
+    // Integrity: CRC32 per ACK window, SHA-256 over the whole file.
+    // The prepared download chunk is CRCed into chunk_window, which
+    // becomes the window once the app has taken the chunk.
+    ble_xfer_integrity_t integ;
+    ble_xfer_window_t chunk_window;
+    int64_t integrity_us;
+
+    ble_compress_enc_t *enc;     // Download compressor
+    ble_compress_dec_t *dec;     // Upload decompressor
+    int64_t codec_us;            // Time spent in the codec (benchmark)
+    int64_t codec_io_us;         // File I/O time inside decoder callbacks, excluded from codec_us
+
+    // Next download chunk (read-based flow), filled in place
+    void *chunk;
+    size_t chunk_len;
+
+    // L2CAP CoC data path (BLE_TRANSFER_FLAG_L2CAP)
+    bool coc_stalled;            // Waiting for peer credits
+    uint32_t coc_sdus;           // SDUs handed to the link this transfer
+
+    ble_xfer_batch_t *batch;     // Non-NULL during a batch download
+    ble_xfer_stats_t stats;
+    ble_xfer_deferred_queue_t deferred_q;
+    uint32_t seq;                // Bumped when a transfer ends
+} ble_xfer_engine_t;
+
+// Transfer start parameters
+typedef struct {
+    const ble_xfer_file_ops_t *fops;
+    const char *path;            // File to read or write; NULL for a sink without one
+    const char *name;            // For logs and the compression decision
+    uint32_t size;               // Upload: bytes the app will send
+    uint8_t flags;               // Requested BLE_TRANSFER_FLAG_*
+    uint8_t granted;             // Flags already accepted by the sink (OTA: Delta)
+    uint32_t offset;             // With BLE_TRANSFER_FLAG_RESUME: where to start
+} ble_xfer_start_t;
+
+/**
+ * @brief Set up an engine (once, before any other call)
+ *
+ * @param e Engine
+ * @param tx Link callbacks
+ * @param hooks Lifecycle callbacks
+ * @param arg Passed to every callback
+ */
+void ble_xfer_engine_init(ble_xfer_engine_t *e, const ble_xfer_transport_t *tx,
+                          const ble_xfer_hooks_t *hooks, void *arg);
+
+/**
+ * @brief Start an upload (phone -> device)
+ *
+ * With BLE_TRANSFER_FLAG_RESUME the file must already hold p->offset
+ * bytes; they are kept and hashed, and the upload continues after them.
+ * The same command during a running, uncompressed upload of the same file
+ * rewinds it to p->offset instead.
+ *
+ * @return ESP_OK once Ready is sent; on failure Error is notified
+ */
+esp_err_t ble_xfer_engine_start_upload(ble_xfer_engine_t *e, const ble_xfer_start_t *p);
+
+/**
+ * @brief Start a download (device -> phone)
+ *
+ * With BLE_TRANSFER_FLAG_RESUME the first p->offset bytes are hashed but
+ * not sent. The same command during a running, uncompressed download of
+ * the same file restarts it from p->offset.
+ *
+ * @return ESP_OK once the download is announced; on failure Error is notified
+ */
+esp_err_t ble_xfer_engine_start_download(ble_xfer_engine_t *e, const ble_xfer_start_t *p);
+
+/**
+ * @brief Allocate an empty batch queue
+ *
+ * @param dir Directory the queued names are in (kept, not copied)
+ * @return Queue, or NULL if out of memory
+ */
+ble_xfer_batch_t *ble_xfer_batch_alloc(const char *dir);
+
+/**
+ * @brief Free a queue that was not passed to ble_xfer_engine_start_batch()
+ */
+void ble_xfer_batch_free(ble_xfer_batch_t *b);
+
+/**
+ * @brief Queue a filename; invalid names are skipped
+ *
+ * @return false once the queue is full
+ */
+bool ble_xfer_batch_add(ble_xfer_batch_t *b, const char *name);
+
+/**
+ * @brief Start a batch download; the engine takes the queue
+ *
+ * @return ESP_OK, also when the queue turned out to be empty
+ */
+esp_err_t ble_xfer_engine_start_batch(ble_xfer_engine_t *e, const ble_xfer_file_ops_t *fops,
+                                      ble_xfer_batch_t *b, uint8_t flags);
+
+/**
+ * @brief Refuse a transfer before it starts (busy file, bad name, ...)
+ *
+ * @param ch Where the app expects the Error: CTRL for uploads and
+ *           batches, DATA for downloads
+ */
+void ble_xfer_engine_reject(ble_xfer_engine_t *e, ble_xfer_channel_t ch);
+
+/**
+ * @brief Take one received chunk (GATT write) or SDU (L2CAP)
+ *
+ * Written segment by segment from where the transport received it.
+ *
+ * @param pkt First segment, for tx->rx_segment
+ * @param sdu Arrived on the CoC channel
+ * @return ESP_OK; ESP_ERR_INVALID_STATE if no matching upload is running;
+ *         on a write error the transfer fails with Error
+ */
+esp_err_t ble_xfer_engine_receive(ble_xfer_engine_t *e, const void *pkt, bool sdu);
+
+/**
+ * @brief Whether receive credits are held (tx->rx_resume() gives them back)
+ */
+bool ble_xfer_engine_rx_held(const ble_xfer_engine_t *e);
+
+/**
+ * @brief The sink finished applying held data, or failed to
+ *
+ * @param err ESP_OK to continue, or why the transfer must fail
+ */
+void ble_xfer_engine_resume(ble_xfer_engine_t *e, esp_err_t err);
+
+/**
+ * @brief Read the next download chunk into a new buffer
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FINISHED at end of file, or an error
+ */
+esp_err_t ble_xfer_engine_prepare(ble_xfer_engine_t *e);
+
+/**
+ * @brief Hand the prepared chunk to the app's read and prepare the next
+ *
+ * Safe inside a GATT callback: notifications are deferred.
+ *
+ * @param[out] buf The chunk; the caller owns it now
+ * @return ESP_OK, or ESP_ERR_INVALID_STATE if no chunk is ready
+ */
+esp_err_t ble_xfer_engine_take_chunk(ble_xfer_engine_t *e, void **buf);
+
+/**
+ * @brief Send what GATT callbacks deferred (see tx->defer)
+ */
+void ble_xfer_engine_run_deferred(ble_xfer_engine_t *e);
+
+/**
+ * @brief Whether a CoC download can send an SDU now
+ */
+bool ble_xfer_engine_pumpable(const ble_xfer_engine_t *e);
+
+/**
+ * @brief Send the next CoC download SDU
+ */
+void ble_xfer_engine_pump(ble_xfer_engine_t *e);
+
+/**
+ * @brief The peer granted credits again after BLE_XFER_SEND_STALLED
+ */
+void ble_xfer_engine_tx_ready(ble_xfer_engine_t *e);
+
+/**
+ * @brief Stop the transfer without a notification (app cancel)
+ *
+ * Closes the file and deletes a partial upload.
+ */
+void ble_xfer_engine_cancel(ble_xfer_engine_t *e);
+
+/**
+ * @brief Fail the transfer and notify Error (e.g. the CoC channel closed)
+ */
+void ble_xfer_engine_fail(ble_xfer_engine_t *e);
+
+/**
+ * @brief Whether an upload or download is running
+ */
+bool ble_xfer_engine_is_active(const ble_xfer_engine_t *e);
+
+/**
+ * @brief Peer wait time so far, including a wait still running
+ */
+int64_t ble_xfer_engine_wait_us(const ble_xfer_engine_t *e, int64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_XFER_ENGINE_H
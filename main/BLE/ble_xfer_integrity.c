@@ -0,0 +1,34 @@
+#include "ble_xfer_integrity.h"
+
+#include <string.h>
+
+// ============ Public Functions ============
+
+void ble_xfer_integrity_begin(ble_xfer_integrity_t *in) {
+    mbedtls_sha256_init(&in->sha_ctx);
+    mbedtls_sha256_starts(&in->sha_ctx, 0);
+    in->sha_active = true;
+    memset(in->sha256, 0, sizeof(in->sha256));
+    ble_xfer_window_begin(&in->window);
+}
+
+void ble_xfer_integrity_hash(ble_xfer_integrity_t *in, const uint8_t *data, size_t len) {
+    mbedtls_sha256_update(&in->sha_ctx, data, len);
+}
+
+void ble_xfer_integrity_finish(ble_xfer_integrity_t *in) {
+    if (!in->sha_active) {
+        return;
+    }
+
+    mbedtls_sha256_finish(&in->sha_ctx, in->sha256);
+    mbedtls_sha256_free(&in->sha_ctx);
+    in->sha_active = false;
+}
+
+void ble_xfer_integrity_abort(ble_xfer_integrity_t *in) {
+    if (in->sha_active) {
+        mbedtls_sha256_free(&in->sha_ctx);
+        in->sha_active = false;
+    }
+}
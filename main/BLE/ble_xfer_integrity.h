@@ -0,0 +1,47 @@
+#ifndef BLE_XFER_INTEGRITY_H
+#define BLE_XFER_INTEGRITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <mbedtls/sha256.h>
+#include "ble_xfer_proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Transfer integrity: SHA-256 over file bytes for the Complete status, plus
+// the CRC32 ACK windows over wire bytes (ble_xfer_proto.h)
+typedef struct {
+    mbedtls_sha256_context sha_ctx;
+    bool sha_active;
+    uint8_t sha256[BLE_TRANSFER_SHA256_SIZE];
+    ble_xfer_window_t window;
+} ble_xfer_integrity_t;
+
+/**
+ * @brief Reset windows and start a new SHA-256
+ */
+void ble_xfer_integrity_begin(ble_xfer_integrity_t *in);
+
+/**
+ * @brief Feed file bytes into the SHA-256
+ */
+void ble_xfer_integrity_hash(ble_xfer_integrity_t *in, const uint8_t *data, size_t len);
+
+/**
+ * @brief Finalize the SHA-256 into in->sha256
+ */
+void ble_xfer_integrity_finish(ble_xfer_integrity_t *in);
+
+/**
+ * @brief Drop the SHA-256 without finalizing
+ */
+void ble_xfer_integrity_abort(ble_xfer_integrity_t *in);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_XFER_INTEGRITY_H
@@ -0,0 +1,201 @@
+#include "ble_xfer_proto.h"
+#include "ble_le.h"
+
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_rom_crc.h>
+#endif
+
+// ============ Internal Functions ============
+
+// Terminate the filename at name_off and read the optional flags byte
+// that follows its NUL (0 for older clients that don't send one), then
+// the resume offset if the flags ask for one
+static int parse_name_flags(uint8_t *buf, size_t len, size_t name_off, ble_xfer_cmd_t *cmd) {
+    buf[len] = '\0';  // Ensure null termination
+
+    size_t name_len = strnlen((const char *)&buf[name_off], len - name_off);
+    size_t flags_off = name_off + name_len + 1;
+    cmd->flags = (flags_off < len) ? buf[flags_off] : 0;
+
+    if (cmd->flags & BLE_TRANSFER_FLAG_RESUME) {
+        if (flags_off + 5 > len) {
+            return BLE_XFER_PARSE_BAD_LEN;
+        }
+        cmd->offset = get_le32(&buf[flags_off + 1]);
+    }
+    return BLE_XFER_PARSE_OK;
+}
+
+// ============ Command Parsing ============
+
+int ble_xfer_parse_command(uint8_t *buf, size_t len, ble_xfer_cmd_t *cmd) {
+    memset(cmd, 0, sizeof(*cmd));
+    if (len < 1) {
+        return BLE_XFER_PARSE_BAD_LEN;
+    }
+
+    cmd->opcode = buf[0];
+
+    switch (cmd->opcode) {
+    case BLE_TRANSFER_OP_CANCEL:
+        return BLE_XFER_PARSE_OK;
+
+    case BLE_TRANSFER_OP_UPLOAD:
+        // Upload: [0x01][size:4][filename\0][flags:1 optional][offset:4 if resume]
+        if (len < 6) {
+            return BLE_XFER_PARSE_BAD_LEN;
+        }
+        cmd->size = get_le32(&buf[1]);
+        cmd->name = (const char *)&buf[5];
+        return parse_name_flags(buf, len, 5, cmd);
+
+    case BLE_TRANSFER_OP_DOWNLOAD:
+        // Download: [0x02][filename\0][flags:1 optional][offset:4 if resume]
+        if (len < 2) {
+            return BLE_XFER_PARSE_BAD_LEN;
+        }
+        cmd->name = (const char *)&buf[1];
+        return parse_name_flags(buf, len, 1, cmd);
+
+    case BLE_TRANSFER_OP_BATCH:
+        // Batch: [0x03][flags:1][mode:1][args]
+        if (len < 3) {
+            return BLE_XFER_PARSE_BAD_LEN;
+        }
+        cmd->flags = buf[1];
+        cmd->batch_mode = buf[2];
+
+        if (cmd->batch_mode == BLE_TRANSFER_BATCH_LIST) {
+            cmd->names = (const char *)&buf[3];
+            cmd->names_len = len - 3;
+            return BLE_XFER_PARSE_OK;
+        }
+        if (cmd->batch_mode == BLE_TRANSFER_BATCH_SINCE && len >= 7) {
+            cmd->after = get_le32(&buf[3]);
+            return BLE_XFER_PARSE_OK;
+        }
+        return BLE_XFER_PARSE_BAD_LEN;
+
+    case BLE_TRANSFER_OP_OTA:
+        // OTA: [0x04][size:4][sha256:32][flags:1 optional]
+        if (len < 5 + BLE_TRANSFER_SHA256_SIZE) {
+            return BLE_XFER_PARSE_BAD_LEN;
+        }
+        cmd->size = get_le32(&buf[1]);
+        cmd->sha256 = &buf[5];
+        cmd->flags = (len > 5 + BLE_TRANSFER_SHA256_SIZE) ? buf[5 + BLE_TRANSFER_SHA256_SIZE] : 0;
+        return BLE_XFER_PARSE_OK;
+
+    default:
+        return BLE_XFER_PARSE_BAD_OPCODE;
+    }
+}
+
+// ============ Frame Encoding ============
+
+size_t ble_xfer_encode_status(uint8_t *buf, uint8_t status, uint32_t size) {
+    buf[0] = status;
+    put_le32(&buf[1], size);
+    return BLE_XFER_STATUS_LEN;
+}
+
+size_t ble_xfer_encode_status_flags(uint8_t *buf, uint8_t status, uint32_t size,
+                                    uint8_t flags) {
+    ble_xfer_encode_status(buf, status, size);
+    buf[5] = flags;
+    return BLE_XFER_STATUS_FLAGS_LEN;
+}
+
+size_t ble_xfer_encode_complete(uint8_t *buf, const uint8_t sha256[BLE_TRANSFER_SHA256_SIZE]) {
+    ble_xfer_encode_status(buf, BLE_TRANSFER_STATUS_COMPLETE, 0);
+    memcpy(&buf[5], sha256, BLE_TRANSFER_SHA256_SIZE);
+    return BLE_XFER_COMPLETE_LEN;
+}
+
+size_t ble_xfer_encode_window(uint8_t *buf, uint32_t crc, uint32_t offset) {
+    buf[0] = BLE_TRANSFER_STATUS_WINDOW;
+    put_le32(&buf[1], crc);
+    put_le32(&buf[5], offset);
+    return BLE_XFER_WINDOW_LEN;
+}
+
+size_t ble_xfer_encode_progress(uint8_t *buf, uint32_t transferred, uint32_t total) {
+    put_le32(&buf[0], transferred);
+    put_le32(&buf[4], total);
+    return BLE_XFER_PROGRESS_LEN;
+}
+
+size_t ble_xfer_encode_batch_end(uint8_t *buf, uint16_t files, uint32_t bytes) {
+    buf[0] = BLE_TRANSFER_STATUS_BATCH_END;
+    put_le16(&buf[1], files);
+    put_le32(&buf[3], bytes);
+    return BLE_XFER_BATCH_END_LEN;
+}
+
+size_t ble_xfer_encode_batch_file(uint8_t *buf, uint16_t index, uint32_t size,
+                                  uint8_t flags, const char *name) {
+    size_t name_len = strlen(name) + 1;
+
+    buf[0] = BLE_TRANSFER_STATUS_FILE;
+    put_le16(&buf[1], index);
+    put_le32(&buf[3], size);
+    buf[7] = flags;
+    memcpy(&buf[BLE_XFER_BATCH_FILE_HDR], name, name_len);
+    return BLE_XFER_BATCH_FILE_HDR + name_len;
+}
+
+// ============ ACK Windows ============
+
+uint32_t ble_xfer_crc32(uint32_t crc, const uint8_t *data, size_t len) {
+#ifdef ESP_PLATFORM
+    // ROM CRC32; esp_rom_crc32_le(0, ...) matches zlib crc32()
+    return esp_rom_crc32_le(crc, data, len);
+#else
+    crc = ~crc;
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+#endif
+}
+
+void ble_xfer_window_begin(ble_xfer_window_t *w) {
+    w->crc = 0;
+    w->chunks = 0;
+    w->chunk_count = 0;
+    w->wire_bytes = 0;
+}
+
+void ble_xfer_window_crc(ble_xfer_window_t *w, const uint8_t *data, size_t len) {
+    w->crc = ble_xfer_crc32(w->crc, data, len);
+    w->wire_bytes += len;
+}
+
+bool ble_xfer_window_chunk_done(ble_xfer_window_t *w, uint32_t *window_crc) {
+    w->chunk_count++;
+
+    if (++w->chunks < BLE_TRANSFER_WINDOW_CHUNKS) {
+        return false;
+    }
+
+    *window_crc = w->crc;
+    w->crc = 0;
+    w->chunks = 0;
+    return true;
+}
+
+bool ble_xfer_window_flush(ble_xfer_window_t *w, uint32_t *window_crc) {
+    if (w->chunks == 0) {
+        return false;
+    }
+
+    *window_crc = w->crc;
+    w->crc = 0;
+    w->chunks = 0;
+    return true;
+}
@@ -0,0 +1,157 @@
+#ifndef BLE_XFER_PROTO_H
+#define BLE_XFER_PROTO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// File transfer protocol core: wire constants, frame encoding, command
+// parsing and ACK windows. Plain C - no mbedtls, NimBLE, esp_timer or
+// stdio - so it also builds for a Linux host (test/host). The SHA-256 half
+// of transfer integrity is in ble_xfer_integrity.h.
+
+// ============ Transfer Status Codes ============
+#define BLE_TRANSFER_STATUS_ERROR     0x00
+#define BLE_TRANSFER_STATUS_READY     0x01
+#define BLE_TRANSFER_STATUS_COMPLETE  0x02
+#define BLE_TRANSFER_STATUS_WINDOW    0x03
+#define BLE_TRANSFER_STATUS_FILE      0x04  // Batch: [0x04][index:2][size:4][flags:1][name\0]
+#define BLE_TRANSFER_STATUS_BATCH_END 0x05  // Batch: [0x05][files:2][bytes:4]
+
+// ============ Transfer Operation Codes ============
+#define BLE_TRANSFER_OP_CANCEL   0x00
+#define BLE_TRANSFER_OP_UPLOAD   0x01
+#define BLE_TRANSFER_OP_DOWNLOAD 0x02
+#define BLE_TRANSFER_OP_BATCH    0x03
+#define BLE_TRANSFER_OP_OTA      0x04  // [0x04][size:4][sha256:32][flags:1] firmware image
+
+// Batch download selectors: [0x03][flags:1][mode:1][args]
+#define BLE_TRANSFER_BATCH_LIST  0x00  // args: [name\0][name\0]...
+#define BLE_TRANSFER_BATCH_SINCE 0x01  // args: [after:4] recording number
+
+// ============ Transfer Flags ============
+// Optional byte after the filename NUL in upload/download commands.
+// The device echoes the flags it granted in the READY notification.
+#define BLE_TRANSFER_FLAG_COMPRESS 0x01  // LZSS-compress the data stream
+#define BLE_TRANSFER_FLAG_L2CAP    0x02  // Move data over the L2CAP CoC channel
+#define BLE_TRANSFER_FLAG_DELTA    0x04  // OTA: the data is a delta patch (ble_delta.h)
+#define BLE_TRANSFER_FLAG_RESUME   0x08  // Upload/download: [offset:4] follows the flags byte
+
+// Chunks per ACK window; a CRC32 of each window is notified on transfer control
+#define BLE_TRANSFER_WINDOW_CHUNKS 16
+
+// SHA-256 digest returned in the COMPLETE status
+#define BLE_TRANSFER_SHA256_SIZE  32
+
+// ============ Frame Sizes ============
+#define BLE_XFER_STATUS_LEN        5   // [status][size:4]
+#define BLE_XFER_STATUS_FLAGS_LEN  6   // [status][size:4][flags]
+#define BLE_XFER_COMPLETE_LEN      (5 + BLE_TRANSFER_SHA256_SIZE)
+#define BLE_XFER_WINDOW_LEN        9   // [0x03][crc32:4][offset:4]
+#define BLE_XFER_PROGRESS_LEN      8   // [transferred:4][total:4]
+#define BLE_XFER_BATCH_END_LEN     7   // [0x05][files:2][bytes:4]
+#define BLE_XFER_BATCH_FILE_HDR    8   // [0x04][index:2][size:4][flags], name follows
+
+// ============ Command Parsing ============
+
+// Parse results
+#define BLE_XFER_PARSE_OK          0
+#define BLE_XFER_PARSE_BAD_LEN     (-1)
+#define BLE_XFER_PARSE_BAD_OPCODE  (-2)
+
+// Decoded transfer control command. Strings point into the parse buffer.
+typedef struct {
+    uint8_t opcode;              // BLE_TRANSFER_OP_*
+    uint8_t flags;               // Requested BLE_TRANSFER_FLAG_*
+    uint32_t size;               // Upload: file size
+    uint32_t offset;             // Upload/download with BLE_TRANSFER_FLAG_RESUME: start offset
+    const char *name;            // Upload/download: NUL-terminated filename
+    uint8_t batch_mode;          // Batch: BLE_TRANSFER_BATCH_*
+    const char *names;           // Batch list: NUL-separated names
+    size_t names_len;
+    uint32_t after;              // Batch since: recording number
+    const uint8_t *sha256;       // OTA: expected image digest
+} ble_xfer_cmd_t;
+
+/**
+ * @brief Parse a transfer control write
+ *
+ * Filenames are NUL-terminated in place, so buf must have room for
+ * len + 1 bytes.
+ *
+ * @param buf Command bytes
+ * @param len Command length
+ * @param[out] cmd Decoded command
+ * @return BLE_XFER_PARSE_OK, BLE_XFER_PARSE_BAD_LEN or BLE_XFER_PARSE_BAD_OPCODE
+ */
+int ble_xfer_parse_command(uint8_t *buf, size_t len, ble_xfer_cmd_t *cmd);
+
+// ============ Frame Encoding ============
+// Each encoder writes one notification payload (little-endian) and
+// returns its length.
+
+size_t ble_xfer_encode_status(uint8_t *buf, uint8_t status, uint32_t size);
+size_t ble_xfer_encode_status_flags(uint8_t *buf, uint8_t status, uint32_t size,
+                                    uint8_t flags);
+size_t ble_xfer_encode_complete(uint8_t *buf, const uint8_t sha256[BLE_TRANSFER_SHA256_SIZE]);
+size_t ble_xfer_encode_window(uint8_t *buf, uint32_t crc, uint32_t offset);
+size_t ble_xfer_encode_progress(uint8_t *buf, uint32_t transferred, uint32_t total);
+size_t ble_xfer_encode_batch_end(uint8_t *buf, uint16_t files, uint32_t bytes);
+
+/**
+ * @brief Encode a batch File header
+ *
+ * @param buf Output, at least BLE_XFER_BATCH_FILE_HDR + strlen(name) + 1 bytes
+ */
+size_t ble_xfer_encode_batch_file(uint8_t *buf, uint16_t index, uint32_t size,
+                                  uint8_t flags, const char *name);
+
+// ============ ACK Windows ============
+
+// CRC32 over wire bytes, one per BLE_TRANSFER_WINDOW_CHUNKS chunks
+typedef struct {
+    uint32_t crc;                // CRC of the open window
+    uint16_t chunks;             // Chunks in the open window
+    uint32_t chunk_count;
+    uint32_t wire_bytes;         // Bytes sent/received over BLE (compressed if enabled)
+} ble_xfer_window_t;
+
+/**
+ * @brief zlib-compatible CRC32 (start with crc = 0)
+ */
+uint32_t ble_xfer_crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief Start counting windows from offset 0
+ */
+void ble_xfer_window_begin(ble_xfer_window_t *w);
+
+/**
+ * @brief Feed wire bytes into the open window's CRC32
+ */
+void ble_xfer_window_crc(ble_xfer_window_t *w, const uint8_t *data, size_t len);
+
+/**
+ * @brief Count one chunk (or CoC SDU)
+ *
+ * @param[out] window_crc CRC of the window this chunk closed
+ * @return true when this chunk closed an ACK window
+ */
+bool ble_xfer_window_chunk_done(ble_xfer_window_t *w, uint32_t *window_crc);
+
+/**
+ * @brief Close a trailing partial window
+ *
+ * @return true if there was one
+ */
+bool ble_xfer_window_flush(ble_xfer_window_t *w, uint32_t *window_crc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_XFER_PROTO_H
@@ -98,6 +98,28 @@ static void format_size(size_t size, char *buf, size_t buf_size)
     }
 }
 
+// Emit one file list item from the storage metadata cache
+static void index_entry_callback(const storage_entry_t *entry, void *user_data)
+{
+    httpd_req_t *req = (httpd_req_t *)user_data;
+    char size_str[32];
+    char item_html[1024];
+
+    if (entry->meta.type == STORAGE_ENTRY_DIRECTORY) return;
+    if (strlen(entry->name) > 64) return;  // Skip overly long names
+
+    format_size(entry->meta.size, size_str, sizeof(size_str));
+    snprintf(item_html, sizeof(item_html),
+        "<li class='file-item'>"
+        "<div><span class='file-name'>%.64s</span><br><span class='file-size'>%s</span></div>"
+        "<div>"
+        "<a href='/download?file=%.64s' class='btn btn-download'>Download</a> "
+        "<a href='/delete?file=%.64s' class='btn btn-delete' onclick=\"return confirm('Delete %.64s?')\">Delete</a>"
+        "</div></li>",
+        entry->name, size_str, entry->name, entry->name, entry->name);
+    httpd_resp_sendstr_chunk(req, item_html);
+}
+
 // HTTP handler: Main page with file list
 static esp_err_t index_handler(httpd_req_t *req)
 {
@@ -108,37 +130,7 @@ static esp_err_t index_handler(httpd_req_t *req)
     // File list
     httpd_resp_sendstr_chunk(req, "<h2>Files on Storage</h2><ul class='file-list'>");
 
-    char base_path[32];
-    get_base_path(base_path, sizeof(base_path));
-
-    DIR *dir = opendir(base_path);
-    if (dir) {
-        struct dirent *entry;
-        char full_path[128];
-        struct stat st;
-        char size_str[32];
-        char item_html[1024];
-
-        while ((entry = readdir(dir)) != NULL) {
-            if (entry->d_type == DT_DIR) continue;
-            if (strlen(entry->d_name) > 64) continue;  // Skip overly long names
-
-            snprintf(full_path, sizeof(full_path), "%s/%.64s", base_path, entry->d_name);
-            if (stat(full_path, &st) == 0) {
-                format_size(st.st_size, size_str, sizeof(size_str));
-                snprintf(item_html, sizeof(item_html),
-                    "<li class='file-item'>"
-                    "<div><span class='file-name'>%.64s</span><br><span class='file-size'>%s</span></div>"
-                    "<div>"
-                    "<a href='/download?file=%.64s' class='btn btn-download'>Download</a> "
-                    "<a href='/delete?file=%.64s' class='btn btn-delete' onclick=\"return confirm('Delete %.64s?')\">Delete</a>"
-                    "</div></li>",
-                    entry->d_name, size_str, entry->d_name, entry->d_name, entry->d_name);
-                httpd_resp_sendstr_chunk(req, item_html);
-            }
-        }
-        closedir(dir);
-    }
+    storage_cache_foreach(index_entry_callback, req);
 
     httpd_resp_sendstr_chunk(req, "</ul>");
 
@@ -257,7 +249,7 @@ static esp_err_t delete_handler(httpd_req_t *req)
     char full_path[256];
     snprintf(full_path, sizeof(full_path), "%s/%s", base_path, filename);
 
-    if (unlink(full_path) != 0) {
+    if (storage_delete_file(full_path) != ESP_OK) {
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to delete");
         return ESP_FAIL;
     }
@@ -366,6 +358,10 @@ static esp_err_t upload_handler(httpd_req_t *req)
         }
         fclose(file);
         ESP_LOGI(TAG, "Uploaded: %s", filename);
+
+        char full_path[256];
+        snprintf(full_path, sizeof(full_path), "%s/%s", base_path, filename);
+        storage_file_written(full_path);
     }
 
     free(buf);
@@ -1,7 +1,11 @@
 #include "playlist.h"
 #include "../Storage/storage.h"
+#include "../Status/device_status.h"
 #include <string.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 static const char *TAG = "Playlist";
 
@@ -10,6 +14,22 @@ static char playlist_paths[PLAYLIST_MAX_FILES][PLAYLIST_MAX_PATH_LEN];
 static int playlist_count = 0;
 static int current_index = 0;
 
+// Edited from the audio task, buttons, the BLE host task and the storage
+// worker. Recursive because rename falls back to add/remove.
+static SemaphoreHandle_t playlist_mutex = NULL;
+
+static void playlist_lock(void) {
+    if (playlist_mutex) {
+        xSemaphoreTakeRecursive(playlist_mutex, portMAX_DELAY);
+    }
+}
+
+static void playlist_unlock(void) {
+    if (playlist_mutex) {
+        xSemaphoreGiveRecursive(playlist_mutex);
+    }
+}
+
 // Callback for storage scanning
 static void scan_callback(const char *file_path, void *user_data) {
     if (playlist_count >= PLAYLIST_MAX_FILES) {
@@ -19,39 +39,71 @@ static void scan_callback(const char *file_path, void *user_data) {
 
     strncpy(playlist_paths[playlist_count], file_path, PLAYLIST_MAX_PATH_LEN - 1);
     playlist_paths[playlist_count][PLAYLIST_MAX_PATH_LEN - 1] = '\0';
-    ESP_LOGI(TAG, "Added to playlist [%d]: %s", playlist_count, file_path);
+    ESP_LOGD(TAG, "Added to playlist [%d]: %s", playlist_count, file_path);
     playlist_count++;
 }
 
+static int find_index(const char *path) {
+    for (int i = 0; i < playlist_count; i++) {
+        if (strcmp(playlist_paths[i], path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static const char *basename_of(const char *path) {
+    const char *filename = strrchr(path, '/');
+    return filename ? filename + 1 : path;
+}
+
+static void publish_track(void) {
+    device_status_set_track((uint16_t)current_index, (uint16_t)playlist_count);
+}
+
+// Whether path is a track: an audio file the storage cache lists, so
+// files moved into subdirectories drop out as they would on a rescan
+static bool is_track(const char *path) {
+    storage_meta_t meta;
+    return storage_cache_get(path, &meta) == ESP_OK && meta.is_audio;
+}
+
 esp_err_t playlist_init(void) {
+    if (playlist_mutex == NULL) {
+        playlist_mutex = xSemaphoreCreateRecursiveMutex();
+        if (playlist_mutex == NULL) {
+            ESP_LOGE(TAG, "Failed to create playlist mutex");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    playlist_lock();
     playlist_count = 0;
     current_index = 0;
 
     esp_err_t ret = storage_scan_audio_files(scan_callback, NULL);
     if (ret != ESP_OK) {
+        playlist_unlock();
         ESP_LOGE(TAG, "Failed to scan audio files");
         return ret;
     }
+    publish_track();
 
     ESP_LOGI(TAG, "========== PLAYLIST INITIALIZED ==========");
     ESP_LOGI(TAG, "Total tracks: %d", playlist_count);
     for (int i = 0; i < playlist_count; i++) {
-        // Extract just filename from full path for cleaner output
-        const char *filename = strrchr(playlist_paths[i], '/');
-        if (filename) {
-            filename++;  // Skip the '/'
-        } else {
-            filename = playlist_paths[i];
-        }
-        ESP_LOGI(TAG, "  [%d] %s", i + 1, filename);
+        ESP_LOGI(TAG, "  [%d] %s", i + 1, basename_of(playlist_paths[i]));
     }
     ESP_LOGI(TAG, "==========================================");
+    playlist_unlock();
 
     return ESP_OK;
 }
 
 esp_err_t playlist_rescan(void) {
     ESP_LOGI(TAG, "Rescanning playlist...");
+    int64_t start = esp_timer_get_time();
+    playlist_lock();
 
     // Remember current track path if possible
     char current_track[PLAYLIST_MAX_PATH_LEN] = {0};
@@ -65,6 +117,7 @@ esp_err_t playlist_rescan(void) {
 
     esp_err_t ret = storage_scan_audio_files(scan_callback, NULL);
     if (ret != ESP_OK) {
+        playlist_unlock();
         ESP_LOGE(TAG, "Failed to rescan audio files");
         return ret;
     }
@@ -80,62 +133,200 @@ esp_err_t playlist_rescan(void) {
         }
     }
 
-    ESP_LOGI(TAG, "========== PLAYLIST RESCANNED ==========");
-    ESP_LOGI(TAG, "Total tracks: %d", playlist_count);
+    publish_track();
+
+    ESP_LOGI(TAG, "Playlist rescanned: %d tracks, current %d (%lld us)",
+             playlist_count, current_index + 1,
+             (long long)(esp_timer_get_time() - start));
     for (int i = 0; i < playlist_count; i++) {
-        const char *filename = strrchr(playlist_paths[i], '/');
-        if (filename) {
-            filename++;
-        } else {
-            filename = playlist_paths[i];
-        }
-        ESP_LOGI(TAG, "  [%d] %s%s", i + 1, filename,
+        ESP_LOGD(TAG, "  [%d] %s%s", i + 1, basename_of(playlist_paths[i]),
                  (i == current_index) ? " <-- current" : "");
     }
-    ESP_LOGI(TAG, "=========================================");
+    playlist_unlock();
 
     return ESP_OK;
 }
 
-const char* playlist_get_current(void) {
+esp_err_t playlist_add(const char *path) {
+    if (!path || !storage_is_audio_file(path)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t start = esp_timer_get_time();
+    playlist_lock();
+
+    // Overwritten file (e.g. re-upload) - already listed
+    if (find_index(path) >= 0) {
+        playlist_unlock();
+        return ESP_OK;
+    }
+
+    if (playlist_count >= PLAYLIST_MAX_FILES) {
+        playlist_unlock();
+        ESP_LOGW(TAG, "Playlist full, ignoring: %s", path);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Append, matching where a new file lands in directory order
+    strncpy(playlist_paths[playlist_count], path, PLAYLIST_MAX_PATH_LEN - 1);
+    playlist_paths[playlist_count][PLAYLIST_MAX_PATH_LEN - 1] = '\0';
+    playlist_count++;
+    publish_track();
+    int count = playlist_count;
+    playlist_unlock();
+
+    ESP_LOGI(TAG, "Added [%d] %s (%d tracks, %lld us)", count,
+             basename_of(path), count,
+             (long long)(esp_timer_get_time() - start));
+    return ESP_OK;
+}
+
+esp_err_t playlist_remove(const char *path) {
+    if (!path) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t start = esp_timer_get_time();
+    playlist_lock();
+
+    int index = find_index(path);
+    if (index < 0) {
+        playlist_unlock();
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Close the gap with one move
+    memmove(playlist_paths[index], playlist_paths[index + 1],
+            (size_t)(playlist_count - index - 1) * PLAYLIST_MAX_PATH_LEN);
+    playlist_count--;
+
+    // Keep pointing at the same track; if it was removed, its successor
+    // now sits at the same index (wrap if it was the last one)
+    if (index < current_index) {
+        current_index--;
+    } else if (current_index >= playlist_count) {
+        current_index = 0;
+    }
+    publish_track();
+    int count = playlist_count;
+    playlist_unlock();
+
+    ESP_LOGI(TAG, "Removed [%d] %s (%d tracks, %lld us)", index + 1,
+             basename_of(path), count,
+             (long long)(esp_timer_get_time() - start));
+    return ESP_OK;
+}
+
+esp_err_t playlist_rename(const char *old_path, const char *new_path) {
+    if (!old_path || !new_path) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bool track = is_track(new_path);
+    playlist_lock();
+
+    int index = find_index(old_path);
+    esp_err_t ret = ESP_OK;
+    if (index < 0) {
+        ret = track ? playlist_add(new_path) : ESP_OK;
+        playlist_unlock();
+        return ret;
+    }
+    if (!track) {
+        ret = playlist_remove(old_path);
+        playlist_unlock();
+        return ret;
+    }
+
+    strncpy(playlist_paths[index], new_path, PLAYLIST_MAX_PATH_LEN - 1);
+    playlist_paths[index][PLAYLIST_MAX_PATH_LEN - 1] = '\0';
+    playlist_unlock();
+
+    ESP_LOGI(TAG, "Renamed [%d] %s -> %s", index + 1, basename_of(old_path),
+             basename_of(new_path));
+    return ESP_OK;
+}
+
+// Copy the current track path (caller holds the lock)
+static esp_err_t copy_current(char *path, size_t len) {
     if (playlist_count == 0) {
-        return NULL;
+        return ESP_ERR_NOT_FOUND;
+    }
+    strncpy(path, playlist_paths[current_index], len - 1);
+    path[len - 1] = '\0';
+    return ESP_OK;
+}
+
+esp_err_t playlist_get_current(char *path, size_t len) {
+    if (!path || len == 0) {
+        return ESP_ERR_INVALID_ARG;
     }
-    return playlist_paths[current_index];
+
+    playlist_lock();
+    esp_err_t ret = copy_current(path, len);
+    playlist_unlock();
+    return ret;
 }
 
-const char* playlist_next(void) {
+esp_err_t playlist_next(char *path, size_t len) {
+    if (!path || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    playlist_lock();
     if (playlist_count == 0) {
-        return NULL;
+        playlist_unlock();
+        return ESP_ERR_NOT_FOUND;
     }
 
     current_index = (current_index + 1) % playlist_count;
+    publish_track();
     ESP_LOGI(TAG, "Next track [%d/%d]: %s",
              current_index + 1, playlist_count, playlist_paths[current_index]);
-    return playlist_paths[current_index];
+    esp_err_t ret = copy_current(path, len);
+    playlist_unlock();
+    return ret;
 }
 
-const char* playlist_prev(void) {
+esp_err_t playlist_prev(char *path, size_t len) {
+    if (!path || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    playlist_lock();
     if (playlist_count == 0) {
-        return NULL;
+        playlist_unlock();
+        return ESP_ERR_NOT_FOUND;
     }
 
     current_index = (current_index - 1 + playlist_count) % playlist_count;
+    publish_track();
     ESP_LOGI(TAG, "Previous track [%d/%d]: %s",
              current_index + 1, playlist_count, playlist_paths[current_index]);
-    return playlist_paths[current_index];
+    esp_err_t ret = copy_current(path, len);
+    playlist_unlock();
+    return ret;
 }
 
-const char* playlist_select(int index) {
+esp_err_t playlist_select(int index, char *path, size_t len) {
+    if (!path || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    playlist_lock();
     if (playlist_count == 0 || index < 0 || index >= playlist_count) {
         ESP_LOGW(TAG, "Invalid playlist index: %d (count: %d)", index, playlist_count);
-        return NULL;
+        playlist_unlock();
+        return ESP_ERR_NOT_FOUND;
     }
 
     current_index = index;
+    publish_track();
     ESP_LOGI(TAG, "Selected track [%d/%d]: %s",
              current_index + 1, playlist_count, playlist_paths[current_index]);
-    return playlist_paths[current_index];
+    esp_err_t ret = copy_current(path, len);
+    playlist_unlock();
+    return ret;
 }
 
 int playlist_get_count(void) {
@@ -2,6 +2,7 @@
 #define PLAYLIST_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <esp_err.h>
 
 #ifdef __cplusplus
@@ -14,20 +15,40 @@ extern "C" {
 // Initialize playlist - scans storage for audio files
 esp_err_t playlist_init(void);
 
-// Rescan storage for audio files (call after new recording)
+// Rescan storage for audio files (boot and consistency checks only;
+// use the incremental functions below for single-file changes)
 esp_err_t playlist_rescan(void);
 
-// Get current track path (returns NULL if empty)
-const char* playlist_get_current(void);
+// Append a new audio file. The current track index does not change.
+// Non-audio paths and paths already in the playlist are ignored.
+esp_err_t playlist_add(const char *path);
 
-// Advance to next track, returns new path (wraps around)
-const char* playlist_next(void);
+// Remove a file. Tracks after it move up one; the current track stays
+// current, or its successor does if it was the one removed.
+esp_err_t playlist_remove(const char *path);
 
-// Go to previous track, returns new path (wraps around)
-const char* playlist_prev(void);
+// Rename a file in place, keeping its position. Call after the storage
+// cache has seen the rename: a new path that the cache doesn't list as
+// audio (other extension, moved into a subdirectory) removes the track,
+// and an old path that wasn't a track adds one.
+esp_err_t playlist_rename(const char *old_path, const char *new_path);
 
-// Jump to specific track by index, returns path or NULL if invalid
-const char* playlist_select(int index);
+// All functions may be called from any task. Track paths are copied into
+// the caller's buffer (PLAYLIST_MAX_PATH_LEN bytes holds any of them)
+// while the playlist is locked, so another task's edit can't change them.
+
+// Copy the current track path. ESP_ERR_NOT_FOUND if the playlist is empty.
+esp_err_t playlist_get_current(char *path, size_t len);
+
+// Advance to the next track (wraps around) and copy its path
+esp_err_t playlist_next(char *path, size_t len);
+
+// Go to the previous track (wraps around) and copy its path
+esp_err_t playlist_prev(char *path, size_t len);
+
+// Jump to a track by index and copy its path. ESP_ERR_NOT_FOUND if the
+// index is out of range.
+esp_err_t playlist_select(int index, char *path, size_t len);
 
 // Get playlist info
 int playlist_get_count(void);
@@ -10,6 +10,7 @@
 #include <esp_adc/adc_cali.h>
 #include "esp_adc/adc_cali_scheme.h"
 #include "Power/power.h"
+#include "Status/device_status.h"
 
 #define power_detected_pin GPIO_NUM_11
 #define charge_detected_pin GPIO_NUM_12
@@ -96,6 +97,9 @@ void init_power_measurement(){
     }
     xSemaphoreGive(power_semaphore);
     ESP_LOGI(TAG, "Power measurement initialized successfully.");
+
+    // Seed device status so readers have a value before the first poll
+    power_sample();
 }
 
 bool is_battery_charging(){
@@ -136,9 +140,7 @@ uint16_t get_bat_voltage(){
     return voltage*2;
 }
 
-uint8_t get_battery_percent(void) {
-    uint16_t voltage_mv = get_bat_voltage();
-
+static uint8_t percent_from_voltage(uint16_t voltage_mv) {
     // Clamp to valid range
     if (voltage_mv >= BATTERY_VOLTAGE_FULL) {
         return 100;
@@ -156,4 +158,18 @@ uint8_t get_battery_percent(void) {
     return percent;
 }
 
+uint8_t get_battery_percent(void) {
+    return percent_from_voltage(get_bat_voltage());
+}
+
+uint16_t power_sample(void) {
+    uint16_t voltage_mv = get_bat_voltage();
+    bool charging = is_battery_charging();
+    bool power_detected = is_power_detected();
+
+    device_status_set_power(voltage_mv, percent_from_voltage(voltage_mv),
+                            charging, power_detected);
+    return voltage_mv;
+}
+
 
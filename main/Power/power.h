@@ -21,6 +21,10 @@ uint16_t get_bat_voltage(void);
 // Get battery level as percentage (0-100)
 uint8_t get_battery_percent(void);
 
+// Read voltage, charging and external power once and publish them to
+// device status. Returns the voltage in mV. Blocks ~50 ms on the ADC.
+uint16_t power_sample(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,107 @@
+#include <string.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+
+#include "device_status.h"
+
+static const char *TAG = "DeviceStatus";
+
+static device_status_t status = {0};
+static device_status_cb_t listener = NULL;
+
+// Publishers run on several tasks; the state is small enough for a spinlock
+static portMUX_TYPE status_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// ============ Internal Functions ============
+
+static void notify_listener(uint32_t changed) {
+    device_status_cb_t cb = listener;
+    if (changed && cb) {
+        cb(changed);
+    }
+}
+
+// ============ Public Functions ============
+
+void device_status_set_audio_state(uint8_t state) {
+    uint32_t changed = 0;
+
+    taskENTER_CRITICAL(&status_lock);
+    if (status.audio_state != state) {
+        status.audio_state = state;
+        changed = DEVICE_STATUS_AUDIO;
+    }
+    taskEXIT_CRITICAL(&status_lock);
+
+    notify_listener(changed);
+}
+
+void device_status_set_volume(uint8_t level) {
+    uint32_t changed = 0;
+
+    taskENTER_CRITICAL(&status_lock);
+    if (status.volume_level != level) {
+        status.volume_level = level;
+        changed = DEVICE_STATUS_VOLUME;
+    }
+    taskEXIT_CRITICAL(&status_lock);
+
+    notify_listener(changed);
+}
+
+void device_status_set_track(uint16_t index, uint16_t count) {
+    uint32_t changed = 0;
+
+    taskENTER_CRITICAL(&status_lock);
+    if (status.track_index != index || status.track_count != count) {
+        status.track_index = index;
+        status.track_count = count;
+        changed = DEVICE_STATUS_TRACK;
+    }
+    taskEXIT_CRITICAL(&status_lock);
+
+    notify_listener(changed);
+}
+
+void device_status_set_power(uint16_t battery_mv, uint8_t battery_percent,
+                             bool is_charging, bool power_detected) {
+    uint32_t changed = 0;
+    uint8_t step = (battery_percent + DEVICE_STATUS_BATTERY_STEP / 2) /
+                   DEVICE_STATUS_BATTERY_STEP * DEVICE_STATUS_BATTERY_STEP;
+    if (step > 100) {
+        step = 100;
+    }
+
+    taskENTER_CRITICAL(&status_lock);
+    status.battery_mv = battery_mv;
+    if (status.battery_percent != step) {
+        status.battery_percent = step;
+        changed |= DEVICE_STATUS_BATTERY;
+    }
+    if (status.is_charging != is_charging || status.power_detected != power_detected) {
+        status.is_charging = is_charging;
+        status.power_detected = power_detected;
+        changed |= DEVICE_STATUS_POWER;
+    }
+    taskEXIT_CRITICAL(&status_lock);
+
+    if (changed) {
+        ESP_LOGD(TAG, "Power: %u%% (%u mV), charging=%d, external=%d",
+                 step, battery_mv, is_charging, power_detected);
+    }
+    notify_listener(changed);
+}
+
+void device_status_get(device_status_t *out) {
+    if (!out) {
+        return;
+    }
+
+    taskENTER_CRITICAL(&status_lock);
+    *out = status;
+    taskEXIT_CRITICAL(&status_lock);
+}
+
+void device_status_set_listener(device_status_cb_t callback) {
+    listener = callback;
+}
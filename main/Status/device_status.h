@@ -0,0 +1,58 @@
+#ifndef DEVICE_STATUS_H
+#define DEVICE_STATUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Latest device state, published by the modules that own each field.
+// Readers get the cached copy and never touch the hardware, and one
+// listener is told which fields changed.
+
+// Battery percent is published in steps of this size so ADC noise
+// doesn't count as a change
+#define DEVICE_STATUS_BATTERY_STEP  5
+
+// Changed-field bits
+#define DEVICE_STATUS_AUDIO         (1 << 0)
+#define DEVICE_STATUS_VOLUME        (1 << 1)
+#define DEVICE_STATUS_TRACK         (1 << 2)  // Index or count
+#define DEVICE_STATUS_BATTERY       (1 << 3)  // Percent step
+#define DEVICE_STATUS_POWER         (1 << 4)  // Charging or external power
+
+typedef struct {
+    uint8_t audio_state;        // audio_state_t
+    uint8_t volume_level;       // volume_level_t
+    uint16_t track_index;       // Current playlist index
+    uint16_t track_count;
+    uint8_t battery_percent;    // Multiple of DEVICE_STATUS_BATTERY_STEP
+    uint16_t battery_mv;        // Last sample (not a tracked change)
+    bool is_charging;
+    bool power_detected;
+} device_status_t;
+
+// Called with the DEVICE_STATUS_* bits that changed, from the
+// publishing task. Keep it short.
+typedef void (*device_status_cb_t)(uint32_t changed);
+
+// Publishers
+void device_status_set_audio_state(uint8_t state);
+void device_status_set_volume(uint8_t level);
+void device_status_set_track(uint16_t index, uint16_t count);
+void device_status_set_power(uint16_t battery_mv, uint8_t battery_percent,
+                             bool is_charging, bool power_detected);
+
+// Copy of the current state
+void device_status_get(device_status_t *status);
+
+// Set the change listener (NULL to clear)
+void device_status_set_listener(device_status_cb_t callback);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DEVICE_STATUS_H
@@ -11,6 +11,7 @@
 #include <driver/gpio.h>
 
 #include "storage.h"
+#include "storage_worker.h"
 
 static const char *TAG = "Storage : ";
 static const char *base_path ="/Storage";
@@ -23,6 +24,7 @@ static const char *base_path ="/Storage";
 #define NAND_SPI_HD_PIN GPIO_NUM_42
 
 bool is_nand_flash_initialized = false;
+static bool is_storage_mounted = false;
 
 void init_nand_flash(spi_nand_flash_device_t **out_handle, spi_device_handle_t *out_spi_handle) {
     ESP_LOGI(TAG, "Initializing NAND flash...");
@@ -140,6 +142,17 @@ void mount_storage() {
         return;
     }
     ESP_LOGI(TAG, "Storage mounted successfully at %s", base_path);
+    is_storage_mounted = true;
+
+    storage_cache_load(base_path);
+
+    if (storage_worker_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start storage worker");
+    }
+}
+
+bool storage_is_mounted(void) {
+    return is_storage_mounted;
 }
 
 void get_storage_info(size_t *total_size, size_t *used_size, size_t *free_size) {
@@ -178,40 +191,51 @@ void get_base_path(char *path, size_t size) {
     ESP_LOGI(TAG, "Base path: %s", path);
 }
 
+// Adapts cache iteration to the path-based scan callback
+typedef struct {
+    storage_scan_cb_t callback;
+    void *user_data;
+    int count;
+} scan_ctx_t;
+
+static void scan_entry_callback(const storage_entry_t *entry, void *user_data) {
+    scan_ctx_t *ctx = (scan_ctx_t *)user_data;
+    if (!entry->meta.is_audio) {
+        return;
+    }
+
+    char full_path[300];
+    snprintf(full_path, sizeof(full_path), "%s/%s", base_path, entry->name);
+    ctx->callback(full_path, ctx->user_data);
+    ctx->count++;
+}
+
 esp_err_t storage_scan_audio_files(storage_scan_cb_t callback, void *user_data) {
     if (!callback) {
         ESP_LOGE(TAG, "Invalid callback");
         return ESP_ERR_INVALID_ARG;
     }
 
-    DIR *dir = opendir(base_path);
-    if (!dir) {
-        ESP_LOGE(TAG, "Failed to open directory: %s", base_path);
+    scan_ctx_t ctx = {
+        .callback = callback,
+        .user_data = user_data,
+    };
+    esp_err_t ret = storage_cache_foreach(scan_entry_callback, &ctx);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Storage cache not loaded");
         return ESP_FAIL;
     }
 
-    struct dirent *entry;
-    char full_path[300];
-    int file_count = 0;
-
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip directories
-        if (entry->d_type == DT_DIR) {
-            continue;
-        }
+    ESP_LOGD(TAG, "Scanned %d audio files", ctx.count);
+    return ESP_OK;
+}
 
-        // Check for .aac extension (case insensitive)
-        const char *ext = strrchr(entry->d_name, '.');
-        if (ext && (strcasecmp(ext, ".aac") == 0)) {
-            snprintf(full_path, sizeof(full_path), "%s/%s", base_path, entry->d_name);
-            callback(full_path, user_data);
-            file_count++;
-        }
+static void max_number_callback(const storage_entry_t *entry, void *user_data) {
+    int *max_num = (int *)user_data;
+    int num = storage_recording_number(entry->name);
+    if (num > *max_num) {
+        *max_num = num;
     }
-
-    closedir(dir);
-    ESP_LOGI(TAG, "Scanned %d audio files", file_count);
-    return ESP_OK;
 }
 
 esp_err_t storage_generate_recording_path(char *path_buf, size_t buf_size) {
@@ -220,31 +244,32 @@ esp_err_t storage_generate_recording_path(char *path_buf, size_t buf_size) {
         return ESP_ERR_INVALID_ARG;
     }
 
+    // Cache not loaded counts as an empty directory - start at 0001
     int max_num = 0;
+    storage_cache_foreach(max_number_callback, &max_num);
 
-    DIR *dir = opendir(base_path);
-    if (!dir) {
-        // Directory doesn't exist or error - start at 0001
-        snprintf(path_buf, buf_size, "%s/recording_0001.aac", base_path);
-        ESP_LOGI(TAG, "Generated recording path: %s", path_buf);
-        return ESP_OK;
+    snprintf(path_buf, buf_size, "%s/recording_%04d.aac", base_path, max_num + 1);
+    ESP_LOGI(TAG, "Generated recording path: %s", path_buf);
+    return ESP_OK;
+}
+
+int storage_recording_number(const char *filename) {
+    int num;
+    // Match pattern: recording_NNNN.aac
+    if (filename && sscanf(filename, "recording_%d.aac", &num) == 1 && num >= 0) {
+        return num;
     }
+    return -1;
+}
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        int num;
-        // Match pattern: recording_NNNN.aac
-        if (sscanf(entry->d_name, "recording_%d.aac", &num) == 1) {
-            if (num > max_num) {
-                max_num = num;
-            }
-        }
+bool storage_is_audio_file(const char *path) {
+    if (!path) {
+        return false;
     }
-    closedir(dir);
 
-    snprintf(path_buf, buf_size, "%s/recording_%04d.aac", base_path, max_num + 1);
-    ESP_LOGI(TAG, "Generated recording path: %s", path_buf);
-    return ESP_OK;
+    // Check for .aac extension (case insensitive)
+    const char *ext = strrchr(path, '.');
+    return ext && (strcasecmp(ext, ".aac") == 0);
 }
 
 bool storage_file_exists(const char *path) {
@@ -256,6 +281,36 @@ bool storage_file_exists(const char *path) {
     return (stat(path, &st) == 0);
 }
 
+esp_err_t storage_delete_file(const char *path) {
+    if (!path) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (unlink(path) != 0) {
+        return ESP_FAIL;
+    }
+
+    storage_cache_remove(path);
+    return ESP_OK;
+}
+
+esp_err_t storage_rename_file(const char *old_path, const char *new_path) {
+    if (!old_path || !new_path) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (rename(old_path, new_path) != 0) {
+        return ESP_FAIL;
+    }
+
+    storage_cache_rename(old_path, new_path);
+    return ESP_OK;
+}
+
+void storage_file_written(const char *path) {
+    storage_cache_refresh(path);
+}
+
 esp_err_t storage_delete_all_files(void) {
     ESP_LOGW(TAG, "Deleting all files in storage...");
 
@@ -278,7 +333,7 @@ esp_err_t storage_delete_all_files(void) {
 
         snprintf(full_path, sizeof(full_path), "%s/%s", base_path, entry->d_name);
 
-        if (unlink(full_path) == 0) {
+        if (storage_delete_file(full_path) == ESP_OK) {
             ESP_LOGI(TAG, "Deleted: %s", entry->d_name);
             deleted_count++;
         } else {
@@ -5,12 +5,15 @@
 #include <stdbool.h>
 #include <esp_err.h>
 
+#include "storage_cache.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 // Existing functions
 void mount_storage(void);
+bool storage_is_mounted(void);
 void get_base_path(char *path, size_t size);
 void get_storage_info(size_t *total_size, size_t *used_size, size_t *free_size);
 void print_storage_info(void);
@@ -18,15 +21,33 @@ void print_storage_info(void);
 // Callback for file scanning
 typedef void (*storage_scan_cb_t)(const char *file_path, void *user_data);
 
-// Scan storage for audio files (.wav) and call callback for each
+// Call callback for each audio file (.aac) in the metadata cache
 esp_err_t storage_scan_audio_files(storage_scan_cb_t callback, void *user_data);
 
-// Generate unique recording filename (sequential: recording_0001.wav, etc.)
+// Generate unique recording filename (sequential: recording_0001.aac, etc.)
 esp_err_t storage_generate_recording_path(char *path_buf, size_t buf_size);
 
+// Recording number of a recording_NNNN.aac filename, or -1 for other files
+int storage_recording_number(const char *filename);
+
+// Check if a path names an audio file (.aac, case insensitive)
+bool storage_is_audio_file(const char *path);
+
 // Check if a file exists
 bool storage_file_exists(const char *path);
 
+// Mutations. Anything that changes /Storage goes through these so the
+// metadata cache stays in step with the flash.
+
+// Delete a file
+esp_err_t storage_delete_file(const char *path);
+
+// Rename a file
+esp_err_t storage_rename_file(const char *old_path, const char *new_path);
+
+// A file was created or rewritten and closed
+void storage_file_written(const char *path);
+
 // Delete all files in storage (for debugging)
 esp_err_t storage_delete_all_files(void);
 
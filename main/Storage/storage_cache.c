@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_rom_crc.h>
+
+#include "storage_cache.h"
+#include "storage_journal.h"
+#include "storage.h"
+
+static const char *TAG = "StorageCache";
+
+// Initial entry capacity (grown by doubling)
+#define CACHE_INIT_ENTRIES 64
+
+// Cached entry; the name is a separate PSRAM allocation
+typedef struct {
+    char *name;
+    storage_meta_t meta;
+} cache_entry_t;
+
+static cache_entry_t *entries = NULL;
+static int entry_count = 0;
+static int entry_capacity = 0;
+static char cache_dir[32] = {0};
+static size_t cache_dir_len = 0;
+
+// Order-independent summary of names, sizes and mtimes (sum of per-entry
+// hashes), kept with the journal generation to spot unjournaled changes.
+// Like the journal it covers audio files only, the set the file list sends.
+static uint32_t cache_fingerprint = 0;
+
+// Recursive so foreach callbacks can call storage_cache_get()
+static SemaphoreHandle_t cache_mutex = NULL;
+
+// ============ Internal Functions ============
+
+static bool cache_lock(void) {
+    if (cache_mutex == NULL) {
+        return false;
+    }
+    xSemaphoreTakeRecursive(cache_mutex, portMAX_DELAY);
+    return true;
+}
+
+static void cache_unlock(void) {
+    xSemaphoreGiveRecursive(cache_mutex);
+}
+
+// Filename of a path directly inside the cached directory, or NULL
+static const char *cache_name_of(const char *path) {
+    if (!path || cache_dir_len == 0 ||
+        strncmp(path, cache_dir, cache_dir_len) != 0 || path[cache_dir_len] != '/') {
+        return NULL;
+    }
+
+    const char *name = path + cache_dir_len + 1;
+    if (*name == '\0' || strchr(name, '/')) {
+        return NULL;
+    }
+    return name;
+}
+
+static int cache_find(const char *name) {
+    for (int i = 0; i < entry_count; i++) {
+        if (strcmp(entries[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static uint32_t entry_hash(const char *name, const storage_meta_t *meta) {
+    if (!meta->is_audio) {
+        return 0;
+    }
+    uint32_t h = esp_rom_crc32_le(0, (const uint8_t *)name, strlen(name));
+    h = esp_rom_crc32_le(h, (const uint8_t *)&meta->size, sizeof(meta->size));
+    uint32_t mtime = (uint32_t)meta->mtime;
+    return esp_rom_crc32_le(h, (const uint8_t *)&mtime, sizeof(mtime));
+}
+
+static void meta_from_stat(storage_meta_t *meta, const char *name, const struct stat *st) {
+    memset(meta, 0, sizeof(*meta));
+    meta->size = st->st_size;
+    meta->mtime = st->st_mtime;
+    meta->type = S_ISDIR(st->st_mode) ? STORAGE_ENTRY_DIRECTORY : STORAGE_ENTRY_FILE;
+    meta->is_audio = (meta->type == STORAGE_ENTRY_FILE) && storage_is_audio_file(name);
+}
+
+// Journal a change to name, given its metadata before and after (NULL if
+// absent). Only audio files are journaled, so a delta sync replays exactly
+// what a full listing would show; a rename away from .aac is a delete.
+static void journal_change(const char *name, const storage_meta_t *before,
+                           const storage_meta_t *after) {
+    if (after && after->is_audio) {
+        storage_journal_record(STORAGE_CHANGE_ADD, name, after->size, cache_fingerprint);
+    } else if (before && before->is_audio) {
+        storage_journal_record(STORAGE_CHANGE_DELETE, name, 0, cache_fingerprint);
+    }
+}
+
+static char *name_dup(const char *name) {
+    size_t len = strlen(name) + 1;
+    char *copy = heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (copy) {
+        memcpy(copy, name, len);
+    }
+    return copy;
+}
+
+// Append an entry (caller holds the lock)
+static esp_err_t cache_append(const char *name, const storage_meta_t *meta) {
+    if (entry_count == entry_capacity) {
+        int capacity = entry_capacity ? entry_capacity * 2 : CACHE_INIT_ENTRIES;
+        cache_entry_t *grown = heap_caps_realloc(entries, capacity * sizeof(cache_entry_t),
+                                                 MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!grown) {
+            return ESP_ERR_NO_MEM;
+        }
+        entries = grown;
+        entry_capacity = capacity;
+    }
+
+    char *copy = name_dup(name);
+    if (!copy) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    entries[entry_count].name = copy;
+    entries[entry_count].meta = *meta;
+    entry_count++;
+    cache_fingerprint += entry_hash(name, meta);
+    return ESP_OK;
+}
+
+// Remove an entry, keeping directory order (caller holds the lock)
+static void cache_delete(int index) {
+    cache_fingerprint -= entry_hash(entries[index].name, &entries[index].meta);
+    heap_caps_free(entries[index].name);
+    memmove(&entries[index], &entries[index + 1],
+            (entry_count - index - 1) * sizeof(cache_entry_t));
+    entry_count--;
+}
+
+// ============ Public Functions ============
+
+esp_err_t storage_cache_load(const char *dir_path) {
+    if (cache_mutex == NULL) {
+        cache_mutex = xSemaphoreCreateRecursiveMutex();
+        if (cache_mutex == NULL) {
+            ESP_LOGE(TAG, "Failed to create cache mutex");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    cache_lock();
+
+    while (entry_count > 0) {
+        heap_caps_free(entries[--entry_count].name);
+    }
+    cache_fingerprint = 0;
+    snprintf(cache_dir, sizeof(cache_dir), "%s", dir_path);
+    cache_dir_len = strlen(cache_dir);
+
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        cache_unlock();
+        ESP_LOGE(TAG, "Failed to open directory: %s", dir_path);
+        return ESP_FAIL;
+    }
+
+    struct dirent *de;
+    struct stat st;
+    char full_path[300];
+    storage_meta_t meta;
+    esp_err_t ret = ESP_OK;
+
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+
+        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, de->d_name);
+        if (stat(full_path, &st) != 0) {
+            continue;
+        }
+
+        meta_from_stat(&meta, de->d_name, &st);
+        ret = cache_append(de->d_name, &meta);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Out of memory after %d entries", entry_count);
+            break;
+        }
+    }
+    closedir(dir);
+
+    cache_unlock();
+
+    storage_journal_init(cache_fingerprint);
+
+    ESP_LOGI(TAG, "Cached %d entries", entry_count);
+    return ret;
+}
+
+esp_err_t storage_cache_foreach(storage_entry_cb_t callback, void *user_data) {
+    if (!callback) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!cache_lock()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    storage_entry_t entry;
+    for (int i = 0; i < entry_count; i++) {
+        entry.name = entries[i].name;
+        entry.meta = entries[i].meta;
+        callback(&entry, user_data);
+    }
+
+    cache_unlock();
+    return ESP_OK;
+}
+
+esp_err_t storage_cache_get(const char *path, storage_meta_t *meta) {
+    const char *name = cache_name_of(path);
+    if (!name || !cache_lock()) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    int index = cache_find(name);
+    if (index >= 0 && meta) {
+        *meta = entries[index].meta;
+    }
+
+    cache_unlock();
+    return (index >= 0) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+int storage_cache_count(void) {
+    return entry_count;
+}
+
+void storage_cache_refresh(const char *path) {
+    const char *name = cache_name_of(path);
+    if (!name || !cache_lock()) {
+        return;
+    }
+
+    struct stat st;
+    int index = cache_find(name);
+
+    if (stat(path, &st) != 0) {
+        if (index >= 0) {
+            storage_meta_t before = entries[index].meta;
+            cache_delete(index);
+            journal_change(name, &before, NULL);
+        }
+    } else if (index >= 0) {
+        storage_meta_t before = entries[index].meta;
+        cache_fingerprint -= entry_hash(name, &before);
+        meta_from_stat(&entries[index].meta, name, &st);
+        cache_fingerprint += entry_hash(name, &entries[index].meta);
+        journal_change(name, &before, &entries[index].meta);
+    } else {
+        storage_meta_t meta;
+        meta_from_stat(&meta, name, &st);
+        if (cache_append(name, &meta) != ESP_OK) {
+            ESP_LOGE(TAG, "Out of memory caching %s", name);
+        }
+        journal_change(name, NULL, &meta);
+    }
+
+    cache_unlock();
+}
+
+void storage_cache_remove(const char *path) {
+    const char *name = cache_name_of(path);
+    if (!name || !cache_lock()) {
+        return;
+    }
+
+    int index = cache_find(name);
+    if (index >= 0) {
+        storage_meta_t before = entries[index].meta;
+        cache_delete(index);
+        journal_change(name, &before, NULL);
+    }
+
+    cache_unlock();
+}
+
+void storage_cache_rename(const char *old_path, const char *new_path) {
+    const char *old_name = cache_name_of(old_path);
+    const char *new_name = cache_name_of(new_path);
+    if (!cache_lock()) {
+        return;
+    }
+
+    int index = old_name ? cache_find(old_name) : -1;
+    char *copy = new_name ? name_dup(new_name) : NULL;
+
+    if (index >= 0 && copy) {
+        // Renaming over an existing file replaces it
+        int existing = cache_find(new_name);
+        if (existing >= 0 && existing != index) {
+            cache_delete(existing);
+            if (existing < index) {
+                index--;
+            }
+        }
+        cache_entry_t *e = &entries[index];
+        cache_fingerprint -= entry_hash(e->name, &e->meta);
+        journal_change(e->name, &e->meta, NULL);
+
+        heap_caps_free(e->name);
+        e->name = copy;
+        e->meta.is_audio = (e->meta.type == STORAGE_ENTRY_FILE) && storage_is_audio_file(new_name);
+        cache_fingerprint += entry_hash(e->name, &e->meta);
+        journal_change(e->name, NULL, &e->meta);
+    } else {
+        // Moved in or out of the cached directory
+        heap_caps_free(copy);
+        if (index >= 0) {
+            storage_meta_t before = entries[index].meta;
+            cache_delete(index);
+            journal_change(old_name, &before, NULL);
+        }
+        if (new_name) {
+            storage_cache_refresh(new_path);
+        }
+    }
+
+    cache_unlock();
+}
+
+void storage_cache_set_duration(const char *path, uint32_t duration_ms) {
+    const char *name = cache_name_of(path);
+    if (!name || !cache_lock()) {
+        return;
+    }
+
+    int index = cache_find(name);
+    if (index >= 0) {
+        entries[index].meta.duration_ms = duration_ms;
+    }
+
+    cache_unlock();
+}
+
+void storage_cache_set_hash(const char *path, const uint8_t sha256[STORAGE_HASH_SIZE]) {
+    const char *name = cache_name_of(path);
+    if (!name || !cache_lock()) {
+        return;
+    }
+
+    int index = cache_find(name);
+    if (index >= 0) {
+        memcpy(entries[index].meta.sha256, sha256, STORAGE_HASH_SIZE);
+        entries[index].meta.has_hash = true;
+    }
+
+    cache_unlock();
+}
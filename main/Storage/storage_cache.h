@@ -0,0 +1,77 @@
+#ifndef STORAGE_CACHE_H
+#define STORAGE_CACHE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// In-RAM metadata for the top level of /Storage. Loaded once at mount
+// and kept current by the mutation functions in storage.h, so listings
+// never walk the flash. Subdirectories show up as entries but their
+// contents are not cached.
+
+#define STORAGE_HASH_SIZE 32
+
+// Entry types
+#define STORAGE_ENTRY_FILE      0
+#define STORAGE_ENTRY_DIRECTORY 1
+
+// Metadata of one cached file
+typedef struct {
+    uint32_t size;
+    time_t mtime;
+    uint8_t type;                       // STORAGE_ENTRY_*
+    bool is_audio;                      // storage_is_audio_file()
+    uint32_t duration_ms;               // 0 = unknown (set by the recorder)
+    bool has_hash;                      // sha256 is valid
+    uint8_t sha256[STORAGE_HASH_SIZE];  // Whole-file SHA-256 (set by BLE transfers)
+} storage_meta_t;
+
+typedef struct {
+    const char *name;                   // Filename only, no path
+    storage_meta_t meta;
+} storage_entry_t;
+
+// Callback for cache iteration
+typedef void (*storage_entry_cb_t)(const storage_entry_t *entry, void *user_data);
+
+// Scan dir_path once and build the cache (called from mount_storage)
+esp_err_t storage_cache_load(const char *dir_path);
+
+// Call callback for each entry in directory order. The cache stays locked
+// until it returns, so callbacks must not modify storage.
+esp_err_t storage_cache_foreach(storage_entry_cb_t callback, void *user_data);
+
+// Look up one file by full path (ESP_ERR_NOT_FOUND if not cached)
+esp_err_t storage_cache_get(const char *path, storage_meta_t *meta);
+
+// Number of cached entries
+int storage_cache_count(void);
+
+// Re-stat one file and add, update or drop its entry. Clears the
+// duration and hash, which no longer describe the new contents.
+void storage_cache_refresh(const char *path);
+
+// Drop one entry
+void storage_cache_remove(const char *path);
+
+// Move an entry to a new name, keeping its metadata
+void storage_cache_rename(const char *old_path, const char *new_path);
+
+// Record the playback length of a file
+void storage_cache_set_duration(const char *path, uint32_t duration_ms);
+
+// Record the SHA-256 of a file's current contents
+void storage_cache_set_hash(const char *path, const uint8_t sha256[STORAGE_HASH_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STORAGE_CACHE_H
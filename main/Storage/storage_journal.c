@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_heap_caps.h>
+#include <nvs_flash.h>
+#include <nvs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "storage_journal.h"
+
+static const char *TAG = "StorageJournal";
+
+// NVS namespace and keys
+#define NVS_NAMESPACE   "storage"
+#define NVS_KEY_EPOCH   "epoch"
+#define NVS_KEY_GEN     "gen"
+#define NVS_KEY_FP      "fp"
+
+// Ring of the most recent changes (PSRAM)
+static storage_change_t *journal = NULL;
+static int journal_head = 0;
+static int journal_len = 0;
+
+// Every change after journal_base is in the ring
+static uint32_t journal_base = 0;
+static uint32_t epoch = 0;
+static uint32_t generation = 0;
+
+// Open batches, and the fingerprint to save when the last one ends
+static int batch_depth = 0;
+static bool batch_dirty = false;
+static uint32_t batch_fingerprint = 0;
+
+static SemaphoreHandle_t journal_mutex = NULL;
+
+// ============ Internal Functions ============
+
+static esp_err_t journal_save(uint32_t fingerprint) {
+    nvs_handle_t handle;
+    esp_err_t err;
+
+    err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    err = nvs_set_u32(handle, NVS_KEY_EPOCH, epoch);
+    if (err == ESP_OK) {
+        err = nvs_set_u32(handle, NVS_KEY_GEN, generation);
+    }
+    if (err == ESP_OK) {
+        err = nvs_set_u32(handle, NVS_KEY_FP, fingerprint);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save generation %lu: %s",
+                 (unsigned long)generation, esp_err_to_name(err));
+    }
+
+    nvs_close(handle);
+    return err;
+}
+
+// ============ Public Functions ============
+
+esp_err_t storage_journal_init(uint32_t fingerprint) {
+    if (journal_mutex == NULL) {
+        journal_mutex = xSemaphoreCreateMutex();
+        journal = heap_caps_calloc(STORAGE_JOURNAL_SIZE, sizeof(storage_change_t),
+                                   MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (journal_mutex == NULL || journal == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate journal");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    xSemaphoreTake(journal_mutex, portMAX_DELAY);
+
+    nvs_handle_t handle;
+    uint32_t saved_fp = 0;
+    bool restored = false;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        restored = nvs_get_u32(handle, NVS_KEY_EPOCH, &epoch) == ESP_OK &&
+                   nvs_get_u32(handle, NVS_KEY_GEN, &generation) == ESP_OK &&
+                   nvs_get_u32(handle, NVS_KEY_FP, &saved_fp) == ESP_OK;
+        nvs_close(handle);
+    }
+
+    esp_err_t err = ESP_OK;
+    if (!restored) {
+        // Epoch 0 is reserved for clients that have never synced
+        do {
+            epoch = esp_random();
+        } while (epoch == 0);
+        generation = 1;
+        ESP_LOGI(TAG, "New storage epoch %08lx", (unsigned long)epoch);
+        err = journal_save(fingerprint);
+    } else if (saved_fp != fingerprint) {
+        generation++;
+        ESP_LOGW(TAG, "Storage changed outside the journal, generation bumped");
+        err = journal_save(fingerprint);
+    }
+
+    journal_head = 0;
+    journal_len = 0;
+    journal_base = generation;
+
+    xSemaphoreGive(journal_mutex);
+
+    ESP_LOGI(TAG, "Storage generation %lu (epoch %08lx)",
+             (unsigned long)generation, (unsigned long)epoch);
+    return err;
+}
+
+void storage_journal_record(uint8_t op, const char *name, uint32_t size, uint32_t fingerprint) {
+    if (journal_mutex == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(journal_mutex, portMAX_DELAY);
+
+    generation++;
+
+    if (strlen(name) >= STORAGE_JOURNAL_NAME_LEN) {
+        // Can't describe this change; anyone behind it must resync
+        journal_base = generation;
+    } else {
+        if (journal_len == STORAGE_JOURNAL_SIZE) {
+            journal_base = journal[journal_head].generation;
+            journal_head = (journal_head + 1) % STORAGE_JOURNAL_SIZE;
+            journal_len--;
+        }
+
+        storage_change_t *change = &journal[(journal_head + journal_len) % STORAGE_JOURNAL_SIZE];
+        change->generation = generation;
+        change->op = op;
+        change->size = size;
+        strcpy(change->name, name);
+        journal_len++;
+    }
+
+    if (batch_depth > 0) {
+        batch_dirty = true;
+        batch_fingerprint = fingerprint;
+    } else {
+        journal_save(fingerprint);
+    }
+
+    ESP_LOGD(TAG, "Generation %lu: %s %s", (unsigned long)generation,
+             (op == STORAGE_CHANGE_DELETE) ? "delete" : "add", name);
+
+    xSemaphoreGive(journal_mutex);
+}
+
+void storage_journal_batch_begin(void) {
+    if (journal_mutex == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(journal_mutex, portMAX_DELAY);
+    batch_depth++;
+    xSemaphoreGive(journal_mutex);
+}
+
+void storage_journal_batch_end(void) {
+    if (journal_mutex == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(journal_mutex, portMAX_DELAY);
+    if (batch_depth > 0 && --batch_depth == 0 && batch_dirty) {
+        batch_dirty = false;
+        journal_save(batch_fingerprint);
+    }
+    xSemaphoreGive(journal_mutex);
+}
+
+void storage_journal_get(uint32_t *out_epoch, uint32_t *out_generation) {
+    if (journal_mutex) {
+        xSemaphoreTake(journal_mutex, portMAX_DELAY);
+    }
+    if (out_epoch) {
+        *out_epoch = epoch;
+    }
+    if (out_generation) {
+        *out_generation = generation;
+    }
+    if (journal_mutex) {
+        xSemaphoreGive(journal_mutex);
+    }
+}
+
+esp_err_t storage_journal_since(uint32_t client_epoch, uint32_t client_generation,
+                                uint32_t *current, storage_change_cb_t callback,
+                                void *user_data) {
+    if (journal_mutex == NULL || !callback) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(journal_mutex, portMAX_DELAY);
+
+    if (current) {
+        *current = generation;
+    }
+
+    if (client_epoch != epoch || client_generation < journal_base ||
+        client_generation > generation) {
+        xSemaphoreGive(journal_mutex);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    for (int i = 0; i < journal_len; i++) {
+        const storage_change_t *change = &journal[(journal_head + i) % STORAGE_JOURNAL_SIZE];
+        if (change->generation > client_generation) {
+            callback(change, user_data);
+        }
+    }
+
+    xSemaphoreGive(journal_mutex);
+    return ESP_OK;
+}
@@ -0,0 +1,70 @@
+#ifndef STORAGE_JOURNAL_H
+#define STORAGE_JOURNAL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Storage generation counter and change journal. Every add, rewrite,
+// delete or rename of an audio file in /Storage bumps the generation (kept
+// in NVS) and is recorded in a bounded RAM journal, so a client that last
+// synced at generation G can fetch just the changes since G. Other files
+// are not journaled, matching the file list.
+//
+// The epoch is a random id drawn when NVS holds no generation (first boot,
+// NVS erase). A client holding a different epoch has to resync in full.
+
+// Journal capacity; older changes are dropped and force a full resync
+#define STORAGE_JOURNAL_SIZE     64
+#define STORAGE_JOURNAL_NAME_LEN 96
+
+// Change types
+#define STORAGE_CHANGE_ADD    0x00  // Created or rewritten (size is the new size)
+#define STORAGE_CHANGE_DELETE 0x01  // Deleted (size is 0)
+
+typedef struct {
+    uint32_t generation;                    // Generation this change produced
+    uint8_t op;                             // STORAGE_CHANGE_*
+    uint32_t size;
+    char name[STORAGE_JOURNAL_NAME_LEN];    // Filename only, no path
+} storage_change_t;
+
+// Callback for journal replay
+typedef void (*storage_change_cb_t)(const storage_change_t *change, void *user_data);
+
+// Restore epoch and generation from NVS. fingerprint summarizes the audio
+// files as loaded at mount; if it differs from the one saved with the
+// generation, files changed without being journaled (e.g. power loss
+// mid-update) and the generation is bumped.
+esp_err_t storage_journal_init(uint32_t fingerprint);
+
+// Record one change and persist the new generation (called by the cache)
+void storage_journal_record(uint8_t op, const char *name, uint32_t size, uint32_t fingerprint);
+
+// Hold the NVS save of the generation until storage_journal_batch_end(),
+// so a batch of changes costs one flash commit. Changes are still
+// journaled one by one. Nests.
+void storage_journal_batch_begin(void);
+void storage_journal_batch_end(void);
+
+// Current epoch and generation
+void storage_journal_get(uint32_t *epoch, uint32_t *generation);
+
+// Call callback for each change after generation, oldest first. current
+// receives the generation the replay brings the client to; it is set
+// before the first callback. Returns ESP_ERR_NOT_FOUND when the journal
+// no longer reaches back that far (or epoch/generation are not ours) and
+// a full resync is needed instead.
+esp_err_t storage_journal_since(uint32_t epoch, uint32_t generation, uint32_t *current,
+                                storage_change_cb_t callback, void *user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STORAGE_JOURNAL_H
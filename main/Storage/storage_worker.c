@@ -0,0 +1,69 @@
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include "storage_worker.h"
+
+static const char *TAG = "StorageWorker";
+
+#define WORKER_TASK_STACK   4096
+#define WORKER_TASK_PRIO    5
+#define WORKER_QUEUE_LEN    8
+
+typedef struct {
+    storage_work_fn_t fn;
+    void *arg;
+} work_item_t;
+
+static QueueHandle_t work_queue = NULL;
+
+static void worker_task(void *param) {
+    work_item_t item;
+
+    while (true) {
+        if (xQueueReceive(work_queue, &item, portMAX_DELAY) == pdTRUE) {
+            item.fn(item.arg);
+        }
+    }
+}
+
+esp_err_t storage_worker_init(void) {
+    if (work_queue != NULL) {
+        return ESP_OK;
+    }
+
+    work_queue = xQueueCreate(WORKER_QUEUE_LEN, sizeof(work_item_t));
+    if (work_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create work queue");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(worker_task, "storage_worker", WORKER_TASK_STACK, NULL,
+                    WORKER_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create worker task");
+        vQueueDelete(work_queue);
+        work_queue = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t storage_worker_submit(storage_work_fn_t fn, void *arg) {
+    if (!fn) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (work_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    work_item_t item = {
+        .fn = fn,
+        .arg = arg,
+    };
+    if (xQueueSend(work_queue, &item, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Work queue full");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,27 @@
+#ifndef STORAGE_WORKER_H
+#define STORAGE_WORKER_H
+
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Background task for slow filesystem work requested from latency
+// sensitive contexts (BLE callbacks). Work items run one at a time in
+// submission order.
+
+typedef void (*storage_work_fn_t)(void *arg);
+
+// Start the worker task (called from mount_storage)
+esp_err_t storage_worker_init(void);
+
+// Queue fn(arg). Returns ESP_ERR_NO_MEM if the queue is full, in which
+// case fn is not called and arg still belongs to the caller.
+esp_err_t storage_worker_submit(storage_work_fn_t fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STORAGE_WORKER_H
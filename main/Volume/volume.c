@@ -1,4 +1,5 @@
 #include "volume.h"
+#include "../Status/device_status.h"
 #include <nvs_flash.h>
 #include <nvs.h>
 #include <esp_log.h>
@@ -22,12 +23,14 @@ static volume_level_t current_level = VOLUME_MEDIUM;  // Default to 50%
 
 void volume_init(void) {
     current_level = VOLUME_MEDIUM;
+    device_status_set_volume(current_level);
     ESP_LOGI(TAG, "Volume initialized to level %d (%d dB)",
              current_level, volume_raw_values[current_level]);
 }
 
 volume_level_t volume_cycle(void) {
     current_level = (current_level + 1) % 5;  // Cycle through 0-4
+    device_status_set_volume(current_level);
 
     ESP_LOGI(TAG, "Volume cycled to level %d (%d dB)",
              current_level, volume_raw_values[current_level]);
@@ -45,6 +48,7 @@ void volume_set_level(volume_level_t level) {
     }
 
     current_level = level;
+    device_status_set_volume(current_level);
     ESP_LOGI(TAG, "Volume set to level %d (%d dB)",
              current_level, volume_raw_values[current_level]);
 }
@@ -117,6 +121,7 @@ esp_err_t volume_load_from_nvs(void) {
     }
 
     current_level = (volume_level_t)saved_level;
+    device_status_set_volume(current_level);
     ESP_LOGI(TAG, "Volume level %d loaded from NVS (%d dB)",
              current_level, volume_raw_values[current_level]);
 
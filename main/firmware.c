@@ -12,6 +12,7 @@
 #include "Audio/audio.h"
 #include "Volume/volume.h"
 #include "Playlist/playlist.h"
+#include "Status/device_status.h"
 #include "BLE/ble.h"
 #include "Debug/debug_server.h"
 
@@ -80,12 +81,12 @@ void app_main(void)
         print_storage_info();
         vTaskDelay(pdMS_TO_TICKS(10000));
 
-        // Log power status
-        bool charging = is_battery_charging();
-        bool power_detected = is_power_detected();
-        uint16_t vbat_voltage = get_bat_voltage();
-        ESP_LOGI(TAG, "Battery Charging: %s", charging ? "Yes" : "No");
-        ESP_LOGI(TAG, "Power Detected: %s", power_detected ? "Yes" : "No");
+        // Sample power (publishes to device status) and log it
+        uint16_t vbat_voltage = power_sample();
+        device_status_t status;
+        device_status_get(&status);
+        ESP_LOGI(TAG, "Battery Charging: %s", status.is_charging ? "Yes" : "No");
+        ESP_LOGI(TAG, "Power Detected: %s", status.power_detected ? "Yes" : "No");
         ESP_LOGI(TAG, "VBAT Voltage: %d mV", vbat_voltage);
 
         // Log audio state
@@ -0,0 +1,192 @@
+# python script to build and check delta firmware patches for BLE updates
+# a patch rebuilds the new image from the one running on the device, see main/BLE/ble_delta.h for the format
+#
+#   python scripts/make_delta.py create <old.bin> <new.bin> <patch.bin>
+#   python scripts/make_delta.py apply <old.bin> <patch.bin> <out.bin>
+
+import sys
+import struct
+import hashlib
+
+MAGIC = b"MHD1"
+HEADER = struct.Struct("<4sI32sI32s")
+
+OP_COPY = 0x01
+OP_ADD = 0x02
+OP_INSERT = 0x03
+
+# Source index granularity: a match must share BLOCK bytes at a STEP-aligned source offset
+BLOCK = 16
+STEP = 4
+
+# Exact runs shorter than this stay inside an ADD (cheaper than a new op header)
+MIN_COPY = 32
+
+# The device runs a COPY in one go on the BLE host task, keep each short
+MAX_COPY = 16 * 1024
+
+def sha256(data):
+    return hashlib.sha256(data).digest()
+
+def build_index(source):
+    index = {}
+    for i in range(0, len(source) - BLOCK + 1, STEP):
+        index.setdefault(source[i:i + BLOCK], i)
+    return index
+
+# Length of the region starting at source[s] / target[t] worth encoding against the source:
+# exact runs, plus windows where at least half the bytes still match (shifted addresses)
+def extend(source, target, s, t):
+    limit = min(len(source) - s, len(target) - t)
+    n = 0
+    while n < limit:
+        if source[s + n] == target[t + n]:
+            n += 1
+            continue
+        w = min(BLOCK, limit - n)
+        same = sum(1 for i in range(w) if source[s + n + i] == target[t + n + i])
+        if same * 2 < w:
+            break
+        n += w
+    while n > 0 and source[s + n - 1] != target[t + n - 1]:
+        n -= 1
+    return n
+
+def emit_copy(ops, s, length):
+    while length > 0:
+        n = min(length, MAX_COPY)
+        ops.append(struct.pack("<BII", OP_COPY, s, n))
+        s += n
+        length -= n
+
+def emit_add(ops, source, target, s, t, length):
+    if length == 0:
+        return
+    diff = bytes((target[t + i] - source[s + i]) & 0xFF for i in range(length))
+    ops.append(struct.pack("<BII", OP_ADD, s, length) + diff)
+
+def emit_insert(ops, data):
+    if data:
+        ops.append(struct.pack("<BI", OP_INSERT, len(data)) + data)
+
+# Split a matched region into COPY for long exact runs and ADD for the rest
+def emit_region(ops, source, target, s, t, length):
+    add_start = 0
+    i = 0
+    while i < length:
+        if source[s + i] != target[t + i]:
+            i += 1
+            continue
+        run = i
+        while run < length and source[s + run] == target[t + run]:
+            run += 1
+        if run - i >= MIN_COPY:
+            emit_add(ops, source, target, s + add_start, t + add_start, i - add_start)
+            emit_copy(ops, s + i, run - i)
+            add_start = run
+        i = run
+    emit_add(ops, source, target, s + add_start, t + add_start, length - add_start)
+
+def create(source, target):
+    index = build_index(source)
+    ops = []
+    literal = 0
+    t = 0
+
+    while t <= len(target) - BLOCK:
+        s = index.get(target[t:t + BLOCK])
+        if s is None:
+            t += 1
+            continue
+
+        # Take back what the literal run shares with the source
+        while t > literal and s > 0 and source[s - 1] == target[t - 1]:
+            s -= 1
+            t -= 1
+
+        length = extend(source, target, s, t)
+        emit_insert(ops, target[literal:t])
+        emit_region(ops, source, target, s, t, length)
+        t += length
+        literal = t
+
+    emit_insert(ops, target[literal:])
+
+    header = HEADER.pack(MAGIC, len(source), sha256(source), len(target), sha256(target))
+    return header + b"".join(ops)
+
+def apply(source, patch):
+    if len(patch) < HEADER.size:
+        raise ValueError("patch too short")
+    magic, source_size, source_hash, target_size, target_hash = HEADER.unpack_from(patch)
+    if magic != MAGIC:
+        raise ValueError("not a delta patch")
+    if source_size != len(source) or sha256(source) != source_hash:
+        raise ValueError("patch was made for a different source image")
+
+    out = bytearray()
+    p = HEADER.size
+    while p < len(patch):
+        op = patch[p]
+        if op in (OP_COPY, OP_ADD):
+            _, s, length = struct.unpack_from("<BII", patch, p)
+            p += 9
+            if s + length > len(source):
+                raise ValueError(f"op at {p - 9} reads past the source")
+            if op == OP_COPY:
+                out += source[s:s + length]
+            else:
+                out += bytes((source[s + i] + patch[p + i]) & 0xFF for i in range(length))
+                p += length
+        elif op == OP_INSERT:
+            _, length = struct.unpack_from("<BI", patch, p)
+            p += 5
+            out += patch[p:p + length]
+            p += length
+        else:
+            raise ValueError(f"unknown op 0x{op:02x} at {p}")
+        if len(out) > target_size:
+            raise ValueError("patch writes past the target size")
+
+    if len(out) != target_size or sha256(out) != target_hash:
+        raise ValueError("rebuilt image does not match the target digest")
+    return bytes(out)
+
+def read_file(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+def write_file(path, data):
+    with open(path, "wb") as f:
+        f.write(data)
+
+def usage():
+    print("Usage: python scripts/make_delta.py create <old.bin> <new.bin> <patch.bin>")
+    print("       python scripts/make_delta.py apply <old.bin> <patch.bin> <out.bin>")
+    exit(1)
+
+if len(sys.argv) != 5:
+    usage()
+
+command = sys.argv[1]
+source = read_file(sys.argv[2])
+
+try:
+    if command == "create":
+        target = read_file(sys.argv[3])
+        patch = create(source, target)
+        # Check the patch rebuilds the image before handing it out
+        apply(source, patch)
+        write_file(sys.argv[4], patch)
+        print(f"Patch: {len(patch)} bytes for a {len(target)} byte image "
+              f"({len(patch) * 100 // max(len(target), 1)}%)")
+        print(f"Patch SHA-256 (OTA command): {sha256(patch).hex()}")
+    elif command == "apply":
+        target = apply(source, read_file(sys.argv[3]))
+        write_file(sys.argv[4], target)
+        print(f"Rebuilt {len(target)} bytes, SHA-256 {sha256(target).hex()} matches")
+    else:
+        usage()
+except ValueError as e:
+    print(f"Error: {e}")
+    exit(1)
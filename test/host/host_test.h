@@ -0,0 +1,46 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Minimal helpers shared by the host tests; each test is one executable
+// that returns non-zero if any CHECK failed.
+
+static int host_test_failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n",                    \
+                    __FILE__, __LINE__, #cond);                             \
+            host_test_failures++;                                           \
+        }                                                                   \
+    } while (0)
+
+// Deterministic pseudo-random numbers (xorshift32), so runs are repeatable
+static uint32_t host_rand_state = 0x12345678;
+
+static inline uint32_t host_rand(void) {
+    uint32_t x = host_rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    host_rand_state = x;
+    return x;
+}
+
+static inline void host_srand(uint32_t seed) {
+    host_rand_state = seed ? seed : 1;
+}
+
+static inline int host_test_result(void) {
+    if (host_test_failures) {
+        fprintf(stderr, "%d check(s) failed\n", host_test_failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
+
+#endif // HOST_TEST_H
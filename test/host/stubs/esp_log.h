@@ -0,0 +1,16 @@
+#ifndef HOST_STUB_ESP_LOG_H
+#define HOST_STUB_ESP_LOG_H
+
+#include <stdio.h>
+
+// Errors and warnings go to stderr; the rest would drown benchmark output,
+// but still have their format checked and arguments used
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOG_QUIET(tag, fmt, ...) \
+    do { if (0) printf("%s: " fmt "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGI ESP_LOG_QUIET
+#define ESP_LOGD ESP_LOG_QUIET
+#define ESP_LOGV ESP_LOG_QUIET
+
+#endif // HOST_STUB_ESP_LOG_H
@@ -0,0 +1,35 @@
+#ifndef HOST_STUB_SEMPHR_H
+#define HOST_STUB_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+// Tests are single threaded: a mutex only tracks its holding depth
+typedef struct {
+    int depth;
+} host_semaphore_t;
+
+typedef host_semaphore_t *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t host_semaphore_create(void) {
+    static host_semaphore_t pool[8];
+    static int used;
+    return used < 8 ? &pool[used++] : NULL;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+    (void)ticks;
+    s->depth++;
+    return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+    s->depth--;
+    return pdTRUE;
+}
+
+#define xSemaphoreCreateMutex()             host_semaphore_create()
+#define xSemaphoreCreateRecursiveMutex()    host_semaphore_create()
+#define xSemaphoreTakeRecursive(s, t)       xSemaphoreTake(s, t)
+#define xSemaphoreGiveRecursive(s)          xSemaphoreGive(s)
+
+#endif // HOST_STUB_SEMPHR_H
@@ -0,0 +1,263 @@
+// Host test and benchmark for the LZSS codec (main/BLE/ble_compress.c).
+// Round-trips generated audio and metadata files through the encoder and
+// decoder with the chunk sizes the transfer code uses, and prints the ratio
+// and throughput of each so changes to the codec can be compared.
+
+#include "ble_compress.h"
+#include "host_test.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Download path: file reads into the encoder input, notifications out
+#define READ_CHUNK      4096
+#define NOTIFY_CAP      244
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    int fail_after;          // Fail the Nth write, 0 = never
+    int writes;
+} sink_t;
+
+static int sink_write(const uint8_t *data, size_t len, void *arg) {
+    sink_t *s = (sink_t *)arg;
+    if (s->fail_after && ++s->writes >= s->fail_after) {
+        return -1;
+    }
+    if (s->len + len > s->cap) {
+        return -1;
+    }
+    memcpy(s->data + s->len, data, len);
+    s->len += len;
+    return 0;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ============ Sample files ============
+
+// ADTS frames of high-entropy payload, like the recorder's .aac output
+static size_t gen_aac(uint8_t *buf, size_t size) {
+    size_t len = 0;
+    while (len + 7 + 371 <= size) {
+        size_t frame = 7 + 371;
+        static const uint8_t hdr[7] = { 0xFF, 0xF1, 0x50, 0x80, 0x2F, 0x7F, 0xFC };
+        memcpy(buf + len, hdr, sizeof(hdr));
+        for (size_t i = 7; i < frame; i++) {
+            buf[len + i] = (uint8_t)host_rand();
+        }
+        len += frame;
+    }
+    return len;
+}
+
+// 16-bit mono PCM: a tone with some noise, behind a WAV header
+static size_t gen_wav(uint8_t *buf, size_t size) {
+    memset(buf, 0, 44);
+    memcpy(buf, "RIFF", 4);
+    memcpy(buf + 8, "WAVEfmt ", 8);
+    memcpy(buf + 36, "data", 4);
+    size_t len = 44;
+    for (size_t n = 0; len + 2 <= size; n++) {
+        double v = 8000.0 * sin(n * 2.0 * M_PI * 440.0 / 16000.0) + (int)(host_rand() % 64) - 32;
+        int16_t sample = (int16_t)v;
+        buf[len++] = (uint8_t)sample;
+        buf[len++] = (uint8_t)(sample >> 8);
+    }
+    return len;
+}
+
+// Mostly silence with short clicks (voice memo gaps)
+static size_t gen_quiet_wav(uint8_t *buf, size_t size) {
+    size_t len = gen_wav(buf, size);
+    for (size_t i = 44; i < len; i++) {
+        if ((i / 2000) % 8 != 0) {
+            buf[i] = 0;
+        }
+    }
+    return len;
+}
+
+// File list style metadata: one line per recording
+static size_t gen_metadata(uint8_t *buf, size_t size) {
+    size_t len = 0;
+    for (int n = 1; ; n++) {
+        char line[160];
+        int l = snprintf(line, sizeof(line),
+                         "{\"name\":\"recording_%04d.aac\",\"size\":%u,\"mtime\":%u,\"duration_ms\":%u}\n",
+                         n, 20000 + (unsigned)(host_rand() % 500000),
+                         1700000000u + n * 97u, 1000 + (unsigned)(host_rand() % 600000));
+        if (len + l > size) {
+            break;
+        }
+        memcpy(buf + len, line, l);
+        len += l;
+    }
+    return len;
+}
+
+// ============ Codec runs ============
+
+// Encode the way the download path does: fill the input buffer in
+// READ_CHUNK pieces, drain in NOTIFY_CAP pieces
+static size_t encode(const uint8_t *in, size_t len, uint8_t *out, size_t cap,
+                     size_t read_chunk, size_t notify_cap) {
+    ble_compress_enc_t *enc = ble_compress_enc_create();
+    CHECK(enc != NULL);
+
+    size_t in_pos = 0;
+    size_t out_len = 0;
+    while (!ble_compress_enc_is_done(enc)) {
+        size_t n = ble_compress_enc_poll(enc, out + out_len,
+                                         (cap - out_len) < notify_cap ? (cap - out_len) : notify_cap);
+        out_len += n;
+        if (n > 0) {
+            continue;
+        }
+        if (in_pos == len) {
+            ble_compress_enc_finish(enc);
+            continue;
+        }
+        size_t space;
+        uint8_t *dst = ble_compress_enc_input(enc, &space);
+        size_t take = len - in_pos;
+        if (take > space) {
+            take = space;
+        }
+        if (take > read_chunk) {
+            take = read_chunk;
+        }
+        CHECK(take > 0);
+        memcpy(dst, in + in_pos, take);
+        ble_compress_enc_commit(enc, take);
+        in_pos += take;
+    }
+
+    ble_compress_enc_destroy(enc);
+    return out_len;
+}
+
+// Decode in pieces of `piece` bytes, like chunks arriving over the link
+static size_t decode(const uint8_t *in, size_t len, uint8_t *out, size_t cap, size_t piece) {
+    ble_compress_dec_t *dec = ble_compress_dec_create();
+    CHECK(dec != NULL);
+
+    sink_t sink = { .data = out, .cap = cap };
+    for (size_t pos = 0; pos < len; pos += piece) {
+        size_t n = (len - pos) < piece ? (len - pos) : piece;
+        CHECK(ble_compress_dec_feed(dec, in + pos, n, sink_write, &sink) == BLE_COMPRESS_OK);
+    }
+
+    ble_compress_dec_destroy(dec);
+    return sink.len;
+}
+
+typedef struct {
+    const char *name;
+    size_t (*gen)(uint8_t *buf, size_t size);
+    size_t size;
+    double max_ratio;        // Compressed / original must not exceed this
+} sample_t;
+
+static void run_sample(const sample_t *sample) {
+    uint8_t *orig = malloc(sample->size);
+    size_t comp_cap = sample->size + sample->size / 8 + 64;
+    uint8_t *comp = malloc(comp_cap);
+    uint8_t *back = malloc(sample->size);
+    CHECK(orig && comp && back);
+
+    size_t len = sample->gen(orig, sample->size);
+
+    double t0 = now_s();
+    size_t comp_len = encode(orig, len, comp, comp_cap, READ_CHUNK, NOTIFY_CAP);
+    double t1 = now_s();
+    size_t back_len = decode(comp, comp_len, back, sample->size, NOTIFY_CAP);
+    double t2 = now_s();
+
+    CHECK(back_len == len);
+    CHECK(memcmp(orig, back, len) == 0);
+
+    // Worst case: one flag byte per 8 literals
+    CHECK(comp_len <= len + (len + 7) / 8);
+    double ratio = (double)comp_len / len;
+    CHECK(ratio <= sample->max_ratio);
+
+    // Other splits of the same data must give the same result
+    static const size_t splits[][2] = { { 1, 1 }, { 7, 20 }, { 517, 1000 } };
+    for (size_t i = 0; i < sizeof(splits) / sizeof(splits[0]); i++) {
+        size_t n = encode(orig, len, comp, comp_cap, splits[i][0], splits[i][1]);
+        CHECK(decode(comp, n, back, sample->size, splits[i][1]) == len);
+        CHECK(memcmp(orig, back, len) == 0);
+    }
+
+    printf("  %-12s %8zu -> %8zu bytes (%5.1f%%)  encode %6.1f MB/s  decode %6.1f MB/s\n",
+           sample->name, len, comp_len, ratio * 100.0,
+           len / (t1 - t0) / 1e6, len / (t2 - t1) / 1e6);
+
+    free(orig);
+    free(comp);
+    free(back);
+}
+
+// ============ Error paths ============
+
+static void test_corrupt_stream(void) {
+    // Match item with nothing decoded yet
+    static const uint8_t bad[] = { 0x01, 0x05, 0x00 };
+    uint8_t out[64];
+    sink_t sink = { .data = out, .cap = sizeof(out) };
+
+    ble_compress_dec_t *dec = ble_compress_dec_create();
+    CHECK(ble_compress_dec_feed(dec, bad, sizeof(bad), sink_write, &sink) == BLE_COMPRESS_ERR_CORRUPT);
+    ble_compress_dec_destroy(dec);
+}
+
+static void test_sink_error(void) {
+    static uint8_t orig[8192];
+    static uint8_t comp[8192 + 1100];
+    static uint8_t back[8192];
+    size_t len = gen_metadata(orig, sizeof(orig));
+    size_t comp_len = encode(orig, len, comp, sizeof(comp), READ_CHUNK, NOTIFY_CAP);
+
+    sink_t sink = { .data = back, .cap = sizeof(back), .fail_after = 2 };
+    ble_compress_dec_t *dec = ble_compress_dec_create();
+    CHECK(ble_compress_dec_feed(dec, comp, comp_len, sink_write, &sink) == BLE_COMPRESS_ERR_WRITE);
+    ble_compress_dec_destroy(dec);
+}
+
+static void test_precompressed(void) {
+    CHECK(ble_compress_is_precompressed("recording_0001.aac"));
+    CHECK(ble_compress_is_precompressed("/sdcard/SONG.MP3"));
+    CHECK(!ble_compress_is_precompressed("notes.wav"));
+    CHECK(!ble_compress_is_precompressed("noext"));
+    CHECK(!ble_compress_is_precompressed(NULL));
+}
+
+int main(void) {
+    static const sample_t samples[] = {
+        { "aac",       gen_aac,       512 * 1024, 1.13 },
+        { "wav",       gen_wav,       512 * 1024, 1.13 },
+        { "quiet.wav", gen_quiet_wav, 512 * 1024, 0.40 },
+        { "metadata",  gen_metadata,  64 * 1024,  0.60 },
+    };
+
+    printf("LZSS codec, %d KB window:\n", 1 << (BLE_COMPRESS_WINDOW_BITS - 10));
+    for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+        run_sample(&samples[i]);
+    }
+
+    test_corrupt_stream();
+    test_sink_error();
+    test_precompressed();
+
+    return host_test_result();
+}
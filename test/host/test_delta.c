@@ -0,0 +1,296 @@
+// Host test for the delta patch decoder (main/BLE/ble_delta.c). Builds
+// patches by hand from random images, feeds them in every kind of split
+// and window size, with and without a work budget, and checks the
+// rebuilt image, the work done per feed and each error code.
+// The decoder doesn't check digests (ble_ota does), so the header carries
+// filler.
+
+#include "ble_delta.h"
+#include "ble_le.h"
+#include "host_test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SOURCE_SIZE     (64 * 1024)
+#define TARGET_MAX      (96 * 1024)
+#define PATCH_MAX       (256 * 1024)
+
+typedef struct {
+    const uint8_t *source;
+    size_t source_size;
+    int fail_read;           // Return an error from every read
+
+    uint8_t *out;
+    size_t out_len;
+    size_t out_cap;
+    int fail_write;          // Return an error from every write
+
+    size_t feed_bytes;       // Source read plus target written in one feed
+    size_t max_feed_bytes;
+} io_t;
+
+static int io_read(uint32_t offset, uint8_t *buf, size_t len, void *arg) {
+    io_t *io = (io_t *)arg;
+    if (io->fail_read || offset + len > io->source_size) {
+        return -1;
+    }
+    memcpy(buf, io->source + offset, len);
+    io->feed_bytes += len;
+    return 0;
+}
+
+static int io_write(const uint8_t *data, size_t len, void *arg) {
+    io_t *io = (io_t *)arg;
+    if (io->fail_write || io->out_len + len > io->out_cap) {
+        return -1;
+    }
+    memcpy(io->out + io->out_len, data, len);
+    io->out_len += len;
+    io->feed_bytes += len;
+    return 0;
+}
+
+// ============ Patch building ============
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} patch_t;
+
+static void patch_header(patch_t *p, uint32_t source_size, uint32_t target_size) {
+    memcpy(p->data, BLE_DELTA_MAGIC, 4);
+    put_le32(p->data + 4, source_size);
+    memset(p->data + 8, 0xA5, BLE_DELTA_SHA256_SIZE);
+    put_le32(p->data + 8 + BLE_DELTA_SHA256_SIZE, target_size);
+    memset(p->data + 12 + BLE_DELTA_SHA256_SIZE, 0x5A, BLE_DELTA_SHA256_SIZE);
+    p->len = BLE_DELTA_HEADER_LEN;
+}
+
+static void patch_copy(patch_t *p, uint32_t offset, uint32_t len) {
+    p->data[p->len++] = BLE_DELTA_OP_COPY;
+    put_le32(p->data + p->len, offset);
+    put_le32(p->data + p->len + 4, len);
+    p->len += 8;
+}
+
+static void patch_add(patch_t *p, uint32_t offset, const uint8_t *diff, uint32_t len) {
+    p->data[p->len++] = BLE_DELTA_OP_ADD;
+    put_le32(p->data + p->len, offset);
+    put_le32(p->data + p->len + 4, len);
+    p->len += 8;
+    memcpy(p->data + p->len, diff, len);
+    p->len += len;
+}
+
+static void patch_insert(patch_t *p, const uint8_t *data, uint32_t len) {
+    p->data[p->len++] = BLE_DELTA_OP_INSERT;
+    put_le32(p->data + p->len, len);
+    p->len += 4;
+    memcpy(p->data + p->len, data, len);
+    p->len += len;
+}
+
+// A new image the way a release makes one: most of the old image, some of
+// it moved or patched in place, and a little new code
+static size_t build_update(const uint8_t *source, uint8_t *target, patch_t *p) {
+    static uint8_t scratch[TARGET_MAX];
+    size_t len = 0;
+
+    patch_header(p, SOURCE_SIZE, 0);
+    while (len < TARGET_MAX - 8192) {
+        uint32_t n = 1 + host_rand() % 6000;
+        uint32_t off = host_rand() % (SOURCE_SIZE - n);
+
+        switch (host_rand() % 3) {
+        case 0:
+            patch_copy(p, off, n);
+            memcpy(target + len, source + off, n);
+            break;
+        case 1:
+            // Small changes, like relocated addresses
+            for (uint32_t i = 0; i < n; i++) {
+                scratch[i] = (host_rand() % 8 == 0) ? (uint8_t)host_rand() : 0;
+                target[len + i] = source[off + i] + scratch[i];
+            }
+            patch_add(p, off, scratch, n);
+            break;
+        default:
+            n = 1 + n % 600;
+            for (uint32_t i = 0; i < n; i++) {
+                target[len + i] = (uint8_t)host_rand();
+            }
+            patch_insert(p, target + len, n);
+            break;
+        }
+        len += n;
+    }
+
+    put_le32(p->data + 8 + BLE_DELTA_SHA256_SIZE, (uint32_t)len);
+    return len;
+}
+
+// ============ Decoding ============
+
+// Feed the patch in pieces of 1..max_piece bytes (0: all at once) the way
+// ble_ota does: with a budget, bytes a feed left unused go in again, and
+// empty feeds run a COPY until it is done
+static int apply(const patch_t *p, io_t *io, size_t window_size, size_t max_piece,
+                 size_t budget) {
+    static uint8_t window[8192];
+    ble_delta_t d;
+
+    io->out_len = 0;
+    io->max_feed_bytes = 0;
+    ble_delta_init(&d, window, window_size, io_read, io_write, io);
+    ble_delta_set_budget(&d, budget);
+
+    size_t off = 0;
+    while (off < p->len || ble_delta_pending(&d)) {
+        size_t n = p->len - off;
+        if (max_piece && n > max_piece) {
+            n = 1 + host_rand() % max_piece;
+        }
+        size_t used;
+        io->feed_bytes = 0;
+        int rc = ble_delta_feed(&d, p->data + off, n, &used);
+        if (io->feed_bytes > io->max_feed_bytes) {
+            io->max_feed_bytes = io->feed_bytes;
+        }
+        if (rc != BLE_DELTA_OK) {
+            return rc;
+        }
+        if (!budget && used != n) {
+            return -100;  // Without a budget every byte is taken
+        }
+        off += used;
+    }
+    return ble_delta_finish(&d);
+}
+
+static void test_rebuild(const uint8_t *source, io_t *io) {
+    static uint8_t target[TARGET_MAX];
+    static uint8_t patch_buf[PATCH_MAX];
+    patch_t p = { patch_buf, 0 };
+
+    size_t target_len = build_update(source, target, &p);
+    CHECK(target_len > 0 && p.len <= PATCH_MAX);
+
+    static const size_t windows[] = { 1, 7, 512, 4096, 8192 };
+    static const size_t pieces[] = { 0, 1, 3, 76, 77, 244, 4096 };
+    static const size_t budgets[] = { 0, 1, 4096, 16 * 1024 };
+    size_t unbounded = 0;
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+        for (size_t s = 0; s < sizeof(pieces) / sizeof(pieces[0]); s++) {
+            for (size_t b = 0; b < sizeof(budgets) / sizeof(budgets[0]); b++) {
+                int rc = apply(&p, io, windows[w], pieces[s], budgets[b]);
+                CHECK(rc == BLE_DELTA_OK);
+                CHECK(io->out_len == target_len);
+                CHECK(memcmp(io->out, target, target_len) == 0);
+
+                // Each feed reads and writes at most one window past the
+                // budget, plus the INSERT bytes it was handed
+                size_t piece = pieces[s] ? pieces[s] : p.len;
+                if (budgets[b]) {
+                    CHECK(io->max_feed_bytes <= 2 * (budgets[b] + windows[w]) + piece);
+                } else if (pieces[s] == 244 && windows[w] == 4096) {
+                    unbounded = io->max_feed_bytes;
+                }
+            }
+        }
+    }
+    printf("Rebuilt %zu bytes from a %zu byte patch; worst 244 byte feed moved "
+           "%zu bytes unbounded\n", target_len, p.len, unbounded);
+}
+
+static void test_header(void) {
+    uint8_t buf[BLE_DELTA_HEADER_LEN];
+    patch_t p = { buf, 0 };
+    uint8_t window[16];
+    ble_delta_t d;
+
+    patch_header(&p, 1234, 5678);
+    ble_delta_init(&d, window, sizeof(window), io_read, io_write, NULL);
+    size_t used;
+    CHECK(ble_delta_feed(&d, buf, BLE_DELTA_HEADER_LEN - 1, &used) == BLE_DELTA_OK);
+    CHECK(used == BLE_DELTA_HEADER_LEN - 1);
+    CHECK(!ble_delta_header_ready(&d));
+    CHECK(ble_delta_finish(&d) == BLE_DELTA_ERR_SHORT);
+    CHECK(ble_delta_feed(&d, buf + BLE_DELTA_HEADER_LEN - 1, 1, &used) == BLE_DELTA_OK);
+    CHECK(ble_delta_header_ready(&d));
+    CHECK(d.source_size == 1234);
+    CHECK(d.target_size == 5678);
+    CHECK(d.source_sha256[0] == 0xA5 && d.target_sha256[0] == 0x5A);
+
+    buf[0] = 'X';
+    ble_delta_init(&d, window, sizeof(window), io_read, io_write, NULL);
+    CHECK(ble_delta_feed(&d, buf, sizeof(buf), &used) == BLE_DELTA_ERR_FORMAT);
+}
+
+static void test_errors(const uint8_t *source, io_t *io) {
+    static uint8_t patch_buf[4096];
+    patch_t p = { patch_buf, 0 };
+    uint8_t data[16] = { 0 };
+
+    // Unknown op
+    patch_header(&p, SOURCE_SIZE, 16);
+    p.data[p.len++] = 0x7F;
+    CHECK(apply(&p, io, 64, 0, 0) == BLE_DELTA_ERR_FORMAT);
+
+    // COPY past the end of the source
+    patch_header(&p, SOURCE_SIZE, 16);
+    patch_copy(&p, SOURCE_SIZE - 8, 16);
+    CHECK(apply(&p, io, 64, 0, 0) == BLE_DELTA_ERR_FORMAT);
+
+    // ADD past the end of the target
+    patch_header(&p, SOURCE_SIZE, 16);
+    patch_add(&p, 0, data, 8);
+    patch_add(&p, 0, data, 16);
+    CHECK(apply(&p, io, 64, 0, 0) == BLE_DELTA_ERR_FORMAT);
+
+    // Bytes after the target is complete
+    patch_header(&p, SOURCE_SIZE, 16);
+    patch_insert(&p, data, 16);
+    patch_insert(&p, data, 1);
+    CHECK(apply(&p, io, 64, 0, 0) == BLE_DELTA_ERR_FORMAT);
+
+    // Ends in the middle of an op, and between ops
+    patch_header(&p, SOURCE_SIZE, 16);
+    patch_insert(&p, data, 16);
+    p.len -= 4;
+    CHECK(apply(&p, io, 64, 0, 0) == BLE_DELTA_ERR_SHORT);
+    patch_header(&p, SOURCE_SIZE, 16);
+    patch_copy(&p, 0, 8);
+    CHECK(apply(&p, io, 64, 1, 0) == BLE_DELTA_ERR_SHORT);
+
+    // Source read and output write failures
+    patch_header(&p, SOURCE_SIZE, 16);
+    patch_copy(&p, 0, 16);
+    io->fail_read = 1;
+    CHECK(apply(&p, io, 64, 0, 0) == BLE_DELTA_ERR_SOURCE);
+    io->fail_read = 0;
+    io->fail_write = 1;
+    CHECK(apply(&p, io, 64, 0, 0) == BLE_DELTA_ERR_WRITE);
+    io->fail_write = 0;
+    CHECK(apply(&p, io, 64, 0, 0) == BLE_DELTA_OK);
+    CHECK(io->out_len == 16 && memcmp(io->out, source, 16) == 0);
+}
+
+int main(void) {
+    static uint8_t source[SOURCE_SIZE];
+    static uint8_t out[TARGET_MAX];
+    io_t io = { source, SOURCE_SIZE, 0, out, 0, TARGET_MAX, 0, 0, 0 };
+
+    for (size_t i = 0; i < SOURCE_SIZE; i++) {
+        source[i] = (uint8_t)host_rand();
+    }
+
+    test_header();
+    for (uint32_t seed = 1; seed <= 4; seed++) {
+        host_srand(seed);
+        test_rebuild(source, &io);
+    }
+    test_errors(source, &io);
+
+    return host_test_result();
+}
@@ -0,0 +1,166 @@
+// Host test and benchmark for the playlist (main/Playlist/playlist.c).
+// Storage is faked: the "card" is a list of paths that the scan callback
+// walks and the cache lookups consult. Checks that edits keep the current
+// track and that paths are copied out whole or truncated safely, then
+// times playlist_add/remove against a full rescan at each playlist size.
+
+#include "playlist.h"
+#include "../Storage/storage.h"
+#include "../Status/device_status.h"
+#include "host_test.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <esp_timer.h>
+
+#define BENCH_RUNS 2000
+
+// ============ Fake storage ============
+
+static char card[PLAYLIST_MAX_FILES + 1][PLAYLIST_MAX_PATH_LEN];
+static int card_count;
+static uint16_t status_index;
+static uint16_t status_count;
+
+bool storage_is_audio_file(const char *path) {
+    const char *ext = path ? strrchr(path, '.') : NULL;
+    return ext && (strcasecmp(ext, ".aac") == 0);
+}
+
+esp_err_t storage_scan_audio_files(storage_scan_cb_t callback, void *user_data) {
+    for (int i = 0; i < card_count; i++) {
+        callback(card[i], user_data);
+    }
+    return ESP_OK;
+}
+
+esp_err_t storage_cache_get(const char *path, storage_meta_t *meta) {
+    memset(meta, 0, sizeof(*meta));
+    meta->is_audio = storage_is_audio_file(path) && strchr(path + strlen("/Storage/"), '/') == NULL;
+    return ESP_OK;
+}
+
+void device_status_set_track(uint16_t index, uint16_t count) {
+    status_index = index;
+    status_count = count;
+}
+
+static void card_fill(int count) {
+    card_count = count;
+    for (int i = 0; i < count; i++) {
+        snprintf(card[i], sizeof(card[i]), "/Storage/rec_%05d.aac", i);
+    }
+}
+
+// ============ Tests ============
+
+static void test_navigation(void) {
+    char path[PLAYLIST_MAX_PATH_LEN];
+
+    card_fill(0);
+    CHECK(playlist_init() == ESP_OK);
+    CHECK(playlist_get_current(path, sizeof(path)) == ESP_ERR_NOT_FOUND);
+    CHECK(playlist_next(path, sizeof(path)) == ESP_ERR_NOT_FOUND);
+
+    card_fill(5);
+    CHECK(playlist_rescan() == ESP_OK);
+    CHECK(playlist_get_count() == 5 && status_count == 5);
+    CHECK(playlist_prev(path, sizeof(path)) == ESP_OK);
+    CHECK(strcmp(path, card[4]) == 0 && status_index == 4);
+    CHECK(playlist_next(path, sizeof(path)) == ESP_OK);
+    CHECK(strcmp(path, card[0]) == 0);
+    CHECK(playlist_select(5, path, sizeof(path)) == ESP_ERR_NOT_FOUND);
+    CHECK(playlist_select(2, path, sizeof(path)) == ESP_OK);
+    CHECK(strcmp(path, card[2]) == 0);
+
+    // A short buffer gets a terminated prefix
+    char small[8];
+    CHECK(playlist_get_current(small, sizeof(small)) == ESP_OK);
+    CHECK(strlen(small) == sizeof(small) - 1 && strncmp(small, card[2], 7) == 0);
+    CHECK(playlist_get_current(NULL, 0) == ESP_ERR_INVALID_ARG);
+}
+
+static void test_edits(void) {
+    char path[PLAYLIST_MAX_PATH_LEN];
+
+    card_fill(5);
+    CHECK(playlist_rescan() == ESP_OK);
+    CHECK(playlist_select(2, path, sizeof(path)) == ESP_OK);
+
+    // Removing an earlier track keeps the same one current
+    CHECK(playlist_remove(card[0]) == ESP_OK);
+    CHECK(playlist_get_current_index() == 1);
+    CHECK(playlist_get_current(path, sizeof(path)) == ESP_OK && strcmp(path, card[2]) == 0);
+
+    // Removing the current one moves on to its successor
+    CHECK(playlist_remove(card[2]) == ESP_OK);
+    CHECK(playlist_get_current(path, sizeof(path)) == ESP_OK && strcmp(path, card[3]) == 0);
+    CHECK(playlist_remove(card[2]) == ESP_ERR_NOT_FOUND);
+
+    // Adds append once, and only audio
+    CHECK(playlist_add("/Storage/new.aac") == ESP_OK);
+    CHECK(playlist_add("/Storage/new.aac") == ESP_OK);
+    CHECK(playlist_add("/Storage/notes.txt") == ESP_ERR_INVALID_ARG);
+    CHECK(playlist_get_count() == 4);
+
+    // Renames keep the position; away from audio they remove
+    CHECK(playlist_rename(card[3], "/Storage/moved.aac") == ESP_OK);
+    CHECK(playlist_get_current(path, sizeof(path)) == ESP_OK &&
+          strcmp(path, "/Storage/moved.aac") == 0);
+    CHECK(playlist_rename("/Storage/moved.aac", "/Storage/moved.txt") == ESP_OK);
+    CHECK(playlist_get_count() == 3);
+
+    // A full playlist refuses more
+    card_fill(PLAYLIST_MAX_FILES);
+    CHECK(playlist_rescan() == ESP_OK);
+    CHECK(playlist_add("/Storage/one_more.aac") == ESP_ERR_NO_MEM);
+}
+
+// ============ Benchmark ============
+
+// Cost of one upload or delete landing in a playlist of count tracks:
+// the incremental edit, and the full rescan it replaced. The rescan
+// here walks a RAM list; on the device it reads the directory as well.
+static void bench(int count) {
+    card_fill(count);
+    CHECK(playlist_rescan() == ESP_OK);
+    const char *first = card[0];   // Worst case for remove: everything moves
+    const char *last = card[count - 1];
+
+    int64_t start = esp_timer_get_time();
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        CHECK(playlist_remove(first) == ESP_OK);
+        CHECK(playlist_add(first) == ESP_OK);
+    }
+    int64_t edit_ns = (esp_timer_get_time() - start) * 1000 / BENCH_RUNS;
+
+    // An add whose duplicate check walks every track
+    start = esp_timer_get_time();
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        CHECK(playlist_add(last) == ESP_OK);
+    }
+    int64_t dup_ns = (esp_timer_get_time() - start) * 1000 / BENCH_RUNS;
+
+    start = esp_timer_get_time();
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        CHECK(playlist_rescan() == ESP_OK);
+    }
+    int64_t rescan_ns = (esp_timer_get_time() - start) * 1000 / BENCH_RUNS;
+    CHECK(playlist_get_count() == count);
+
+    printf("%4d tracks: remove+add %6lld ns, add (listed) %6lld ns, rescan %7lld ns\n",
+           count, (long long)edit_ns, (long long)dup_ns, (long long)rescan_ns);
+}
+
+int main(void) {
+    test_navigation();
+    test_edits();
+
+    static const int counts[] = { 10, 25, 50, PLAYLIST_MAX_FILES };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        bench(counts[i]);
+    }
+
+    return host_test_result();
+}
@@ -0,0 +1,225 @@
+// Host test and benchmark for the storage metadata cache
+// (main/Storage/storage_cache.c). Fills a temporary directory, loads the
+// cache from it, checks lookups and the mutation hooks, and times a cold
+// readdir + stat walk against the same question answered from the cache.
+//
+// On the host the kernel's dentry cache keeps even the "cold" walk warm;
+// on the device every stat() is a FATFS directory read, so the gap there
+// is wider than what this prints.
+
+#include "storage.h"
+#include "storage_journal.h"
+#include "host_test.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <esp_timer.h>
+
+#define QUERY_RUNS 20
+
+// ============ Stand-ins for storage.c and storage_journal.c ============
+
+static int journal_records;
+
+bool storage_is_audio_file(const char *path) {
+    const char *ext = path ? strrchr(path, '.') : NULL;
+    return ext && (strcasecmp(ext, ".aac") == 0);
+}
+
+esp_err_t storage_journal_init(uint32_t fingerprint) {
+    (void)fingerprint;
+    return ESP_OK;
+}
+
+void storage_journal_record(uint8_t op, const char *name, uint32_t size, uint32_t fingerprint) {
+    (void)op;
+    (void)name;
+    (void)size;
+    (void)fingerprint;
+    journal_records++;
+}
+
+// ============ Fixtures ============
+
+static char dir_path[32];
+
+static void make_file(const char *name, size_t size) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s/%s", dir_path, name);
+    FILE *f = fopen(path, "wb");
+    CHECK(f != NULL);
+    if (f) {
+        for (size_t i = 0; i < size; i++) {
+            fputc((int)(host_rand() & 0xFF), f);
+        }
+        fclose(f);
+    }
+}
+
+static void clear_dir(void) {
+    DIR *dir = opendir(dir_path);
+    struct dirent *de;
+    char path[300];
+    while (dir && (de = readdir(dir)) != NULL) {
+        if (de->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", dir_path, de->d_name);
+            unlink(path);
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+}
+
+// Every 8th file is not audio, like the odd text file on a card
+static int fill_dir(int count) {
+    char name[32];
+    int audio = 0;
+    for (int i = 0; i < count; i++) {
+        bool is_audio = (i % 8) != 7;
+        snprintf(name, sizeof(name), is_audio ? "rec_%05d.aac" : "note_%05d.txt", i);
+        make_file(name, 1 + host_rand() % 64);
+        audio += is_audio;
+    }
+    return audio;
+}
+
+// ============ The two ways of answering "how many recordings?" ============
+
+// What listings did before the cache: walk and stat the directory
+static int count_cold(void) {
+    DIR *dir = opendir(dir_path);
+    struct dirent *de;
+    struct stat st;
+    char path[300];
+    int audio = 0;
+
+    while (dir && (de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir_path, de->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && storage_is_audio_file(de->d_name)) {
+            audio++;
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    return audio;
+}
+
+static void count_callback(const storage_entry_t *entry, void *user_data) {
+    if (entry->meta.is_audio) {
+        (*(int *)user_data)++;
+    }
+}
+
+static int count_cached(void) {
+    int audio = 0;
+    storage_cache_foreach(count_callback, &audio);
+    return audio;
+}
+
+// ============ Tests ============
+
+static void test_mutations(void) {
+    char path[300];
+    char moved[300];
+    storage_meta_t meta;
+
+    clear_dir();
+    fill_dir(16);
+    CHECK(storage_cache_load(dir_path) == ESP_OK);
+    CHECK(storage_cache_count() == 16);
+
+    // A rewrite shows the new size and drops the stale hash
+    snprintf(path, sizeof(path), "%s/rec_00003.aac", dir_path);
+    uint8_t sha[STORAGE_HASH_SIZE] = { 1 };
+    storage_cache_set_hash(path, sha);
+    CHECK(storage_cache_get(path, &meta) == ESP_OK && meta.has_hash);
+    make_file("rec_00003.aac", 200);
+    storage_cache_refresh(path);
+    CHECK(storage_cache_get(path, &meta) == ESP_OK);
+    CHECK(meta.size == 200 && !meta.has_hash);
+
+    // Renaming away from .aac leaves the set of recordings
+    int journaled = journal_records;
+    snprintf(moved, sizeof(moved), "%s/rec_00003.txt", dir_path);
+    rename(path, moved);
+    storage_cache_rename(path, moved);
+    CHECK(storage_cache_get(path, &meta) == ESP_ERR_NOT_FOUND);
+    CHECK(storage_cache_get(moved, &meta) == ESP_OK && !meta.is_audio && meta.size == 200);
+    CHECK(journal_records == journaled + 1);
+    CHECK(count_cached() == count_cold());
+
+    unlink(moved);
+    storage_cache_remove(moved);
+    CHECK(storage_cache_count() == 15);
+
+    // Paths outside the cached directory are ignored
+    CHECK(storage_cache_get("/elsewhere/rec_00001.aac", &meta) == ESP_ERR_NOT_FOUND);
+}
+
+static void bench(int count) {
+    clear_dir();
+    int audio = fill_dir(count);
+
+    int64_t start = esp_timer_get_time();
+    CHECK(storage_cache_load(dir_path) == ESP_OK);
+    int64_t load_us = esp_timer_get_time() - start;
+    CHECK(storage_cache_count() == count);
+
+    int64_t cold_us = 0;
+    int64_t cached_us = 0;
+    for (int run = 0; run < QUERY_RUNS; run++) {
+        start = esp_timer_get_time();
+        CHECK(count_cold() == audio);
+        cold_us += esp_timer_get_time() - start;
+
+        start = esp_timer_get_time();
+        CHECK(count_cached() == audio);
+        cached_us += esp_timer_get_time() - start;
+    }
+
+    // Every file found by full path
+    char path[300];
+    storage_meta_t meta;
+    int found = 0;
+    start = esp_timer_get_time();
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), (i % 8) != 7 ? "%s/rec_%05d.aac" : "%s/note_%05d.txt",
+                 dir_path, i);
+        found += storage_cache_get(path, &meta) == ESP_OK;
+    }
+    int64_t get_us = esp_timer_get_time() - start;
+    CHECK(found == count);
+
+    printf("%5d files: load %6lld us, cold walk %6lld us, cached query %5lld us, get %.2f us/file\n",
+           count, (long long)load_us, (long long)(cold_us / QUERY_RUNS),
+           (long long)(cached_us / QUERY_RUNS), (double)get_us / count);
+}
+
+int main(void) {
+    snprintf(dir_path, sizeof(dir_path), "/tmp/scache_XXXXXX");
+    if (!mkdtemp(dir_path)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    test_mutations();
+
+    static const int counts[] = { 64, 512, 2048 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        bench(counts[i]);
+    }
+
+    clear_dir();
+    rmdir(dir_path);
+    return host_test_result();
+}